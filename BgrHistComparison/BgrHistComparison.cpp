@@ -17,6 +17,10 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "BatchHistComparator.h"
+#include "FastEmd.h"
+#include "ReducedImageDecoder.h"
+
 using namespace std;
 using namespace cv;
 namespace po = boost::program_options;
@@ -336,7 +340,13 @@ int main(int argc, char** argv)
         ("help,h", "Display the help information")
         ("bgr-channels,c", po::value<string>(), "The BGR channels used for generating the histogram (b | g | r). If not specified, default bgr. Note that one histogram is generated for each specified channel.")
         ("comparison-method,m", po::value<string>(), "The comparison method (correl | chisqr | chisqr_alt | intersect | bhattacharyya | hellinger | kl_div | emd | all). If not specified, default correl.")
-        ("distance,d", po::value<string>(), "The distance used by the EMD comparison (l1 | l2 | c | all). If not specified, default l1.");
+        ("distance,d", po::value<string>(), "The distance used by the EMD comparison (l1 | l2 | c | all). If not specified, default l1.")
+        ("emd-solver,s", po::value<string>(), "The EMD solver (exact | cdf | sinkhorn | auto). If not specified, default exact.")
+        ("sinkhorn-reg", po::value<double>(), "The regularization of the Sinkhorn solver relative to the largest ground distance. If not specified, default 0.01.")
+        ("emd-prune", po::value<float>(), "Skip solving EMD if the centroid lower bound is above this threshold, and report the bound instead.")
+        ("decode-scale", po::value<int>()->default_value(1), "Decode the images at 1/2, 1/4 or 1/8 of the resolution (1 | 2 | 4 | 8) for the histograms, which uses the DCT scaling of the JPEG decoder.")
+        ("target-pixels", po::value<int>(), "Decode the images at the lowest resolution with at least this number of pixels by the DCT scaling or the box downsampling, instead of a fixed decode scale.")
+        ("measure-decode-error", "Measure the errors of the histograms of the reduced resolution against the full resolution, and the decoding times.");
 
     po::positional_options_description posOpt;
     posOpt.add("image1", 1);
@@ -349,7 +359,7 @@ int main(int argc, char** argv)
 
         if (vm.count("help") > 0)
         {
-            cout << "Usage: ./BgrHistComparison image1 image2 -c [BGR-channels] -m [comparison-method] -d [distance]" << endl << endl;
+            cout << "Usage: ./BgrHistComparison image1 image2 -c [BGR-channels] -m [comparison-method] -d [distance] -s [EMD-solver]" << endl << endl;
             cout << opt << endl;
             return 0;
         }
@@ -412,6 +422,10 @@ int main(int argc, char** argv)
     }
 
     vector<int> distances;
+    int emdSolver = FastEmd::SOLVER_EXACT;
+    double sinkhornReg = 0.01;
+    bool isPruned = false;
+    float pruneThreshold = 0;
     if ((strCompMethod == "emd") || (strCompMethod == "all"))
     {
         if (vm.count("distance") > 0)
@@ -430,22 +444,76 @@ int main(int argc, char** argv)
             cerr << "[ERROR]: Unsupported or invalid EMD distance method " << strDistance << "." << endl << endl;
             return -1;
         }
+
+        string strEmdSolver = "exact";
+        if (vm.count("emd-solver") > 0)
+        {
+            strEmdSolver = vm["emd-solver"].as<string>();
+        }
+
+        if (!FastEmd::Str2Solver(strEmdSolver, emdSolver))
+        {
+            cerr << "[ERROR]: Unsupported or invalid EMD solver " << strEmdSolver << "." << endl << endl;
+            return -1;
+        }
+
+        if (vm.count("sinkhorn-reg") > 0)
+        {
+            sinkhornReg = vm["sinkhorn-reg"].as<double>();
+            if (sinkhornReg <= 0)
+            {
+                cerr << "[ERROR]: The Sinkhorn regularization should be positive." << endl << endl;
+                return -1;
+            }
+        }
+
+        isPruned = (vm.count("emd-prune") > 0);
+        pruneThreshold = isPruned ? vm["emd-prune"].as<float>() : 0;
+    }
+
+    FastEmd fastEmd(emdSolver, sinkhornReg);
+
+    int decodeScale = vm["decode-scale"].as<int>();
+    int targetPixels = (vm.count("target-pixels") > 0) ? vm["target-pixels"].as<int>() : 0;
+    if (!ReducedImageDecoder::IsValidScale(decodeScale) || (targetPixels < 0))
+    {
+        cerr << "[ERROR]: The decode scale should be 1, 2, 4 or 8, and the target pixels should be positive." << endl << endl;
+        return -1;
+    }
+
+    ReducedImageDecoder decoder(decodeScale, targetPixels);
+    if (!decoder.IsFullResolution())
+    {
+        cout << "[INFO]: The images are decoded at " << decoder.ToStr() << "." << endl;
     }
 
-    Mat srcImg1 = imread(img1, IMREAD_COLOR);
+    Mat srcImg1 = decoder.Read(img1);
     if (srcImg1.empty())
     {
         cerr << "[ERROR]: Cannot load " << img1 << "." << endl << endl;
         return -1;
     }
 
-    Mat srcImg2 = imread(img2, IMREAD_COLOR);
+    Mat srcImg2 = decoder.Read(img2);
     if (srcImg2.empty())
     {
         cerr << "[ERROR]: Cannot load " << img2 << "." << endl << endl;
         return -1;
     }
 
+    if (vm.count("measure-decode-error") > 0)
+    {
+        decoder.ReportError(vector<string>{img1, img2}, [&bgrChannels, &histSize, &ranges](const Mat& img, vector<Mat>& hists)
+            {
+                hists.resize(bgrChannels.size());
+                for (size_t channelIndex = 0; channelIndex < bgrChannels.size(); ++channelIndex)
+                {
+                    calcHist(vector<Mat>{img}, vector<int>{bgrChannels[channelIndex]}, noArray(), hists[channelIndex], histSize, ranges);
+                    normalize(hists[channelIndex], hists[channelIndex], 1, 0, NORM_L1);
+                }
+            });
+    }
+
     // Display the original image 1 and 2 in one window side by side.
     if (srcImg1.rows == srcImg2.rows)
     {
@@ -466,9 +534,6 @@ int main(int argc, char** argv)
     vector<Mat> sig2(bgrChannels.size());
     for (size_t channelIndex = 0; channelIndex < bgrChannels.size(); ++channelIndex)
     {
-        cout << "============================================================================================" << endl;
-        cout << "[INFO]: Result of channel " << BgrChannel2Str(bgrChannels[channelIndex]) << ":" << endl;
-
         // Compute the histograms of image 1 and 2, respectively.
         calcHist(vector<Mat>{srcImg1}, vector<int>{bgrChannels[channelIndex]}, noArray(), hist1[channelIndex], histSize, ranges);
         calcHist(vector<Mat>{srcImg2}, vector<int>{bgrChannels[channelIndex]}, noArray(), hist2[channelIndex], histSize, ranges);
@@ -476,6 +541,30 @@ int main(int argc, char** argv)
         // Normalize the histograms.
         normalize(hist1[channelIndex], hist1[channelIndex], 1, 0, NORM_L1);
         normalize(hist2[channelIndex], hist2[channelIndex], 1, 0, NORM_L1);
+    }
+
+    // Compare the histogram of each channel only with that of the same channel, i.e., a one-to-one comparison by a
+    // comparator per channel, where the comparator keeps the per-histogram terms across the methods.
+    vector<vector<double>> allCompareResults(bgrChannels.size(), vector<double>(histComparisonMethods.size(), 0));
+    for (size_t channelIndex = 0; channelIndex < bgrChannels.size(); ++channelIndex)
+    {
+        BatchHistComparator histComparator(BatchHistComparator::StackHists(vector<Mat>{hist2[channelIndex]}));
+        Mat queryHist = BatchHistComparator::StackHists(vector<Mat>{hist1[channelIndex]});
+        for (size_t compMethodIndex = 0; compMethodIndex < histComparisonMethods.size(); ++compMethodIndex)
+        {
+            if (histComparisonMethods[compMethodIndex] != CV_COMP_EMD)
+            {
+                Mat compareResult;
+                histComparator.Compare(queryHist, histComparisonMethods[compMethodIndex], compareResult);
+                allCompareResults[channelIndex][compMethodIndex] = compareResult.at<double>(0, 0);
+            }
+        }
+    }
+
+    for (size_t channelIndex = 0; channelIndex < bgrChannels.size(); ++channelIndex)
+    {
+        cout << "============================================================================================" << endl;
+        cout << "[INFO]: Result of channel " << BgrChannel2Str(bgrChannels[channelIndex]) << ":" << endl;
 
         DrawHistogram(hist1[channelIndex], histogram1[channelIndex]);
         DrawHistogram(hist2[channelIndex], histogram2[channelIndex]);
@@ -494,7 +583,7 @@ int main(int argc, char** argv)
 
             if (histComparisonMethods[compMethodIndex] != CV_COMP_EMD)
             {
-                compareResult = compareHist(hist1[channelIndex], hist2[channelIndex], histComparisonMethods[compMethodIndex]);
+                compareResult = allCompareResults[channelIndex][compMethodIndex];
 
                 cout << "[INFO]: The comparison result of the two histograms = " << compareResult << " with the method "
                     << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << endl;
@@ -508,10 +597,26 @@ int main(int argc, char** argv)
 
                 for (const int& distMethod : distances)
                 {
-                    compareResult = EMD(sig1[channelIndex], sig2[channelIndex], distMethod);
+                    // The centroid lower bound costs O(n), so a pair already known to be farther than the threshold
+                    // isn't solved.
+                    if (isPruned)
+                    {
+                        float lowerBound = fastEmd.ComputeCentroidLowerBound(sig1[channelIndex], sig2[channelIndex], distMethod);
+                        if (lowerBound > pruneThreshold)
+                        {
+                            cout << "[INFO]: The comparison of the two histograms with the method "
+                                << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << " and the "
+                                << DistMethod2Str(distMethod) << " is pruned with the lower bound " << lowerBound
+                                << " > " << pruneThreshold << "." << endl;
+                            continue;
+                        }
+                    }
+
+                    compareResult = fastEmd.Compute(sig1[channelIndex], sig2[channelIndex], distMethod);
                     cout << "[INFO]: The comparison result of the two histograms = " << compareResult << " with the method "
                         << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << " and the "
-                        << DistMethod2Str(distMethod) << "." << endl;
+                        << DistMethod2Str(distMethod) << " by the "
+                        << FastEmd::Solver2Str(fastEmd.SelectSolver(sig1[channelIndex], sig2[channelIndex])) << "." << endl;
                 }
             }
 
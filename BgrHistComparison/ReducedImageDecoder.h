@@ -0,0 +1,60 @@
+/*
+ * ReducedImageDecoder.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef REDUCEDIMAGEDECODER_H_
+#define REDUCEDIMAGEDECODER_H_
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <opencv2/core.hpp>
+
+// Decode the BGR-colored images at a reduced resolution for the workloads which only need their histograms, where
+// the decoding at the full resolution is the majority of the time.
+//
+// A fixed decode scale of 2, 4 or 8 decodes by IMREAD_REDUCED_COLOR_2/4/8, where the JPEG decoder only computes the
+// scaled inverse DCT, and the other formats are decoded and resized. A target pixel count instead selects the largest
+// scale whose image still has at least the target pixels: the size of a JPEG image is read from its header and the
+// decoder scale is selected up front, and an image still more than 4 times the target, e.g., not a JPEG one, is then
+// box-downsampled by the largest integer factor, i.e., INTER_AREA.
+//
+// Each directory is a self-contained Eclipse project, so every tool using the decoder carries an identical copy of
+// ReducedImageDecoder.h/.cpp, as with HsvHistogram and BatchHistComparator. A change must be made to all the copies.
+class ReducedImageDecoder
+{
+private:
+    int m_decodeScale;
+    int m_targetPixels;
+
+    // Read the size from the SOF segment of a JPEG file. Return false if the file isn't a JPEG one.
+    static bool ReadJpegSize(const std::string& file, cv::Size& size);
+
+public:
+    // decodeScale is 1 (the full resolution), 2, 4 or 8, and targetPixels, if positive, overrides it.
+    ReducedImageDecoder(const int decodeScale = 1, const int targetPixels = 0);
+
+    static bool IsValidScale(const int decodeScale);
+
+    bool IsFullResolution() const;
+
+    // Identify the decode mode, e.g., in the key of the cached histograms, which is empty for the full resolution.
+    std::string GetKey() const;
+    std::string ToStr() const;
+
+    // Decode a file into a CV_8UC3 BGR-colored image, which is empty if the file can't be loaded.
+    cv::Mat Read(const std::string& file) const;
+
+    // Decode each file at both the full and the reduced resolutions, where calcHistsFunc computes the L1-normalized
+    // histograms of an image, and print the L1 distances between the histograms of the two resolutions (0 to 2) and
+    // the decoding times. The files are measured in parallel.
+    void ReportError(
+        const std::vector<std::string>& files,
+        const std::function<void(const cv::Mat&, std::vector<cv::Mat>&)>& calcHistsFunc) const;
+};
+
+#endif /* REDUCEDIMAGEDECODER_H_ */
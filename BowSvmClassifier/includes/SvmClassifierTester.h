@@ -138,6 +138,7 @@ class SvmClassifierTester
 private:
 
     int m_surfMinHessian;
+    int m_keypointBudget;   // Read from the vocabulary file.
     int m_knnMatchCandidateCnt;
     float m_goodMatchPercentThreshold;
     int m_goodMatchCntThreshold;
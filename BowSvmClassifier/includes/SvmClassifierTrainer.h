@@ -29,6 +29,7 @@ private:
     std::string m_classifierFilePrefix;
 
     int m_surfMinHessian;
+    int m_keypointBudget;   // Read from the vocabulary file.
 
     std::map<std::string, cv::Mat> m_img2DescriptorsMap;
     std::map<std::string, cv::Mat> m_label2BowDescriptorsMap;
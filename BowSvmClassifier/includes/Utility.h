@@ -47,6 +47,16 @@ public:
         std::string& filename);
 
     static std::string CvType2Str(const int type);
+
+    // Keep at most keypointBudget keypoints together with their descriptors. The image is divided into a
+    // gridSize x gridSize grid, and the strongest keypoints by the response are kept in each cell for the spatial
+    // coverage. The kept keypoints are sorted by the response in the descending order. A budget <= 0 keeps all.
+    static void RetainBestKeypointsInGrid(
+        std::vector<cv::KeyPoint>& keypoints,
+        cv::Mat& descriptors,
+        const cv::Size& imgSize,
+        const int keypointBudget,
+        const int gridSize = 4);
 };
 
 #endif /* INCLUDES_UTILITY_H_ */
@@ -28,6 +28,7 @@ private:
 
     int m_cntBowClusters;
     int m_surfMinHessian;
+    int m_keypointBudget;
     cv::Mat m_descriptors;
     cv::Mat m_vocabulary;
 
@@ -35,10 +36,12 @@ private:
 
 public:
 
+    // keypointBudget is the maximum number of keypoints per image, or 0 for no limit.
     VocabularyBuilder(
         const std::string& imgBasePath,
         const std::string& descriptorsFile,
-        const std::string& vocabularyFile);
+        const std::string& vocabularyFile,
+        const int keypointBudget = 0);
     ~VocabularyBuilder();
 
     void Reset(
@@ -52,6 +52,7 @@ SvmClassifierTester::SvmClassifierTester(
     const string& matcherDescriptorsFile,
     const string& resultFile) :
     m_surfMinHessian(400),  // TODO: Read the value from the vocabulary file.
+    m_keypointBudget(0),
     m_knnMatchCandidateCnt(5),
     m_goodMatchPercentThreshold(7.5),
     m_goodMatchCntThreshold(10),
@@ -95,6 +96,9 @@ bool SvmClassifierTester::InitBowImgDescriptorExtractor()
     fsVocabulary["vocabulary"] >> vocabulary;
     cout << "[INFO]: Read the vocabulary with " << vocabulary.rows << " clusters from " << m_vocabularyFile
         << "." << endl;
+
+    // The vocabulary files built without a keypoint budget don't have the node, which is read as 0.
+    m_keypointBudget = (int)fsVocabulary["keypointBudget"];
     fsVocabulary.release();
 
     //cout << "[DEBUG]: vocabulary #rows = " << vocabulary.rows << ", #cols = " << vocabulary.cols << ", type = "
@@ -197,6 +201,7 @@ bool SvmClassifierTester::ComputeSurfAndBowDescriptor(
     Mat surfDescriptors;
 
     m_detector->detectAndCompute(img, noArray(), surfKeypoints, surfDescriptors);
+    Utility::RetainBestKeypointsInGrid(surfKeypoints, surfDescriptors, img.size(), m_keypointBudget);
     m_img2SurfDescriptorMap.insert(make_pair(img2ClassifierResultMapKey, surfDescriptors));
 
     // Compute the BOW descriptor.
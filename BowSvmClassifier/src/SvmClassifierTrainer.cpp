@@ -30,7 +30,8 @@ SvmClassifierTrainer::SvmClassifierTrainer(
     m_imgBasePath(imgBasePath),
     m_matcherDescriptorsFile(matcherDescriptorsFile),
     m_classifierFilePrefix(classifierFilePrefix),
-    m_surfMinHessian(400)   // TODO: Expose m_cntBowClusters and m_surfMinHessian as configurable parameters.
+    m_surfMinHessian(400),  // TODO: Expose m_cntBowClusters and m_surfMinHessian as configurable parameters.
+    m_keypointBudget(0)
 {
 
 }
@@ -64,6 +65,9 @@ bool SvmClassifierTrainer::ComputeBowDescriptors()
     fsVocabulary["vocabulary"] >> vocabulary;
     cout << "[INFO]: Read the vocabulary with " << vocabulary.rows << " clusters from " << m_vocabularyFile
         << "." << endl;
+
+    // The vocabulary files built without a keypoint budget don't have the node, which is read as 0.
+    m_keypointBudget = (int)fsVocabulary["keypointBudget"];
     fsVocabulary.release();
 
     // Load the filenames of all the training images.
@@ -236,6 +240,8 @@ void SvmClassifierTrainer::ComputeAndSaveMatcherDescriptors()
     cout << "[INFO]: Write the filenames of " << matcherImgWithLabels.size() << " images with their labels to file "
         << m_matcherDescriptorsFile << " for the FLANN-based matcher." << endl;
 
+    fs << "keypointBudget" << m_keypointBudget;
+
     Ptr<SurfFeatureDetector> detector = SURF::create(m_surfMinHessian);
 
     int imgIndex = 0;
@@ -251,6 +257,7 @@ void SvmClassifierTrainer::ComputeAndSaveMatcherDescriptors()
 
         auto tStart = Clock::now();
         detector->detectAndCompute(img, noArray(), oneImgKeypoints, oneImgDescriptors);
+        Utility::RetainBestKeypointsInGrid(oneImgKeypoints, oneImgDescriptors, img.size(), m_keypointBudget);
         auto tEnd = Clock::now();
 
         cout << "[INFO]: Computed the SURF descriptors of " << imgLabel << " for the FLANN-based matcher in "
@@ -16,19 +16,22 @@ typedef std::chrono::high_resolution_clock Clock;
 
 VocabularyBuilder::VocabularyBuilder() :
     m_cntBowClusters(0),
-    m_surfMinHessian(0)
+    m_surfMinHessian(0),
+    m_keypointBudget(0)
 {
 }
 
 VocabularyBuilder::VocabularyBuilder(
     const string& imgBasePath,
     const string& descriptorsFile,
-    const string& vocabularyFile) :
+    const string& vocabularyFile,
+    const int keypointBudget) :
     m_imgBasePath(imgBasePath),
     m_descriptorsFile(descriptorsFile),
     m_vocabularyFile(vocabularyFile),
     m_cntBowClusters(1000), // TODO: Expose m_cntBowClusters and m_surfMinHessian as configurable parameters.
-    m_surfMinHessian(400)
+    m_surfMinHessian(400),
+    m_keypointBudget(keypointBudget)
 {
 
 }
@@ -67,6 +70,12 @@ void VocabularyBuilder::ComputeDescriptors(OutputArray descriptors)
     cout << "[INFO]: Write the filenames of " << imgWithLabels.size() << " images with their labels to file "
         << m_descriptorsFile << "." << endl;
 
+    fs << "keypointBudget" << m_keypointBudget;
+    if (m_keypointBudget > 0)
+    {
+        cout << "[INFO]: Keep at most " << m_keypointBudget << " keypoints per image." << endl;
+    }
+
     Ptr<SurfFeatureDetector> detector = SURF::create(m_surfMinHessian);
 
     cout << "[INFO]: Computing the SURF descriptors of " << imgWithLabels.size() << " images." << endl;
@@ -84,6 +93,7 @@ void VocabularyBuilder::ComputeDescriptors(OutputArray descriptors)
         Mat imgDescriptors;
 
         detector->detectAndCompute(img, noArray(), imgKeypoints, imgDescriptors);
+        Utility::RetainBestKeypointsInGrid(imgKeypoints, imgDescriptors, img.size(), m_keypointBudget);
 
         // Key names must start with a letter or '_'. Since the image filename may start with a non-letter,
         // e.g., a digit, we don't use the image filename as the key name.
@@ -130,6 +140,10 @@ void VocabularyBuilder::BuildVocabulary(OutputArray vocabulary)
     // parameter value (e.g., m_surfMinHessian) to the vocabulary file.
     fs << "vocabulary" << m_vocabulary;
 
+    // The trainer and the tester apply the same keypoint budget as the vocabulary, so that the BOW descriptors
+    // are computed from the comparable sets of keypoints.
+    fs << "keypointBudget" << m_keypointBudget;
+
     cout << "[INFO]: Write the vocabulary with " << m_vocabulary.rows << " clusters to file "
         << m_vocabularyFile << "." << endl;
 
@@ -33,6 +33,7 @@ int main(int argc, char** argv)
         ("expected-class,c", po::value<string>(), "The expected class of the test image which will be compared with the class evaluated by the SVM classifiers")
         ("image,i", po::value<string>(), "The image file which will be used for testing")
         ("image-dir,d", po::value<string>(), "The directory of images which will be used for vocabulary building or matcher training or classifier testing")
+        ("keypoint-budget", po::value<int>()->default_value(0), "For vocabulary building, the maximum number of SURF keypoints per image, which are the strongest ones in each cell of a 4x4 grid. It is saved in the vocabulary file and applied by the classifier training and testing as well. 0 means no limit")
         ("matcher-descriptors-file,m", po::value<string>(), "The yml file which stores the descriptors for the FLANN-based matcher. It is an output for training and an input for classifier testing")
         ("result,r", po::value<string>(), "The output yml file which will store the testing results")
         ("vocabulary,v", po::value<string>(), "The yml file which stores the vocabulary. It is an output for vocabulary building and an input for classifier training and testing");
@@ -97,7 +98,9 @@ int main(int argc, char** argv)
         descriptorsFile = vm["descriptors"].as<string>();
         imgDir = vm["image-dir"].as<string>();
         vocabularyFile = vm["vocabulary"].as<string>();
-        VocabularyBuilder builder(imgDir, descriptorsFile, vocabularyFile);
+        int keypointBudget = max(vm["keypoint-budget"].as<int>(), 0);
+
+        VocabularyBuilder builder(imgDir, descriptorsFile, vocabularyFile, keypointBudget);
 
         // We don't need the output descriptors and vocabulary, so we pass noArray() here.
         builder.ComputeDescriptors(noArray());
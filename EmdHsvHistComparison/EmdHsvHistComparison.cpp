@@ -20,6 +20,10 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "HsvHistogram.h"
+#include "FastEmd.h"
+#include "ReducedImageDecoder.h"
+
 using namespace std;
 using namespace cv;
 namespace po = boost::program_options;
@@ -238,7 +242,14 @@ int main(int argc, char** argv)
         ("image2", po::value<string>()->required(), "The second image") // This is also a positional option.
         ("help,h", "Display the help information")
         ("distance,d", po::value<string>(), "The type of the distance used for EMD comparison (l1 | l2 | c | all). If not specified, default l1.")
-        ("hsv-channels,c", po::value<string>(), "One or two HSV channels used for generating the histogram (h | s | v | hs | hv | sv). If not specified, default hs.");
+        ("hsv-channels,c", po::value<string>(), "One or two HSV channels used for generating the histogram (h | s | v | hs | hv | sv). If not specified, default hs.")
+        ("emd-solver,s", po::value<string>(), "The EMD solver (exact | cdf | sinkhorn | auto), where cdf is only for one HSV channel. If not specified, default exact.")
+        ("sinkhorn-reg", po::value<double>(), "The regularization of the Sinkhorn solver relative to the largest ground distance. If not specified, default 0.01.")
+        ("emd-prune", po::value<float>(), "Skip solving EMD if the centroid lower bound is above this threshold, and report the bound instead.")
+        ("circular-hue", "Measure the ground distance along the hue bins around the hue circle, so that the first and the last bins are adjacent.")
+        ("decode-scale", po::value<int>()->default_value(1), "Decode the images at 1/2, 1/4 or 1/8 of the resolution (1 | 2 | 4 | 8) for the histograms, which uses the DCT scaling of the JPEG decoder.")
+        ("target-pixels", po::value<int>(), "Decode the images at the lowest resolution with at least this number of pixels by the DCT scaling or the box downsampling, instead of a fixed decode scale.")
+        ("measure-decode-error", "Measure the errors of the histograms of the reduced resolution against the full resolution, and the decoding times.");
 
     po::positional_options_description posOpt;
     posOpt.add("image1", 1);
@@ -251,7 +262,7 @@ int main(int argc, char** argv)
 
         if (vm.count("help") > 0)
         {
-            cout << "Usage: ./EmdHsvHistComparison image1 image2 -d [distance-method] -c [HSV-channels]" << endl << endl;
+            cout << "Usage: ./EmdHsvHistComparison image1 image2 -d [distance-method] -c [HSV-channels] -s [EMD-solver]" << endl << endl;
             cout << opt << endl;
             return 0;
         }
@@ -317,20 +328,90 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    Mat srcImg1 = imread(img1, IMREAD_COLOR);
+    string strEmdSolver = "exact";
+    if (vm.count("emd-solver") > 0)
+    {
+        strEmdSolver = vm["emd-solver"].as<string>();
+    }
+
+    int emdSolver = FastEmd::SOLVER_EXACT;
+    if (!FastEmd::Str2Solver(strEmdSolver, emdSolver))
+    {
+        cerr << "[ERROR]: Unsupported or invalid EMD solver " << strEmdSolver << "." << endl << endl;
+        return -1;
+    }
+    else if ((emdSolver == FastEmd::SOLVER_CDF) && (hsvChannels.size() != 1))
+    {
+        cerr << "[ERROR]: The CDF solver only supports the histogram of one HSV channel." << endl << endl;
+        return -1;
+    }
+
+    double sinkhornReg = 0.01;
+    if (vm.count("sinkhorn-reg") > 0)
+    {
+        sinkhornReg = vm["sinkhorn-reg"].as<double>();
+        if (sinkhornReg <= 0)
+        {
+            cerr << "[ERROR]: The Sinkhorn regularization should be positive." << endl << endl;
+            return -1;
+        }
+    }
+
+    bool isPruned = (vm.count("emd-prune") > 0);
+    float pruneThreshold = isPruned ? vm["emd-prune"].as<float>() : 0;
+
+    FastEmd fastEmd(emdSolver, sinkhornReg);
+    if (vm.count("circular-hue") > 0)
+    {
+        // Hue is always the first HSV channel of the histogram if it is used.
+        if (hsvChannels[0] == 0)
+        {
+            fastEmd.SetCircularDim(histSize, 0);
+        }
+        else
+        {
+            cout << "[INFO]: The hue channel is not used and --circular-hue is ignored." << endl;
+        }
+    }
+
+    int decodeScale = vm["decode-scale"].as<int>();
+    int targetPixels = (vm.count("target-pixels") > 0) ? vm["target-pixels"].as<int>() : 0;
+    if (!ReducedImageDecoder::IsValidScale(decodeScale) || (targetPixels < 0))
+    {
+        cerr << "[ERROR]: The decode scale should be 1, 2, 4 or 8, and the target pixels should be positive." << endl << endl;
+        return -1;
+    }
+
+    ReducedImageDecoder decoder(decodeScale, targetPixels);
+    if (!decoder.IsFullResolution())
+    {
+        cout << "[INFO]: The images are decoded at " << decoder.ToStr() << "." << endl;
+    }
+
+    Mat srcImg1 = decoder.Read(img1);
     if (srcImg1.empty())
     {
         cerr << "[ERROR]: Cannot load " << img1 << "." << endl << endl;
         return -1;
     }
 
-    Mat srcImg2 = imread(img2, IMREAD_COLOR);
+    Mat srcImg2 = decoder.Read(img2);
     if (srcImg2.empty())
     {
         cerr << "[ERROR]: Cannot load " << img2 << "." << endl << endl;
         return -1;
     }
 
+    if (vm.count("measure-decode-error") > 0)
+    {
+        decoder.ReportError(vector<string>{img1, img2}, [&hsvChannels, &histSize, &ranges](const Mat& img, vector<Mat>& hists)
+            {
+                hists.resize(1);
+                CalcHsvHist(img, hsvChannels, histSize, ranges, hists[0]);
+                normalize(hists[0], hists[0], 1, 0, NORM_L1);
+            });
+    }
+
     // Display the original image 1 and 2 in one window side by side.
     if (srcImg1.rows == srcImg2.rows)
     {
@@ -342,17 +423,12 @@ int main(int argc, char** argv)
         imshow("The original image 1 and 2", srcImgs);
     }
 
-    // Convert image 1 and 2 into HSV.
-    Mat hsvImg1;
-    Mat hsvImg2;
-    cvtColor(srcImg1, hsvImg1, COLOR_BGR2HSV);
-    cvtColor(srcImg2, hsvImg2, COLOR_BGR2HSV);
-
-    // Compute the histograms of image 1 and 2, respectively.
+    // Compute the histograms of the HSV channels of image 1 and 2, respectively, without converting the images
+    // into HSV first.
     Mat hist1;
     Mat hist2;
-    calcHist(vector<Mat>{hsvImg1}, hsvChannels, noArray(), hist1, histSize, ranges);
-    calcHist(vector<Mat>{hsvImg2}, hsvChannels, noArray(), hist2, histSize, ranges);
+    CalcHsvHist(srcImg1, hsvChannels, histSize, ranges, hist1);
+    CalcHsvHist(srcImg2, hsvChannels, histSize, ranges, hist2);
 
     // Normalize the histograms.
     normalize(hist1, hist1, 1, 0, NORM_L1);
@@ -388,12 +464,28 @@ int main(int argc, char** argv)
     for (const int& distMethod : distances)
     {
         auto tStart = Clock::now();
-        float emdResult = EMD(sig1, sig2, distMethod);
+
+        // The centroid lower bound costs O(n), so a pair already known to be farther than the threshold isn't solved.
+        if (isPruned)
+        {
+            float lowerBound = fastEmd.ComputeCentroidLowerBound(sig1, sig2, distMethod);
+            if (lowerBound > pruneThreshold)
+            {
+                auto tEnd = Clock::now();
+
+                cout << "[INFO]: The EMD comparison of the two histograms is pruned with the lower bound " << lowerBound
+                    << " > " << pruneThreshold << " with the " << DistMethod2Str(distMethod) << " in "
+                    << chrono::duration_cast<chrono::microseconds>(tEnd - tStart).count() << " microseconds." << endl;
+                continue;
+            }
+        }
+
+        float emdResult = fastEmd.Compute(sig1, sig2, distMethod);
         auto tEnd = Clock::now();
 
         cout << "[INFO]: The EMD comparison result of the two histograms = " << emdResult << " with the "
-            << DistMethod2Str(distMethod) << " in "
-            << chrono::duration_cast<chrono::milliseconds>(tEnd - tStart).count() << " milliseconds." << endl;
+            << DistMethod2Str(distMethod) << " by the " << FastEmd::Solver2Str(fastEmd.SelectSolver(sig1, sig2))
+            << " in " << chrono::duration_cast<chrono::microseconds>(tEnd - tStart).count() << " microseconds." << endl;
     }
 
     waitKey();
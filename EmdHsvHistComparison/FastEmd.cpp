@@ -0,0 +1,448 @@
+/*
+ * FastEmd.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/imgproc.hpp>
+
+#include "FastEmd.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// The ground distance between two coordinate vectors of cntDims dimensions, where the differences along dimension
+// circularDim, if any, are taken the shorter way around the circle of the given period.
+template<typename T>
+double GroundDist(
+    const T* coords1,
+    const T* coords2,
+    const int cntDims,
+    const int distType,
+    const int circularDim = -1,
+    const double period = 0)
+{
+    double dist = 0;
+    for (int dim = 0; dim < cntDims; ++dim)
+    {
+        double diff = fabs(static_cast<double>(coords1[dim]) - coords2[dim]);
+        if (dim == circularDim)
+        {
+            diff = min(diff, period - diff);
+        }
+
+        switch (distType)
+        {
+        case DIST_L1:
+            dist += diff;
+            break;
+
+        case DIST_L2:
+            dist += diff*diff;
+            break;
+
+        case DIST_C:
+            dist = max(dist, diff);
+            break;
+
+        default:
+            CV_Error(Error::StsBadArg, "Unsupported EMD distance type");
+        }
+    }
+
+    return (distType == DIST_L2) ? std::sqrt(dist) : dist;
+}
+
+// The weights of a signature normalized to the sum of 1, as a column vector.
+Mat NormalizedWeights(const Mat& sig)
+{
+    Mat weights;
+    sig.col(0).convertTo(weights, CV_64F);
+
+    double weightSum = sum(weights)[0];
+    CV_Assert(weightSum > DBL_EPSILON);
+
+    return weights/weightSum;
+}
+
+}
+
+FastEmd::FastEmd(
+    const int solver,
+    const double sinkhornReg,
+    const int sinkhornMaxIters,
+    const double sinkhornTol) :
+    m_solver(solver),
+    m_sinkhornReg(sinkhornReg),
+    m_sinkhornMaxIters(sinkhornMaxIters),
+    m_sinkhornTol(sinkhornTol),
+    m_circularDim(-1)
+{
+}
+
+bool FastEmd::Str2Solver(string& strSolver, int& solver)
+{
+    transform(strSolver.begin(), strSolver.end(), strSolver.begin(), ::tolower);
+
+    if (strSolver == "exact")
+    {
+        solver = SOLVER_EXACT;
+    }
+    else if (strSolver == "cdf")
+    {
+        solver = SOLVER_CDF;
+    }
+    else if (strSolver == "sinkhorn")
+    {
+        solver = SOLVER_SINKHORN;
+    }
+    else if (strSolver == "auto")
+    {
+        solver = SOLVER_AUTO;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+string FastEmd::Solver2Str(const int solver)
+{
+    switch (solver)
+    {
+    case SOLVER_EXACT:
+        return "exact solver";
+
+    case SOLVER_CDF:
+        return "closed-form CDF solver";
+
+    case SOLVER_SINKHORN:
+        return "Sinkhorn solver";
+
+    case SOLVER_AUTO:
+        return "automatically selected solver";
+
+    default:
+        return "Unsupported or invalid solver";
+    }
+}
+
+void FastEmd::SetCircularDim(const vector<int>& histSize, const int circularDim)
+{
+    CV_Assert((circularDim >= 0) && (circularDim < static_cast<int>(histSize.size())));
+
+    if ((histSize != m_histSize) || (circularDim != m_circularDim))
+    {
+        m_histSize = histSize;
+        m_circularDim = circularDim;
+        m_binCosts.clear();
+    }
+}
+
+const Mat& FastEmd::GetBinCosts(const int distType)
+{
+    Mat& binCosts = m_binCosts[distType];
+    if (!binCosts.empty())
+    {
+        return binCosts;
+    }
+
+    // Unflatten the bin indices into the coordinates in the same order as the signatures, i.e., row major.
+    const int cntDims = static_cast<int>(m_histSize.size());
+    int cntBins = 1;
+    for (const int& dimSize : m_histSize)
+    {
+        cntBins *= dimSize;
+    }
+
+    vector<int> binCoords(cntBins*cntDims);
+    for (int bin = 0; bin < cntBins; ++bin)
+    {
+        int remainder = bin;
+        for (int dim = cntDims - 1; dim >= 0; --dim)
+        {
+            binCoords[bin*cntDims + dim] = remainder % m_histSize[dim];
+            remainder /= m_histSize[dim];
+        }
+    }
+
+    binCosts.create(cntBins, cntBins, CV_32F);
+    for (int bin1 = 0; bin1 < cntBins; ++bin1)
+    {
+        float* binCost = binCosts.ptr<float>(bin1);
+        for (int bin2 = 0; bin2 < cntBins; ++bin2)
+        {
+            binCost[bin2] = static_cast<float>(GroundDist(&binCoords[bin1*cntDims], &binCoords[bin2*cntDims], cntDims,
+                distType, m_circularDim, m_histSize[m_circularDim]));
+        }
+    }
+
+    return binCosts;
+}
+
+void FastEmd::BuildCosts(const Mat& sig1, const Mat& sig2, const int distType, Mat& costs)
+{
+    const int cntDims = sig1.cols - 1;
+    costs.create(sig1.rows, sig2.rows, CV_32F);
+
+    if (m_circularDim < 0)
+    {
+        for (int row1 = 0; row1 < sig1.rows; ++row1)
+        {
+            const float* coords1 = sig1.ptr<float>(row1) + 1;
+            float* cost = costs.ptr<float>(row1);
+            for (int row2 = 0; row2 < sig2.rows; ++row2)
+            {
+                cost[row2] = static_cast<float>(GroundDist(coords1, sig2.ptr<float>(row2) + 1, cntDims, distType));
+            }
+        }
+
+        return;
+    }
+
+    CV_Assert(cntDims == static_cast<int>(m_histSize.size()));
+
+    // Look up the costs by the flattened bin indices of the signature rows.
+    const Mat& binCosts = GetBinCosts(distType);
+    vector<int> bins1(sig1.rows);
+    vector<int> bins2(sig2.rows);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const Mat& sig = (pass == 0) ? sig1 : sig2;
+        vector<int>& bins = (pass == 0) ? bins1 : bins2;
+        for (int row = 0; row < sig.rows; ++row)
+        {
+            int bin = 0;
+            for (int dim = 0; dim < cntDims; ++dim)
+            {
+                bin = bin*m_histSize[dim] + cvRound(sig.at<float>(row, dim + 1));
+            }
+
+            bins[row] = bin;
+        }
+    }
+
+    for (int row1 = 0; row1 < sig1.rows; ++row1)
+    {
+        const float* binCost = binCosts.ptr<float>(bins1[row1]);
+        float* cost = costs.ptr<float>(row1);
+        for (int row2 = 0; row2 < sig2.rows; ++row2)
+        {
+            cost[row2] = binCost[bins2[row2]];
+        }
+    }
+}
+
+int FastEmd::SelectSolver(const Mat& sig1, const Mat& sig2) const
+{
+    if (m_solver != SOLVER_AUTO)
+    {
+        return m_solver;
+    }
+
+    if ((sig1.cols == 2) && (sig2.cols == 2))
+    {
+        return SOLVER_CDF;
+    }
+
+    return (sig1.rows*sig2.rows <= maxExactPairs) ? SOLVER_EXACT : SOLVER_SINKHORN;
+}
+
+float FastEmd::Compute(const Mat& sig1, const Mat& sig2, const int distType)
+{
+    switch (SelectSolver(sig1, sig2))
+    {
+    case SOLVER_EXACT:
+        if (m_circularDim >= 0)
+        {
+            Mat costs;
+            BuildCosts(sig1, sig2, distType, costs);
+            return EMD(sig1, sig2, DIST_USER, costs);
+        }
+
+        return EMD(sig1, sig2, distType);
+
+    case SOLVER_CDF:
+        return ComputeByCdf(sig1, sig2);
+
+    case SOLVER_SINKHORN:
+        return ComputeBySinkhorn(sig1, sig2, distType);
+
+    default:
+        CV_Error(Error::StsBadArg, "Unknown EMD solver");
+    }
+
+    return 0;
+}
+
+float FastEmd::ComputeByCdf(const Mat& sig1, const Mat& sig2) const
+{
+    CV_Assert((sig1.type() == CV_32F) && (sig2.type() == CV_32F) && (sig1.cols == 2) && (sig2.cols == 2));
+
+    Mat weights1 = NormalizedWeights(sig1);
+    Mat weights2 = NormalizedWeights(sig2);
+
+    // Each bin adds its weight to the CDF difference at its coordinate, positively for signature 1 and negatively
+    // for signature 2, and the difference is constant up to the next coordinate.
+    vector<pair<float, double> > steps;
+    steps.reserve(sig1.rows + sig2.rows);
+    for (int row = 0; row < sig1.rows; ++row)
+    {
+        steps.push_back(make_pair(sig1.at<float>(row, 1), weights1.at<double>(row)));
+    }
+
+    for (int row = 0; row < sig2.rows; ++row)
+    {
+        steps.push_back(make_pair(sig2.at<float>(row, 1), -weights2.at<double>(row)));
+    }
+
+    sort(steps.begin(), steps.end());
+
+    double cdfDiff = 0;
+    double result = 0;
+    if (m_circularDim < 0)
+    {
+        for (size_t stepIdx = 0; stepIdx + 1 < steps.size(); ++stepIdx)
+        {
+            cdfDiff += steps[stepIdx].second;
+            result += fabs(cdfDiff)*(static_cast<double>(steps[stepIdx + 1].first) - steps[stepIdx].first);
+        }
+
+        return static_cast<float>(result);
+    }
+
+    // On a circle, the CDF difference may be shifted by any constant c by starting the CDFs elsewhere, and EMD is the
+    // minimum of the integral of |cdfDiff - c| over c, which is reached at the median of cdfDiff weighted by the lengths
+    // of the intervals. The interval from the last coordinate wraps around to the first one.
+    const double period = m_histSize[m_circularDim];
+    vector<pair<double, double> > intervals;
+    intervals.reserve(steps.size());
+    for (size_t stepIdx = 0; stepIdx < steps.size(); ++stepIdx)
+    {
+        cdfDiff += steps[stepIdx].second;
+        double next = (stepIdx + 1 < steps.size()) ? steps[stepIdx + 1].first : steps[0].first + period;
+        intervals.push_back(make_pair(cdfDiff, next - steps[stepIdx].first));
+    }
+
+    sort(intervals.begin(), intervals.end());
+
+    double median = 0;
+    double length = 0;
+    for (auto& interval: intervals)
+    {
+        length += interval.second;
+        if (2*length >= period)
+        {
+            median = interval.first;
+            break;
+        }
+    }
+
+    for (auto& interval: intervals)
+    {
+        result += fabs(interval.first - median)*interval.second;
+    }
+
+    return static_cast<float>(result);
+}
+
+float FastEmd::ComputeBySinkhorn(const Mat& sig1, const Mat& sig2, const int distType)
+{
+    CV_Assert((sig1.type() == CV_32F) && (sig2.type() == CV_32F) && (sig1.cols == sig2.cols) && (sig1.cols > 1));
+
+    Mat weights1 = NormalizedWeights(sig1);
+    Mat weights2 = NormalizedWeights(sig2);
+
+    Mat costs32;
+    Mat costs;
+    double maxCost = 0;
+    BuildCosts(sig1, sig2, distType, costs32);
+    costs32.convertTo(costs, CV_64F);
+    minMaxLoc(costs, NULL, &maxCost);
+
+    if (maxCost <= DBL_EPSILON)
+    {
+        return 0;
+    }
+
+    // The kernel is exp(-cost/eps), whose smallest element exp(-1/reg) must not underflow the double.
+    const double minReg = 1.0/500;
+    double eps = max(m_sinkhornReg, minReg)*maxCost;
+    Mat kernel;
+    exp(costs*(-1.0/eps), kernel);
+
+    // Scale the rows and the columns of the kernel alternately until the plan diag(u)*K*diag(v) has the marginals
+    // of the two weights.
+    Mat u = Mat::ones(sig1.rows, 1, CV_64F);
+    Mat v = Mat::ones(sig2.rows, 1, CV_64F);
+    Mat kv;
+    Mat ktu;
+    const int itersPerCheck = 10;
+    for (int iter = 0; iter < m_sinkhornMaxIters; ++iter)
+    {
+        gemm(kernel, v, 1, noArray(), 0, kv);
+        cv::max(kv, DBL_MIN, kv);
+        divide(weights1, kv, u);
+
+        gemm(kernel, u, 1, noArray(), 0, ktu, GEMM_1_T);
+        cv::max(ktu, DBL_MIN, ktu);
+        divide(weights2, ktu, v);
+
+        // The columns of the plan sum up to weights2 right after v is updated, so only the rows are checked.
+        if ((iter + 1) % itersPerCheck == 0)
+        {
+            gemm(kernel, v, 1, noArray(), 0, kv);
+            if (norm(u.mul(kv), weights1, NORM_L1) < m_sinkhornTol)
+            {
+                break;
+            }
+        }
+    }
+
+    // The transport cost of the plan, i.e., u'*(K.*C)*v.
+    Mat costKernel = kernel.mul(costs);
+    Mat costKv;
+    gemm(costKernel, v, 1, noArray(), 0, costKv);
+
+    return static_cast<float>(u.dot(costKv));
+}
+
+float FastEmd::ComputeCentroidLowerBound(const Mat& sig1, const Mat& sig2, const int distType) const
+{
+    CV_Assert((sig1.type() == CV_32F) && (sig2.type() == CV_32F) && (sig1.cols == sig2.cols) && (sig1.cols > 1));
+
+    const int cntDims = sig1.cols - 1;
+    Mat weights1 = NormalizedWeights(sig1);
+    Mat weights2 = NormalizedWeights(sig2);
+
+    vector<double> centroid1(cntDims, 0);
+    vector<double> centroid2(cntDims, 0);
+    for (int dim = 0; dim < cntDims; ++dim)
+    {
+        if (dim == m_circularDim)
+        {
+            continue;
+        }
+
+        Mat coords1;
+        Mat coords2;
+        sig1.col(dim + 1).convertTo(coords1, CV_64F);
+        sig2.col(dim + 1).convertTo(coords2, CV_64F);
+
+        centroid1[dim] = weights1.dot(coords1);
+        centroid2[dim] = weights2.dot(coords2);
+    }
+
+    return static_cast<float>(GroundDist(&centroid1[0], &centroid2[0], cntDims, distType));
+}
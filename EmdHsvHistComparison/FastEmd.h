@@ -0,0 +1,103 @@
+/*
+ * FastEmd.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef FASTEMD_H_
+#define FASTEMD_H_
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <opencv2/core.hpp>
+
+// Compute the earth mover's distance between two signatures in the format of EMD(), i.e., one CV_32F row per
+// nonzero bin holding the weight followed by the bin coordinates, by one of the following solvers.
+//
+// Exact: EMD() itself, which solves the transportation problem by the simplex method.
+// CDF: the closed form of the one-dimensional signatures, i.e., the integral of the absolute difference of the two
+//      cumulative distributions, which is exact for any of DIST_L1, DIST_L2 and DIST_C and takes O(n log n).
+// Sinkhorn: the entropy-regularized transport solved by the Sinkhorn-Knopp matrix scaling, which costs O(n1*n2) per
+//      iteration. The result is the transport cost of the regularized plan, so it approximates EMD from above, more
+//      closely for a smaller regularization.
+// Auto: CDF for the one-dimensional signatures, and for the others, exact for the small signatures and Sinkhorn for
+//      the large ones.
+//
+// The weights of both signatures are normalized to the sum of 1, which doesn't change EMD() if they sum to the same.
+//
+// If the coordinates are the bin indices of a histogram one of whose dimensions wraps around, e.g., hue, the ground
+// distance along that dimension is the shorter way around the circle. The ground distances between all the bins of the
+// histogram shape are then computed once per distance type, and the solvers take the costs between the bins of the two
+// signatures from them, e.g., EMD() by DIST_USER. The CDF solver uses the closed form of the circle instead.
+class FastEmd
+{
+public:
+    enum Solver
+    {
+        SOLVER_EXACT = 0,
+        SOLVER_CDF,
+        SOLVER_SINKHORN,
+        SOLVER_AUTO
+    };
+
+private:
+    int m_solver;
+
+    // The regularization relative to the largest ground distance between the two signatures.
+    double m_sinkhornReg;
+    int m_sinkhornMaxIters;
+
+    // The L1 error of the marginals at which the Sinkhorn iterations stop.
+    double m_sinkhornTol;
+
+    // The auto solver uses EMD() up to this many pairs of bins.
+    static const int maxExactPairs = 4096;
+
+    // The histogram shape and its circular dimension, or -1 if none.
+    std::vector<int> m_histSize;
+    int m_circularDim;
+
+    // The B x B CV_32F ground distances between all the bins of the histogram shape for each distance type.
+    std::map<int, cv::Mat> m_binCosts;
+
+    const cv::Mat& GetBinCosts(const int distType);
+
+    // The n1 x n2 CV_32F ground distances between the bins of the two signatures.
+    void BuildCosts(const cv::Mat& sig1, const cv::Mat& sig2, const int distType, cv::Mat& costs);
+
+    float ComputeBySinkhorn(const cv::Mat& sig1, const cv::Mat& sig2, const int distType);
+
+public:
+    FastEmd(
+        const int solver = SOLVER_EXACT,
+        const double sinkhornReg = 0.01,
+        const int sinkhornMaxIters = 1000,
+        const double sinkhornTol = 1e-6);
+
+    // Return false if the solver name (exact | cdf | sinkhorn | auto) is invalid.
+    static bool Str2Solver(std::string& strSolver, int& solver);
+    static std::string Solver2Str(const int solver);
+
+    // Make dimension circularDim of the histograms of histSize, whose bin indices are the signature coordinates,
+    // wrap around after histSize[circularDim] bins.
+    void SetCircularDim(const std::vector<int>& histSize, const int circularDim);
+
+    // Resolve the auto solver into the one used for the two signatures.
+    int SelectSolver(const cv::Mat& sig1, const cv::Mat& sig2) const;
+
+    // distType is one of DIST_L1, DIST_L2 and DIST_C as EMD(). The CDF solver only accepts the one-dimensional
+    // signatures.
+    float Compute(const cv::Mat& sig1, const cv::Mat& sig2, const int distType);
+
+    float ComputeByCdf(const cv::Mat& sig1, const cv::Mat& sig2) const;
+
+    // The distance between the weighted centroids of the two signatures, which never exceeds their EMD for a ground
+    // distance which is a norm, so a pair whose bound is already above a threshold can be skipped without solving.
+    // The circular dimension has no centroid and is left out, which only loosens the bound.
+    float ComputeCentroidLowerBound(const cv::Mat& sig1, const cv::Mat& sig2, const int distType) const;
+};
+
+#endif /* FASTEMD_H_ */
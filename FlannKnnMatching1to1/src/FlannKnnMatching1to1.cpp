@@ -8,11 +8,13 @@
 #include <cstdio>
 #include <vector>
 #include <chrono>
+#include <string>
 #include "opencv2/core.hpp"
 #include "opencv2/features2d.hpp"
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
 #include "opencv2/xfeatures2d.hpp"
+#include "ExactL2KnnMatcher.h"
 
 using namespace std;
 using namespace cv;
@@ -29,7 +31,15 @@ void readme();
  */
 int main(int argc, char** argv)
 {
-    if( argc != 3 )
+    if( argc != 3 && argc != 4 )
+    {
+        readme();
+        return -1;
+    }
+
+    // The matching engine is selected automatically by the numbers of descriptors unless it is given explicitly.
+    string engine = (argc == 4) ? string(argv[3]) : string("auto");
+    if (engine != "auto" && engine != "exact" && engine != "flann")
     {
         readme();
         return -1;
@@ -66,19 +76,44 @@ int main(int argc, char** argv)
     printf("The time for the SURF keypoint detection and the descriptor computation: %ld milliseconds\n",
             chrono::duration_cast<chrono::milliseconds>(tDetectAndComputeEnd - tStart).count());
 
-    // 2. Match the two descriptors using the FLANN matcher.
-    FlannBasedMatcher flannMatcher;
+    // 2. Match the two descriptors using either the FLANN matcher or the exact matcher. For two single images,
+    // scanning all the descriptor pairs can be faster than building the KD-trees of the FLANN matcher.
+    bool useExactMatcher = (engine == "exact")
+        || (engine == "auto" && ExactL2KnnMatcher::IsFasterThanFlann(descriptors1.rows, descriptors2.rows));
     vector<vector<DMatch>> knnMatches;
 
-    // There are two match methods: one for object recognition and the other for tracking.
-    // Here we are using the one for tracking.
-    flannMatcher.knnMatch(descriptors1, descriptors2, knnMatches, 2);
+    if (useExactMatcher)
+    {
+        if (ExactL2KnnMatcher::KnnMatch(descriptors1, descriptors2, knnMatches, 2) != 0)
+        {
+            printf("Error matching the descriptors!!\n");
+            return -1;
+        }
+    }
+    else
+    {
+        FlannBasedMatcher flannMatcher;
+
+        // There are two match methods: one for object recognition and the other for tracking.
+        // Here we are using the one for tracking.
+        flannMatcher.knnMatch(descriptors1, descriptors2, knnMatches, 2);
+    }
 
     auto tMatchEnd = Clock::now();
 
     printf("======================================================================\n");
-    printf("The time for the FLANN matching: %ld milliseconds\n",
-            chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tDetectAndComputeEnd).count());
+    if (useExactMatcher)
+    {
+        printf("The time for the exact matching (%s kernel) of %d x %d descriptors: %ld milliseconds\n",
+                ExactL2KnnMatcher::GetKernelName().c_str(), descriptors1.rows, descriptors2.rows,
+                chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tDetectAndComputeEnd).count());
+    }
+    else
+    {
+        printf("The time for the FLANN matching of %d x %d descriptors: %ld milliseconds\n",
+                descriptors1.rows, descriptors2.rows,
+                chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tDetectAndComputeEnd).count());
+    }
 
     // 3. Find only "good" matches among the closest matches, i.e., whose distance is much better (<0.8) than
     // the corresponding second closest match.
@@ -125,5 +160,5 @@ int main(int argc, char** argv)
  */
 void readme()
 {
-    printf(" Usage: ./FlannKnnMatching1to1 <img1> <img2>\n");
+    printf(" Usage: ./FlannKnnMatching1to1 <img1> <img2> [auto | exact | flann]\n");
 }
@@ -0,0 +1,61 @@
+/*
+ * ReferenceSetCache.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_REFERENCESETCACHE_H_
+#define INCLUDES_REFERENCESETCACHE_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include "CachedFlannBasedMatcher.h"
+
+// A persistent cache of the keypoints, the descriptors and the trained FLANN index of a set of reference (source)
+// images. The cache is stored in a yml file and the FLANN index in a raw file next to it, i.e., cacheFile +
+// "_flannindex". The cache is valid only if it was built with the same detector from the same list of files, each
+// of which still has the same size and modification time.
+class ReferenceSetCache
+{
+private:
+    std::string m_cacheFile;
+    std::string m_indexFile;
+
+    // Get the sizes and modification times (seconds and nanoseconds) of the files. Return false if any file can't
+    // be stat'ed.
+    static bool GetFileStamps(
+        const std::vector<std::string>& files,
+        std::vector<double>& sizes,
+        std::vector<double>& mtimeSecs,
+        std::vector<int>& mtimeNsecs);
+
+public:
+    explicit ReferenceSetCache(const std::string& cacheFile);
+
+    // Load the keypoints and the descriptors of the source images and the FLANN index trained with them into the
+    // matcher. Return false if there is no valid cache, in which case the outputs are left empty.
+    bool Load(
+        const std::string& detectorMethod,
+        const int keypointBudget,
+        const std::vector<std::string>& srcFiles,
+        std::vector<std::vector<cv::KeyPoint> >& allSrcKeypoints,
+        std::vector<cv::Mat>& allSrcDescriptors,
+        const cv::Ptr<cv::CachedFlannBasedMatcher>& matcher) const;
+
+    // Save the keypoints and the descriptors of the source images and the FLANN index of the trained matcher.
+    // Return 0 on success, or -1 if the source files can't be stat'ed or the cache file can't be opened.
+    int Save(
+        const std::string& detectorMethod,
+        const int keypointBudget,
+        const std::vector<std::string>& srcFiles,
+        const std::vector<std::vector<cv::KeyPoint> >& allSrcKeypoints,
+        const std::vector<cv::Mat>& allSrcDescriptors,
+        const cv::Ptr<cv::CachedFlannBasedMatcher>& matcher) const;
+};
+
+#endif /* INCLUDES_REFERENCESETCACHE_H_ */
@@ -0,0 +1,197 @@
+/*
+ * ReferenceSetCache.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ReferenceSetCache.h"
+
+using namespace std;
+using namespace cv;
+
+ReferenceSetCache::ReferenceSetCache(const string& cacheFile) :
+    m_cacheFile(cacheFile),
+    m_indexFile(cacheFile + "_flannindex")
+{
+}
+
+bool ReferenceSetCache::GetFileStamps(
+    const vector<string>& files,
+    vector<double>& sizes,
+    vector<double>& mtimeSecs,
+    vector<int>& mtimeNsecs)
+{
+    sizes.clear();
+    mtimeSecs.clear();
+    mtimeNsecs.clear();
+
+    struct stat info;
+    for (auto& file: files)
+    {
+        if (stat(file.c_str(), &info) != 0)
+        {
+            printf("Error: stat(%s) for %s.\n", strerror(errno), file.c_str());
+            return false;
+        }
+
+        // FileStorage has no 64-bit integers, but a double holds the sizes and the seconds exactly.
+        sizes.push_back(static_cast<double>(info.st_size));
+        mtimeSecs.push_back(static_cast<double>(info.st_mtim.tv_sec));
+        mtimeNsecs.push_back(static_cast<int>(info.st_mtim.tv_nsec));
+    }
+
+    return true;
+}
+
+bool ReferenceSetCache::Load(
+    const string& detectorMethod,
+    const int keypointBudget,
+    const vector<string>& srcFiles,
+    vector<vector<KeyPoint>>& allSrcKeypoints,
+    vector<Mat>& allSrcDescriptors,
+    const Ptr<CachedFlannBasedMatcher>& matcher) const
+{
+    allSrcKeypoints.clear();
+    allSrcDescriptors.clear();
+
+    // A corrupt or truncated cache file makes FileStorage throw while parsing or reading it, in which case the cache
+    // is rebuilt as a stale one is.
+    try
+    {
+        FileStorage fs(m_cacheFile, FileStorage::READ);
+        if (!fs.isOpened())
+        {
+            printf("The reference set cache %s doesn't exist.\n", m_cacheFile.c_str());
+            return false;
+        }
+
+        string cachedDetectorMethod;
+        vector<string> cachedSrcFiles;
+        vector<double> cachedSizes;
+        vector<double> cachedMtimeSecs;
+        vector<int> cachedMtimeNsecs;
+
+        fs["detectorMethod"] >> cachedDetectorMethod;
+        // The caches built before the keypoint budget was introduced have no such node, which reads as 0, i.e., no
+        // budget.
+        int cachedKeypointBudget = (int)fs["keypointBudget"];
+        fs["srcFiles"] >> cachedSrcFiles;
+        fs["srcFileSizes"] >> cachedSizes;
+        fs["srcFileMtimeSecs"] >> cachedMtimeSecs;
+        fs["srcFileMtimeNsecs"] >> cachedMtimeNsecs;
+
+        if (cachedDetectorMethod != detectorMethod)
+        {
+            printf("The reference set cache %s was built with the %s detector, so it is rebuilt.\n",
+                    m_cacheFile.c_str(), cachedDetectorMethod.c_str());
+            return false;
+        }
+
+        if (cachedKeypointBudget != keypointBudget)
+        {
+            printf("The reference set cache %s was built with the keypoint budget %d, so it is rebuilt.\n",
+                    m_cacheFile.c_str(), cachedKeypointBudget);
+            return false;
+        }
+
+        if (cachedSrcFiles != srcFiles)
+        {
+            printf("The source images have been added, removed or renamed since the reference set cache %s was built, so it is rebuilt.\n",
+                    m_cacheFile.c_str());
+            return false;
+        }
+
+        vector<double> sizes;
+        vector<double> mtimeSecs;
+        vector<int> mtimeNsecs;
+        if (!GetFileStamps(srcFiles, sizes, mtimeSecs, mtimeNsecs))
+        {
+            return false;
+        }
+
+        if (cachedSizes != sizes || cachedMtimeSecs != mtimeSecs || cachedMtimeNsecs != mtimeNsecs)
+        {
+            printf("The source images have been modified since the reference set cache %s was built, so it is rebuilt.\n",
+                    m_cacheFile.c_str());
+            return false;
+        }
+
+        for (size_t srcIndex = 0; srcIndex < srcFiles.size(); srcIndex++)
+        {
+            vector<KeyPoint> oneSrcKeypoints;
+            Mat oneSrcDescriptors;
+
+            read(fs["keypoints_" + to_string(srcIndex)], oneSrcKeypoints);
+            fs["descriptors_" + to_string(srcIndex)] >> oneSrcDescriptors;
+
+            allSrcKeypoints.push_back(oneSrcKeypoints);
+            allSrcDescriptors.push_back(oneSrcDescriptors);
+        }
+    }
+    catch (const cv::Exception& e)
+    {
+        printf("Error: the reference set cache %s is corrupt (%s), so it is rebuilt.\n", m_cacheFile.c_str(), e.what());
+        allSrcKeypoints.clear();
+        allSrcDescriptors.clear();
+        return false;
+    }
+
+    if (!matcher->loadIndex(allSrcDescriptors, m_indexFile))
+    {
+        printf("Error: can't load the FLANN index %s of the reference set cache, so it is rebuilt.\n", m_indexFile.c_str());
+        allSrcKeypoints.clear();
+        allSrcDescriptors.clear();
+        return false;
+    }
+
+    return true;
+}
+
+int ReferenceSetCache::Save(
+    const string& detectorMethod,
+    const int keypointBudget,
+    const vector<string>& srcFiles,
+    const vector<vector<KeyPoint>>& allSrcKeypoints,
+    const vector<Mat>& allSrcDescriptors,
+    const Ptr<CachedFlannBasedMatcher>& matcher) const
+{
+    vector<double> sizes;
+    vector<double> mtimeSecs;
+    vector<int> mtimeNsecs;
+    if (!GetFileStamps(srcFiles, sizes, mtimeSecs, mtimeNsecs))
+    {
+        return -1;
+    }
+
+    FileStorage fs(m_cacheFile, FileStorage::WRITE);
+    if (!fs.isOpened())
+    {
+        printf("Error: can't open the reference set cache %s for writing.\n", m_cacheFile.c_str());
+        return -1;
+    }
+
+    fs << "detectorMethod" << detectorMethod;
+    fs << "keypointBudget" << keypointBudget;
+    fs << "srcFiles" << srcFiles;
+    fs << "srcFileSizes" << sizes;
+    fs << "srcFileMtimeSecs" << mtimeSecs;
+    fs << "srcFileMtimeNsecs" << mtimeNsecs;
+
+    for (size_t srcIndex = 0; srcIndex < srcFiles.size(); srcIndex++)
+    {
+        write(fs, "keypoints_" + to_string(srcIndex), allSrcKeypoints[srcIndex]);
+        fs << "descriptors_" + to_string(srcIndex) << allSrcDescriptors[srcIndex];
+    }
+
+    matcher->saveIndex(m_indexFile);
+
+    return 0;
+}
@@ -22,6 +22,7 @@ private:
     std::vector<std::string> trainedImgFilenameList;
     std::string flannIndexFileDir;
     std::string flannIndexFilename;
+    int keypointBudget;
 
 public:
     FlannBasedSavableMatcher();
@@ -32,6 +33,11 @@ public:
     void setFlannIndexFileDir(const std::string& dir);
     void setFlannIndexFilename(const std::string& filename);
 
+    // The maximum number of keypoints per image which the matcher is trained with, or 0 for no limit. It is saved
+    // in the matcher file so that the query images are limited in the same way.
+    int getKeypointBudget() const;
+    void setKeypointBudget(const int budget);
+
     virtual void read(const FileNode& fn);
     virtual void write(FileStorage& fs) const;
 
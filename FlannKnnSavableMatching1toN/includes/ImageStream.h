@@ -0,0 +1,95 @@
+/*
+ * ImageStream.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_IMAGESTREAM_H_
+#define INCLUDES_IMAGESTREAM_H_
+
+#include <condition_variable>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// A streaming source of the images in a directory. The images are decoded by background threads while the consumer
+// is working on the earlier images, but at most m_maxReadAhead decoded images are held at any time, including the one
+// delivered by the last Next() until the next call, so the peak memory doesn't grow with the number of images in the
+// directory. The images are delivered in the order of the
+// directory listing no matter which thread decoded them, and the files which can't be decoded are skipped.
+class ImageStream
+{
+public:
+    struct Frame
+    {
+        std::string filename;
+        cv::Mat img;
+    };
+
+    // An input iterator over the remaining images of the stream, i.e., for (auto& frame: stream) { ... }.
+    class Iterator : public std::iterator<std::input_iterator_tag, Frame>
+    {
+    private:
+        ImageStream* m_stream;
+        Frame m_frame;
+
+    public:
+        explicit Iterator(ImageStream* stream);
+
+        const Frame& operator*() const { return m_frame; }
+        const Frame* operator->() const { return &m_frame; }
+        Iterator& operator++();
+        bool operator==(const Iterator& other) const { return m_stream == other.m_stream; }
+        bool operator!=(const Iterator& other) const { return m_stream != other.m_stream; }
+    };
+
+private:
+    std::string m_imgDir;
+    std::vector<std::string> m_filenames;
+    int m_maxReadAhead;
+
+    size_t m_nextToDecode;
+    size_t m_nextToDeliver;
+    bool m_isFrameHeld;     // The consumer holds the image delivered by the last Next().
+    bool m_stopped;
+    std::map<size_t, cv::Mat> m_decodedImgs;
+
+    std::mutex m_mutex;
+    std::condition_variable m_decodeCond;     // Signalled when a slot of the read-ahead window becomes free.
+    std::condition_variable m_deliverCond;    // Signalled when an image has been decoded.
+    std::vector<std::thread> m_workers;
+
+    void DecodeLoop();
+
+    // The stream owns its decoding threads, so it can't be copied.
+    ImageStream(const ImageStream&) = delete;
+    ImageStream& operator=(const ImageStream&) = delete;
+
+public:
+    ImageStream();
+    ~ImageStream();
+
+    // List the regular files in the directory and start the decoding threads. Return 0 on success, or errno if the
+    // directory can't be opened.
+    int Open(
+        const std::string& imgDir,
+        const int maxReadAhead,
+        const int cntThreads);
+
+    // Get the next decoded image in the order of the directory listing. Return false at the end of the stream. The
+    // image of the previous call is released from frame, and its slot of the read-ahead window is given back.
+    bool Next(Frame& frame);
+
+    void Close();
+
+    Iterator begin();
+    Iterator end();
+};
+
+#endif /* INCLUDES_IMAGESTREAM_H_ */
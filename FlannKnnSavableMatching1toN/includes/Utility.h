@@ -19,6 +19,7 @@
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/features2d.hpp>
 
 class Utility
 {
@@ -41,6 +42,53 @@ public:
         const cv::Mat& descriptors,
         std::vector<cv::KeyPoint>& filteredKeypoints,
         cv::Mat& filteredDescriptors);
+
+    // Keep the keypoints which are located within any of the rectangles or polygons, together with the corresponding
+    // descriptors. The kept indices are found in a first pass so that the outputs are allocated only once and the
+    // descriptor rows are gathered in bulk.
+    static void FilterKeypointsAndDescriptors(
+        const std::vector<cv::Rect2f>& rects,
+        const std::vector<std::vector<cv::Point2f> >& polygons,
+        const std::vector<cv::KeyPoint>& keypoints,
+        const cv::Mat& descriptors,
+        std::vector<cv::KeyPoint>& filteredKeypoints,
+        cv::Mat& filteredDescriptors);
+
+    // Detect the keypoints and compute the descriptors of an image, keeping only the keypoints within any of the
+    // rectangles or polygons. If cropBeforeDetection is true, the detector only runs on the bounding box of all the
+    // regions expanded by the given border and the keypoints are translated back to the full image coordinates, which
+    // are nearly identical to those of the full image (keypoints within the border band may differ, since the large
+    // filters and the descriptor windows of the coarse octaves span beyond it). Otherwise the detector runs on the full
+    // image and the keypoints outside the regions are thrown away afterwards.
+    static void DetectAndComputeInRegions(
+        const cv::Ptr<cv::Feature2D>& detector,
+        const cv::Mat& img,
+        const std::vector<cv::Rect2f>& rects,
+        const std::vector<std::vector<cv::Point2f> >& polygons,
+        const bool cropBeforeDetection,
+        const int border,
+        std::vector<cv::KeyPoint>& keypoints,
+        cv::Mat& descriptors);
+
+    // Parse a rectangle given as "x,y,width,height". Return false if the string is malformed.
+    static bool ParseRect(
+        const std::string& str,
+        cv::Rect2f& rect);
+
+    // Parse a polygon given as "x1,y1;x2,y2;x3,y3;...". Return false if the string is malformed or has less than 3 vertices.
+    static bool ParsePolygon(
+        const std::string& str,
+        std::vector<cv::Point2f>& polygon);
+
+    // Keep at most keypointBudget keypoints together with their descriptors. The image is divided into a
+    // gridSize x gridSize grid, and the strongest keypoints by the response are kept in each cell for the spatial
+    // coverage. The kept keypoints are sorted by the response in the descending order. A budget <= 0 keeps all.
+    static void RetainBestKeypointsInGrid(
+        std::vector<cv::KeyPoint>& keypoints,
+        cv::Mat& descriptors,
+        const cv::Size& imgSize,
+        const int keypointBudget,
+        const int gridSize = 4);
 };
 
 #endif /* INCLUDES_UTILITY_H_ */
@@ -17,7 +17,8 @@ using namespace std;
 typedef std::chrono::high_resolution_clock Clock;
 
 FlannBasedSavableMatcher::FlannBasedSavableMatcher() :
-    flannIndexFileDir("./")
+    flannIndexFileDir("./"),
+    keypointBudget(0)
 {
 
 }
@@ -52,6 +53,16 @@ void FlannBasedSavableMatcher::setFlannIndexFilename(const string& filename)
     flannIndexFilename = filename;
 }
 
+int FlannBasedSavableMatcher::getKeypointBudget() const
+{
+    return keypointBudget;
+}
+
+void FlannBasedSavableMatcher::setKeypointBudget(const int budget)
+{
+    keypointBudget = budget;
+}
+
 void FlannBasedSavableMatcher::read(const FileNode& fn)
 {
     // Read indexParams and searchParams from fs.
@@ -98,6 +109,9 @@ void FlannBasedSavableMatcher::read(const FileNode& fn)
     }
     mergedDescriptors.set(trainDescCollection);
 
+    // The matcher files saved without a keypoint budget don't have the node, which is read as 0.
+    keypointBudget = (int)fn["keypointBudget"];
+
     // Read flannIndex from "flannIndexFileDir + flannIndexFilename".
     fn["flannIndexFilename"] >> flannIndexFilename;
 
@@ -119,6 +133,7 @@ void FlannBasedSavableMatcher::write(FileStorage& fs) const
 
     // Write the trained image filenames into fs.
     fs << "imgFilenameList" << trainedImgFilenameList;
+    fs << "keypointBudget" << keypointBudget;
 
     // Write the trained descriptors into fs.
     for (size_t imgIndex = 0; imgIndex < trainDescCollection.size(); ++imgIndex)
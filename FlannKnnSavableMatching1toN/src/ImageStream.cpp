@@ -0,0 +1,219 @@
+/*
+ * ImageStream.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <iostream>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "ImageStream.h"
+
+using namespace std;
+using namespace cv;
+
+ImageStream::Iterator::Iterator(ImageStream* stream) :
+    m_stream(stream)
+{
+    // Fetch the first image so that dereferencing begin() gives a valid frame.
+    if (m_stream != nullptr)
+    {
+        ++(*this);
+    }
+}
+
+ImageStream::Iterator& ImageStream::Iterator::operator++()
+{
+    // Release the pixels of the current image before waiting for the next one.
+    m_frame.img.release();
+
+    if (!m_stream->Next(m_frame))
+    {
+        m_stream = nullptr;
+    }
+
+    return *this;
+}
+
+ImageStream::ImageStream() :
+    m_maxReadAhead(1),
+    m_nextToDecode(0),
+    m_nextToDeliver(0),
+    m_isFrameHeld(false),
+    m_stopped(false)
+{
+}
+
+ImageStream::~ImageStream()
+{
+    Close();
+}
+
+int ImageStream::Open(
+    const string& imgDir,
+    const int maxReadAhead,
+    const int cntThreads)
+{
+    Close();
+
+    DIR *dp = nullptr;
+    struct dirent *dirp = nullptr;
+
+    dp = opendir(imgDir.c_str());
+    if (dp == nullptr)
+    {
+        cerr << "[ERROR]: opendir failed to open " << imgDir
+            << " with error " << strerror(errno) << "." << endl << endl;
+        return errno;
+    }
+
+    m_imgDir = imgDir;
+    m_filenames.clear();
+    while ((dirp = readdir(dp)) != nullptr)
+    {
+        if (dirp->d_type == DT_REG)
+        {
+            m_filenames.push_back(dirp->d_name);
+        }
+    }
+
+    closedir(dp);
+
+    m_maxReadAhead = max(maxReadAhead, 1);
+    m_nextToDecode = 0;
+    m_nextToDeliver = 0;
+    m_isFrameHeld = false;
+    m_stopped = false;
+    m_decodedImgs.clear();
+
+    // There is no point in having more threads than images which may be decoded ahead.
+    int cntWorkers = min(max(cntThreads, 1), m_maxReadAhead);
+    for (int i = 0; i < cntWorkers; ++i)
+    {
+        m_workers.push_back(thread(&ImageStream::DecodeLoop, this));
+    }
+
+    cout << "[INFO]: Streaming " << m_filenames.size() << " files in " << imgDir << " with " << cntWorkers
+        << " decoding threads and a read-ahead of " << m_maxReadAhead << " images." << endl;
+
+    return 0;
+}
+
+void ImageStream::DecodeLoop()
+{
+    while (true)
+    {
+        size_t idx = 0;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            // The image held by the consumer takes a slot of the window as well, so that at most m_maxReadAhead
+            // decoded images exist at a time.
+            m_decodeCond.wait(lock, [this]
+                {
+                    return m_stopped
+                        || m_nextToDecode >= m_filenames.size()
+                        || m_nextToDecode + (m_isFrameHeld ? 1 : 0) < m_nextToDeliver + m_maxReadAhead;
+                });
+
+            if (m_stopped || m_nextToDecode >= m_filenames.size())
+            {
+                return;
+            }
+
+            idx = m_nextToDecode++;
+        }
+
+        // Decode outside the lock so that the threads decode in parallel. An empty Mat marks a file which is not an
+        // image, and it is skipped by Next().
+        Mat img = imread(m_imgDir + '/' + m_filenames[idx]);
+
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_decodedImgs[idx] = img;
+        }
+        m_deliverCond.notify_all();
+    }
+}
+
+bool ImageStream::Next(Frame& frame)
+{
+    // The consumer is done with the previous image, so its slot of the read-ahead window is free.
+    frame.img.release();
+
+    unique_lock<mutex> lock(m_mutex);
+    if (m_isFrameHeld)
+    {
+        m_isFrameHeld = false;
+        m_decodeCond.notify_all();
+    }
+
+    while (!m_stopped && m_nextToDeliver < m_filenames.size())
+    {
+        m_deliverCond.wait(lock, [this]
+            {
+                return m_stopped || m_decodedImgs.count(m_nextToDeliver) > 0;
+            });
+
+        if (m_stopped)
+        {
+            break;
+        }
+
+        auto it = m_decodedImgs.find(m_nextToDeliver);
+        Mat img = it->second;
+        m_decodedImgs.erase(it);
+        size_t idx = m_nextToDeliver++;
+
+        // A slot of the read-ahead window is free now.
+        m_decodeCond.notify_all();
+
+        if (img.empty())
+        {
+            cerr << "[WARNING]: " << m_filenames[idx] << " is not an image file." << endl;
+            continue;
+        }
+
+        frame.filename = m_filenames[idx];
+        frame.img = img;
+        m_isFrameHeld = true;
+        return true;
+    }
+
+    return false;
+}
+
+void ImageStream::Close()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+    m_decodeCond.notify_all();
+    m_deliverCond.notify_all();
+
+    for (auto& worker: m_workers)
+    {
+        worker.join();
+    }
+
+    m_workers.clear();
+    m_decodedImgs.clear();
+}
+
+ImageStream::Iterator ImageStream::begin()
+{
+    return Iterator(this);
+}
+
+ImageStream::Iterator ImageStream::end()
+{
+    return Iterator(nullptr);
+}
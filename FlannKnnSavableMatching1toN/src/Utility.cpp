@@ -5,6 +5,14 @@
  *      Author: renwei
  */
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include <opencv2/imgproc.hpp>
+
 #include "Utility.h"
 
 using namespace std;
@@ -133,17 +141,286 @@ void Utility::FilterKeypointsAndDescriptors(
         std::vector<cv::KeyPoint>& filteredKeypoints,
         cv::Mat& filteredDescriptors)
 {
+    FilterKeypointsAndDescriptors(
+        vector<Rect2f>(1, rect),
+        vector<vector<Point2f> >(),
+        keypoints,
+        descriptors,
+        filteredKeypoints,
+        filteredDescriptors);
+}
+
+void Utility::FilterKeypointsAndDescriptors(
+        const vector<Rect2f>& rects,
+        const vector<vector<Point2f> >& polygons,
+        const vector<KeyPoint>& keypoints,
+        const Mat& descriptors,
+        vector<KeyPoint>& filteredKeypoints,
+        Mat& filteredDescriptors)
+{
+    // The bounding boxes let most of the keypoints outside a polygon be rejected without the polygon test.
+    vector<Rect2f> polygonBoxes;
+    for (auto& polygon: polygons)
+    {
+        Rect box = boundingRect(polygon);
+        polygonBoxes.push_back(Rect2f(static_cast<float>(box.x), static_cast<float>(box.y),
+            static_cast<float>(box.width), static_cast<float>(box.height)));
+    }
+
+    // First pass: mark the keypoints to keep.
+    vector<uchar> keepMask(keypoints.size(), 0);
+    int keptCnt = 0;
     for (size_t keypointIndex = 0; keypointIndex < keypoints.size(); ++keypointIndex)
     {
-        // Keep the keypoint and the corresponding descriptor if the keypoint
-        // is located within the rectangle, otherwise throw them away.
-        if (rect.contains(keypoints[keypointIndex].pt))
+        const Point2f& pt = keypoints[keypointIndex].pt;
+        bool isInside = false;
+
+        for (size_t i = 0; !isInside && i < rects.size(); ++i)
+        {
+            isInside = rects[i].contains(pt);
+        }
+
+        // Note that boundingRect() is exclusive at the bottom-right, so a point on the right or bottom edge of the
+        // polygon is still tested against the polygon itself.
+        for (size_t i = 0; !isInside && i < polygons.size(); ++i)
+        {
+            if (pt.x >= polygonBoxes[i].x && pt.y >= polygonBoxes[i].y
+                && pt.x <= polygonBoxes[i].x + polygonBoxes[i].width && pt.y <= polygonBoxes[i].y + polygonBoxes[i].height)
+            {
+                isInside = (pointPolygonTest(polygons[i], pt, false) >= 0);
+            }
+        }
+
+        if (isInside)
+        {
+            keepMask[keypointIndex] = 1;
+            keptCnt++;
+        }
+    }
+
+    // Second pass: size the outputs once and gather the kept rows, copying each run of consecutive kept rows at once.
+    filteredKeypoints.clear();
+    filteredKeypoints.reserve(keptCnt);
+    filteredDescriptors.create(keptCnt, descriptors.cols, descriptors.type());
+
+    const size_t rowSize = descriptors.cols * descriptors.elemSize();
+    int dstRow = 0;
+    size_t keypointIndex = 0;
+    while (keypointIndex < keypoints.size())
+    {
+        if (!keepMask[keypointIndex])
+        {
+            keypointIndex++;
+            continue;
+        }
+
+        size_t runStart = keypointIndex;
+        while (keypointIndex < keypoints.size() && keepMask[keypointIndex])
         {
             filteredKeypoints.push_back(keypoints[keypointIndex]);
-            filteredDescriptors.push_back(descriptors.row(keypointIndex));
+            keypointIndex++;
         }
+
+        int runLength = static_cast<int>(keypointIndex - runStart);
+        if (descriptors.isContinuous() && filteredDescriptors.isContinuous())
+        {
+            memcpy(filteredDescriptors.ptr(dstRow), descriptors.ptr(static_cast<int>(runStart)), runLength * rowSize);
+        }
+        else
+        {
+            descriptors.rowRange(static_cast<int>(runStart), static_cast<int>(keypointIndex))
+                .copyTo(filteredDescriptors.rowRange(dstRow, dstRow + runLength));
+        }
+        dstRow += runLength;
     }
 
     cout << "[INFO]: Keep " << filteredDescriptors.rows << " descriptors out of "
         << descriptors.rows << "." << endl;
 }
+
+void Utility::DetectAndComputeInRegions(
+    const Ptr<Feature2D>& detector,
+    const Mat& img,
+    const vector<Rect2f>& rects,
+    const vector<vector<Point2f> >& polygons,
+    const bool cropBeforeDetection,
+    const int border,
+    vector<KeyPoint>& keypoints,
+    Mat& descriptors)
+{
+    vector<KeyPoint> allKeypoints;
+    Mat allDescriptors;
+
+    if (rects.empty() && polygons.empty())
+    {
+        detector->detectAndCompute(img, noArray(), keypoints, descriptors);
+        return;
+    }
+
+    if (!cropBeforeDetection)
+    {
+        detector->detectAndCompute(img, noArray(), allKeypoints, allDescriptors);
+        FilterKeypointsAndDescriptors(rects, polygons, allKeypoints, allDescriptors, keypoints, descriptors);
+        return;
+    }
+
+    // Find the bounding box of all the regions.
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (auto& rect: rects)
+    {
+        minX = min(minX, rect.x);
+        minY = min(minY, rect.y);
+        maxX = max(maxX, rect.x + rect.width);
+        maxY = max(maxY, rect.y + rect.height);
+    }
+
+    for (auto& polygon: polygons)
+    {
+        for (auto& pt: polygon)
+        {
+            minX = min(minX, pt.x);
+            minY = min(minY, pt.y);
+            maxX = max(maxX, pt.x);
+            maxY = max(maxY, pt.y);
+        }
+    }
+
+    // Expand the bounding box by the border and clip it to the image.
+    int x0 = max(static_cast<int>(floor(minX)) - border, 0);
+    int y0 = max(static_cast<int>(floor(minY)) - border, 0);
+    int x1 = min(static_cast<int>(ceil(maxX)) + 1 + border, img.cols);
+    int y1 = min(static_cast<int>(ceil(maxY)) + 1 + border, img.rows);
+    if (x1 <= x0 || y1 <= y0)
+    {
+        cerr << "[WARNING]: The regions are outside the image." << endl;
+        keypoints.clear();
+        descriptors.release();
+        return;
+    }
+
+    // The cropped image shares the pixels with the full image, so there is no copy.
+    Rect cropRect(x0, y0, x1 - x0, y1 - y0);
+    detector->detectAndCompute(img(cropRect), noArray(), allKeypoints, allDescriptors);
+
+    for (auto& keypoint: allKeypoints)
+    {
+        keypoint.pt.x += x0;
+        keypoint.pt.y += y0;
+    }
+
+    cout << "[INFO]: Detected " << allKeypoints.size() << " keypoints in the " << cropRect.width << "x" << cropRect.height
+        << " cropped area of the " << img.cols << "x" << img.rows << " image." << endl;
+
+    // The border only keeps most of the detector response near the edges of the regions as in the full image, so
+    // throw away the keypoints in it as well as those between the regions.
+    FilterKeypointsAndDescriptors(rects, polygons, allKeypoints, allDescriptors, keypoints, descriptors);
+}
+
+bool Utility::ParseRect(
+    const string& str,
+    Rect2f& rect)
+{
+    float x = 0, y = 0, width = 0, height = 0;
+    char trailing = 0;
+    if (sscanf(str.c_str(), "%f,%f,%f,%f%c", &x, &y, &width, &height, &trailing) != 4
+        || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    rect = Rect2f(x, y, width, height);
+    return true;
+}
+
+bool Utility::ParsePolygon(
+    const string& str,
+    vector<Point2f>& polygon)
+{
+    polygon.clear();
+
+    istringstream iss(str);
+    string vertex;
+    while (getline(iss, vertex, ';'))
+    {
+        float x = 0, y = 0;
+        char trailing = 0;
+        if (sscanf(vertex.c_str(), "%f,%f%c", &x, &y, &trailing) != 2)
+        {
+            return false;
+        }
+
+        polygon.push_back(Point2f(x, y));
+    }
+
+    return (polygon.size() >= 3);
+}
+
+void Utility::RetainBestKeypointsInGrid(
+    vector<KeyPoint>& keypoints,
+    Mat& descriptors,
+    const Size& imgSize,
+    const int keypointBudget,
+    const int gridSize)
+{
+    if ((keypointBudget <= 0) || (static_cast<int>(keypoints.size()) <= keypointBudget))
+    {
+        return;
+    }
+
+    // Bucket the keypoints by a gridSize x gridSize grid over the image.
+    int cntCells = gridSize*gridSize;
+    vector<vector<int> > cellKeypointIdxs(cntCells);
+    for (int keypointIdx = 0; keypointIdx < static_cast<int>(keypoints.size()); ++keypointIdx)
+    {
+        const Point2f& pt = keypoints[keypointIdx].pt;
+        int col = min(max(static_cast<int>(pt.x*gridSize/max(imgSize.width, 1)), 0), gridSize - 1);
+        int row = min(max(static_cast<int>(pt.y*gridSize/max(imgSize.height, 1)), 0), gridSize - 1);
+        cellKeypointIdxs[row*gridSize + col].push_back(keypointIdx);
+    }
+
+    auto byResponse = [&keypoints](const int lhs, const int rhs)
+        {
+            return keypoints[lhs].response > keypoints[rhs].response;
+        };
+
+    // Take the strongest keypoints of each cell up to an equal share of the budget, so that all the parts of the
+    // image are covered. The share left by the sparse cells goes to the strongest of the remaining keypoints.
+    int cellQuota = keypointBudget/cntCells;
+    vector<int> keptIdxs;
+    vector<int> remainingIdxs;
+    for (auto& oneCellIdxs : cellKeypointIdxs)
+    {
+        stable_sort(oneCellIdxs.begin(), oneCellIdxs.end(), byResponse);
+
+        int cntKept = min(cellQuota, static_cast<int>(oneCellIdxs.size()));
+        keptIdxs.insert(keptIdxs.end(), oneCellIdxs.begin(), oneCellIdxs.begin() + cntKept);
+        remainingIdxs.insert(remainingIdxs.end(), oneCellIdxs.begin() + cntKept, oneCellIdxs.end());
+    }
+
+    stable_sort(remainingIdxs.begin(), remainingIdxs.end(), byResponse);
+    int cntLeft = min(keypointBudget - static_cast<int>(keptIdxs.size()), static_cast<int>(remainingIdxs.size()));
+    keptIdxs.insert(keptIdxs.end(), remainingIdxs.begin(), remainingIdxs.begin() + cntLeft);
+
+    // Sort the kept keypoints by the response, so a truncated prefix of the descriptors is still the strongest.
+    stable_sort(keptIdxs.begin(), keptIdxs.end(), byResponse);
+
+    vector<KeyPoint> keptKeypoints;
+    keptKeypoints.reserve(keptIdxs.size());
+    Mat keptDescriptors;
+    if (!descriptors.empty())
+    {
+        keptDescriptors.create(static_cast<int>(keptIdxs.size()), descriptors.cols, descriptors.type());
+    }
+
+    for (int keptIndex = 0; keptIndex < static_cast<int>(keptIdxs.size()); ++keptIndex)
+    {
+        keptKeypoints.push_back(keypoints[keptIdxs[keptIndex]]);
+        if (!descriptors.empty())
+        {
+            descriptors.row(keptIdxs[keptIndex]).copyTo(keptDescriptors.row(keptIndex));
+        }
+    }
+
+    keypoints.swap(keptKeypoints);
+    descriptors = keptDescriptors;
+}
@@ -15,6 +15,7 @@
 #include <opencv2/xfeatures2d.hpp>
 
 #include "Utility.h"
+#include "ImageStream.h"
 #include "FlannBasedSavableMatcher.h"
 
 using namespace std;
@@ -32,10 +33,17 @@ int main(int argc, char** argv)
         ("image,i", po::value<string>(), "The image file which will be used for SURF matching")
         ("image-dir,d", po::value<string>(), "The directory of images which will be used for training the FLANN-based matcher")
         ("matcher-file,m", po::value<string>(), "The file which will store the FLANN-based matcher. It is an output for training and an input for SURF matching")
+        ("read-ahead", po::value<int>()->default_value(4), "The maximum number of decoded training images held at a time, including the one under the SURF extraction")
+        ("decode-threads", po::value<int>()->default_value(2), "The number of background threads which decode the training images")
         ("tlx", po::value<int>(), "The x-coordinate of the top-left corner of the cropped rectangular area when we do the match")
         ("tly", po::value<int>(), "The y-coordinate of the top-left corner of the cropped rectangular area when we do the match")
         ("brx", po::value<int>(), "The x-coordinate of the bottom-right corner of the cropped rectangular area when we do the match")
-        ("bry", po::value<int>(), "The y-coordinate of the bottom-right corner of the cropped rectangular area when we do the match");
+        ("bry", po::value<int>(), "The y-coordinate of the bottom-right corner of the cropped rectangular area when we do the match")
+        ("roi", po::value<vector<string>>()->composing(), "A rectangular region given as x,y,width,height. It can be given multiple times and a keypoint is kept if it is within any of the regions")
+        ("polygon", po::value<vector<string>>()->composing(), "A polygonal region given as x1,y1;x2,y2;x3,y3;... It can be given multiple times like --roi")
+        ("roi-mode", po::value<string>()->default_value("filter"), "filter: detect the keypoints in the full image and throw away those outside the regions afterwards | crop: detect the keypoints only in the bounding box of the regions")
+        ("roi-border", po::value<int>()->default_value(32), "The border in pixels around the bounding box of the regions in the crop mode, which keeps most of the keypoints near the edges of the regions as in the full image")
+        ("keypoint-budget", po::value<int>()->default_value(0), "For training, the maximum number of SURF keypoints per image, which are the strongest ones in each cell of a 4x4 grid. It is saved in the matcher file and applied to the image to match as well. 0 means no limit");
 
     po::positional_options_description posOpt;
     posOpt.add("command", 1);   // Only one command is accepted at one execution.
@@ -98,6 +106,66 @@ int main(int argc, char** argv)
     cout << "[INFO]: The top-left corner of the cropped rectangle = (" << rect.tl().x << ", " << rect.tl().y << ")." << endl;
     cout << "[INFO]: The bottom-right corner of the cropped rectangle = (" << rect.br().x << ", " << rect.br().y << ")." << endl;
 
+    // Collect all the regions in which the keypoints are kept.
+    vector<Rect2f> roiRects;
+    vector<vector<Point2f>> roiPolygons;
+    if (rect.area() > 0)
+    {
+        roiRects.push_back(rect);
+    }
+
+    if (vm.count("roi") > 0)
+    {
+        for (auto& roiStr: vm["roi"].as<vector<string>>())
+        {
+            Rect2f roiRect;
+            if (!Utility::ParseRect(roiStr, roiRect))
+            {
+                cerr << "[ERROR]: Invalid rectangular region " << roiStr << ", which should be given as x,y,width,height." << endl << endl;
+                return -1;
+            }
+
+            roiRects.push_back(roiRect);
+        }
+    }
+
+    if (vm.count("polygon") > 0)
+    {
+        for (auto& polygonStr: vm["polygon"].as<vector<string>>())
+        {
+            vector<Point2f> polygon;
+            if (!Utility::ParsePolygon(polygonStr, polygon))
+            {
+                cerr << "[ERROR]: Invalid polygonal region " << polygonStr << ", which should be given as x1,y1;x2,y2;x3,y3;..." << endl << endl;
+                return -1;
+            }
+
+            roiPolygons.push_back(polygon);
+        }
+    }
+
+    bool hasRoi = !roiRects.empty() || !roiPolygons.empty();
+    if (hasRoi)
+    {
+        cout << "[INFO]: Keep only the keypoints within " << roiRects.size() << " rectangles and "
+            << roiPolygons.size() << " polygons." << endl;
+    }
+
+    string roiMode = vm["roi-mode"].as<string>();
+    transform(roiMode.begin(), roiMode.end(), roiMode.begin(), ::tolower);
+    if (roiMode != "filter" && roiMode != "crop")
+    {
+        cerr << "[ERROR]: Unknown ROI mode " << roiMode << ", which should be filter or crop." << endl << endl;
+        return -1;
+    }
+
+    bool cropBeforeDetection = (roiMode == "crop");
+    int roiBorder = max(vm["roi-border"].as<int>(), 0);
+    if (hasRoi && cropBeforeDetection)
+    {
+        cout << "[INFO]: Detect the keypoints only in the bounding box of the regions with a border of " << roiBorder << " pixels." << endl;
+    }
+
     const int minHessian = 400;
     Ptr<SurfFeatureDetector> detector = SURF::create(minHessian);
 
@@ -126,41 +194,55 @@ int main(int argc, char** argv)
         matcherFile = vm["matcher-file"].as<string>();
         Utility::SeparateDirFromFilename(matcherFile, matcherFileDir, matcherFilename);
 
-        cout << "[INFO]: Loading the images in the given directory." << endl;
-        vector<string> imgFilenameList;
-        vector<Mat> imgs;
+        int readAhead = vm["read-ahead"].as<int>();
+        int decodeThreads = vm["decode-threads"].as<int>();
 
-        Utility::LoadAllImagesInDir(imgDir, imgFilenameList, imgs);
+        // Stream the images instead of loading all of them up front, so that decoding overlaps with the SURF
+        // extraction and the pixels of each image are released as soon as its descriptors are computed.
+        cout << "[INFO]: Streaming the images in the given directory." << endl;
+        ImageStream imgStream;
+        if (imgStream.Open(imgDir, readAhead, decodeThreads) != 0)
+        {
+            return -1;
+        }
 
         cout << "[INFO]: Detecting the SURF keypoints and computing the descriptors of the images." << endl;
 
+        int keypointBudget = max(vm["keypoint-budget"].as<int>(), 0);
+        if (keypointBudget > 0)
+        {
+            cout << "[INFO]: Keep at most " << keypointBudget << " keypoints per image." << endl;
+        }
+
+        vector<string> imgFilenameList;
         vector<Mat> allImgDescriptors;
         vector<KeyPoint> oneImgKeypoints;
         Mat oneImgDescriptors;
-        for (auto& oneImg: imgs)
+        auto tExtractStart = Clock::now();
+        for (auto& frame: imgStream)
         {
-            detector->detectAndCompute(oneImg, noArray(), oneImgKeypoints, oneImgDescriptors);
-            if (rect.area() > 0)
-            {
-                // Keep the keypoint and the corresponding descriptor if the keypoint
-                // is located within the rectangle, otherwise throw them away.
-                vector<KeyPoint> filteredOneImgKeypoints;
-                Mat filteredOneImgDescriptors;
-
-                Utility::FilterKeypointsAndDescriptors(
-                    rect,
-                    oneImgKeypoints,
-                    oneImgDescriptors,
-                    filteredOneImgKeypoints,
-                    filteredOneImgDescriptors);
-
-                allImgDescriptors.push_back(filteredOneImgDescriptors);
-            }
-            else
-            {
-                allImgDescriptors.push_back(oneImgDescriptors);
-            }
+            cout << "[INFO]: Loaded image " << frame.filename << "." << endl;
+            imgFilenameList.push_back(frame.filename);
+
+            Utility::DetectAndComputeInRegions(
+                detector,
+                frame.img,
+                roiRects,
+                roiPolygons,
+                cropBeforeDetection,
+                roiBorder,
+                oneImgKeypoints,
+                oneImgDescriptors);
+            Utility::RetainBestKeypointsInGrid(oneImgKeypoints, oneImgDescriptors, frame.img.size(), keypointBudget);
+
+            // Detach from oneImgDescriptors so that the next detection doesn't overwrite the descriptors.
+            allImgDescriptors.push_back(oneImgDescriptors.clone());
         }
+        auto tExtractEnd = Clock::now();
+        cout << "[DEBUG]: Decoded the images and computed the descriptors in " << chrono::duration_cast<chrono::milliseconds>(tExtractEnd - tExtractStart).count()
+            << " ms." << endl;
+
+        cout << "[INFO]: Loaded " << imgFilenameList.size() << " images in " << imgDir << "." << endl;
 
         cout << "[INFO]: Training the FLANN-based matcher with the SURF descriptors of the images." << endl;
 
@@ -175,6 +257,7 @@ int main(int argc, char** argv)
         cout << "[INFO]: Saving the trained FLANN-based matcher." << endl;
 
         flannMatcher->setTrainedImgFilenameList(imgFilenameList);
+        flannMatcher->setKeypointBudget(keypointBudget);
         flannMatcher->setFlannIndexFileDir(matcherFileDir);
         flannMatcher->setFlannIndexFilename(matcherFilename + "_klannindex");
 
@@ -210,24 +293,15 @@ int main(int argc, char** argv)
         cout << "[INFO]: Detecting the SURF keypoints and computing the descriptors of the image." << endl;
         vector<KeyPoint> imgKeypoints;
         Mat imgDescriptors;
-        detector->detectAndCompute(img, noArray(), imgKeypoints, imgDescriptors);
-
-        if (rect.area() > 0)
-        {
-            // Keep the keypoint and the corresponding descriptor if the keypoint
-            // is located within the rectangle, otherwise throw them away.
-            vector<KeyPoint> filteredImgKeypoints;
-            Mat filteredImgDescriptors;
-
-            Utility::FilterKeypointsAndDescriptors(
-                rect,
-                imgKeypoints,
-                imgDescriptors,
-                filteredImgKeypoints,
-                filteredImgDescriptors);
-
-            imgDescriptors = filteredImgDescriptors;
-        }
+        Utility::DetectAndComputeInRegions(
+            detector,
+            img,
+            roiRects,
+            roiPolygons,
+            cropBeforeDetection,
+            roiBorder,
+            imgKeypoints,
+            imgDescriptors);
 
         cout << "[INFO]: Loading the trained FLANN-based matcher." << endl;
 
@@ -247,6 +321,9 @@ int main(int argc, char** argv)
         cout << "[DEBUG]: Loaded the matcher in " << chrono::duration_cast<chrono::milliseconds>(tReadEnd - tReadStart).count()
             << " ms." << endl;
 
+        // Limit the keypoints of the image in the same way as the trained images.
+        Utility::RetainBestKeypointsInGrid(imgKeypoints, imgDescriptors, img.size(), flannMatcher->getKeypointBudget());
+
         vector<string> trainedImgFilenameList;
         trainedImgFilenameList = flannMatcher->getTrainedImgFilenameList();
 
@@ -20,22 +20,49 @@ class FlannBasedSavableMatcher : public FlannBasedMatcher
 {
 private:
     std::vector<std::pair<std::string, std::string> > trainedImgFilename2LabelList;
+    std::vector<std::vector<Point2f> > trainedKeypointPts;
     std::string flannIndexFileDir;
     std::string flannIndexFilename;
+    int keypointBudget;
 
 public:
     FlannBasedSavableMatcher();
+    FlannBasedSavableMatcher(
+        const Ptr<flann::IndexParams>& indexParams,
+        const Ptr<flann::SearchParams>& searchParams);
     virtual ~FlannBasedSavableMatcher();
 
     std::vector<std::pair<std::string, std::string> > getTrainedImgFilename2LabelList();
     void setTrainedImgFilename2LabelList(const std::vector<std::pair<std::string, std::string> >& imgFilename2LabelList);
+
+    // The coordinates of the keypoints of the trained descriptors, which are needed for the spatial verification.
+    // They are empty if the matcher file is saved without the keypoints.
+    std::vector<std::vector<Point2f> > getTrainedKeypointPts();
+    void setTrainedKeypoints(const std::vector<std::vector<KeyPoint> >& allImgKeypoints);
+
     void setFlannIndexFileDir(const std::string& dir);
     void setFlannIndexFilename(const std::string& filename);
 
+    // The maximum number of keypoints per image which the matcher is trained with, or 0 for no limit. It is saved
+    // in the matcher file so that the query images are limited in the same way.
+    int getKeypointBudget() const;
+    void setKeypointBudget(const int budget);
+
+    // Override the search parameters, e.g., the ones loaded from the matcher file, for trading
+    // the recall for the speed at the query time.
+    void setSearchParams(const Ptr<flann::SearchParams>& params);
+
+    // Get the checks and eps of the current search parameters, e.g., the ones loaded from the matcher file. Either
+    // is left unchanged if the search parameters don't have it.
+    void getSearchParams(int& checks, float& eps) const;
+
     virtual void read(const FileNode& fn);
     virtual void write(FileStorage& fs) const;
 
     static Ptr<FlannBasedSavableMatcher> create();
+    static Ptr<FlannBasedSavableMatcher> create(
+        const Ptr<flann::IndexParams>& indexParams,
+        const Ptr<flann::SearchParams>& searchParams);
 };
 
 }
@@ -0,0 +1,46 @@
+/*
+ * FlannParams.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_FLANNPARAMS_H_
+#define INCLUDES_FLANNPARAMS_H_
+
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/flann.hpp>
+
+// The configurable index and search parameters of the FLANN-based matcher.
+// Only the fields related to the selected algorithm are used.
+struct FlannParams
+{
+    std::string algorithm;      // kdtree | kmeans | autotuned | lsh | linear
+
+    int trees;                  // kdtree
+    int branching;              // kmeans
+    int iterations;             // kmeans
+    float targetRecall;         // autotuned
+    int lshTableNumber;         // lsh
+    int lshKeySize;             // lsh
+    int lshMultiProbeLevel;     // lsh
+
+    int checks;                 // The number of leaves to visit when searching the nearest neighbours.
+    float eps;                  // The approximation factor of the kdtree search.
+
+    FlannParams();
+
+    // Return an empty pointer if the algorithm is unknown.
+    cv::Ptr<cv::flann::IndexParams> CreateIndexParams() const;
+    cv::Ptr<cv::flann::SearchParams> CreateSearchParams() const;
+
+    // Check whether the algorithm can index the descriptors of the given type, e.g., LSH
+    // only works with binary descriptors while the others only work with float descriptors.
+    bool IsCompatibleWith(const int descriptorType) const;
+
+    std::string ToString() const;
+};
+
+#endif /* INCLUDES_FLANNPARAMS_H_ */
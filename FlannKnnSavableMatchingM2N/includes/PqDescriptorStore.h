@@ -0,0 +1,120 @@
+/*
+ * PqDescriptorStore.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_PQDESCRIPTORSTORE_H_
+#define INCLUDES_PQDESCRIPTORSTORE_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// A compressed store of the trained descriptors with product quantization (PQ). Each descriptor is split into
+// m_cntSubspaces sub-vectors and each sub-vector is replaced by the index of its nearest centroid in the codebook
+// of the subspace, so a 64-dimensional float SURF descriptor (256 bytes) takes only m_cntSubspaces bytes. With
+// optimized product quantization (OPQ), the descriptors are rotated before the quantization to reduce the error.
+//
+// The 2-NN search computes the asymmetric distances (ADC) between the raw query descriptors and the quantized
+// descriptors by table lookup. Optionally the shortlist of the search is re-ranked by the exact distances which are
+// computed from the raw descriptors file mapped into memory, i.e., only the pages touched by the shortlist are loaded.
+class PqDescriptorStore
+{
+private:
+    int m_cntSubspaces;
+    int m_cntCentroids;
+    int m_dim;
+    bool m_useOpq;
+
+    cv::Mat m_rotation;     // m_dim x m_dim, identity for PQ.
+    cv::Mat m_codebooks;    // (m_cntSubspaces*m_cntCentroids) x (m_dim/m_cntSubspaces), the codebook of subspace m is in rows [m*m_cntCentroids, (m + 1)*m_cntCentroids).
+    cv::Mat m_codes;        // N x m_cntSubspaces, CV_8U.
+
+    std::vector<int> m_imgDescriptorCnts;
+    std::vector<int> m_imgStartIdxs;
+    std::vector<std::pair<std::string, std::string> > m_trainedImgFilename2LabelList;
+    std::vector<std::vector<cv::Point2f> > m_trainedKeypointPts;
+    int m_keypointBudget;
+
+    std::string m_rawDescriptorsFileDir;
+    std::string m_rawDescriptorsFilename;
+
+    // The raw descriptors file mapped into memory.
+    int m_rawDescriptorsFd;
+    void* m_rawDescriptorsMapping;
+    size_t m_rawDescriptorsMappingSize;
+    const float* m_rawDescriptors;
+
+    void TrainCodebooks(
+        const cv::Mat& rotatedDescriptors,
+        const int maxIterations);
+
+    void Encode(
+        const cv::Mat& rotatedDescriptors,
+        cv::Mat& codes) const;
+
+    void Decode(
+        const cv::Mat& codes,
+        cv::Mat& rotatedDescriptors) const;
+
+    void UpdateImgStartIdxs();
+
+    void UnmapRawDescriptors();
+
+    // The store owns the mapping of the raw descriptors file, so it can't be copied.
+    PqDescriptorStore(const PqDescriptorStore&) = delete;
+    PqDescriptorStore& operator=(const PqDescriptorStore&) = delete;
+
+public:
+    PqDescriptorStore();
+    ~PqDescriptorStore();
+
+    // Return 0 on success, or -1 if the descriptors can't be split into the given number of subspaces.
+    int Train(
+        const std::vector<cv::Mat>& allImgDescriptors,
+        const int cntSubspaces,
+        const bool useOpq);
+
+    // Find the k nearest neighbours of each query descriptor, where imgIdx and trainIdx of each match are the index
+    // of the training image and the index of the descriptor within the training image, as done by the FLANN-based
+    // matcher. If rerankCnt > k and the raw descriptors are mapped, the rerankCnt nearest neighbours by ADC are
+    // re-ranked by the exact distances.
+    void KnnMatch(
+        const cv::Mat& queryDescriptors,
+        std::vector<std::vector<cv::DMatch> >& knnMatches,
+        const int k,
+        const int rerankCnt) const;
+
+    std::vector<std::pair<std::string, std::string> > GetTrainedImgFilename2LabelList() const;
+    void SetTrainedImgFilename2LabelList(const std::vector<std::pair<std::string, std::string> >& imgFilename2LabelList);
+    std::vector<int> GetImgDescriptorCnts() const;
+    std::vector<std::vector<cv::Point2f> > GetTrainedKeypointPts() const;
+    void SetTrainedKeypoints(const std::vector<std::vector<cv::KeyPoint> >& allImgKeypoints);
+
+    // The maximum number of keypoints per image which the store is trained with, or 0 for no limit.
+    int GetKeypointBudget() const;
+    void SetKeypointBudget(const int keypointBudget);
+    void SetRawDescriptorsFileDir(const std::string& dir);
+    void SetRawDescriptorsFilename(const std::string& filename);
+
+    // The raw descriptors file has a header of two int32 values (rows and cols) followed by the CV_32F descriptors
+    // of all the training images in the row-major order.
+    static int WriteRawDescriptors(
+        const std::string& rawDescriptorsFile,
+        const std::vector<cv::Mat>& allImgDescriptors);
+    int MapRawDescriptors();
+
+    size_t GetCompressedSize() const;
+    size_t GetRawSize() const;
+
+    void Read(const cv::FileNode& fn);
+    void Write(cv::FileStorage& fs) const;
+
+    // The store is saved as the top-level node "PqDescriptorStore" so it can be told apart from the FLANN-based matcher.
+    void Save(const std::string& storeFile) const;
+};
+
+#endif /* INCLUDES_PQDESCRIPTORSTORE_H_ */
@@ -17,7 +17,18 @@ using namespace std;
 typedef std::chrono::high_resolution_clock Clock;
 
 FlannBasedSavableMatcher::FlannBasedSavableMatcher() :
-    flannIndexFileDir("./")
+    flannIndexFileDir("./"),
+    keypointBudget(0)
+{
+
+}
+
+FlannBasedSavableMatcher::FlannBasedSavableMatcher(
+    const Ptr<flann::IndexParams>& indexParams,
+    const Ptr<flann::SearchParams>& searchParams) :
+    FlannBasedMatcher(indexParams, searchParams),
+    flannIndexFileDir("./"),
+    keypointBudget(0)
 {
 
 }
@@ -32,6 +43,13 @@ Ptr<FlannBasedSavableMatcher> FlannBasedSavableMatcher::create()
     return makePtr<FlannBasedSavableMatcher>();
 }
 
+Ptr<FlannBasedSavableMatcher> FlannBasedSavableMatcher::create(
+    const Ptr<flann::IndexParams>& indexParams,
+    const Ptr<flann::SearchParams>& searchParams)
+{
+    return makePtr<FlannBasedSavableMatcher>(indexParams, searchParams);
+}
+
 vector<pair<string, string> > FlannBasedSavableMatcher::getTrainedImgFilename2LabelList()
 {
     return trainedImgFilename2LabelList;
@@ -42,6 +60,22 @@ void FlannBasedSavableMatcher::setTrainedImgFilename2LabelList(const vector<pair
     trainedImgFilename2LabelList = imgFilename2LabelList;
 }
 
+vector<vector<Point2f> > FlannBasedSavableMatcher::getTrainedKeypointPts()
+{
+    return trainedKeypointPts;
+}
+
+void FlannBasedSavableMatcher::setTrainedKeypoints(const vector<vector<KeyPoint> >& allImgKeypoints)
+{
+    trainedKeypointPts.clear();
+    for (const auto& oneImgKeypoints : allImgKeypoints)
+    {
+        vector<Point2f> oneImgKeypointPts;
+        KeyPoint::convert(oneImgKeypoints, oneImgKeypointPts);
+        trainedKeypointPts.push_back(oneImgKeypointPts);
+    }
+}
+
 void FlannBasedSavableMatcher::setFlannIndexFileDir(const string& dir)
 {
     flannIndexFileDir = dir;
@@ -52,13 +86,67 @@ void FlannBasedSavableMatcher::setFlannIndexFilename(const string& filename)
     flannIndexFilename = filename;
 }
 
+void FlannBasedSavableMatcher::setSearchParams(const Ptr<flann::SearchParams>& params)
+{
+    searchParams = params;
+}
+
+void FlannBasedSavableMatcher::getSearchParams(int& checks, float& eps) const
+{
+    if (searchParams.empty())
+    {
+        return;
+    }
+
+    vector<String> paramNames;
+    vector<int> paramTypes;
+    vector<String> paramStrValues;
+    vector<double> paramNumValues;
+    searchParams->getAll(paramNames, paramTypes, paramStrValues, paramNumValues);
+    for (size_t paramIndex = 0; paramIndex < paramNames.size(); ++paramIndex)
+    {
+        if (paramNames[paramIndex] == "checks")
+        {
+            checks = static_cast<int>(paramNumValues[paramIndex]);
+        }
+        else if (paramNames[paramIndex] == "eps")
+        {
+            eps = static_cast<float>(paramNumValues[paramIndex]);
+        }
+    }
+}
+
+int FlannBasedSavableMatcher::getKeypointBudget() const
+{
+    return keypointBudget;
+}
+
+void FlannBasedSavableMatcher::setKeypointBudget(const int budget)
+{
+    keypointBudget = budget;
+}
+
 void FlannBasedSavableMatcher::read(const FileNode& fn)
 {
     auto tStart = Clock::now();
 
-    // Read indexParams and searchParams from fs.
+    // Read indexParams and searchParams from fs. Note that the index algorithm (e.g., kdtree or kmeans)
+    // and its parameters chosen at the training time are restored here, so the matching always uses
+    // the same parameters as the training unless the search parameters are overridden later.
     FlannBasedMatcher::read(fn);
 
+    vector<String> paramNames;
+    vector<int> paramTypes;
+    vector<String> paramStrValues;
+    vector<double> paramNumValues;
+    indexParams->getAll(paramNames, paramTypes, paramStrValues, paramNumValues);
+    for (size_t paramIndex = 0; paramIndex < paramNames.size(); ++paramIndex)
+    {
+        cout << "[DEBUG]: Loaded the FLANN index parameter " << paramNames[paramIndex] << " = "
+            << (paramTypes[paramIndex] == CV_USRTYPE1 ? string(paramStrValues[paramIndex]) : to_string(paramNumValues[paramIndex]))
+            << "." << endl;
+    }
+
     // Read the trained image filenames from fs.
     FileNode imgFilenameListNode = fn["imgFilename2LabelList"];
     if (imgFilenameListNode.type() != FileNode::SEQ)
@@ -90,6 +178,25 @@ void FlannBasedSavableMatcher::read(const FileNode& fn)
     cout << "[DEBUG]: Loaded the descriptors in " << chrono::duration_cast<chrono::milliseconds>(tDescriptorsEnd - tDescriptorsStart).count()
         << " ms." << endl;
 
+    // Read the keypoint coordinates of the trained descriptors from fs if they are saved.
+    trainedKeypointPts.clear();
+    if (!fn["keypoints_0"].empty())
+    {
+        for (size_t imgIndex = 0; imgIndex < trainedImgFilename2LabelList.size(); ++imgIndex)
+        {
+            string keypointsKey("keypoints_" + to_string(imgIndex));
+            Mat keypointPtsMat;
+            vector<Point2f> keypointPts;
+
+            fn[keypointsKey] >> keypointPtsMat;
+            if (!keypointPtsMat.empty())
+            {
+                keypointPtsMat.copyTo(keypointPts);
+            }
+            trainedKeypointPts.push_back(keypointPts);
+        }
+    }
+
     // Add the trained descriptors to the matcher and update all the related descriptors.
     FlannBasedMatcher::add(allTrainedDescriptors);
     if (!utrainDescCollection.empty())
@@ -102,6 +209,9 @@ void FlannBasedSavableMatcher::read(const FileNode& fn)
     }
     mergedDescriptors.set(trainDescCollection);
 
+    // The matcher files saved without a keypoint budget don't have the node, which is read as 0.
+    keypointBudget = (int)fn["keypointBudget"];
+
     // Read flannIndex from "flannIndexFileDir + flannIndexFilename".
     fn["flannIndexFilename"] >> flannIndexFilename;
 
@@ -133,12 +243,20 @@ void FlannBasedSavableMatcher::write(FileStorage& fs) const
     }
     fs << "]";  // End of trainedImgFilename2LabelList
 
+    fs << "keypointBudget" << keypointBudget;
+
     // Write the trained descriptors into fs.
     for (size_t imgIndex = 0; imgIndex < trainDescCollection.size(); ++imgIndex)
     {
         fs << string("descriptors_" + to_string(imgIndex)) << trainDescCollection[imgIndex];
     }
 
+    // Write the keypoint coordinates of the trained descriptors into fs, each as a N x 1 matrix of Point2f.
+    for (size_t imgIndex = 0; imgIndex < trainedKeypointPts.size(); ++imgIndex)
+    {
+        fs << string("keypoints_" + to_string(imgIndex)) << Mat(trainedKeypointPts[imgIndex]);
+    }
+
     if (!flannIndexFilename.empty())
     {
         // Write flannIndexFile into fs. Since we assume that flannIndexFile is always in the same
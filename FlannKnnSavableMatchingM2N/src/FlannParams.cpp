@@ -0,0 +1,99 @@
+/*
+ * FlannParams.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <iostream>
+#include <sstream>
+
+#include "FlannParams.h"
+
+using namespace std;
+using namespace cv;
+
+// The default values are the same as those used by FlannBasedMatcher, i.e., a KD-tree with 4 trees and 32 checks.
+FlannParams::FlannParams() :
+    algorithm("kdtree"),
+    trees(4),
+    branching(32),
+    iterations(11),
+    targetRecall(0.9),
+    lshTableNumber(6),
+    lshKeySize(12),
+    lshMultiProbeLevel(1),
+    checks(32),
+    eps(0.0)
+{
+}
+
+Ptr<flann::IndexParams> FlannParams::CreateIndexParams() const
+{
+    if (algorithm == "kdtree")
+    {
+        return makePtr<flann::KDTreeIndexParams>(trees);
+    }
+    else if (algorithm == "kmeans")
+    {
+        return makePtr<flann::KMeansIndexParams>(branching, iterations);
+    }
+    else if (algorithm == "autotuned")
+    {
+        return makePtr<flann::AutotunedIndexParams>(targetRecall);
+    }
+    else if (algorithm == "lsh")
+    {
+        return makePtr<flann::LshIndexParams>(lshTableNumber, lshKeySize, lshMultiProbeLevel);
+    }
+    else if (algorithm == "linear")
+    {
+        return makePtr<flann::LinearIndexParams>();
+    }
+
+    cerr << "[ERROR]: Unknown FLANN index algorithm " << algorithm << "." << endl << endl;
+    return Ptr<flann::IndexParams>();
+}
+
+Ptr<flann::SearchParams> FlannParams::CreateSearchParams() const
+{
+    return makePtr<flann::SearchParams>(checks, eps);
+}
+
+bool FlannParams::IsCompatibleWith(const int descriptorType) const
+{
+    if (algorithm == "lsh")
+    {
+        return (descriptorType == CV_8U);
+    }
+
+    return (descriptorType == CV_32F);
+}
+
+string FlannParams::ToString() const
+{
+    ostringstream oss;
+
+    oss << algorithm;
+    if (algorithm == "kdtree")
+    {
+        oss << "(trees = " << trees << ")";
+    }
+    else if (algorithm == "kmeans")
+    {
+        oss << "(branching = " << branching << ", iterations = " << iterations << ")";
+    }
+    else if (algorithm == "autotuned")
+    {
+        oss << "(target recall = " << targetRecall << ")";
+    }
+    else if (algorithm == "lsh")
+    {
+        oss << "(tables = " << lshTableNumber << ", key size = " << lshKeySize
+            << ", multi-probe level = " << lshMultiProbeLevel << ")";
+    }
+
+    oss << " with checks = " << checks << " and eps = " << eps;
+
+    return oss.str();
+}
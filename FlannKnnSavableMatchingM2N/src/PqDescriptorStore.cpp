@@ -0,0 +1,671 @@
+/*
+ * PqDescriptorStore.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <opencv2/features2d.hpp>
+
+#include "PqDescriptorStore.h"
+
+using namespace std;
+using namespace cv;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+namespace
+{
+
+// The number of centroids of each subspace, so that each sub-vector is encoded in one byte.
+const int maxCntCentroids = 256;
+
+// The codebooks and the rotation are learned from a random subset of the descriptors to bound the training time.
+const int maxCntTrainingDescriptors = 65536;
+
+// The number of the alternating iterations of OPQ between the codebooks and the rotation.
+const int cntOpqIterations = 8;
+
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+}
+
+PqDescriptorStore::PqDescriptorStore() :
+    m_cntSubspaces(0),
+    m_cntCentroids(0),
+    m_dim(0),
+    m_useOpq(false),
+    m_keypointBudget(0),
+    m_rawDescriptorsFileDir("./"),
+    m_rawDescriptorsFd(-1),
+    m_rawDescriptorsMapping(nullptr),
+    m_rawDescriptorsMappingSize(0),
+    m_rawDescriptors(nullptr)
+{
+}
+
+PqDescriptorStore::~PqDescriptorStore()
+{
+    UnmapRawDescriptors();
+}
+
+int PqDescriptorStore::Train(
+    const vector<Mat>& allImgDescriptors,
+    const int cntSubspaces,
+    const bool useOpq)
+{
+    m_imgDescriptorCnts.clear();
+    vector<Mat> nonEmptyDescriptors;
+    for (const auto& oneImgDescriptors : allImgDescriptors)
+    {
+        m_imgDescriptorCnts.push_back(oneImgDescriptors.rows);
+        if (!oneImgDescriptors.empty())
+        {
+            nonEmptyDescriptors.push_back(oneImgDescriptors);
+        }
+    }
+
+    if (nonEmptyDescriptors.empty())
+    {
+        cerr << "[ERROR]: No descriptor is given for training the product quantization." << endl << endl;
+        return -1;
+    }
+
+    Mat descriptors;
+    vconcat(nonEmptyDescriptors, descriptors);
+
+    if (descriptors.type() != CV_32F)
+    {
+        cerr << "[ERROR]: The product quantization only supports the CV_32F descriptors." << endl << endl;
+        return -1;
+    }
+
+    if ((cntSubspaces <= 0) || (descriptors.cols % cntSubspaces != 0))
+    {
+        cerr << "[ERROR]: The " << descriptors.cols << "-dimensional descriptors can't be split into "
+            << cntSubspaces << " subspaces." << endl << endl;
+        return -1;
+    }
+
+    m_cntSubspaces = cntSubspaces;
+    m_cntCentroids = min(maxCntCentroids, descriptors.rows);
+    m_dim = descriptors.cols;
+    m_useOpq = useOpq;
+
+    // Learn the codebooks and the rotation from a random subset of the descriptors.
+    Mat trainingDescriptors;
+    if (descriptors.rows > maxCntTrainingDescriptors)
+    {
+        vector<int> descIndices(descriptors.rows);
+        iota(descIndices.begin(), descIndices.end(), 0);
+        shuffle(descIndices.begin(), descIndices.end(), mt19937(0));
+
+        trainingDescriptors.create(maxCntTrainingDescriptors, m_dim, CV_32F);
+        for (int rowIndex = 0; rowIndex < maxCntTrainingDescriptors; ++rowIndex)
+        {
+            descriptors.row(descIndices[rowIndex]).copyTo(trainingDescriptors.row(rowIndex));
+        }
+    }
+    else
+    {
+        trainingDescriptors = descriptors;
+    }
+
+    auto tTrainStart = Clock::now();
+
+    m_rotation = Mat::eye(m_dim, m_dim, CV_32F);
+    if (m_useOpq)
+    {
+        // Alternate between training the codebooks of the rotated descriptors and solving the rotation which maps
+        // the descriptors closest to their reconstructions, i.e., the orthogonal Procrustes problem
+        // min ||X*R - Y|| whose solution is R = U*Vt with X^T*Y = U*S*Vt.
+        for (int iteration = 0; iteration < cntOpqIterations; ++iteration)
+        {
+            Mat rotatedDescriptors = trainingDescriptors*m_rotation;
+            TrainCodebooks(rotatedDescriptors, 5);
+
+            Mat codes;
+            Mat reconstructedDescriptors;
+            Encode(rotatedDescriptors, codes);
+            Decode(codes, reconstructedDescriptors);
+
+            double distortion = norm(rotatedDescriptors, reconstructedDescriptors, NORM_L2SQR)/rotatedDescriptors.rows;
+            cout << "[DEBUG]: OPQ iteration " << iteration << ": quantization distortion = " << distortion << "." << endl;
+
+            Mat w;
+            Mat u;
+            Mat vt;
+            SVD::compute(trainingDescriptors.t()*reconstructedDescriptors, w, u, vt);
+            m_rotation = u*vt;
+        }
+    }
+
+    Mat rotatedTrainingDescriptors = trainingDescriptors*m_rotation;
+    TrainCodebooks(rotatedTrainingDescriptors, 20);
+
+    Mat rotatedDescriptors = descriptors*m_rotation;
+    Encode(rotatedDescriptors, m_codes);
+
+    auto tTrainEnd = Clock::now();
+
+    Mat reconstructedDescriptors;
+    Decode(m_codes, reconstructedDescriptors);
+    double distortion = norm(rotatedDescriptors, reconstructedDescriptors, NORM_L2SQR)/rotatedDescriptors.rows;
+
+    UpdateImgStartIdxs();
+
+    cout << "[INFO]: Trained the " << (m_useOpq ? "OPQ" : "PQ") << " codebooks of " << m_cntSubspaces << " subspaces x "
+        << m_cntCentroids << " centroids in " << chrono::duration_cast<chrono::milliseconds>(tTrainEnd - tTrainStart).count()
+        << " ms with the quantization distortion " << distortion << "." << endl;
+    cout << "[INFO]: Compressed " << m_codes.rows << " descriptors from " << GetRawSize() << " bytes to "
+        << GetCompressedSize() << " bytes." << endl;
+
+    return 0;
+}
+
+void PqDescriptorStore::TrainCodebooks(
+    const Mat& rotatedDescriptors,
+    const int maxIterations)
+{
+    const int subDim = m_dim/m_cntSubspaces;
+
+    m_codebooks.create(m_cntSubspaces*m_cntCentroids, subDim, CV_32F);
+    for (int subspaceIndex = 0; subspaceIndex < m_cntSubspaces; ++subspaceIndex)
+    {
+        Mat subDescriptors = rotatedDescriptors.colRange(subspaceIndex*subDim, (subspaceIndex + 1)*subDim).clone();
+
+        Mat labels;
+        Mat centroids;
+        kmeans(subDescriptors, m_cntCentroids, labels, TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, maxIterations, 1e-4),
+            1, KMEANS_PP_CENTERS, centroids);
+
+        centroids.copyTo(m_codebooks.rowRange(subspaceIndex*m_cntCentroids, (subspaceIndex + 1)*m_cntCentroids));
+    }
+}
+
+void PqDescriptorStore::Encode(
+    const Mat& rotatedDescriptors,
+    Mat& codes) const
+{
+    const int subDim = m_dim/m_cntSubspaces;
+
+    codes.create(rotatedDescriptors.rows, m_cntSubspaces, CV_8U);
+
+    BFMatcher centroidMatcher(NORM_L2);
+    for (int subspaceIndex = 0; subspaceIndex < m_cntSubspaces; ++subspaceIndex)
+    {
+        Mat subDescriptors = rotatedDescriptors.colRange(subspaceIndex*subDim, (subspaceIndex + 1)*subDim).clone();
+        Mat codebook = m_codebooks.rowRange(subspaceIndex*m_cntCentroids, (subspaceIndex + 1)*m_cntCentroids);
+
+        vector<DMatch> nearestCentroids;
+        centroidMatcher.match(subDescriptors, codebook, nearestCentroids);
+
+        for (const auto& nearestCentroid : nearestCentroids)
+        {
+            codes.at<uchar>(nearestCentroid.queryIdx, subspaceIndex) = static_cast<uchar>(nearestCentroid.trainIdx);
+        }
+    }
+}
+
+void PqDescriptorStore::Decode(
+    const Mat& codes,
+    Mat& rotatedDescriptors) const
+{
+    const int subDim = m_dim/m_cntSubspaces;
+
+    rotatedDescriptors.create(codes.rows, m_dim, CV_32F);
+    for (int rowIndex = 0; rowIndex < codes.rows; ++rowIndex)
+    {
+        for (int subspaceIndex = 0; subspaceIndex < m_cntSubspaces; ++subspaceIndex)
+        {
+            int centroidIndex = subspaceIndex*m_cntCentroids + codes.at<uchar>(rowIndex, subspaceIndex);
+            m_codebooks.row(centroidIndex).copyTo(
+                rotatedDescriptors.row(rowIndex).colRange(subspaceIndex*subDim, (subspaceIndex + 1)*subDim));
+        }
+    }
+}
+
+void PqDescriptorStore::UpdateImgStartIdxs()
+{
+    m_imgStartIdxs.resize(m_imgDescriptorCnts.size());
+    int startIdx = 0;
+    for (size_t imgIndex = 0; imgIndex < m_imgDescriptorCnts.size(); ++imgIndex)
+    {
+        m_imgStartIdxs[imgIndex] = startIdx;
+        startIdx += m_imgDescriptorCnts[imgIndex];
+    }
+}
+
+void PqDescriptorStore::KnnMatch(
+    const Mat& queryDescriptors,
+    vector<vector<DMatch> >& knnMatches,
+    const int k,
+    const int rerankCnt) const
+{
+    knnMatches.clear();
+    knnMatches.resize(queryDescriptors.rows);
+
+    if (queryDescriptors.empty() || m_codes.empty())
+    {
+        return;
+    }
+
+    CV_Assert((queryDescriptors.type() == CV_32F) && (queryDescriptors.cols == m_dim));
+
+    const int subDim = m_dim/m_cntSubspaces;
+    const bool isReranked = (m_rawDescriptors != nullptr) && (rerankCnt > k);
+    const size_t shortlistSize = isReranked ? rerankCnt : k;
+
+    Mat rotatedQueryDescriptors = queryDescriptors*m_rotation;
+
+    parallel_for_(Range(0, queryDescriptors.rows), ParallelLoopBodyWrapper([&](const Range& range)
+    {
+        vector<float> distanceTable(m_cntSubspaces*m_cntCentroids);
+        vector<pair<float, int> > shortlist;
+
+        for (int queryIdx = range.start; queryIdx < range.end; ++queryIdx)
+        {
+            // Build the lookup table of the squared distances between each sub-vector of the query descriptor and
+            // the centroids of its subspace.
+            const float* rotatedQuery = rotatedQueryDescriptors.ptr<float>(queryIdx);
+            for (int subspaceIndex = 0; subspaceIndex < m_cntSubspaces; ++subspaceIndex)
+            {
+                const float* subQuery = rotatedQuery + subspaceIndex*subDim;
+                for (int centroidIndex = 0; centroidIndex < m_cntCentroids; ++centroidIndex)
+                {
+                    const float* centroid = m_codebooks.ptr<float>(subspaceIndex*m_cntCentroids + centroidIndex);
+                    float distance = 0.0;
+                    for (int dimIndex = 0; dimIndex < subDim; ++dimIndex)
+                    {
+                        float diff = subQuery[dimIndex] - centroid[dimIndex];
+                        distance += diff*diff;
+                    }
+
+                    distanceTable[subspaceIndex*m_cntCentroids + centroidIndex] = distance;
+                }
+            }
+
+            // Scan the codes and keep the shortlist of the nearest descriptors in a max-heap.
+            priority_queue<pair<float, int> > nearestDescriptors;
+            for (int descIndex = 0; descIndex < m_codes.rows; ++descIndex)
+            {
+                const uchar* code = m_codes.ptr<uchar>(descIndex);
+                float distance = 0.0;
+                for (int subspaceIndex = 0; subspaceIndex < m_cntSubspaces; ++subspaceIndex)
+                {
+                    distance += distanceTable[subspaceIndex*m_cntCentroids + code[subspaceIndex]];
+                }
+
+                if (nearestDescriptors.size() < shortlistSize)
+                {
+                    nearestDescriptors.push(make_pair(distance, descIndex));
+                }
+                else if (distance < nearestDescriptors.top().first)
+                {
+                    nearestDescriptors.pop();
+                    nearestDescriptors.push(make_pair(distance, descIndex));
+                }
+            }
+
+            shortlist.clear();
+            while (!nearestDescriptors.empty())
+            {
+                shortlist.push_back(nearestDescriptors.top());
+                nearestDescriptors.pop();
+            }
+
+            if (isReranked)
+            {
+                // Replace the ADC distances with the exact squared distances to the raw descriptors.
+                const float* query = queryDescriptors.ptr<float>(queryIdx);
+                for (auto& candidate : shortlist)
+                {
+                    const float* rawDescriptor = m_rawDescriptors + static_cast<size_t>(candidate.second)*m_dim;
+                    float distance = 0.0;
+                    for (int dimIndex = 0; dimIndex < m_dim; ++dimIndex)
+                    {
+                        float diff = query[dimIndex] - rawDescriptor[dimIndex];
+                        distance += diff*diff;
+                    }
+
+                    candidate.first = distance;
+                }
+            }
+
+            sort(shortlist.begin(), shortlist.end());
+
+            // Convert the index of the merged descriptors to the image index and the descriptor index within the
+            // image, and the squared distance to the L2 distance as returned by the FLANN-based matcher.
+            vector<DMatch>& matches = knnMatches[queryIdx];
+            for (int neighbourIndex = 0; neighbourIndex < min(k, static_cast<int>(shortlist.size())); ++neighbourIndex)
+            {
+                int descIndex = shortlist[neighbourIndex].second;
+                int imgIndex = static_cast<int>(upper_bound(m_imgStartIdxs.begin(), m_imgStartIdxs.end(), descIndex) - m_imgStartIdxs.begin()) - 1;
+                matches.push_back(DMatch(queryIdx, descIndex - m_imgStartIdxs[imgIndex], imgIndex, sqrt(shortlist[neighbourIndex].first)));
+            }
+        }
+    }));
+}
+
+vector<pair<string, string> > PqDescriptorStore::GetTrainedImgFilename2LabelList() const
+{
+    return m_trainedImgFilename2LabelList;
+}
+
+void PqDescriptorStore::SetTrainedImgFilename2LabelList(const vector<pair<string, string> >& imgFilename2LabelList)
+{
+    m_trainedImgFilename2LabelList = imgFilename2LabelList;
+}
+
+vector<int> PqDescriptorStore::GetImgDescriptorCnts() const
+{
+    return m_imgDescriptorCnts;
+}
+
+vector<vector<Point2f> > PqDescriptorStore::GetTrainedKeypointPts() const
+{
+    return m_trainedKeypointPts;
+}
+
+void PqDescriptorStore::SetTrainedKeypoints(const vector<vector<KeyPoint> >& allImgKeypoints)
+{
+    m_trainedKeypointPts.clear();
+    for (const auto& oneImgKeypoints : allImgKeypoints)
+    {
+        vector<Point2f> oneImgKeypointPts;
+        KeyPoint::convert(oneImgKeypoints, oneImgKeypointPts);
+        m_trainedKeypointPts.push_back(oneImgKeypointPts);
+    }
+}
+
+int PqDescriptorStore::GetKeypointBudget() const
+{
+    return m_keypointBudget;
+}
+
+void PqDescriptorStore::SetKeypointBudget(const int keypointBudget)
+{
+    m_keypointBudget = keypointBudget;
+}
+
+void PqDescriptorStore::SetRawDescriptorsFileDir(const string& dir)
+{
+    m_rawDescriptorsFileDir = dir;
+}
+
+void PqDescriptorStore::SetRawDescriptorsFilename(const string& filename)
+{
+    m_rawDescriptorsFilename = filename;
+}
+
+int PqDescriptorStore::WriteRawDescriptors(
+    const string& rawDescriptorsFile,
+    const vector<Mat>& allImgDescriptors)
+{
+    int32_t rows = 0;
+    int32_t cols = 0;
+    for (const auto& oneImgDescriptors : allImgDescriptors)
+    {
+        if (!oneImgDescriptors.empty())
+        {
+            rows += oneImgDescriptors.rows;
+            cols = oneImgDescriptors.cols;
+        }
+    }
+
+    ofstream ofs(rawDescriptorsFile, ios::out | ios::binary);
+    if (!ofs.is_open())
+    {
+        cerr << "[ERROR]: Can't open the raw descriptors file " << rawDescriptorsFile << "." << endl << endl;
+        return -1;
+    }
+
+    ofs.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+    ofs.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+    for (const auto& oneImgDescriptors : allImgDescriptors)
+    {
+        for (int rowIndex = 0; rowIndex < oneImgDescriptors.rows; ++rowIndex)
+        {
+            ofs.write(reinterpret_cast<const char*>(oneImgDescriptors.ptr<float>(rowIndex)), cols*sizeof(float));
+        }
+    }
+
+    if (!ofs.good())
+    {
+        cerr << "[ERROR]: Failed to write the raw descriptors file " << rawDescriptorsFile << "." << endl << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int PqDescriptorStore::MapRawDescriptors()
+{
+    UnmapRawDescriptors();
+
+    if (m_rawDescriptorsFilename.empty())
+    {
+        cerr << "[ERROR]: rawDescriptorsFilename is empty so the raw descriptors can't be mapped." << endl << endl;
+        return -1;
+    }
+
+    string rawDescriptorsFile = m_rawDescriptorsFileDir + m_rawDescriptorsFilename;
+
+    m_rawDescriptorsFd = open(rawDescriptorsFile.c_str(), O_RDONLY);
+    if (m_rawDescriptorsFd < 0)
+    {
+        cerr << "[ERROR]: open failed to open " << rawDescriptorsFile << " with error " << strerror(errno) << "." << endl << endl;
+        return errno;
+    }
+
+    struct stat fileStat;
+    if (fstat(m_rawDescriptorsFd, &fileStat) != 0)
+    {
+        const int error = errno;
+        cerr << "[ERROR]: fstat failed to stat " << rawDescriptorsFile << " with error " << strerror(error) << "." << endl << endl;
+        UnmapRawDescriptors();
+        return error;
+    }
+
+    const size_t headerSize = 2*sizeof(int32_t);
+    const size_t expectedSize = headerSize + static_cast<size_t>(m_codes.rows)*m_dim*sizeof(float);
+    if (static_cast<size_t>(fileStat.st_size) != expectedSize)
+    {
+        cerr << "[ERROR]: The size of the raw descriptors file " << rawDescriptorsFile << " is " << fileStat.st_size
+            << " bytes but " << expectedSize << " bytes are expected." << endl << endl;
+        UnmapRawDescriptors();
+        return -1;
+    }
+
+    m_rawDescriptorsMapping = mmap(nullptr, expectedSize, PROT_READ, MAP_SHARED, m_rawDescriptorsFd, 0);
+    if (m_rawDescriptorsMapping == MAP_FAILED)
+    {
+        cerr << "[ERROR]: mmap failed to map " << rawDescriptorsFile << " with error " << strerror(errno) << "." << endl << endl;
+        m_rawDescriptorsMapping = nullptr;
+        UnmapRawDescriptors();
+        return -1;
+    }
+    m_rawDescriptorsMappingSize = expectedSize;
+
+    const int32_t* header = static_cast<const int32_t*>(m_rawDescriptorsMapping);
+    if ((header[0] != m_codes.rows) || (header[1] != m_dim))
+    {
+        cerr << "[ERROR]: The raw descriptors file " << rawDescriptorsFile << " has " << header[0] << " x " << header[1]
+            << " descriptors which don't match the " << m_codes.rows << " x " << m_dim << " quantized descriptors." << endl << endl;
+        UnmapRawDescriptors();
+        return -1;
+    }
+
+    // The re-ranking only touches the few descriptors in each shortlist, so there is no point to read ahead.
+    madvise(m_rawDescriptorsMapping, m_rawDescriptorsMappingSize, MADV_RANDOM);
+
+    m_rawDescriptors = reinterpret_cast<const float*>(static_cast<const char*>(m_rawDescriptorsMapping) + headerSize);
+
+    return 0;
+}
+
+void PqDescriptorStore::UnmapRawDescriptors()
+{
+    if (m_rawDescriptorsMapping != nullptr)
+    {
+        munmap(m_rawDescriptorsMapping, m_rawDescriptorsMappingSize);
+        m_rawDescriptorsMapping = nullptr;
+        m_rawDescriptorsMappingSize = 0;
+    }
+
+    if (m_rawDescriptorsFd >= 0)
+    {
+        close(m_rawDescriptorsFd);
+        m_rawDescriptorsFd = -1;
+    }
+
+    m_rawDescriptors = nullptr;
+}
+
+size_t PqDescriptorStore::GetCompressedSize() const
+{
+    return m_codes.total()*m_codes.elemSize() + m_codebooks.total()*m_codebooks.elemSize()
+        + m_rotation.total()*m_rotation.elemSize();
+}
+
+size_t PqDescriptorStore::GetRawSize() const
+{
+    return static_cast<size_t>(m_codes.rows)*m_dim*sizeof(float);
+}
+
+void PqDescriptorStore::Read(const FileNode& fn)
+{
+    UnmapRawDescriptors();
+
+    int useOpq = 0;
+    fn["cntSubspaces"] >> m_cntSubspaces;
+    fn["cntCentroids"] >> m_cntCentroids;
+    fn["dim"] >> m_dim;
+    fn["useOpq"] >> useOpq;
+    m_useOpq = (useOpq != 0);
+
+    fn["rotation"] >> m_rotation;
+    fn["codebooks"] >> m_codebooks;
+    fn["codes"] >> m_codes;
+    fn["imgDescriptorCnts"] >> m_imgDescriptorCnts;
+
+    // The stores saved without a keypoint budget don't have the node, which is read as 0.
+    m_keypointBudget = (int)fn["keypointBudget"];
+
+    // Read the trained image filenames from fs.
+    FileNode imgFilenameListNode = fn["imgFilename2LabelList"];
+    if (imgFilenameListNode.type() != FileNode::SEQ)
+    {
+        cerr << "[ERROR]: the list of trained image filenames is not a sequence." << endl << endl;
+        return;
+    }
+
+    m_trainedImgFilename2LabelList.clear();
+    for (FileNodeIterator itNode = imgFilenameListNode.begin(); itNode != imgFilenameListNode.end(); ++itNode)
+    {
+        string imgFilename = string(*itNode++);
+        string imgLabel = string(*itNode);
+        m_trainedImgFilename2LabelList.push_back(make_pair(imgFilename, imgLabel));
+    }
+
+    // Read the keypoint coordinates of the trained descriptors from fs if they are saved.
+    m_trainedKeypointPts.clear();
+    if (!fn["keypoints_0"].empty())
+    {
+        for (size_t imgIndex = 0; imgIndex < m_trainedImgFilename2LabelList.size(); ++imgIndex)
+        {
+            Mat keypointPtsMat;
+            vector<Point2f> keypointPts;
+
+            fn["keypoints_" + to_string(imgIndex)] >> keypointPtsMat;
+            if (!keypointPtsMat.empty())
+            {
+                keypointPtsMat.copyTo(keypointPts);
+            }
+            m_trainedKeypointPts.push_back(keypointPts);
+        }
+    }
+
+    fn["rawDescriptorsFilename"] >> m_rawDescriptorsFilename;
+
+    UpdateImgStartIdxs();
+
+    cout << "[DEBUG]: Loaded " << m_codes.rows << " " << (m_useOpq ? "OPQ" : "PQ") << " codes of " << m_cntSubspaces
+        << " subspaces in " << GetCompressedSize() << " bytes instead of " << GetRawSize() << " bytes." << endl;
+}
+
+void PqDescriptorStore::Write(FileStorage& fs) const
+{
+    fs << "cntSubspaces" << m_cntSubspaces;
+    fs << "cntCentroids" << m_cntCentroids;
+    fs << "dim" << m_dim;
+    fs << "useOpq" << (m_useOpq ? 1 : 0);
+    fs << "rotation" << m_rotation;
+    fs << "codebooks" << m_codebooks;
+    fs << "codes" << m_codes;
+    fs << "imgDescriptorCnts" << m_imgDescriptorCnts;
+    fs << "keypointBudget" << m_keypointBudget;
+
+    // Write the trained image filenames with their labels into fs.
+    fs << "imgFilename2LabelList" << "[";
+    for (const auto& img2Label : m_trainedImgFilename2LabelList)
+    {
+        fs << img2Label.first << img2Label.second;
+    }
+    fs << "]";  // End of imgFilename2LabelList
+
+    // Write the keypoint coordinates of the trained descriptors into fs, each as a N x 1 matrix of Point2f.
+    for (size_t imgIndex = 0; imgIndex < m_trainedKeypointPts.size(); ++imgIndex)
+    {
+        fs << "keypoints_" + to_string(imgIndex) << Mat(m_trainedKeypointPts[imgIndex]);
+    }
+
+    // Since we assume that the raw descriptors file is always in the same directory as fs,
+    // we don't write rawDescriptorsFileDir into fs.
+    if (!m_rawDescriptorsFilename.empty())
+    {
+        fs << "rawDescriptorsFilename" << m_rawDescriptorsFilename;
+    }
+}
+
+void PqDescriptorStore::Save(const string& storeFile) const
+{
+    FileStorage fs(storeFile, FileStorage::WRITE);
+    fs << "PqDescriptorStore" << "{";
+    Write(fs);
+    fs << "}";
+    fs.release();
+}
@@ -5,6 +5,8 @@
  *      Author: renwei
  */
 
+#include <algorithm>
+
 #include "Utility.h"
 
 using namespace std;
@@ -256,3 +258,73 @@ string Utility::CvType2Str(const int type)
 
     return typeStr;
 }
+
+void Utility::RetainBestKeypointsInGrid(
+    vector<KeyPoint>& keypoints,
+    Mat& descriptors,
+    const Size& imgSize,
+    const int keypointBudget,
+    const int gridSize)
+{
+    if ((keypointBudget <= 0) || (static_cast<int>(keypoints.size()) <= keypointBudget))
+    {
+        return;
+    }
+
+    // Bucket the keypoints by a gridSize x gridSize grid over the image.
+    int cntCells = gridSize*gridSize;
+    vector<vector<int> > cellKeypointIdxs(cntCells);
+    for (int keypointIdx = 0; keypointIdx < static_cast<int>(keypoints.size()); ++keypointIdx)
+    {
+        const Point2f& pt = keypoints[keypointIdx].pt;
+        int col = min(max(static_cast<int>(pt.x*gridSize/max(imgSize.width, 1)), 0), gridSize - 1);
+        int row = min(max(static_cast<int>(pt.y*gridSize/max(imgSize.height, 1)), 0), gridSize - 1);
+        cellKeypointIdxs[row*gridSize + col].push_back(keypointIdx);
+    }
+
+    auto byResponse = [&keypoints](const int lhs, const int rhs)
+        {
+            return keypoints[lhs].response > keypoints[rhs].response;
+        };
+
+    // Take the strongest keypoints of each cell up to an equal share of the budget, so that all the parts of the
+    // image are covered. The share left by the sparse cells goes to the strongest of the remaining keypoints.
+    int cellQuota = keypointBudget/cntCells;
+    vector<int> keptIdxs;
+    vector<int> remainingIdxs;
+    for (auto& oneCellIdxs : cellKeypointIdxs)
+    {
+        stable_sort(oneCellIdxs.begin(), oneCellIdxs.end(), byResponse);
+
+        int cntKept = min(cellQuota, static_cast<int>(oneCellIdxs.size()));
+        keptIdxs.insert(keptIdxs.end(), oneCellIdxs.begin(), oneCellIdxs.begin() + cntKept);
+        remainingIdxs.insert(remainingIdxs.end(), oneCellIdxs.begin() + cntKept, oneCellIdxs.end());
+    }
+
+    stable_sort(remainingIdxs.begin(), remainingIdxs.end(), byResponse);
+    int cntLeft = min(keypointBudget - static_cast<int>(keptIdxs.size()), static_cast<int>(remainingIdxs.size()));
+    keptIdxs.insert(keptIdxs.end(), remainingIdxs.begin(), remainingIdxs.begin() + cntLeft);
+
+    // Sort the kept keypoints by the response, so a truncated prefix of the descriptors is still the strongest.
+    stable_sort(keptIdxs.begin(), keptIdxs.end(), byResponse);
+
+    vector<KeyPoint> keptKeypoints;
+    keptKeypoints.reserve(keptIdxs.size());
+    Mat keptDescriptors;
+    if (!descriptors.empty())
+    {
+        keptDescriptors.create(static_cast<int>(keptIdxs.size()), descriptors.cols, descriptors.type());
+    }
+
+    for (int keptIndex = 0; keptIndex < static_cast<int>(keptIdxs.size()); ++keptIndex)
+    {
+        keptKeypoints.push_back(keypoints[keptIdxs[keptIndex]]);
+        if (!descriptors.empty())
+        {
+            descriptors.row(keptIdxs[keptIndex]).copyTo(keptDescriptors.row(keptIndex));
+        }
+    }
+
+    keypoints.swap(keptKeypoints);
+    descriptors = keptDescriptors;
+}
@@ -10,14 +10,23 @@
 #include <map>
 #include <chrono>
 #include <numeric>
+#include <cfloat>
+#include <functional>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
 
 #include <boost/program_options.hpp>
 
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
 #include <opencv2/xfeatures2d.hpp>
 
 #include "Utility.h"
+#include "FlannParams.h"
 #include "FlannBasedSavableMatcher.h"
+#include "PqDescriptorStore.h"
 
 using namespace std;
 using namespace cv;
@@ -26,6 +35,10 @@ namespace po = boost::program_options;
 
 typedef std::chrono::high_resolution_clock Clock;
 
+// Find the 2 nearest neighbours of each query descriptor among the trained descriptors, where imgIdx of each match
+// is the index of the training image, e.g., with the FLANN-based matcher or the product-quantized descriptor store.
+typedef std::function<void(const Mat&, vector<vector<DMatch>>&)> KnnMatchFunction;
+
 struct FnnMatchResult
 {
     string expectedLabel;
@@ -33,8 +46,19 @@ struct FnnMatchResult
     float maxGoodMatchPercentTest;
     float maxGoodMatchPercentTraining;
     int maxGoodMatchCnt;
-
-    FnnMatchResult()
+    int inlierCnt;
+
+    // The level of the query pyramid where the label is evaluated, and the scale of the query image at that level.
+    int pyramidLevel;
+    float pyramidScale;
+
+    FnnMatchResult() :
+        maxGoodMatchPercentTest(0.0),
+        maxGoodMatchPercentTraining(0.0),
+        maxGoodMatchCnt(0),
+        inlierCnt(0),
+        pyramidLevel(0),
+        pyramidScale(1.0)
     {
     }
 
@@ -45,7 +69,10 @@ struct FnnMatchResult
         fs << "evaluatedLabel" << evaluatedLabel;
         fs << "maxGoodMatchPercentTest" << maxGoodMatchPercentTest;
         fs << "maxGoodMatchPercentTraining" << maxGoodMatchPercentTraining;
-        fs << "maxGoodMatchCnt" << maxGoodMatchCnt << "}";
+        fs << "maxGoodMatchCnt" << maxGoodMatchCnt;
+        fs << "inlierCnt" << inlierCnt;
+        fs << "pyramidLevel" << pyramidLevel;
+        fs << "pyramidScale" << pyramidScale << "}";
     }
 
     // Read de-serialization for this class
@@ -56,6 +83,9 @@ struct FnnMatchResult
         maxGoodMatchPercentTest = (float)(node["maxGoodMatchPercentTest"]);
         maxGoodMatchPercentTraining = (float)(node["maxGoodMatchPercentTraining"]);
         maxGoodMatchCnt = (int)(node["maxGoodMatchCnt"]);
+        inlierCnt = (int)(node["inlierCnt"]);
+        pyramidLevel = (int)(node["pyramidLevel"]);
+        pyramidScale = node["pyramidScale"].empty() ? 1.0f : (float)(node["pyramidScale"]);
     }
 };
 
@@ -82,119 +112,1175 @@ static void read(
     }
 }
 
+bool ParseFlannParams(
+    const po::variables_map& vm,
+    FlannParams& flannParams)
+{
+    if (vm.count("index") > 0)
+    {
+        flannParams.algorithm = vm["index"].as<string>();
+        transform(flannParams.algorithm.begin(), flannParams.algorithm.end(), flannParams.algorithm.begin(), ::tolower);
+    }
+
+    if (vm.count("trees") > 0)
+    {
+        flannParams.trees = vm["trees"].as<int>();
+    }
+
+    if (vm.count("branching") > 0)
+    {
+        flannParams.branching = vm["branching"].as<int>();
+    }
+
+    if (vm.count("iterations") > 0)
+    {
+        flannParams.iterations = vm["iterations"].as<int>();
+    }
+
+    if (vm.count("target-recall") > 0)
+    {
+        flannParams.targetRecall = vm["target-recall"].as<float>();
+    }
+
+    if (vm.count("lsh-tables") > 0)
+    {
+        flannParams.lshTableNumber = vm["lsh-tables"].as<int>();
+    }
+
+    if (vm.count("lsh-key-size") > 0)
+    {
+        flannParams.lshKeySize = vm["lsh-key-size"].as<int>();
+    }
+
+    if (vm.count("lsh-probe-level") > 0)
+    {
+        flannParams.lshMultiProbeLevel = vm["lsh-probe-level"].as<int>();
+    }
+
+    if (vm.count("checks") > 0)
+    {
+        flannParams.checks = vm["checks"].as<int>();
+    }
+
+    if (vm.count("eps") > 0)
+    {
+        flannParams.eps = vm["eps"].as<float>();
+    }
+
+    if (flannParams.CreateIndexParams().empty())
+    {
+        return false;
+    }
+
+    if ((flannParams.targetRecall <= 0) || (flannParams.targetRecall > 1))
+    {
+        cerr << "[ERROR]: The target recall " << flannParams.targetRecall << " should be in (0, 1]." << endl << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Parse the comma-separated scale factors of the query pyramid, e.g., "0.25,0.5". The scales are sorted from the
+// coarsest to the finest, and the full resolution is appended as the last level.
+bool ParsePyramidScales(
+    const string& scalesStr,
+    vector<float>& pyramidScales)
+{
+    pyramidScales.clear();
+
+    stringstream ss(scalesStr);
+    string scaleStr;
+    while (getline(ss, scaleStr, ','))
+    {
+        char* end = nullptr;
+        float scale = strtof(scaleStr.c_str(), &end);
+        if ((end == scaleStr.c_str()) || (*end != '\0') || (scale <= 0) || (scale >= 1))
+        {
+            cerr << "[ERROR]: The pyramid scale " << scaleStr << " should be a number in (0, 1)." << endl << endl;
+            return false;
+        }
+
+        pyramidScales.push_back(scale);
+    }
+
+    sort(pyramidScales.begin(), pyramidScales.end());
+    pyramidScales.erase(unique(pyramidScales.begin(), pyramidScales.end()), pyramidScales.end());
+    pyramidScales.push_back(1.0);
+
+    return true;
+}
+
+int DetectAndComputeLabelledImages(
+    const Ptr<SurfFeatureDetector>& detector,
+    const int keypointBudget,
+    const string& imgDir,
+    vector<pair<string, string> >& imgFilename2LabelList,
+    vector<vector<KeyPoint> >& allImgKeypoints,
+    vector<Mat>& allImgDescriptors)
+{
+    vector<pair<string, string> > label2Imgs;
+    int error = Utility::GetImagesWithLabels(imgDir, label2Imgs);
+    if (error != 0)
+    {
+        return error;
+    }
+
+    for (const auto& label2Img : label2Imgs)
+    {
+        string imgLabel = label2Img.first;
+        string imgFilename = label2Img.second;
+        string imgFullFilename = imgDir + "/" + imgLabel + "/" + imgFilename;
+
+        imgFilename2LabelList.push_back(make_pair(imgFilename, imgLabel));
+
+        Mat img = imread(imgFullFilename);
+
+        vector<KeyPoint> oneImgKeypoints;
+        Mat oneImgDescriptors;
+        detector->detectAndCompute(img, noArray(), oneImgKeypoints, oneImgDescriptors);
+        Utility::RetainBestKeypointsInGrid(oneImgKeypoints, oneImgDescriptors, img.size(), keypointBudget);
+        allImgKeypoints.push_back(oneImgKeypoints);
+        allImgDescriptors.push_back(oneImgDescriptors);
+    }
+
+    return 0;
+}
+
+// Merge the descriptors of all the images into a single matrix. Note that the images without any
+// keypoint are skipped, since vconcat() doesn't accept the empty matrices.
+void MergeDescriptors(
+    const vector<Mat>& allImgDescriptors,
+    Mat& mergedDescriptors)
+{
+    vector<Mat> nonEmptyDescriptors;
+    for (const auto& oneImgDescriptors : allImgDescriptors)
+    {
+        if (!oneImgDescriptors.empty())
+        {
+            nonEmptyDescriptors.push_back(oneImgDescriptors);
+        }
+    }
+
+    mergedDescriptors.release();
+    if (!nonEmptyDescriptors.empty())
+    {
+        vconcat(nonEmptyDescriptors, mergedDescriptors);
+    }
+}
+
+bool CheckDescriptorCompatibility(
+    const FlannParams& flannParams,
+    const vector<Mat>& allImgDescriptors)
+{
+    for (const auto& oneImgDescriptors : allImgDescriptors)
+    {
+        if (!oneImgDescriptors.empty() && !flannParams.IsCompatibleWith(oneImgDescriptors.depth()))
+        {
+            cerr << "[ERROR]: The FLANN index " << flannParams.algorithm << " doesn't support the descriptors of type "
+                << Utility::CvType2Str(oneImgDescriptors.type()) << "." << endl << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int TrainAndSaveFlannBasedMatcher(
+    const FlannParams& flannParams,
+    const vector<vector<KeyPoint> >& allImgKeypoints,
+    const vector<Mat>& allImgDescriptors,
+    const vector<pair<string, string> >& trainedImgFilename2LabelList,
+    const int keypointBudget,
+    const string& matcherFile)
+{
+    if (!CheckDescriptorCompatibility(flannParams, allImgDescriptors))
+    {
+        return -1;
+    }
+
+    string matcherFileDir;
+    string matcherFilename;
+    Utility::SeparateDirFromFilename(matcherFile, matcherFileDir, matcherFilename);
+
+    cout << "[INFO]: Training the FLANN-based matcher with the SURF descriptors of the images using the FLANN index "
+        << flannParams.ToString() << "." << endl;
+
+    Ptr<FlannBasedSavableMatcher> flannMatcher = FlannBasedSavableMatcher::create(
+        flannParams.CreateIndexParams(),
+        flannParams.CreateSearchParams());
+
+    flannMatcher->add(allImgDescriptors);
+
+    auto tTrainStart = Clock::now();
+    flannMatcher->train();
+    auto tTrainEnd = Clock::now();
+    cout << "[INFO]: Trained the FLANN-based matcher in " << chrono::duration_cast<chrono::milliseconds>(tTrainEnd - tTrainStart).count()
+        << " ms." << endl;
+
+    cout << "[INFO]: Saving the trained FLANN-based matcher." << endl;
+
+    // Note that the index and search parameters are saved in the matcher file by FlannBasedMatcher::write(),
+    // and they will be restored automatically when the matcher is loaded.
+    flannMatcher->setTrainedImgFilename2LabelList(trainedImgFilename2LabelList);
+    flannMatcher->setTrainedKeypoints(allImgKeypoints);
+    flannMatcher->setFlannIndexFileDir(matcherFileDir);
+    flannMatcher->setFlannIndexFilename(matcherFilename + "_klannindex");
+    flannMatcher->setKeypointBudget(keypointBudget);
+
+    flannMatcher->save(matcherFile);
+
+    return 0;
+}
+
+// The 2-NN recall is the fraction of the exact 2 nearest neighbours which are also found by the approximate search.
+float ComputeKnnRecall(
+    const Mat& approxIndices,
+    const vector<vector<DMatch>>& exactKnnMatches)
+{
+    int cntFound = 0;
+    int cntExact = 0;
+    for (int queryIndex = 0; queryIndex < approxIndices.rows; ++queryIndex)
+    {
+        for (const auto& exactMatch : exactKnnMatches[queryIndex])
+        {
+            for (int k = 0; k < approxIndices.cols; ++k)
+            {
+                if (approxIndices.at<int>(queryIndex, k) == exactMatch.trainIdx)
+                {
+                    cntFound++;
+                    break;
+                }
+            }
+
+            cntExact++;
+        }
+    }
+
+    return (cntExact > 0) ? static_cast<float>(cntFound)/cntExact : 1.0f;
+}
+
+// Search a grid of KD-tree and k-means parameters on the validation descriptors, which are computed from a set of
+// held-out images, and pick the parameters which achieve the target 2-NN recall with the minimum query time.
+// If none of the parameters achieves the target recall, pick the parameters with the maximum recall.
+void AutotuneFlannParams(
+    const vector<Mat>& allImgDescriptors,
+    const Mat& validationDescriptors,
+    const float targetRecall,
+    FlannParams& bestFlannParams)
+{
+    Mat trainDescriptors;
+    MergeDescriptors(allImgDescriptors, trainDescriptors);
+
+    cout << "[INFO]: Computing the exact 2-NN of " << validationDescriptors.rows << " validation descriptors among "
+        << trainDescriptors.rows << " training descriptors." << endl;
+
+    BFMatcher exactMatcher(NORM_L2);
+    vector<vector<DMatch>> exactKnnMatches;
+    exactMatcher.knnMatch(validationDescriptors, trainDescriptors, exactKnnMatches, 2);
+
+    vector<FlannParams> candidateIndexParams;
+    for (const int trees : {1, 2, 4, 8, 16})
+    {
+        FlannParams params;
+        params.algorithm = "kdtree";
+        params.trees = trees;
+        candidateIndexParams.push_back(params);
+    }
+
+    for (const int branching : {16, 32, 64})
+    {
+        for (const int iterations : {5, 11})
+        {
+            FlannParams params;
+            params.algorithm = "kmeans";
+            params.branching = branching;
+            params.iterations = iterations;
+            candidateIndexParams.push_back(params);
+        }
+    }
+
+    const vector<int> candidateChecks{16, 32, 64, 128, 256, 512};
+
+    bool isTargetMet = false;
+    float bestRecall = -1.0;
+    double bestQueryTime = DBL_MAX;
+    for (auto& params : candidateIndexParams)
+    {
+        // The index only depends on the index parameters, so build it once for all the checks.
+        auto tBuildStart = Clock::now();
+        flann::Index index(trainDescriptors, *params.CreateIndexParams());
+        auto tBuildEnd = Clock::now();
+        long buildTime = chrono::duration_cast<chrono::milliseconds>(tBuildEnd - tBuildStart).count();
+
+        for (const int checks : candidateChecks)
+        {
+            params.checks = checks;
+
+            Mat indices;
+            Mat dists;
+            auto tQueryStart = Clock::now();
+            index.knnSearch(validationDescriptors, indices, dists, 2, *params.CreateSearchParams());
+            auto tQueryEnd = Clock::now();
+            double queryTime = chrono::duration_cast<chrono::microseconds>(tQueryEnd - tQueryStart).count()/1000.0;
+
+            float recall = ComputeKnnRecall(indices, exactKnnMatches);
+
+            cout << "[INFO]: " << params.ToString() << ": recall = " << recall << ", build time = " << buildTime
+                << " ms, query time = " << queryTime << " ms." << endl;
+
+            if (recall >= targetRecall)
+            {
+                if (!isTargetMet || (queryTime < bestQueryTime))
+                {
+                    isTargetMet = true;
+                    bestRecall = recall;
+                    bestQueryTime = queryTime;
+                    bestFlannParams = params;
+                }
+            }
+            else if (!isTargetMet && (recall > bestRecall))
+            {
+                bestRecall = recall;
+                bestQueryTime = queryTime;
+                bestFlannParams = params;
+            }
+        }
+    }
+
+    if (isTargetMet)
+    {
+        cout << "[INFO]: Picked the FLANN index " << bestFlannParams.ToString() << " with the recall " << bestRecall
+            << " >= " << targetRecall << " and the query time " << bestQueryTime << " ms." << endl;
+    }
+    else
+    {
+        cerr << "[WARNING]: None of the FLANN indices achieves the target recall " << targetRecall << ", so picked "
+            << bestFlannParams.ToString() << " with the maximum recall " << bestRecall << "." << endl;
+    }
+}
+
 void InitFlannBasedMatcher(
     Ptr<FlannBasedSavableMatcher>& flannMatcher,
     const string& matcherFileDir,
-    const string& matcherFile)
+    const FileNode& matcherNode)
 {
     flannMatcher->setFlannIndexFileDir(matcherFileDir);
+    flannMatcher->read(matcherNode);
+}
 
-    auto tStart = Clock::now();
-    FileStorage fs(matcherFile, FileStorage::READ);
-    auto tEnd = Clock::now();
-    cout << "[DEBUG]: InitFlannBasedMatcher::FileStorage in " << chrono::duration_cast<chrono::milliseconds>(tEnd - tStart).count()
-        << " ms." << endl;
+int InitPqDescriptorStore(
+    Ptr<PqDescriptorStore>& pqStore,
+    const string& matcherFileDir,
+    const FileNode& matcherNode,
+    const int k,
+    const int rerankCnt)
+{
+    pqStore->SetRawDescriptorsFileDir(matcherFileDir);
+    pqStore->Read(matcherNode);
+
+    // The raw descriptors are only needed for re-ranking the shortlist of the ADC search, which can't change the k
+    // nearest neighbours unless the shortlist is longer than k.
+    if (rerankCnt > k)
+    {
+        return pqStore->MapRawDescriptors();
+    }
+
+    return 0;
+}
+
+int TrainAndSavePqDescriptorStore(
+    const int cntSubspaces,
+    const bool useOpq,
+    const vector<vector<KeyPoint> >& allImgKeypoints,
+    const vector<Mat>& allImgDescriptors,
+    const vector<pair<string, string> >& trainedImgFilename2LabelList,
+    const int keypointBudget,
+    const string& matcherFile)
+{
+    string matcherFileDir;
+    string matcherFilename;
+    Utility::SeparateDirFromFilename(matcherFile, matcherFileDir, matcherFilename);
+
+    cout << "[INFO]: Training the " << (useOpq ? "OPQ" : "PQ") << " descriptor store of " << cntSubspaces
+        << " subspaces with the SURF descriptors of the images." << endl;
+
+    PqDescriptorStore pqStore;
+    int error = pqStore.Train(allImgDescriptors, cntSubspaces, useOpq);
+    if (error != 0)
+    {
+        return error;
+    }
+
+    cout << "[INFO]: Saving the trained PQ descriptor store and the raw descriptors for re-ranking." << endl;
+
+    // Like the FLANN index file, the raw descriptors file is written next to the store file.
+    string rawDescriptorsFilename = matcherFilename + "_rawdescriptors";
+    error = PqDescriptorStore::WriteRawDescriptors(matcherFileDir + rawDescriptorsFilename, allImgDescriptors);
+    if (error != 0)
+    {
+        return error;
+    }
+
+    pqStore.SetTrainedImgFilename2LabelList(trainedImgFilename2LabelList);
+    pqStore.SetTrainedKeypoints(allImgKeypoints);
+    pqStore.SetRawDescriptorsFilename(rawDescriptorsFilename);
+    pqStore.SetKeypointBudget(keypointBudget);
+    pqStore.Save(matcherFile);
+
+    return 0;
+}
+
+// A good match is the one which passes the ratio test, i.e., its nearest neighbour is significantly
+// closer than its second nearest neighbour.
+bool IsGoodKnnMatch(const vector<DMatch>& knnMatchPair)
+{
+    return (knnMatchPair.size() > 1 && knnMatchPair[0].distance < 0.8 * knnMatchPair[1].distance);
+}
+
+// A training image is accepted as the best match only if its good match count is larger than goodMatchCntThreshold
+// and its good match percentage is larger than goodMatchPercentThreshold.
+const float goodMatchPercentThreshold = 4.499;
+const int goodMatchCntThreshold = 10;
+
+// Find the best matched training image from the good match counts. It returns -1 if none of the training images
+// is accepted. queryDescriptorCnt is the number of the descriptors of the test image.
+int FindBestMatchImage(
+    const vector<int>& goodMatchCnts,
+    const int queryDescriptorCnt,
+    const vector<int>& trainedDescriptorCnts,
+    float& maxGoodMatchPercentTest,
+    float& maxGoodMatchPercentTraining,
+    int& maxGoodMatchCnt)
+{
+    maxGoodMatchPercentTest = 0.0;
+    maxGoodMatchPercentTraining = 0.0;
+    int maxGoodMatchCntTest = 0;
+    int maxGoodMatchCntTraining = 0;
+    int bestMatchImageIndexTest = -1;
+    int bestMatchImageIndexTraining = -1;
+    for (int imgIndex = 0; imgIndex < static_cast<int>(trainedDescriptorCnts.size()); ++imgIndex)
+    {
+        // If the good match count is too small, simply drop it.
+        if (goodMatchCnts[imgIndex] <= goodMatchCntThreshold)
+        {
+            continue;
+        }
+
+        // The denominator of this good match percentage is the number of the descriptors of the test image.
+        float goodMatchPercentTest = 0.0;
+        if (queryDescriptorCnt > 0)
+        {
+            goodMatchPercentTest = 100.0*goodMatchCnts[imgIndex]/queryDescriptorCnt;
+        }
+
+        // The denominator of this good match percentage is the number of the descriptors of the training image.
+        float goodMatchPercentTraining = 0.0;
+        if (trainedDescriptorCnts[imgIndex] > 0)
+        {
+            goodMatchPercentTraining = 100.0*goodMatchCnts[imgIndex]/trainedDescriptorCnts[imgIndex];
+        }
+
+        if ((goodMatchPercentTest > goodMatchPercentThreshold) &&
+            (maxGoodMatchPercentTest < goodMatchPercentTest))
+        {
+            maxGoodMatchPercentTest = goodMatchPercentTest;
+            maxGoodMatchCntTest = goodMatchCnts[imgIndex];
+            bestMatchImageIndexTest = imgIndex;
+        }
+
+        if ((goodMatchPercentTraining > goodMatchPercentThreshold) &&
+            (maxGoodMatchPercentTraining < goodMatchPercentTraining))
+        {
+            maxGoodMatchPercentTraining = goodMatchPercentTraining;
+            maxGoodMatchCntTraining = goodMatchCnts[imgIndex];
+            bestMatchImageIndexTraining = imgIndex;
+        }
+    }
+
+    // Set the maximum good match percentage to the larger one of the above two percentages.
+    maxGoodMatchCnt = maxGoodMatchCntTest;
+    int bestMatchImageIndex = bestMatchImageIndexTest;
+    if (maxGoodMatchPercentTest < maxGoodMatchPercentTraining)
+    {
+        maxGoodMatchCnt = maxGoodMatchCntTraining;
+        bestMatchImageIndex = bestMatchImageIndexTraining;
+    }
+
+    return bestMatchImageIndex;
+}
+
+// Evaluate the label of the test image from the good match count of each training image.
+void EvaluateLabelFromGoodMatchCnts(
+    const vector<int>& goodMatchCnts,
+    const Mat& imgDescriptors,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    FnnMatchResult& result)
+{
+    string evaluatedLabel("unknown");
+
+    float maxGoodMatchPercentTest = 0.0;
+    float maxGoodMatchPercentTraining = 0.0;
+    int maxGoodMatchCnt = 0;
+    int bestMatchImageIndex = FindBestMatchImage(goodMatchCnts, imgDescriptors.rows, trainedDescriptorCnts,
+        maxGoodMatchPercentTest, maxGoodMatchPercentTraining, maxGoodMatchCnt);
+
+    if (bestMatchImageIndex != -1)
+    {
+        evaluatedLabel = matcherTrainedImg2LabelList[bestMatchImageIndex].second;
+        cout << "[INFO]: The maximum good match percentage " << max(maxGoodMatchPercentTest, maxGoodMatchPercentTraining) << "% > "
+                << goodMatchPercentThreshold << "% and the maximum good match count " << maxGoodMatchCnt << " > " << goodMatchCntThreshold
+                << ", so evaluate the class as " << evaluatedLabel << "." << endl;
+    }
+    else
+    {
+        cout << "[INFO]: Either The maximum good match count < " << goodMatchCntThreshold << " or the maximum good match percentage < "
+            << goodMatchPercentThreshold << "%, so evaluate the class as unknown." << endl;
+    }
+
+    result.evaluatedLabel = evaluatedLabel;
+    result.maxGoodMatchPercentTest = maxGoodMatchPercentTest;
+    result.maxGoodMatchPercentTraining = maxGoodMatchPercentTraining;
+    result.maxGoodMatchCnt = maxGoodMatchCnt;
+}
+
+// Evaluate the label of the test image from the 2-NN matches of its descriptors, where imgIdx of each match
+// is the index of the training image in trainedDescriptorCnts.
+void EvaluateLabelFromKnnMatches(
+    const vector<vector<DMatch>>& knnMatches,
+    const Mat& imgDescriptors,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    FnnMatchResult& result)
+{
+    vector<int> goodMatchCnts(matcherTrainedImg2LabelList.size());
+    for (const auto& knnMatchPair: knnMatches)
+    {
+        if (IsGoodKnnMatch(knnMatchPair))
+        {
+            goodMatchCnts[knnMatchPair[0].imgIdx]++;
+        }
+    }
+
+    EvaluateLabelFromGoodMatchCnts(goodMatchCnts, imgDescriptors, trainedDescriptorCnts, matcherTrainedImg2LabelList, result);
+}
+
+// Evaluate the label of the test image by the spatial verification of the top candidate training images, i.e.,
+// the training images with the most good matches. For each candidate, a homography is estimated from the good
+// matches with RHO, a PROSAC-based RANSAC variant which draws the samples from the best matches first, so the
+// good matches are sorted by their ratio of the nearest distance to the second nearest distance. The number of
+// inliers of the homography, instead of the good match count, decides the best matched training image.
+void EvaluateLabelBySpatialVerification(
+    const vector<vector<DMatch>>& knnMatches,
+    const vector<KeyPoint>& imgKeypoints,
+    const Mat& imgDescriptors,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<vector<Point2f> >& trainedKeypointPts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    const int verifyTopCnt,
+    const int inlierCntThreshold,
+    FnnMatchResult& result)
+{
+    // At least 4 point correspondences are needed to estimate a homography.
+    const int minGoodMatchCnt = 4;
+    const double ransacReprojThreshold = 5.0;
+
+    string evaluatedLabel("unknown");
+
+    // Collect the good matches of each training image together with their ratios.
+    vector<vector<pair<float, DMatch> > > allImgGoodMatches(matcherTrainedImg2LabelList.size());
+    for (const auto& knnMatchPair: knnMatches)
+    {
+        if (IsGoodKnnMatch(knnMatchPair))
+        {
+            float ratio = (knnMatchPair[1].distance > 0) ? knnMatchPair[0].distance/knnMatchPair[1].distance : 0.0f;
+            allImgGoodMatches[knnMatchPair[0].imgIdx].push_back(make_pair(ratio, knnMatchPair[0]));
+        }
+    }
+
+    vector<int> candidateImgIndices(allImgGoodMatches.size());
+    iota(candidateImgIndices.begin(), candidateImgIndices.end(), 0);
+    stable_sort(candidateImgIndices.begin(), candidateImgIndices.end(),
+        [&allImgGoodMatches](const int lhs, const int rhs)
+        {
+            return allImgGoodMatches[lhs].size() > allImgGoodMatches[rhs].size();
+        });
+
+    int bestMatchImageIndex = -1;
+    int maxInlierCnt = 0;
+    for (int candidateIndex = 0; candidateIndex < min(verifyTopCnt, static_cast<int>(candidateImgIndices.size())); ++candidateIndex)
+    {
+        int imgIndex = candidateImgIndices[candidateIndex];
+        vector<pair<float, DMatch> >& goodMatches = allImgGoodMatches[imgIndex];
+
+        // The candidates are sorted by the good match count, which is the upper bound of the inlier count, so none
+        // of the remaining candidates can have more inliers than the best one.
+        int goodMatchCnt = static_cast<int>(goodMatches.size());
+        if ((goodMatchCnt < minGoodMatchCnt) || (goodMatchCnt <= maxInlierCnt))
+        {
+            break;
+        }
+
+        stable_sort(goodMatches.begin(), goodMatches.end(),
+            [](const pair<float, DMatch>& lhs, const pair<float, DMatch>& rhs)
+            {
+                return lhs.first < rhs.first;
+            });
+
+        vector<Point2f> queryPts;
+        vector<Point2f> trainPts;
+        for (const auto& goodMatch : goodMatches)
+        {
+            queryPts.push_back(imgKeypoints[goodMatch.second.queryIdx].pt);
+            trainPts.push_back(trainedKeypointPts[imgIndex][goodMatch.second.trainIdx]);
+        }
+
+        Mat inlierMask;
+        Mat homography = findHomography(queryPts, trainPts, RHO, ransacReprojThreshold, inlierMask);
+        int inlierCnt = homography.empty() ? 0 : countNonZero(inlierMask);
+
+        cout << "[DEBUG]: The candidate " << matcherTrainedImg2LabelList[imgIndex].first << " has " << inlierCnt
+            << " inliers out of " << goodMatchCnt << " good matches." << endl;
+
+        if (inlierCnt > maxInlierCnt)
+        {
+            maxInlierCnt = inlierCnt;
+            bestMatchImageIndex = imgIndex;
+        }
+    }
+
+    if ((bestMatchImageIndex != -1) && (maxInlierCnt >= inlierCntThreshold))
+    {
+        evaluatedLabel = matcherTrainedImg2LabelList[bestMatchImageIndex].second;
+        cout << "[INFO]: The maximum inlier count " << maxInlierCnt << " >= " << inlierCntThreshold
+            << ", so evaluate the class as " << evaluatedLabel << "." << endl;
+    }
+    else
+    {
+        cout << "[INFO]: The maximum inlier count " << maxInlierCnt << " < " << inlierCntThreshold
+            << ", so evaluate the class as unknown." << endl;
+    }
+
+    result.evaluatedLabel = evaluatedLabel;
+    result.inlierCnt = maxInlierCnt;
+    result.maxGoodMatchPercentTest = 0.0;
+    result.maxGoodMatchPercentTraining = 0.0;
+    result.maxGoodMatchCnt = 0;
+    if (bestMatchImageIndex != -1)
+    {
+        int goodMatchCnt = static_cast<int>(allImgGoodMatches[bestMatchImageIndex].size());
+        result.maxGoodMatchCnt = goodMatchCnt;
+        if (imgDescriptors.rows > 0)
+        {
+            result.maxGoodMatchPercentTest = 100.0*goodMatchCnt/imgDescriptors.rows;
+        }
+
+        if (trainedDescriptorCnts[bestMatchImageIndex] > 0)
+        {
+            result.maxGoodMatchPercentTraining = 100.0*goodMatchCnt/trainedDescriptorCnts[bestMatchImageIndex];
+        }
+    }
+}
+
+// The score of a training image is its larger good match percentage which passes goodMatchPercentThreshold,
+// or -1 if the training image is not accepted with the given good match count. It is the quantity maximized
+// by FindBestMatchImage().
+float GetBestMatchScore(
+    const int goodMatchCnt,
+    const int queryDescriptorCnt,
+    const int trainedDescriptorCnt)
+{
+    if (goodMatchCnt <= goodMatchCntThreshold)
+    {
+        return -1.0;
+    }
+
+    float score = -1.0;
+
+    float goodMatchPercentTest = (queryDescriptorCnt > 0) ? 100.0*goodMatchCnt/queryDescriptorCnt : 0.0;
+    if (goodMatchPercentTest > goodMatchPercentThreshold)
+    {
+        score = goodMatchPercentTest;
+    }
+
+    float goodMatchPercentTraining = (trainedDescriptorCnt > 0) ? 100.0*goodMatchCnt/trainedDescriptorCnt : 0.0;
+    if (goodMatchPercentTraining > goodMatchPercentThreshold)
+    {
+        score = max(score, goodMatchPercentTraining);
+    }
+
+    return score;
+}
+
+// Check whether the remaining descriptors can still change the result of FindBestMatchImage(). Since each of the
+// remaining descriptors adds at most one good match to one training image, the final good match count of each
+// training image is within [goodMatchCnts[i], goodMatchCnts[i] + remainingDescriptorCnt]. The result is decided if
+// either no training image can be accepted even with the upper bound (i.e., unknown), or the current leader is
+// accepted and its score with the lower bound is larger than the score of any other image with the upper bound.
+bool IsBestMatchDecided(
+    const vector<int>& goodMatchCnts,
+    const int remainingDescriptorCnt,
+    const int queryDescriptorCnt,
+    const vector<int>& trainedDescriptorCnts)
+{
+    int leaderImageIndex = -1;
+    float leaderScore = -1.0;
+    for (int imgIndex = 0; imgIndex < static_cast<int>(trainedDescriptorCnts.size()); ++imgIndex)
+    {
+        float score = GetBestMatchScore(goodMatchCnts[imgIndex], queryDescriptorCnt, trainedDescriptorCnts[imgIndex]);
+        if (score > leaderScore)
+        {
+            leaderScore = score;
+            leaderImageIndex = imgIndex;
+        }
+    }
+
+    for (int imgIndex = 0; imgIndex < static_cast<int>(trainedDescriptorCnts.size()); ++imgIndex)
+    {
+        if (imgIndex == leaderImageIndex)
+        {
+            continue;
+        }
+
+        float maxScore = GetBestMatchScore(goodMatchCnts[imgIndex] + remainingDescriptorCnt, queryDescriptorCnt,
+            trainedDescriptorCnts[imgIndex]);
+
+        // Without a leader, any image which may be accepted later can change the unknown result. With a leader,
+        // any image which may reach the score of the leader can change the best match.
+        if ((leaderImageIndex == -1) ? (maxScore >= 0.0) : (maxScore >= leaderScore))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void FlannBasedKnnMatch(
+    const Mat& imgDescriptors,
+    const KnnMatchFunction& knnMatch,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    const string& imgMapKey,
+    FnnMatchResult& result)
+{
+    vector<vector<DMatch>> knnMatches;
+    knnMatch(imgDescriptors, knnMatches);
+
+    EvaluateLabelFromKnnMatches(knnMatches, imgDescriptors, trainedDescriptorCnts, matcherTrainedImg2LabelList, result);
+}
+
+void VerifiedFlannBasedKnnMatch(
+    const vector<KeyPoint>& imgKeypoints,
+    const Mat& imgDescriptors,
+    const KnnMatchFunction& knnMatch,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<vector<Point2f> >& trainedKeypointPts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    const int verifyTopCnt,
+    const int inlierCntThreshold,
+    FnnMatchResult& result)
+{
+    vector<vector<DMatch>> knnMatches;
+    knnMatch(imgDescriptors, knnMatches);
+
+    EvaluateLabelBySpatialVerification(knnMatches, imgKeypoints, imgDescriptors, trainedDescriptorCnts, trainedKeypointPts,
+        matcherTrainedImg2LabelList, verifyTopCnt, inlierCntThreshold, result);
+}
+
+// Do the knnMatching of the descriptors chunk by chunk in the descending order of the keypoint response, and stop
+// as soon as the remaining descriptors can't change the evaluated label. Note that the good match percentages of
+// the result are computed with the good match counts of the matched descriptors only.
+void ProgressiveFlannBasedKnnMatch(
+    const vector<KeyPoint>& imgKeypoints,
+    const Mat& imgDescriptors,
+    const KnnMatchFunction& knnMatch,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    const int chunkSize,
+    FnnMatchResult& result)
+{
+    // The strongest keypoints are the most repeatable ones, so they are the most likely to be good matches.
+    vector<int> sortedDescriptorIndices(imgDescriptors.rows);
+    iota(sortedDescriptorIndices.begin(), sortedDescriptorIndices.end(), 0);
+    stable_sort(sortedDescriptorIndices.begin(), sortedDescriptorIndices.end(),
+        [&imgKeypoints](const int lhs, const int rhs)
+        {
+            return imgKeypoints[lhs].response > imgKeypoints[rhs].response;
+        });
+
+    vector<int> goodMatchCnts(matcherTrainedImg2LabelList.size());
+    int matchedDescriptorCnt = 0;
+    while (matchedDescriptorCnt < imgDescriptors.rows)
+    {
+        int chunkEnd = min(matchedDescriptorCnt + chunkSize, imgDescriptors.rows);
+
+        Mat chunkDescriptors(chunkEnd - matchedDescriptorCnt, imgDescriptors.cols, imgDescriptors.type());
+        for (int descIndex = matchedDescriptorCnt; descIndex < chunkEnd; ++descIndex)
+        {
+            imgDescriptors.row(sortedDescriptorIndices[descIndex]).copyTo(chunkDescriptors.row(descIndex - matchedDescriptorCnt));
+        }
+
+        vector<vector<DMatch>> knnMatches;
+        knnMatch(chunkDescriptors, knnMatches);
+
+        for (const auto& knnMatchPair: knnMatches)
+        {
+            if (IsGoodKnnMatch(knnMatchPair))
+            {
+                goodMatchCnts[knnMatchPair[0].imgIdx]++;
+            }
+        }
+
+        matchedDescriptorCnt = chunkEnd;
+
+        if (IsBestMatchDecided(goodMatchCnts, imgDescriptors.rows - matchedDescriptorCnt, imgDescriptors.rows, trainedDescriptorCnts))
+        {
+            break;
+        }
+    }
+
+    cout << "[INFO]: The progressive knnMatching stopped after " << matchedDescriptorCnt << " of "
+        << imgDescriptors.rows << " descriptors." << endl;
+
+    EvaluateLabelFromGoodMatchCnts(goodMatchCnts, imgDescriptors, trainedDescriptorCnts, matcherTrainedImg2LabelList, result);
+}
+
+// Do the knnMatching coarse-to-fine on a pyramid of the query image. At each coarse level the image is downscaled,
+// and its keypoints are detected and matched. The label of that level is taken if the best matched training image
+// is accepted with a good match percentage of at least acceptPercent. If no training image reaches rejectPercent
+// even without the thresholds of FindBestMatchImage(), the image is evaluated as unknown. Otherwise the count is
+// ambiguous, and the next finer level is tried. The last level is the full resolution, where the label is evaluated
+// as without the pyramid.
+void PyramidFlannBasedKnnMatch(
+    const Mat& img,
+    const Ptr<Feature2D>& detector,
+    const int keypointBudget,
+    const vector<float>& pyramidScales,
+    const float acceptPercent,
+    const float rejectPercent,
+    const KnnMatchFunction& knnMatch,
+    const vector<int>& trainedDescriptorCnts,
+    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
+    FnnMatchResult& result)
+{
+    for (int level = 0; level < static_cast<int>(pyramidScales.size()); ++level)
+    {
+        float scale = pyramidScales[level];
+        bool isFinestLevel = (level == static_cast<int>(pyramidScales.size()) - 1);
+
+        Mat levelImg = img;
+        if (!isFinestLevel)
+        {
+            resize(img, levelImg, Size(), scale, scale, INTER_AREA);
+        }
+
+        vector<KeyPoint> levelKeypoints;
+        Mat levelDescriptors;
+        detector->detectAndCompute(levelImg, noArray(), levelKeypoints, levelDescriptors);
+        Utility::RetainBestKeypointsInGrid(levelKeypoints, levelDescriptors, levelImg.size(), keypointBudget);
+
+        vector<vector<DMatch>> knnMatches;
+        knnMatch(levelDescriptors, knnMatches);
+
+        vector<int> goodMatchCnts(matcherTrainedImg2LabelList.size());
+        for (const auto& knnMatchPair: knnMatches)
+        {
+            if (IsGoodKnnMatch(knnMatchPair))
+            {
+                goodMatchCnts[knnMatchPair[0].imgIdx]++;
+            }
+        }
+
+        cout << "[INFO]: Pyramid level " << level << " at scale " << scale << " has "
+            << levelDescriptors.rows << " descriptors." << endl;
+
+        FnnMatchResult levelResult = result;
+        EvaluateLabelFromGoodMatchCnts(goodMatchCnts, levelDescriptors, trainedDescriptorCnts, matcherTrainedImg2LabelList,
+            levelResult);
+        levelResult.pyramidLevel = level;
+        levelResult.pyramidScale = scale;
+
+        if (isFinestLevel)
+        {
+            result = levelResult;
+            return;
+        }
+
+        float bestPercent = max(levelResult.maxGoodMatchPercentTest, levelResult.maxGoodMatchPercentTraining);
+        if ((levelResult.evaluatedLabel != "unknown") && (bestPercent >= acceptPercent))
+        {
+            cout << "[INFO]: The good match percentage " << bestPercent << "% >= " << acceptPercent
+                << "%, so accept the label at pyramid level " << level << "." << endl;
+            result = levelResult;
+            return;
+        }
+
+        // The largest good match percentage of any training image, regardless of the acceptance thresholds.
+        float maxRawPercent = 0.0;
+        for (int imgIndex = 0; imgIndex < static_cast<int>(goodMatchCnts.size()); ++imgIndex)
+        {
+            if (levelDescriptors.rows > 0)
+            {
+                maxRawPercent = max(maxRawPercent, 100.0f*goodMatchCnts[imgIndex]/levelDescriptors.rows);
+            }
+
+            if (trainedDescriptorCnts[imgIndex] > 0)
+            {
+                maxRawPercent = max(maxRawPercent, 100.0f*goodMatchCnts[imgIndex]/trainedDescriptorCnts[imgIndex]);
+            }
+        }
+
+        if (maxRawPercent < rejectPercent)
+        {
+            cout << "[INFO]: The largest good match percentage " << maxRawPercent << "% < " << rejectPercent
+                << "%, so reject the image as unknown at pyramid level " << level << "." << endl;
+            levelResult.evaluatedLabel = "unknown";
+            result = levelResult;
+            return;
+        }
+
+        cout << "[INFO]: The good match counts at pyramid level " << level << " are ambiguous, so escalate to the next level." << endl;
+    }
+}
+
+// Split the labelled images into the training and query images by holding out every N-th image of each label.
+void HoldOutLabelledImages(
+    const int holdoutInterval,
+    vector<pair<string, string> >& imgFilename2LabelList,
+    vector<vector<KeyPoint> >& allImgKeypoints,
+    vector<Mat>& allImgDescriptors,
+    vector<pair<string, string> >& heldOutImgFilename2LabelList,
+    vector<vector<KeyPoint> >& allHeldOutKeypoints,
+    vector<Mat>& allHeldOutDescriptors)
+{
+    vector<pair<string, string> > keptImgFilename2LabelList;
+    vector<vector<KeyPoint> > allKeptKeypoints;
+    vector<Mat> allKeptDescriptors;
+    map<string, int> label2ImgCnt;
+    for (size_t imgIndex = 0; imgIndex < imgFilename2LabelList.size(); ++imgIndex)
+    {
+        int& imgCnt = label2ImgCnt[imgFilename2LabelList[imgIndex].second];
+        imgCnt++;
+
+        if (imgCnt % holdoutInterval == 0)
+        {
+            heldOutImgFilename2LabelList.push_back(imgFilename2LabelList[imgIndex]);
+            allHeldOutKeypoints.push_back(allImgKeypoints[imgIndex]);
+            allHeldOutDescriptors.push_back(allImgDescriptors[imgIndex]);
+        }
+        else
+        {
+            keptImgFilename2LabelList.push_back(imgFilename2LabelList[imgIndex]);
+            allKeptKeypoints.push_back(allImgKeypoints[imgIndex]);
+            allKeptDescriptors.push_back(allImgDescriptors[imgIndex]);
+        }
+    }
 
-    flannMatcher->read(fs.getFirstTopLevelNode());
+    imgFilename2LabelList.swap(keptImgFilename2LabelList);
+    allImgKeypoints.swap(allKeptKeypoints);
+    allImgDescriptors.swap(allKeptDescriptors);
 }
 
-void FlannBasedKnnMatch(
-    const Mat& imgDescriptors,
-    const Ptr<FlannBasedSavableMatcher>& flannMatcher,
-    const vector<pair<string, string> >& matcherTrainedImg2LabelList,
-    const string& imgMapKey,
-    FnnMatchResult& result)
+// Run the exact brute-force knnMatch and the FLANN-based knnMatch on the same query images, and write the
+// accuracy and speed of the FLANN approximation to the result file (yml or json, depending on its extension).
+int BenchmarkFlannBasedKnnMatch(
+    const FlannParams& flannParams,
+    const vector<Mat>& allTrainedDescriptors,
+    const vector<pair<string, string> >& trainedImgFilename2LabelList,
+    const vector<Mat>& allQueryDescriptors,
+    const vector<pair<string, string> >& queryImgFilename2LabelList,
+    const string& resultFile)
 {
-    const float goodMatchPercentThreshold = 4.499;
-    const int goodMatchCntThreshold = 10;
+    if (!CheckDescriptorCompatibility(flannParams, allTrainedDescriptors))
+    {
+        return -1;
+    }
 
-    string evaluatedLabel("unknown");
+    FileStorage fsResult(resultFile, FileStorage::WRITE);
+    if (!fsResult.isOpened())
+    {
+        cerr << "[ERROR]: Can't open the result file " << resultFile << "." << endl << endl;
+        return -1;
+    }
 
-    vector<vector<DMatch>> knnMatches;
-    flannMatcher->knnMatch(imgDescriptors, knnMatches, 2);
+    cout << "[INFO]: Building the FLANN index " << flannParams.ToString() << "." << endl;
 
-    vector<int> goodMatchCnts(matcherTrainedImg2LabelList.size());
-    for (const auto& knnMatchPair: knnMatches)
+    Ptr<FlannBasedSavableMatcher> flannMatcher = FlannBasedSavableMatcher::create(
+        flannParams.CreateIndexParams(),
+        flannParams.CreateSearchParams());
+    flannMatcher->add(allTrainedDescriptors);
+
+    auto tBuildStart = Clock::now();
+    flannMatcher->train();
+    auto tBuildEnd = Clock::now();
+    double buildTime = chrono::duration_cast<chrono::microseconds>(tBuildEnd - tBuildStart).count()/1000.0;
+
+    // The exact matcher searches the merged training descriptors, so its trainIdx has to be converted
+    // back to the image index and the descriptor index within the image as done by the FLANN-based matcher.
+    Mat mergedTrainedDescriptors;
+    MergeDescriptors(allTrainedDescriptors, mergedTrainedDescriptors);
+
+    vector<int> trainedDescriptorCnts(allTrainedDescriptors.size());
+    vector<int> startIdxs(allTrainedDescriptors.size());
+    for (size_t imgIndex = 0; imgIndex < allTrainedDescriptors.size(); ++imgIndex)
     {
-        if (knnMatchPair.size() > 1 && knnMatchPair[0].distance < 0.8 * knnMatchPair[1].distance)
+        trainedDescriptorCnts[imgIndex] = allTrainedDescriptors[imgIndex].rows;
+        if (imgIndex > 0)
         {
-            goodMatchCnts[knnMatchPair[0].imgIdx]++;
+            startIdxs[imgIndex] = startIdxs[imgIndex - 1] + trainedDescriptorCnts[imgIndex - 1];
         }
     }
 
-    vector<Mat> allTrainedDescriptors = flannMatcher->getTrainDescriptors();
-
-    float maxGoodMatchPercentTest = 0.0;
-    float maxGoodMatchPercentTraining = 0.0;
-    int maxGoodMatchCntTest = 0;
-    int maxGoodMatchCntTraining = 0;
-    int bestMatchImageIndexTest = -1;
-    int bestMatchImageIndexTraining = -1;
-    for (int imgIndex = 0; imgIndex < static_cast<int>(allTrainedDescriptors.size()); ++imgIndex)
+    BFMatcher exactMatcher(NORM_L2);
+
+    fsResult << "flannParams" << "{";
+    fsResult << "algorithm" << flannParams.algorithm;
+    fsResult << "trees" << flannParams.trees;
+    fsResult << "branching" << flannParams.branching;
+    fsResult << "iterations" << flannParams.iterations;
+    fsResult << "targetRecall" << flannParams.targetRecall;
+    fsResult << "checks" << flannParams.checks;
+    fsResult << "eps" << flannParams.eps << "}";
+
+    int cntExactNeighbours = 0;
+    int cntFoundNeighbours = 0;
+    int cntQueryDescriptors = 0;
+    int cntRatioTestAgreements = 0;
+    int cntLabelAgreements = 0;
+    int cntExactCorrectLabels = 0;
+    int cntFlannCorrectLabels = 0;
+    double exactQueryTime = 0.0;
+    double flannQueryTime = 0.0;
+
+    fsResult << "images" << "[";
+    for (size_t queryIndex = 0; queryIndex < allQueryDescriptors.size(); ++queryIndex)
     {
-        // If the good match count is too small, simply drop it.
-        if (goodMatchCnts[imgIndex] <= goodMatchCntThreshold)
-        {
-            continue;
-        }
+        const Mat& queryDescriptors = allQueryDescriptors[queryIndex];
+        const string& expectedLabel = queryImgFilename2LabelList[queryIndex].second;
 
-        // The denominator of this good match percentage is the number of the descriptors of the test image.
-        float goodMatchPercentTest = 0.0;
-        if (imgDescriptors.rows > 0)
+        vector<vector<DMatch>> exactKnnMatches;
+        vector<vector<DMatch>> flannKnnMatches;
+        if (!queryDescriptors.empty() && !mergedTrainedDescriptors.empty())
         {
-            goodMatchPercentTest = 100.0*goodMatchCnts[imgIndex]/(imgDescriptors.rows);
+            auto tExactStart = Clock::now();
+            exactMatcher.knnMatch(queryDescriptors, mergedTrainedDescriptors, exactKnnMatches, 2);
+            auto tExactEnd = Clock::now();
+            exactQueryTime += chrono::duration_cast<chrono::microseconds>(tExactEnd - tExactStart).count()/1000.0;
+
+            auto tFlannStart = Clock::now();
+            flannMatcher->knnMatch(queryDescriptors, flannKnnMatches, 2);
+            auto tFlannEnd = Clock::now();
+            flannQueryTime += chrono::duration_cast<chrono::microseconds>(tFlannEnd - tFlannStart).count()/1000.0;
         }
 
-        // The denominator of this good match percentage is the number of the descriptors of the training image.
-        float goodMatchPercentTraining = 0.0;
-        if (allTrainedDescriptors[imgIndex].rows > 0)
+        for (auto& exactKnnMatchPair : exactKnnMatches)
         {
-            goodMatchPercentTraining = 100.0*goodMatchCnts[imgIndex]/(allTrainedDescriptors[imgIndex].rows);
+            for (auto& exactMatch : exactKnnMatchPair)
+            {
+                int imgIndex = static_cast<int>(upper_bound(startIdxs.begin(), startIdxs.end(), exactMatch.trainIdx) - startIdxs.begin()) - 1;
+                exactMatch.imgIdx = imgIndex;
+                exactMatch.trainIdx -= startIdxs[imgIndex];
+            }
         }
 
-        if ((goodMatchPercentTest > goodMatchPercentThreshold) &&
-            (maxGoodMatchPercentTest < goodMatchPercentTest))
+        // The 2-NN recall is the fraction of the exact 2 nearest neighbours which are also found by the FLANN index,
+        // and the ratio test agrees if both searches make the same decision and vote for the same training image.
+        int cntImgExactNeighbours = 0;
+        int cntImgFoundNeighbours = 0;
+        int cntImgRatioTestAgreements = 0;
+        for (size_t descIndex = 0; descIndex < exactKnnMatches.size(); ++descIndex)
         {
-            maxGoodMatchPercentTest = goodMatchPercentTest;
-            maxGoodMatchCntTest = goodMatchCnts[imgIndex];
-            bestMatchImageIndexTest = imgIndex;
-        }
+            const vector<DMatch>& exactKnnMatchPair = exactKnnMatches[descIndex];
+            const vector<DMatch>& flannKnnMatchPair = flannKnnMatches[descIndex];
 
-        if ((goodMatchPercentTraining > goodMatchPercentThreshold) &&
-            (maxGoodMatchPercentTraining < goodMatchPercentTraining))
-        {
-            maxGoodMatchPercentTraining = goodMatchPercentTraining;
-            maxGoodMatchCntTraining = goodMatchCnts[imgIndex];
-            bestMatchImageIndexTraining = imgIndex;
+            for (const auto& exactMatch : exactKnnMatchPair)
+            {
+                for (const auto& flannMatch : flannKnnMatchPair)
+                {
+                    if ((flannMatch.imgIdx == exactMatch.imgIdx) && (flannMatch.trainIdx == exactMatch.trainIdx))
+                    {
+                        cntImgFoundNeighbours++;
+                        break;
+                    }
+                }
+
+                cntImgExactNeighbours++;
+            }
+
+            bool isExactGoodMatch = IsGoodKnnMatch(exactKnnMatchPair);
+            bool isFlannGoodMatch = IsGoodKnnMatch(flannKnnMatchPair);
+            if ((isExactGoodMatch == isFlannGoodMatch) &&
+                (!isExactGoodMatch || (exactKnnMatchPair[0].imgIdx == flannKnnMatchPair[0].imgIdx)))
+            {
+                cntImgRatioTestAgreements++;
+            }
         }
-    }
 
-    // Set the maximum good match percentage to the larger one of the above two percentages.
-    int maxGoodMatchCnt = maxGoodMatchCntTest;
-    int bestMatchImageIndex = bestMatchImageIndexTest;
-    if (maxGoodMatchPercentTest < maxGoodMatchPercentTraining)
-    {
-        maxGoodMatchCnt = maxGoodMatchCntTraining;
-        bestMatchImageIndex = bestMatchImageIndexTraining;
+        FnnMatchResult exactResult;
+        FnnMatchResult flannResult;
+        EvaluateLabelFromKnnMatches(exactKnnMatches, queryDescriptors, trainedDescriptorCnts, trainedImgFilename2LabelList, exactResult);
+        EvaluateLabelFromKnnMatches(flannKnnMatches, queryDescriptors, trainedDescriptorCnts, trainedImgFilename2LabelList, flannResult);
+
+        cntExactNeighbours += cntImgExactNeighbours;
+        cntFoundNeighbours += cntImgFoundNeighbours;
+        cntQueryDescriptors += static_cast<int>(exactKnnMatches.size());
+        cntRatioTestAgreements += cntImgRatioTestAgreements;
+        cntLabelAgreements += (exactResult.evaluatedLabel == flannResult.evaluatedLabel) ? 1 : 0;
+        cntExactCorrectLabels += (exactResult.evaluatedLabel == expectedLabel) ? 1 : 0;
+        cntFlannCorrectLabels += (flannResult.evaluatedLabel == expectedLabel) ? 1 : 0;
+
+        fsResult << "{" << "filename" << queryImgFilename2LabelList[queryIndex].first;
+        fsResult << "expectedLabel" << expectedLabel;
+        fsResult << "descriptors" << queryDescriptors.rows;
+        fsResult << "recall" << ((cntImgExactNeighbours > 0) ? static_cast<float>(cntImgFoundNeighbours)/cntImgExactNeighbours : 1.0f);
+        fsResult << "ratioTestAgreement" << ((exactKnnMatches.size() > 0) ? static_cast<float>(cntImgRatioTestAgreements)/exactKnnMatches.size() : 1.0f);
+        fsResult << "exactLabel" << exactResult.evaluatedLabel;
+        fsResult << "flannLabel" << flannResult.evaluatedLabel << "}";
     }
+    fsResult << "]";
+
+    const int cntQueryImgs = static_cast<int>(allQueryDescriptors.size());
+
+    float recall = (cntExactNeighbours > 0) ? static_cast<float>(cntFoundNeighbours)/cntExactNeighbours : 1.0f;
+    float ratioTestAgreement = (cntQueryDescriptors > 0) ? static_cast<float>(cntRatioTestAgreements)/cntQueryDescriptors : 1.0f;
+    float labelAgreement = (cntQueryImgs > 0) ? static_cast<float>(cntLabelAgreements)/cntQueryImgs : 1.0f;
+    float exactAccuracy = (cntQueryImgs > 0) ? static_cast<float>(cntExactCorrectLabels)/cntQueryImgs : 0.0f;
+    float flannAccuracy = (cntQueryImgs > 0) ? static_cast<float>(cntFlannCorrectLabels)/cntQueryImgs : 0.0f;
+
+    // QPS is the number of query descriptors searched per second.
+    double exactQps = (exactQueryTime > 0) ? 1000.0*cntQueryDescriptors/exactQueryTime : 0.0;
+    double flannQps = (flannQueryTime > 0) ? 1000.0*cntQueryDescriptors/flannQueryTime : 0.0;
+
+    fsResult << "summary" << "{";
+    fsResult << "trainingImages" << static_cast<int>(allTrainedDescriptors.size());
+    fsResult << "trainingDescriptors" << mergedTrainedDescriptors.rows;
+    fsResult << "queryImages" << cntQueryImgs;
+    fsResult << "queryDescriptors" << cntQueryDescriptors;
+    fsResult << "recall" << recall;
+    fsResult << "ratioTestAgreement" << ratioTestAgreement;
+    fsResult << "labelAgreement" << labelAgreement;
+    fsResult << "exactAccuracy" << exactAccuracy;
+    fsResult << "flannAccuracy" << flannAccuracy;
+    fsResult << "buildTimeMs" << buildTime;
+    fsResult << "exactQueryTimeMs" << exactQueryTime;
+    fsResult << "flannQueryTimeMs" << flannQueryTime;
+    fsResult << "exactQps" << exactQps;
+    fsResult << "flannQps" << flannQps << "}";
 
-    if (bestMatchImageIndex != -1)
-    {
-        evaluatedLabel = matcherTrainedImg2LabelList[bestMatchImageIndex].second;
-        cout << "[INFO]: The maximum good match percentage " << max(maxGoodMatchPercentTest, maxGoodMatchPercentTraining) << "% > "
-                << goodMatchPercentThreshold << "% and the maximum good match count " << maxGoodMatchCnt << " > " << goodMatchCntThreshold
-                << ", so evaluate the class as " << evaluatedLabel << "." << endl;
-    }
-    else
-    {
-        cout << "[INFO]: Either The maximum good match count < " << goodMatchCntThreshold << " or the maximum good match percentage < "
-            << goodMatchPercentThreshold << "%, so evaluate the class as unknown." << endl;
-    }
+    fsResult.release();
 
-    result.evaluatedLabel = evaluatedLabel;
-    result.maxGoodMatchPercentTest = maxGoodMatchPercentTest;
-    result.maxGoodMatchPercentTraining = maxGoodMatchPercentTraining;
-    result.maxGoodMatchCnt = maxGoodMatchCnt;
+    cout << "===============================================================================================" << endl;
+    cout << "[INFO]: Benchmark of the FLANN index " << flannParams.ToString() << " on " << cntQueryImgs
+        << " query images with " << cntQueryDescriptors << " descriptors:" << endl;
+    cout << "===============================================================================================" << endl;
+    cout << "[INFO]: 2-NN recall = " << recall << ", ratio test agreement = " << ratioTestAgreement
+        << ", label agreement = " << labelAgreement << "." << endl;
+    cout << "[INFO]: Label accuracy: exact = " << exactAccuracy << ", FLANN = " << flannAccuracy << "." << endl;
+    cout << "[INFO]: Build time = " << buildTime << " ms, QPS: exact = " << exactQps << ", FLANN = " << flannQps << "." << endl;
+
+    return 0;
 }
 
 void WriteResultsToFile(
@@ -216,8 +1302,8 @@ void WriteResultsToFile(
         cout << "[INFO]: " << img2Result.first << ": expected label = " << img2Result.second.expectedLabel
             << ", evaluated label = " << img2Result.second.evaluatedLabel << ", maxGoodMatchPercentTest = "
             << img2Result.second.maxGoodMatchPercentTest << "%, maxGoodMatchPercentTraining = "
-            << img2Result.second.maxGoodMatchPercentTraining << "% and maxGoodMatchCnt = "
-            << img2Result.second.maxGoodMatchCnt << "." << endl;
+            << img2Result.second.maxGoodMatchPercentTraining << "%, maxGoodMatchCnt = "
+            << img2Result.second.maxGoodMatchCnt << " and inlierCnt = " << img2Result.second.inlierCnt << "." << endl;
     }
 
     cout << "===============================================================================================" << endl;
@@ -253,12 +1339,35 @@ int main(int argc, char** argv)
 {
     po::options_description opt("Options");
     opt.add_options()
-        ("command", po::value<string>()->required(), "train | match | help")   // This is a positional option.
+        ("command", po::value<string>()->required(), "train | autotune | benchmark | match | help")   // This is a positional option.
         ("expected-label,l", po::value<string>(), "The expected label of the image file for SURF matching")
         ("image,i", po::value<string>(), "The image file which will be used for SURF matching")
         ("image-dir,d", po::value<string>(), "The directory of images which will be used for training the FLANN-based matcher or doing the SURF matching")
         ("matcher-file,m", po::value<string>(), "The file which will store the FLANN-based matcher. It is an output for training and an input for SURF matching")
-        ("result,r", po::value<string>(), "The output file which will store the matching results");
+        ("result,r", po::value<string>(), "The output file which will store the matching results")
+        ("validation-dir,v", po::value<string>(), "The directory of held-out images which will be used for autotuning or benchmarking the FLANN index")
+        ("holdout", po::value<int>(), "For benchmarking without a held-out directory, every N-th image of each label in the image directory is held out as a query image. If not specified, default 5.")
+        ("index", po::value<string>(), "The FLANN index (kdtree | kmeans | autotuned | lsh | linear). If not specified, default kdtree.")
+        ("trees", po::value<int>(), "The number of randomized trees of the kdtree index. If not specified, default 4.")
+        ("branching", po::value<int>(), "The branching factor of the kmeans index. If not specified, default 32.")
+        ("iterations", po::value<int>(), "The maximum number of k-means iterations of the kmeans index. If not specified, default 11.")
+        ("target-recall", po::value<float>(), "The target 2-NN recall of the autotuned index and the autotune command. If not specified, default 0.9.")
+        ("lsh-tables", po::value<int>(), "The number of hash tables of the lsh index. If not specified, default 6.")
+        ("lsh-key-size", po::value<int>(), "The hash key size in bits of the lsh index. If not specified, default 12.")
+        ("lsh-probe-level", po::value<int>(), "The multi-probe level of the lsh index. If not specified, default 1.")
+        ("checks", po::value<int>(), "The number of leaves to check in the search. For matching, it overrides the one saved in the matcher file. If not specified, default 32.")
+        ("eps", po::value<float>(), "The approximation factor of the search. For matching, it overrides the one saved in the matcher file. If not specified, default 0.")
+        ("progressive", "For matching, do the knnMatching chunk by chunk in the order of the keypoint response and stop once the label is decided")
+        ("chunk-size", po::value<int>(), "The number of descriptors in each chunk of the progressive knnMatching. If not specified, default 64.")
+        ("pq-subspaces", po::value<int>(), "For training, compress the descriptors by product quantization with the given number of subspaces (e.g., 16 or 32 for the 64-dimensional SURF descriptors) instead of building the FLANN index")
+        ("opq", "For training with product quantization, rotate the descriptors before the quantization (optimized product quantization)")
+        ("verify-top", po::value<int>(), "For matching, verify the given number of top candidate training images with a homography estimated by PROSAC over the good matches, and evaluate the label by the inlier count. It can't be used together with --progressive. If not specified, default 0, i.e., no verification.")
+        ("min-inliers", po::value<int>(), "The minimum inlier count of the best matched training image in the spatial verification. If not specified, default 15.")
+        ("rerank", po::value<int>(), "For matching with the product-quantized descriptors, re-rank the given number of nearest neighbours by the exact distances to the raw descriptors. If not specified, default 0, i.e., no re-ranking.")
+        ("pyramid-scales", po::value<string>(), "For matching, detect and match the downscaled query image at the given comma-separated scales (e.g., 0.25,0.5) first, and escalate to the next finer scale up to the full resolution only if the good match counts are ambiguous. It can't be used together with --progressive or --verify-top.")
+        ("pyramid-accept", po::value<float>(), "The good match percentage of the best matched training image for accepting its label at a coarse pyramid level. If not specified, default 10.")
+        ("pyramid-reject", po::value<float>(), "The good match percentage below which all the training images have to be for evaluating the image as unknown at a coarse pyramid level. If not specified, default 1.")
+        ("keypoint-budget", po::value<int>()->default_value(0), "For training, autotuning and benchmarking, the maximum number of SURF keypoints per image, which are the strongest ones in each cell of a 4x4 grid. It is saved in the matcher file, and the match command applies the saved one to the query images. 0 means no limit.");
 
     po::positional_options_description posOpt;
     posOpt.add("command", 1);   // Only one command is accepted at one execution.
@@ -296,6 +1405,9 @@ int main(int argc, char** argv)
 
     Ptr<FlannBasedSavableMatcher> flannMatcher = FlannBasedSavableMatcher::create();
 
+    // The keypoint budget is given for training, and it is read from the matcher file for matching.
+    int keypointBudget = max(vm["keypoint-budget"].as<int>(), 0);
+
     if (cmd == "help")
     {
         cout << opt << endl;
@@ -316,47 +1428,176 @@ int main(int argc, char** argv)
 
         imgDir = vm["image-dir"].as<string>();
         matcherFile = vm["matcher-file"].as<string>();
-        Utility::SeparateDirFromFilename(matcherFile, matcherFileDir, matcherFilename);
+
+        FlannParams flannParams;
+        if (!ParseFlannParams(vm, flannParams))
+        {
+            return -1;
+        }
 
         cout << "[INFO]: Loading the images, detecting the SURF keypoints and computing the descriptors." << endl;
-        vector<pair<string, string> > label2Imgs;
-        Utility::GetImagesWithLabels(imgDir, label2Imgs);
+        vector<pair<string, string> > trainedImgFilename2LabelList;
+        vector<vector<KeyPoint> > allImgKeypoints;
+        vector<Mat> allImgDescriptors;
+        int error = DetectAndComputeLabelledImages(detector, keypointBudget, imgDir, trainedImgFilename2LabelList, allImgKeypoints, allImgDescriptors);
+        if (error != 0)
+        {
+            return error;
+        }
+
+        if (vm.count("pq-subspaces") > 0)
+        {
+            error = TrainAndSavePqDescriptorStore(vm["pq-subspaces"].as<int>(), (vm.count("opq") > 0),
+                allImgKeypoints, allImgDescriptors, trainedImgFilename2LabelList, keypointBudget, matcherFile);
+        }
+        else
+        {
+            error = TrainAndSaveFlannBasedMatcher(flannParams, allImgKeypoints, allImgDescriptors, trainedImgFilename2LabelList, keypointBudget, matcherFile);
+        }
+
+        if (error != 0)
+        {
+            return error;
+        }
+    }
+    else if (cmd == "autotune")
+    {
+        if (vm.count("image-dir") == 0)
+        {
+            cerr << "[ERROR]: A directory of images is required to be given for training the FLANN-based matcher." << endl << endl;
+            return -1;
+        }
+
+        if (vm.count("validation-dir") == 0)
+        {
+            cerr << "[ERROR]: A directory of held-out images is required to be given for autotuning the FLANN index." << endl << endl;
+            return -1;
+        }
+
+        if (vm.count("matcher-file") == 0)
+        {
+            cerr << "[ERROR]: A yml file is required to be given for saving the trained FLANN-based matcher." << endl << endl;
+            return -1;
+        }
+
+        imgDir = vm["image-dir"].as<string>();
+        string validationDir = vm["validation-dir"].as<string>();
+        matcherFile = vm["matcher-file"].as<string>();
+
+        FlannParams flannParams;
+        if (!ParseFlannParams(vm, flannParams))
+        {
+            return -1;
+        }
 
+        cout << "[INFO]: Loading the training images, detecting the SURF keypoints and computing the descriptors." << endl;
         vector<pair<string, string> > trainedImgFilename2LabelList;
+        vector<vector<KeyPoint> > allImgKeypoints;
         vector<Mat> allImgDescriptors;
-        for (const auto& label2Img : label2Imgs)
+        int error = DetectAndComputeLabelledImages(detector, keypointBudget, imgDir, trainedImgFilename2LabelList, allImgKeypoints, allImgDescriptors);
+        if (error != 0)
         {
-            string imgLabel = label2Img.first;
-            string imgFilename = label2Img.second;
-            string imgFullFilename = imgDir + "/" + imgLabel + "/" + imgFilename;
+            return error;
+        }
 
-            trainedImgFilename2LabelList.push_back(make_pair(imgFilename, imgLabel));
+        cout << "[INFO]: Loading the held-out images, detecting the SURF keypoints and computing the descriptors." << endl;
+        vector<pair<string, string> > validationImgFilename2LabelList;
+        vector<vector<KeyPoint> > allValidationKeypoints;
+        vector<Mat> allValidationDescriptors;
+        error = DetectAndComputeLabelledImages(detector, keypointBudget, validationDir, validationImgFilename2LabelList, allValidationKeypoints, allValidationDescriptors);
+        if (error != 0)
+        {
+            return error;
+        }
 
-            Mat img = imread(imgFullFilename);
+        Mat validationDescriptors;
+        MergeDescriptors(allValidationDescriptors, validationDescriptors);
+        if (validationDescriptors.empty())
+        {
+            cerr << "[ERROR]: No descriptor is found in the held-out images under " << validationDir << "." << endl << endl;
+            return -1;
+        }
+
+        AutotuneFlannParams(allImgDescriptors, validationDescriptors, flannParams.targetRecall, flannParams);
+
+        error = TrainAndSaveFlannBasedMatcher(flannParams, allImgKeypoints, allImgDescriptors, trainedImgFilename2LabelList, keypointBudget, matcherFile);
+        if (error != 0)
+        {
+            return error;
+        }
+    }
+    else if (cmd == "benchmark")
+    {
+        if (vm.count("image-dir") == 0)
+        {
+            cerr << "[ERROR]: A directory of images is required to be given for training the FLANN-based matcher." << endl << endl;
+            return -1;
+        }
 
-            vector<KeyPoint> oneImgKeypoints;
-            Mat oneImgDescriptors;
-            detector->detectAndCompute(img, noArray(), oneImgKeypoints, oneImgDescriptors);
-            allImgDescriptors.push_back(oneImgDescriptors);
+        if (vm.count("result") == 0)
+        {
+            cerr << "[ERROR]: A yml or json file is required to be given for recording the benchmark result." << endl << endl;
+            return -1;
         }
 
-        cout << "[INFO]: Training the FLANN-based matcher with the SURF descriptors of the images." << endl;
+        imgDir = vm["image-dir"].as<string>();
+        resultFile = vm["result"].as<string>();
 
-        flannMatcher->add(allImgDescriptors);
+        FlannParams flannParams;
+        if (!ParseFlannParams(vm, flannParams))
+        {
+            return -1;
+        }
 
-        auto tTrainStart = Clock::now();
-        flannMatcher->train();
-        auto tTrainEnd = Clock::now();
-        cout << "[INFO]: Trained the FLANN-based matcher in " << chrono::duration_cast<chrono::milliseconds>(tTrainEnd - tTrainStart).count()
-            << " ms." << endl;
+        cout << "[INFO]: Loading the training images, detecting the SURF keypoints and computing the descriptors." << endl;
+        vector<pair<string, string> > trainedImgFilename2LabelList;
+        vector<vector<KeyPoint> > allImgKeypoints;
+        vector<Mat> allImgDescriptors;
+        int error = DetectAndComputeLabelledImages(detector, keypointBudget, imgDir, trainedImgFilename2LabelList, allImgKeypoints, allImgDescriptors);
+        if (error != 0)
+        {
+            return error;
+        }
+
+        vector<pair<string, string> > queryImgFilename2LabelList;
+        vector<vector<KeyPoint> > allQueryKeypoints;
+        vector<Mat> allQueryDescriptors;
+        if (vm.count("validation-dir") > 0)
+        {
+            string validationDir = vm["validation-dir"].as<string>();
+
+            cout << "[INFO]: Loading the held-out images, detecting the SURF keypoints and computing the descriptors." << endl;
+            error = DetectAndComputeLabelledImages(detector, keypointBudget, validationDir, queryImgFilename2LabelList, allQueryKeypoints, allQueryDescriptors);
+            if (error != 0)
+            {
+                return error;
+            }
+        }
+        else
+        {
+            int holdoutInterval = 5;
+            if (vm.count("holdout") > 0)
+            {
+                holdoutInterval = vm["holdout"].as<int>();
+            }
 
-        cout << "[INFO]: Saving the trained FLANN-based matcher." << endl;
+            if (holdoutInterval < 2)
+            {
+                cerr << "[ERROR]: The holdout interval " << holdoutInterval << " should be at least 2." << endl << endl;
+                return -1;
+            }
 
-        flannMatcher->setTrainedImgFilename2LabelList(trainedImgFilename2LabelList);
-        flannMatcher->setFlannIndexFileDir(matcherFileDir);
-        flannMatcher->setFlannIndexFilename(matcherFilename + "_klannindex");
+            cout << "[INFO]: Holding out every " << holdoutInterval << "-th image of each label as a query image." << endl;
+            HoldOutLabelledImages(holdoutInterval, trainedImgFilename2LabelList, allImgKeypoints, allImgDescriptors,
+                queryImgFilename2LabelList, allQueryKeypoints, allQueryDescriptors);
+        }
 
-        flannMatcher->save(matcherFile);
+        error = BenchmarkFlannBasedKnnMatch(flannParams, allImgDescriptors, trainedImgFilename2LabelList,
+            allQueryDescriptors, queryImgFilename2LabelList, resultFile);
+        if (error != 0)
+        {
+            return error;
+        }
     }
     else if (cmd == "match")
     {
@@ -389,6 +1630,72 @@ int main(int argc, char** argv)
 
         resultFile = vm["result"].as<string>();
 
+        bool isProgressive = (vm.count("progressive") > 0);
+        int chunkSize = 64;
+        if (vm.count("chunk-size") > 0)
+        {
+            chunkSize = vm["chunk-size"].as<int>();
+        }
+
+        if (chunkSize <= 0)
+        {
+            cerr << "[ERROR]: The chunk size " << chunkSize << " should be positive." << endl << endl;
+            return -1;
+        }
+
+        int verifyTopCnt = 0;
+        if (vm.count("verify-top") > 0)
+        {
+            verifyTopCnt = vm["verify-top"].as<int>();
+        }
+
+        int inlierCntThreshold = 15;
+        if (vm.count("min-inliers") > 0)
+        {
+            inlierCntThreshold = vm["min-inliers"].as<int>();
+        }
+
+        // The early termination of the progressive knnMatching relies on the good match counts, which are not
+        // the decision score any more with the spatial verification.
+        if ((verifyTopCnt > 0) && isProgressive)
+        {
+            cerr << "[WARNING]: The progressive knnMatching is disabled by the spatial verification." << endl;
+            isProgressive = false;
+        }
+
+        vector<float> pyramidScales;
+        if ((vm.count("pyramid-scales") > 0) && !ParsePyramidScales(vm["pyramid-scales"].as<string>(), pyramidScales))
+        {
+            return -1;
+        }
+
+        float pyramidAcceptPercent = 10.0;
+        if (vm.count("pyramid-accept") > 0)
+        {
+            pyramidAcceptPercent = vm["pyramid-accept"].as<float>();
+        }
+
+        float pyramidRejectPercent = 1.0;
+        if (vm.count("pyramid-reject") > 0)
+        {
+            pyramidRejectPercent = vm["pyramid-reject"].as<float>();
+        }
+
+        if (pyramidRejectPercent > pyramidAcceptPercent)
+        {
+            cerr << "[ERROR]: The pyramid reject percentage " << pyramidRejectPercent << "% should not be larger than the pyramid accept percentage "
+                << pyramidAcceptPercent << "%." << endl << endl;
+            return -1;
+        }
+
+        // The coarse levels decide by the good match counts, which are neither the decision score of the spatial
+        // verification nor complete in the progressive knnMatching.
+        if (!pyramidScales.empty() && ((verifyTopCnt > 0) || isProgressive))
+        {
+            cerr << "[WARNING]: The query pyramid is disabled by the spatial verification or the progressive knnMatching." << endl;
+            pyramidScales.clear();
+        }
+
         map<string, string> img2FullFilenameMap;
         map<string, FnnMatchResult> img2ResultMap;
         string imgMapKey;
@@ -439,20 +1746,111 @@ int main(int argc, char** argv)
             }
         }
 
+        int rerankCnt = 0;
+        if (vm.count("rerank") > 0)
+        {
+            rerankCnt = vm["rerank"].as<int>();
+        }
+
         cout << "[INFO]: Loading the trained FLANN-based matcher." << endl;
 
         // Note that imgFilenameList and flannIndexFilename is saved in the matcherFile and will be loaded automatically in load(),
         // so there is no need to set them here.
         auto tLoadStart = Clock::now();
-        InitFlannBasedMatcher(flannMatcher, matcherFileDir, matcherFile);
-        auto tLoadEnd = Clock::now();
+        FileStorage fsMatcher(matcherFile, FileStorage::READ);
+        auto tFileStorageEnd = Clock::now();
+        cout << "[DEBUG]: FileStorage of the matcher file in " << chrono::duration_cast<chrono::milliseconds>(tFileStorageEnd - tLoadStart).count()
+            << " ms." << endl;
 
+        // The matcher file stores either a FLANN-based matcher or a PQ descriptor store, which are told apart by
+        // the name of the top-level node.
+        FileNode matcherNode = fsMatcher.getFirstTopLevelNode();
+        bool isPqDescriptorStore = (matcherNode.name() == "PqDescriptorStore");
+
+        Ptr<PqDescriptorStore> pqStore;
+        KnnMatchFunction knnMatch;
+        vector<int> trainedDescriptorCnts;
         vector<pair<string, string> > matcherTrainedImg2LabelList;
-        matcherTrainedImg2LabelList = flannMatcher->getTrainedImgFilename2LabelList();
+        vector<vector<Point2f> > trainedKeypointPts;
+        if (isPqDescriptorStore)
+        {
+            pqStore = makePtr<PqDescriptorStore>();
+            // The 2 nearest neighbours for the ratio test.
+            const int k = 2;
+            if ((rerankCnt > 0) && (rerankCnt <= k))
+            {
+                cout << "[INFO]: Re-ranking " << rerankCnt << " nearest neighbours can't change the " << k
+                    << " nearest ones, so the raw descriptors aren't mapped." << endl;
+            }
+
+            int error = InitPqDescriptorStore(pqStore, matcherFileDir, matcherNode, k, rerankCnt);
+            if (error != 0)
+            {
+                return error;
+            }
+
+            knnMatch = [&pqStore, k, rerankCnt](const Mat& queryDescriptors, vector<vector<DMatch>>& knnMatches)
+            {
+                pqStore->KnnMatch(queryDescriptors, knnMatches, k, rerankCnt);
+            };
+            trainedDescriptorCnts = pqStore->GetImgDescriptorCnts();
+            matcherTrainedImg2LabelList = pqStore->GetTrainedImgFilename2LabelList();
+            trainedKeypointPts = pqStore->GetTrainedKeypointPts();
+        }
+        else
+        {
+            InitFlannBasedMatcher(flannMatcher, matcherFileDir, matcherNode);
+
+            if ((vm.count("checks") > 0) || (vm.count("eps") > 0))
+            {
+                // Start from the search parameters saved in the matcher file, so only the given one is overridden.
+                FlannParams flannParams;
+                flannMatcher->getSearchParams(flannParams.checks, flannParams.eps);
+                cout << "[INFO]: The saved search parameters are checks = " << flannParams.checks
+                    << " and eps = " << flannParams.eps << "." << endl;
+
+                if (!ParseFlannParams(vm, flannParams))
+                {
+                    return -1;
+                }
+
+                cout << "[INFO]: Overriding the search parameters with checks = " << flannParams.checks
+                    << " and eps = " << flannParams.eps << "." << endl;
+                flannMatcher->setSearchParams(flannParams.CreateSearchParams());
+            }
+
+            knnMatch = [&flannMatcher](const Mat& queryDescriptors, vector<vector<DMatch>>& knnMatches)
+            {
+                flannMatcher->knnMatch(queryDescriptors, knnMatches, 2);
+            };
+            for (const auto& trainedDescriptors : flannMatcher->getTrainDescriptors())
+            {
+                trainedDescriptorCnts.push_back(trainedDescriptors.rows);
+            }
+            matcherTrainedImg2LabelList = flannMatcher->getTrainedImgFilename2LabelList();
+            trainedKeypointPts = flannMatcher->getTrainedKeypointPts();
+        }
+        fsMatcher.release();
+        auto tLoadEnd = Clock::now();
 
-        cout << "[INFO]: Loaded the FLANN-based matcher for " << matcherTrainedImg2LabelList.size() << " labels in "
+        cout << "[INFO]: Loaded the " << (isPqDescriptorStore ? "PQ descriptor store" : "FLANN-based matcher") << " for "
+            << matcherTrainedImg2LabelList.size() << " labels in "
             << chrono::duration_cast<chrono::milliseconds>(tLoadEnd - tLoadStart).count() << " ms." << endl;
 
+        keypointBudget = isPqDescriptorStore ? pqStore->GetKeypointBudget() : flannMatcher->getKeypointBudget();
+        if (keypointBudget > 0)
+        {
+            cout << "[INFO]: Keep at most " << keypointBudget << " keypoints per image as in the training." << endl;
+        }
+
+        if ((verifyTopCnt > 0) && (trainedKeypointPts.size() != matcherTrainedImg2LabelList.size()))
+        {
+            cerr << "[ERROR]: The matcher file " << matcherFile << " doesn't contain the keypoints for the spatial verification. "
+                << "Please train the matcher again." << endl << endl;
+            return -1;
+        }
+
+        vector<int> levelAnsweredCnts(pyramidScales.size());
         auto tMatchStart = Clock::now();
         for (auto& img2Result : img2ResultMap)
         {
@@ -466,24 +1864,77 @@ int main(int argc, char** argv)
                 return -1;
             }
 
+            if (!pyramidScales.empty())
+            {
+                cout << "[INFO]: Doing the coarse-to-fine FLANN-based knnMatching for the image " << imgFullFilename << "." << endl;
+                PyramidFlannBasedKnnMatch(
+                    img,
+                    detector,
+                    keypointBudget,
+                    pyramidScales,
+                    pyramidAcceptPercent,
+                    pyramidRejectPercent,
+                    knnMatch,
+                    trainedDescriptorCnts,
+                    matcherTrainedImg2LabelList,
+                    img2Result.second);
+                levelAnsweredCnts[img2Result.second.pyramidLevel]++;
+                continue;
+            }
+
             cout << "[INFO]: Detecting the SURF keypoints and computing the descriptors of the image "
                 << imgFullFilename << "." << endl;
             vector<KeyPoint> imgKeypoints;
             Mat imgDescriptors;
             detector->detectAndCompute(img, noArray(), imgKeypoints, imgDescriptors);
+            Utility::RetainBestKeypointsInGrid(imgKeypoints, imgDescriptors, img.size(), keypointBudget);
 
             cout << "[INFO]: Doing the FLANN-based knnMatching for the image " << imgFullFilename << "." << endl;
-            FlannBasedKnnMatch(
-                imgDescriptors,
-                flannMatcher,
-                matcherTrainedImg2LabelList,
-                img2Result.first,
-                img2Result.second);
+            if (verifyTopCnt > 0)
+            {
+                VerifiedFlannBasedKnnMatch(
+                    imgKeypoints,
+                    imgDescriptors,
+                    knnMatch,
+                    trainedDescriptorCnts,
+                    trainedKeypointPts,
+                    matcherTrainedImg2LabelList,
+                    verifyTopCnt,
+                    inlierCntThreshold,
+                    img2Result.second);
+            }
+            else if (isProgressive)
+            {
+                ProgressiveFlannBasedKnnMatch(
+                    imgKeypoints,
+                    imgDescriptors,
+                    knnMatch,
+                    trainedDescriptorCnts,
+                    matcherTrainedImg2LabelList,
+                    chunkSize,
+                    img2Result.second);
+            }
+            else
+            {
+                FlannBasedKnnMatch(
+                    imgDescriptors,
+                    knnMatch,
+                    trainedDescriptorCnts,
+                    matcherTrainedImg2LabelList,
+                    img2Result.first,
+                    img2Result.second);
+            }
         }
         auto tMatchEnd = Clock::now();
         cout << "[INFO]: Did the FLANN-based knnMatching for " << img2FullFilenameMap.size() << " images in "
             << chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tMatchStart).count() << " ms." << endl;
 
+        for (int level = 0; level < static_cast<int>(levelAnsweredCnts.size()); ++level)
+        {
+            cout << "[INFO]: Pyramid level " << level << " at scale " << pyramidScales[level] << " answered "
+                << levelAnsweredCnts[level] << " images (" << 100.0*levelAnsweredCnts[level]/img2ResultMap.size() << "%)." << endl;
+        }
+
         WriteResultsToFile(img2ResultMap, resultFile);
     }
     else
@@ -0,0 +1,48 @@
+/*
+ * ExactL2KnnMatcher.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_EXACTL2KNNMATCHER_H_
+#define INCLUDES_EXACTL2KNNMATCHER_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// An exact brute-force matcher for the CV_32F descriptors with the L2 distance. When only two images are matched,
+// building the KD-trees of the FLANN-based matcher may cost more than scanning all the descriptor pairs, so the
+// squared distances are computed tile by tile, i.e., a block of the query descriptors against a tile of the train
+// descriptors which stays in the cache, and the two nearest neighbours of each query descriptor are updated right
+// after each tile rather than from a full distance matrix. The distance kernel uses AVX-512 or AVX2 if the CPU
+// supports them, otherwise a scalar kernel.
+class ExactL2KnnMatcher
+{
+public:
+    // Find the k (1 or 2) nearest neighbours of each query descriptor as done by BFMatcher with NORM_L2.
+    // Return 0 on success, or -1 if the descriptors are not CV_32F or k is not supported.
+    static int KnnMatch(
+        const cv::Mat& queryDescriptors,
+        const cv::Mat& trainDescriptors,
+        std::vector<std::vector<cv::DMatch> >& knnMatches,
+        const int k);
+
+    static int Match(
+        const cv::Mat& queryDescriptors,
+        const cv::Mat& trainDescriptors,
+        std::vector<cv::DMatch>& matches);
+
+    // Whether the exact matching is expected to be faster than building and searching the FLANN index, which is
+    // estimated by the number of descriptor pairs.
+    static bool IsFasterThanFlann(
+        const int queryDescriptorCnt,
+        const int trainDescriptorCnt);
+
+    // The name of the distance kernel selected for the CPU, i.e., "avx512", "avx2" or "scalar".
+    static std::string GetKernelName();
+};
+
+#endif /* INCLUDES_EXACTL2KNNMATCHER_H_ */
@@ -0,0 +1,392 @@
+/*
+ * ExactL2KnnMatcher.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <iostream>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EXACT_L2_HAS_X86_KERNELS
+#endif
+
+#include "ExactL2KnnMatcher.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// The query descriptors are processed in blocks of 4 so that each train descriptor loaded into the registers is
+// reused 4 times, and the train descriptors in tiles of 128 rows, i.e., 32 KB for the 64-dimensional SURF descriptors.
+const int queryBlockSize = 4;
+const int trainTileSize = 128;
+
+// The number of descriptor pairs below which the exact matching is preferred over the FLANN-based matching. The
+// AVX2/AVX-512 kernels scan 4 million pairs of the 64-dimensional descriptors in about 30 ms, which is comparable
+// to building the KD-trees and searching them with the default parameters of FlannBasedMatcher.
+const double maxExactDescriptorPairCnt = 4e6;
+
+// Compute the squared L2 distances between a block of queryBlockSize query descriptors and a tile of train
+// descriptors, where dists[q*trainTileSize + t] is the distance between query q and train t.
+typedef void (*DistanceTileKernel)(
+    const float* const* queryRows,
+    const float* trainTile,
+    const size_t trainStep,
+    const int trainCnt,
+    const int dim,
+    float* dists);
+
+void SquaredL2TileScalar(
+    const float* const* queryRows,
+    const float* trainTile,
+    const size_t trainStep,
+    const int trainCnt,
+    const int dim,
+    float* dists)
+{
+    for (int t = 0; t < trainCnt; ++t)
+    {
+        const float* trainRow = trainTile + t*trainStep;
+        float acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+        for (int i = 0; i < dim; ++i)
+        {
+            float d0 = queryRows[0][i] - trainRow[i];
+            float d1 = queryRows[1][i] - trainRow[i];
+            float d2 = queryRows[2][i] - trainRow[i];
+            float d3 = queryRows[3][i] - trainRow[i];
+            acc0 += d0*d0;
+            acc1 += d1*d1;
+            acc2 += d2*d2;
+            acc3 += d3*d3;
+        }
+
+        dists[t] = acc0;
+        dists[trainTileSize + t] = acc1;
+        dists[2*trainTileSize + t] = acc2;
+        dists[3*trainTileSize + t] = acc3;
+    }
+}
+
+#ifdef EXACT_L2_HAS_X86_KERNELS
+
+// Sum each of the 4 vectors horizontally, i.e., the result is {sum(v0), sum(v1), sum(v2), sum(v3)}, which is
+// cheaper than 4 separate horizontal sums.
+__attribute__((target("avx2,fma")))
+inline __m128 HorizontalSum4Avx2(const __m256 v0, const __m256 v1, const __m256 v2, const __m256 v3)
+{
+    __m256 sum = _mm256_hadd_ps(_mm256_hadd_ps(v0, v1), _mm256_hadd_ps(v2, v3));
+    return _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+}
+
+__attribute__((target("avx2,fma")))
+void SquaredL2TileAvx2(
+    const float* const* queryRows,
+    const float* trainTile,
+    const size_t trainStep,
+    const int trainCnt,
+    const int dim,
+    float* dists)
+{
+    const float* q0 = queryRows[0];
+    const float* q1 = queryRows[1];
+    const float* q2 = queryRows[2];
+    const float* q3 = queryRows[3];
+
+    for (int t = 0; t < trainCnt; ++t)
+    {
+        const float* trainRow = trainTile + t*trainStep;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+
+        int i = 0;
+        for (; i + 8 <= dim; i += 8)
+        {
+            __m256 trainVec = _mm256_loadu_ps(trainRow + i);
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(q0 + i), trainVec);
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(q1 + i), trainVec);
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(q2 + i), trainVec);
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(q3 + i), trainVec);
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        }
+
+        float sums[4];
+        _mm_storeu_ps(sums, HorizontalSum4Avx2(acc0, acc1, acc2, acc3));
+        float sum0 = sums[0];
+        float sum1 = sums[1];
+        float sum2 = sums[2];
+        float sum3 = sums[3];
+        for (; i < dim; ++i)
+        {
+            float d0 = q0[i] - trainRow[i];
+            float d1 = q1[i] - trainRow[i];
+            float d2 = q2[i] - trainRow[i];
+            float d3 = q3[i] - trainRow[i];
+            sum0 += d0*d0;
+            sum1 += d1*d1;
+            sum2 += d2*d2;
+            sum3 += d3*d3;
+        }
+
+        dists[t] = sum0;
+        dists[trainTileSize + t] = sum1;
+        dists[2*trainTileSize + t] = sum2;
+        dists[3*trainTileSize + t] = sum3;
+    }
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void SquaredL2TileAvx512(
+    const float* const* queryRows,
+    const float* trainTile,
+    const size_t trainStep,
+    const int trainCnt,
+    const int dim,
+    float* dists)
+{
+    const float* q0 = queryRows[0];
+    const float* q1 = queryRows[1];
+    const float* q2 = queryRows[2];
+    const float* q3 = queryRows[3];
+
+    for (int t = 0; t < trainCnt; ++t)
+    {
+        const float* trainRow = trainTile + t*trainStep;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps();
+        __m512 acc3 = _mm512_setzero_ps();
+
+        // The tail of the descriptor is loaded with a mask, where the masked-out lanes are zeros in both the query
+        // and the train descriptors and thus don't contribute to the distances.
+        for (int i = 0; i < dim; i += 16)
+        {
+            __mmask16 mask = (dim - i >= 16) ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (dim - i)) - 1);
+            __m512 trainVec = _mm512_maskz_loadu_ps(mask, trainRow + i);
+            __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, q0 + i), trainVec);
+            __m512 d1 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, q1 + i), trainVec);
+            __m512 d2 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, q2 + i), trainVec);
+            __m512 d3 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, q3 + i), trainVec);
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+        }
+
+        // Fold each accumulator into 256 bits and then sum the 4 of them horizontally at once.
+        float sums[4];
+        _mm_storeu_ps(sums, HorizontalSum4Avx2(
+            _mm256_add_ps(_mm512_castps512_ps256(acc0), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc0), 1))),
+            _mm256_add_ps(_mm512_castps512_ps256(acc1), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc1), 1))),
+            _mm256_add_ps(_mm512_castps512_ps256(acc2), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc2), 1))),
+            _mm256_add_ps(_mm512_castps512_ps256(acc3), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc3), 1)))));
+
+        dists[t] = sums[0];
+        dists[trainTileSize + t] = sums[1];
+        dists[2*trainTileSize + t] = sums[2];
+        dists[3*trainTileSize + t] = sums[3];
+    }
+}
+
+#endif
+
+// Select the fastest kernel supported by the CPU once.
+DistanceTileKernel SelectKernel(string& kernelName)
+{
+#ifdef EXACT_L2_HAS_X86_KERNELS
+    __builtin_cpu_init();
+    // The AVX-512 kernel uses the AVX2 horizontal sums as well.
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        kernelName = "avx512";
+        return SquaredL2TileAvx512;
+    }
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        kernelName = "avx2";
+        return SquaredL2TileAvx2;
+    }
+#endif
+
+    kernelName = "scalar";
+    return SquaredL2TileScalar;
+}
+
+string selectedKernelName;
+const DistanceTileKernel selectedKernel = SelectKernel(selectedKernelName);
+
+// Find the (up to) 2 nearest neighbours of each query descriptor, where bestIdxs[2*q + j] and bestDists[2*q + j]
+// are the index and the squared distance of the j-th nearest neighbour of query q, and the index is -1 if there
+// are less than 2 train descriptors.
+void KnnMatchTop2(
+    const float* query,
+    const size_t queryStep,
+    const int queryCnt,
+    const float* train,
+    const size_t trainStep,
+    const int trainCnt,
+    const int dim,
+    int* bestIdxs,
+    float* bestDists)
+{
+    for (int q = 0; q < queryCnt; ++q)
+    {
+        bestIdxs[2*q] = bestIdxs[2*q + 1] = -1;
+        bestDists[2*q] = bestDists[2*q + 1] = FLT_MAX;
+    }
+
+    vector<float> dists(queryBlockSize*trainTileSize);
+    const float* queryRows[queryBlockSize];
+
+    for (int queryStart = 0; queryStart < queryCnt; queryStart += queryBlockSize)
+    {
+        // Pad the last block by repeating its last query descriptor, whose extra distances are ignored.
+        int blockCnt = min(queryBlockSize, queryCnt - queryStart);
+        for (int b = 0; b < queryBlockSize; ++b)
+        {
+            queryRows[b] = query + (queryStart + min(b, blockCnt - 1))*queryStep;
+        }
+
+        for (int trainStart = 0; trainStart < trainCnt; trainStart += trainTileSize)
+        {
+            int tileCnt = min(trainTileSize, trainCnt - trainStart);
+            selectedKernel(queryRows, train + trainStart*trainStep, trainStep, tileCnt, dim, dists.data());
+
+            // Fold the distances of the tile into the two nearest neighbours while they are still in the cache.
+            // The strict comparisons keep the smaller train index on ties as done by BFMatcher.
+            for (int b = 0; b < blockCnt; ++b)
+            {
+                const float* blockDists = dists.data() + b*trainTileSize;
+                int* idxs = bestIdxs + 2*(queryStart + b);
+                float* bests = bestDists + 2*(queryStart + b);
+                float best0 = bests[0], best1 = bests[1];
+                int idx0 = idxs[0], idx1 = idxs[1];
+
+                for (int t = 0; t < tileCnt; ++t)
+                {
+                    float d = blockDists[t];
+                    if (d < best1)
+                    {
+                        if (d < best0)
+                        {
+                            best1 = best0;
+                            idx1 = idx0;
+                            best0 = d;
+                            idx0 = trainStart + t;
+                        }
+                        else
+                        {
+                            best1 = d;
+                            idx1 = trainStart + t;
+                        }
+                    }
+                }
+
+                bests[0] = best0;
+                bests[1] = best1;
+                idxs[0] = idx0;
+                idxs[1] = idx1;
+            }
+        }
+    }
+}
+
+}
+
+int ExactL2KnnMatcher::KnnMatch(
+    const Mat& queryDescriptors,
+    const Mat& trainDescriptors,
+    vector<vector<DMatch> >& knnMatches,
+    const int k)
+{
+    knnMatches.clear();
+
+    if (k < 1 || k > 2)
+    {
+        cerr << "[ERROR]: The exact L2 matcher only supports k = 1 or 2, but k = " << k << "." << endl << endl;
+        return -1;
+    }
+
+    if (queryDescriptors.empty() || trainDescriptors.empty())
+    {
+        knnMatches.resize(queryDescriptors.rows);
+        return 0;
+    }
+
+    if (queryDescriptors.type() != CV_32F || trainDescriptors.type() != CV_32F
+        || queryDescriptors.cols != trainDescriptors.cols)
+    {
+        cerr << "[ERROR]: The exact L2 matcher requires the CV_32F descriptors of the same dimension." << endl << endl;
+        return -1;
+    }
+
+    const int queryCnt = queryDescriptors.rows;
+    vector<int> bestIdxs(2*queryCnt);
+    vector<float> bestDists(2*queryCnt);
+
+    KnnMatchTop2(
+        queryDescriptors.ptr<float>(0),
+        queryDescriptors.step1(),
+        queryCnt,
+        trainDescriptors.ptr<float>(0),
+        trainDescriptors.step1(),
+        trainDescriptors.rows,
+        queryDescriptors.cols,
+        bestIdxs.data(),
+        bestDists.data());
+
+    knnMatches.resize(queryCnt);
+    for (int q = 0; q < queryCnt; ++q)
+    {
+        knnMatches[q].reserve(k);
+        for (int j = 0; j < k && bestIdxs[2*q + j] >= 0; ++j)
+        {
+            knnMatches[q].push_back(DMatch(q, bestIdxs[2*q + j], 0, sqrt(bestDists[2*q + j])));
+        }
+    }
+
+    return 0;
+}
+
+int ExactL2KnnMatcher::Match(
+    const Mat& queryDescriptors,
+    const Mat& trainDescriptors,
+    vector<DMatch>& matches)
+{
+    vector<vector<DMatch> > knnMatches;
+    int ret = KnnMatch(queryDescriptors, trainDescriptors, knnMatches, 1);
+
+    matches.clear();
+    for (auto& knnMatch: knnMatches)
+    {
+        if (!knnMatch.empty())
+        {
+            matches.push_back(knnMatch[0]);
+        }
+    }
+
+    return ret;
+}
+
+bool ExactL2KnnMatcher::IsFasterThanFlann(
+    const int queryDescriptorCnt,
+    const int trainDescriptorCnt)
+{
+    return static_cast<double>(queryDescriptorCnt)*trainDescriptorCnt <= maxExactDescriptorPairCnt;
+}
+
+string ExactL2KnnMatcher::GetKernelName()
+{
+    return selectedKernelName;
+}
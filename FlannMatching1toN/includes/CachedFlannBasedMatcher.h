@@ -0,0 +1,42 @@
+/*
+ * CachedFlannBasedMatcher.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_CACHEDFLANNBASEDMATCHER_H_
+#define INCLUDES_CACHEDFLANNBASEDMATCHER_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace cv
+{
+
+// A FLANN-based matcher whose trained index can be saved into a file and loaded later, so that the index of a
+// reference set doesn't have to be rebuilt by every run.
+class CachedFlannBasedMatcher : public FlannBasedMatcher
+{
+public:
+    CachedFlannBasedMatcher(
+        const Ptr<flann::IndexParams>& indexParams = makePtr<flann::KDTreeIndexParams>(),
+        const Ptr<flann::SearchParams>& searchParams = makePtr<flann::SearchParams>());
+    virtual ~CachedFlannBasedMatcher();
+
+    // Save the trained FLANN index in the raw format of flann::Index::save().
+    void saveIndex(const std::string& indexFile) const;
+
+    // Add the descriptors and load the FLANN index trained with them, after which train() doesn't rebuild the
+    // index. Return false if the index can't be loaded.
+    bool loadIndex(
+        const std::vector<Mat>& descriptors,
+        const std::string& indexFile);
+};
+
+}
+
+#endif /* INCLUDES_CACHEDFLANNBASEDMATCHER_H_ */
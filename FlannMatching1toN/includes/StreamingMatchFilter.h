@@ -0,0 +1,128 @@
+/*
+ * StreamingMatchFilter.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCLUDES_STREAMINGMATCHFILTER_H_
+#define INCLUDES_STREAMINGMATCHFILTER_H_
+
+#include <map>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Consume the matches between a target image and a set of source images one by one, and find the "good" matches,
+// i.e., whose distance is less than minDistFactor*minDist or a small preset threshold, in a single pass.
+//
+// The distance statistics are kept in a histogram and the matches are counted per source image on the fly, so the
+// matches don't have to be materialized. As minDist only decreases, so does the threshold, and a match above the
+// running threshold can never be good. Since the final threshold depends on minDist of all the source images, the
+// good matches can only be counted at Finish(), so the distances of the matches below the running threshold are
+// buffered per source image (4 bytes each), while only the top-K of them per source image are kept as DMatch in a
+// bounded heap. After Finish(), only the top-K good matches of the best matched source image are retained.
+//
+// The filters which have consumed the matches of different source images, e.g., one per thread, can be merged
+// into one before Finish(). The statistics are kept per source image and added up in the order of the source images,
+// so the results don't depend on how the source images are split among the filters or the order they are merged in.
+class StreamingMatchFilter
+{
+private:
+    // The matches with one source image.
+    struct ImageStats
+    {
+        int cntMatches;
+        double sumDist;
+        double minDist;
+
+        // The distances of the matches below the running threshold, which may still be good.
+        std::vector<float> candidateDists;
+
+        // The top-K matches below the running threshold as a max-heap by the distance, i.e., the front is the worst.
+        std::vector<cv::DMatch> topMatches;
+
+        ImageStats();
+    };
+
+    int m_cntImages;
+    int m_topK;
+    double m_minDistFactor;
+    double m_presetMaxGoodDist;
+
+    // The distance statistics.
+    size_t m_cntMatches;
+    double m_minDist;
+    double m_maxDist;
+    double m_histMax;
+    std::vector<int> m_hist;
+
+    // Only the source images which have any match are kept, so a filter of a few source images stays small.
+    std::map<int, ImageStats> m_allImageStats;
+
+    // The candidates are pruned whenever they have doubled since the last pruning, so each of them is pruned at most
+    // once on average.
+    size_t m_cntCandidates;
+    size_t m_cntCandidatesAfterPrune;
+    size_t m_peakCntCandidates;
+
+    bool m_isFinished;
+    double m_sumDist;
+    int m_bestImgIdx;
+    std::vector<int> m_matchCnts;
+    std::vector<int> m_goodMatchCnts;
+    std::vector<cv::DMatch> m_topGoodMatches;
+
+    double GetThreshold() const;
+    void PushTopMatch(ImageStats& imageStats, const cv::DMatch& match) const;
+    void PruneCandidates();
+
+public:
+    // topK is the number of the good matches of the best matched source image to keep, where 0 keeps none of them
+    // and a negative value keeps all of them. histMax is the upper bound of the distances covered by the histogram,
+    // e.g., 2 for the L2-normalized SURF descriptors or the bit count of the ORB descriptors. Larger distances fall
+    // into the last bin.
+    StreamingMatchFilter(
+        const int cntImages,
+        const int topK,
+        const double histMax,
+        const int histBins = 256,
+        const double minDistFactor = 5.0,
+        const double presetMaxGoodDist = 0.02);
+
+    void Consume(const cv::DMatch& match);
+    void Consume(const std::vector<cv::DMatch>& matches);
+
+    // Add the matches consumed by another filter with the same parameters as if this filter had consumed them.
+    // Neither filter may have been finished.
+    void Merge(const StreamingMatchFilter& other);
+
+    // Apply the final threshold, count the good matches per source image, find the best matched source image and
+    // keep its top-K good matches. No match may be consumed afterwards.
+    void Finish();
+
+    size_t GetMatchCnt() const;
+    double GetMinDist() const;
+    double GetMaxDist() const;
+
+    // Estimate the q-quantile (0 <= q <= 1) of the distances from the histogram.
+    double GetDistQuantile(const double q) const;
+
+    // The final threshold for the good matches.
+    double GetGoodDistThreshold() const;
+
+    // The following are valid after Finish().
+    double GetMeanDist() const;
+    const std::vector<int>& GetMatchCnts() const;
+    const std::vector<int>& GetGoodMatchCnts() const;
+    int GetBestImgIdx() const;
+
+    // The top-K good matches of the best matched source image sorted by the distance, which is empty for topK = 0.
+    const std::vector<cv::DMatch>& GetTopGoodMatches() const;
+
+    // The largest number of the candidates which have been buffered at the same time. For the merged filters, it is
+    // the sum of their peaks, which bounds the peak of the filters consuming concurrently.
+    size_t GetPeakCandidateCnt() const;
+};
+
+#endif /* INCLUDES_STREAMINGMATCHFILTER_H_ */
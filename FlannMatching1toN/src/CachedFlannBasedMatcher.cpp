@@ -0,0 +1,82 @@
+/*
+ * CachedFlannBasedMatcher.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cstdio>
+
+#include "CachedFlannBasedMatcher.h"
+
+using namespace std;
+
+namespace cv
+{
+
+CachedFlannBasedMatcher::CachedFlannBasedMatcher(
+    const Ptr<flann::IndexParams>& indexParams,
+    const Ptr<flann::SearchParams>& searchParams) :
+    FlannBasedMatcher(indexParams, searchParams)
+{
+
+}
+
+CachedFlannBasedMatcher::~CachedFlannBasedMatcher()
+{
+
+}
+
+void CachedFlannBasedMatcher::saveIndex(const string& indexFile) const
+{
+    // Note that flann::Index::save() writes the index data in a raw format and doesn't support serialization,
+    // so the index has to be written into a separate file.
+    flannIndex->save(indexFile);
+}
+
+bool CachedFlannBasedMatcher::loadIndex(
+    const vector<Mat>& descriptors,
+    const string& indexFile)
+{
+    // Add the descriptors to the matcher and update all the related descriptors as train() does, but load the
+    // index instead of building it.
+    FlannBasedMatcher::add(descriptors);
+    if (!utrainDescCollection.empty())
+    {
+        CV_Assert(trainDescCollection.size() == 0);
+        for (size_t i = 0; i < utrainDescCollection.size(); ++i)
+        {
+            trainDescCollection.push_back(utrainDescCollection[i].getMat(ACCESS_READ));
+        }
+    }
+    mergedDescriptors.set(trainDescCollection);
+
+    flannIndex.release();
+    flannIndex = makePtr<flann::Index>();
+    bool isLoaded = false;
+    try
+    {
+        isLoaded = flannIndex->load(mergedDescriptors.getDescriptors(), indexFile);
+    }
+    catch (const cv::Exception& e)
+    {
+        printf("Error: %s\n", e.what());
+    }
+    catch (const std::exception& e)
+    {
+        // A truncated or corrupt index file may also fail in FLANN itself, which throws cvflann::FLANNException.
+        printf("Error: %s\n", e.what());
+    }
+
+    if (!isLoaded)
+    {
+        // Drop the half-loaded state so that train() builds the index from scratch.
+        clear();
+        flannIndex.release();
+        return false;
+    }
+
+    return true;
+}
+
+}
@@ -11,16 +11,22 @@
 #include <dirent.h>
 #include <errno.h>
 #include <cstdio>
+#include <cstdlib>
+#include <cfloat>
 #include <vector>
 #include <string>
 #include <chrono>
 #include <iterator>
 #include <algorithm>
+#include <fstream>
 #include "opencv2/core.hpp"
 #include "opencv2/features2d.hpp"
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
 #include "opencv2/xfeatures2d.hpp"
+#include "CachedFlannBasedMatcher.h"
+#include "ReferenceSetCache.h"
+#include "StreamingMatchFilter.h"
 
 using namespace std;
 using namespace cv;
@@ -29,13 +35,16 @@ using namespace cv::xfeatures2d;
 typedef std::chrono::high_resolution_clock Clock;
 
 const double presetMaxGoodDist = 0.02;
+const double minDistFactor = 5.0;
+const int distHistBins = 256;
+const int maxDrawnGoodMatches = 100;
 
 /*
  * @function Readme()
  */
 void Readme()
 {
-    printf(" Usage: ./FlannMatching1toN [surf/orb] [slow/fast] <source_image_directory> <target_image>\n");
+    printf(" Usage: ./FlannMatching1toN [surf/orb] [slow/fast/parallel/bench] <source_image_directory> <target_image | target_image_directory | target_list.txt> [reference_cache_file | -] [keypoint_budget]\n");
 }
 
 /*
@@ -83,79 +92,191 @@ int GetDirFiles(const string& dir, vector<string>& files)
 }
 
 /*
- * @function FindBestMatchedImageSlow()
+ * @function GetTargetFiles()
+ * @brief Get the target image files, which are given by a single image, a directory of images or a text file listing
+ * one image per line. Return 0 on success, or errno if the directory or the list can't be opened.
  */
-int FindBestMatchedImageSlow(
-    const vector<string>& srcFiles,
-    const Ptr<FlannBasedMatcher>& matcher,
-    const vector<Mat>& allSrcDescriptors,
-    const Mat& targetDescriptors,
-    vector<DMatch>& allMatches,
-    vector<DMatch>& allGoodMatches,
-    double& matchedPercentage)
+int GetTargetFiles(const string& target, vector<string>& targetFiles, bool& isBatch)
 {
-    double minDist = DBL_MAX;
-    double maxDist = 0;
+    struct stat info;
 
-    auto tMatchStart = Clock::now();
+    targetFiles.clear();
+    isBatch = false;
 
-    // Match the descriptor vectors between the target image and each source image.
-    for (int srcIndex = 0; srcIndex < static_cast<int>(allSrcDescriptors.size()); srcIndex++)
+    if (stat(target.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
     {
-        // There are two match methods: one for object recognition and the other for tracking.
-        // Here we are using the one for tracking.
-        vector<DMatch> oneMatches;
-        matcher->match(targetDescriptors, allSrcDescriptors[srcIndex], oneMatches);
+        isBatch = true;
+        return GetDirFiles(target, targetFiles);
+    }
 
-        // Set the imgIdx of oneMatches. Also update the min and max distances.
-        for (auto& match: oneMatches)
+    if (target.size() > 4 && target.compare(target.size() - 4, 4, ".txt") == 0)
+    {
+        ifstream listFile(target);
+        if (!listFile.is_open())
         {
-            match.imgIdx = srcIndex;
-            allMatches.push_back(match);
-
-            double dist = match.distance;
-            if (dist < minDist)
-            {
-                minDist = dist;
-            }
+            printf("Error: can't open the target list %s.\n", target.c_str());
+            return ENOENT;
+        }
 
-            if (dist > maxDist)
+        isBatch = true;
+        string line;
+        while (getline(listFile, line))
+        {
+            if (!line.empty())
             {
-                maxDist = dist;
+                targetFiles.push_back(line);
             }
         }
+
+        return 0;
     }
 
-    auto tMatchEnd = Clock::now();
+    targetFiles.push_back(target);
+    return 0;
+}
 
-    printf("======================================================================\n");
-    printf("The time for matching the descriptors of %lu images: %ld milliseconds\n",
-            allSrcDescriptors.size(), chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tMatchStart).count());
+/*
+ * @function CreateDetector()
+ */
+Ptr<Feature2D> CreateDetector(const string& detectorMethod)
+{
+    if (detectorMethod == "surf")
+    {
+        const int minHessian = 400;
+        return SURF::create(minHessian);
+    }
+    else if (detectorMethod == "orb")
+    {
+        return ORB::create();
+    }
 
-    printf("======================================================================\n");
-    printf("Min Dist: %f \n", minDist);
-    printf("Max Dist: %f \n", maxDist);
+    return Ptr<Feature2D>();
+}
+
+/*
+ * @function RetainBestKeypointsInGrid()
+ * @brief Keep at most keypointBudget keypoints together with their descriptors. The image is divided into a
+ * gridSize x gridSize grid, and the strongest keypoints by the response are kept in each cell for the spatial
+ * coverage. The kept keypoints are sorted by the response in the descending order. A budget <= 0 keeps all.
+ */
+void RetainBestKeypointsInGrid(
+    vector<KeyPoint>& keypoints,
+    Mat& descriptors,
+    const Size& imgSize,
+    const int keypointBudget,
+    const int gridSize = 4)
+{
+    if ((keypointBudget <= 0) || (static_cast<int>(keypoints.size()) <= keypointBudget))
+    {
+        return;
+    }
 
-    // Find only "good" matches, i.e., whose distance is less than 5*minDist, or a small preset
-    // threshold (e.g., 0.02) in case that minDist is very small.
-    vector<int> matchCnts(allSrcDescriptors.size());
-    vector<int> goodMatchCnts(allSrcDescriptors.size());
-    for (auto& match: allMatches)
+    // Bucket the keypoints by a gridSize x gridSize grid over the image.
+    int cntCells = gridSize*gridSize;
+    vector<vector<int> > cellKeypointIdxs(cntCells);
+    for (int keypointIdx = 0; keypointIdx < static_cast<int>(keypoints.size()); ++keypointIdx)
     {
-        if (match.distance <= max(5*minDist, presetMaxGoodDist))
+        const Point2f& pt = keypoints[keypointIdx].pt;
+        int col = min(max(static_cast<int>(pt.x*gridSize/max(imgSize.width, 1)), 0), gridSize - 1);
+        int row = min(max(static_cast<int>(pt.y*gridSize/max(imgSize.height, 1)), 0), gridSize - 1);
+        cellKeypointIdxs[row*gridSize + col].push_back(keypointIdx);
+    }
+
+    auto byResponse = [&keypoints](const int lhs, const int rhs)
         {
-            allGoodMatches.push_back(match);
-            goodMatchCnts[match.imgIdx]++;
+            return keypoints[lhs].response > keypoints[rhs].response;
+        };
+
+    // Take the strongest keypoints of each cell up to an equal share of the budget, so that all the parts of the
+    // image are covered. The share left by the sparse cells goes to the strongest of the remaining keypoints.
+    int cellQuota = keypointBudget/cntCells;
+    vector<int> keptIdxs;
+    vector<int> remainingIdxs;
+    for (auto& oneCellIdxs : cellKeypointIdxs)
+    {
+        stable_sort(oneCellIdxs.begin(), oneCellIdxs.end(), byResponse);
+
+        int cntKept = min(cellQuota, static_cast<int>(oneCellIdxs.size()));
+        keptIdxs.insert(keptIdxs.end(), oneCellIdxs.begin(), oneCellIdxs.begin() + cntKept);
+        remainingIdxs.insert(remainingIdxs.end(), oneCellIdxs.begin() + cntKept, oneCellIdxs.end());
+    }
+
+    stable_sort(remainingIdxs.begin(), remainingIdxs.end(), byResponse);
+    int cntLeft = min(keypointBudget - static_cast<int>(keptIdxs.size()), static_cast<int>(remainingIdxs.size()));
+    keptIdxs.insert(keptIdxs.end(), remainingIdxs.begin(), remainingIdxs.begin() + cntLeft);
+
+    // Sort the kept keypoints by the response, so a truncated prefix of the descriptors is still the strongest.
+    stable_sort(keptIdxs.begin(), keptIdxs.end(), byResponse);
+
+    vector<KeyPoint> keptKeypoints;
+    keptKeypoints.reserve(keptIdxs.size());
+    Mat keptDescriptors;
+    if (!descriptors.empty())
+    {
+        keptDescriptors.create(static_cast<int>(keptIdxs.size()), descriptors.cols, descriptors.type());
+    }
+
+    for (int keptIndex = 0; keptIndex < static_cast<int>(keptIdxs.size()); ++keptIndex)
+    {
+        keptKeypoints.push_back(keypoints[keptIdxs[keptIndex]]);
+        if (!descriptors.empty())
+        {
+            descriptors.row(keptIdxs[keptIndex]).copyTo(keptDescriptors.row(keptIndex));
         }
+    }
+
+    keypoints.swap(keptKeypoints);
+    descriptors = keptDescriptors;
+}
 
-        matchCnts[match.imgIdx]++;
+/*
+ * @function GetMaxDescriptorDist()
+ * @brief Return the upper bound of the distances between the descriptors, which is the range of the histogram of
+ * the StreamingMatchFilter: the bit count for the binary descriptors (e.g., ORB) compared with the Hamming distance,
+ * and 2 for the L2-normalized float descriptors (e.g., SURF).
+ */
+double GetMaxDescriptorDist(const Mat& descriptors)
+{
+    if (descriptors.depth() == CV_8U)
+    {
+        return 8.0 * descriptors.cols;
     }
 
-    // Find the best matched source image (i.e., with the most "good matches").
-    auto bestMatchImageIt = max_element(goodMatchCnts.begin(), goodMatchCnts.end());
-    int bestMatchImageIndex = distance(goodMatchCnts.begin(), bestMatchImageIt);
+    return 2.0;
+}
+
+/*
+ * @function ReportBestMatchedImage()
+ */
+int ReportBestMatchedImage(
+    const vector<string>& srcFiles,
+    StreamingMatchFilter& filter,
+    const int targetDescriptorCnt,
+    double& matchedPercentage,
+    const bool verbose)
+{
+    // Only "good" matches are counted, i.e., whose distance is less than 5*minDist, or a small preset threshold
+    // (e.g., 0.02) in case that minDist is very small. The filter has counted them while consuming the matches.
+    filter.Finish();
+
+    // The best matched source image is the one with the most "good matches".
+    int bestMatchImageIndex = filter.GetBestImgIdx();
+    int bestGoodMatchCnt = (bestMatchImageIndex >= 0) ? filter.GetGoodMatchCnts()[bestMatchImageIndex] : 0;
 
-    matchedPercentage = 100.0 * (*bestMatchImageIt) / targetDescriptors.rows;
+    matchedPercentage = (targetDescriptorCnt > 0) ? 100.0 * bestGoodMatchCnt / targetDescriptorCnt : 0.0;
+
+    if (!verbose)
+    {
+        return bestMatchImageIndex;
+    }
+
+    printf("======================================================================\n");
+    printf("Min Dist: %f \n", filter.GetMinDist());
+    printf("Max Dist: %f \n", filter.GetMaxDist());
+    printf("Mean Dist: %f \n", filter.GetMeanDist());
+    printf("Median Dist (from the histogram): %f \n", filter.GetDistQuantile(0.5));
+    printf("Good Dist threshold: %f \n", filter.GetGoodDistThreshold());
+    printf("Buffered at most %lu of %lu matches while filtering\n", filter.GetPeakCandidateCnt(), filter.GetMatchCnt());
 
     printf("======================================================================\n");
     printf("The index of the best matched source image is %d with the matched percentage %f%%\n",
@@ -163,15 +284,58 @@ int FindBestMatchedImageSlow(
 
     printf("======================================================================\n");
     printf("The counts of matches and good matches for each source image: \n");
-    for (size_t srcImgIndex = 0; srcImgIndex < allSrcDescriptors.size(); srcImgIndex++)
+    for (size_t srcImgIndex = 0; srcImgIndex < srcFiles.size(); srcImgIndex++)
     {
         printf("\tsrc image %s: match# = %d, good match# = %d\n",
-                srcFiles[srcImgIndex].c_str(), matchCnts[srcImgIndex], goodMatchCnts[srcImgIndex]);
+                srcFiles[srcImgIndex].c_str(), filter.GetMatchCnts()[srcImgIndex], filter.GetGoodMatchCnts()[srcImgIndex]);
     }
 
     return bestMatchImageIndex;
 }
 
+/*
+ * @function FindBestMatchedImageSlow()
+ */
+int FindBestMatchedImageSlow(
+    const vector<string>& srcFiles,
+    const Ptr<FlannBasedMatcher>& matcher,
+    const vector<Mat>& allSrcDescriptors,
+    const Mat& targetDescriptors,
+    StreamingMatchFilter& filter,
+    double& matchedPercentage,
+    const bool verbose = true)
+{
+    auto tMatchStart = Clock::now();
+
+    // Match the descriptor vectors between the target image and each source image.
+    vector<DMatch> oneMatches;
+    for (int srcIndex = 0; srcIndex < static_cast<int>(allSrcDescriptors.size()); srcIndex++)
+    {
+        // There are two match methods: one for object recognition and the other for tracking.
+        // Here we are using the one for tracking.
+        matcher->match(targetDescriptors, allSrcDescriptors[srcIndex], oneMatches);
+
+        // Set the imgIdx of oneMatches and feed them to the filter, so only the matches of one source image
+        // are held at a time.
+        for (auto& match: oneMatches)
+        {
+            match.imgIdx = srcIndex;
+            filter.Consume(match);
+        }
+    }
+
+    auto tMatchEnd = Clock::now();
+
+    if (verbose)
+    {
+        printf("======================================================================\n");
+        printf("The time for matching the descriptors of %lu images: %ld milliseconds\n",
+                allSrcDescriptors.size(), chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tMatchStart).count());
+    }
+
+    return ReportBestMatchedImage(srcFiles, filter, targetDescriptors.rows, matchedPercentage, verbose);
+}
+
 /*
  * @function FindBestMatchedImageFast()
  */
@@ -180,12 +344,19 @@ int FindBestMatchedImageFast(
     const Ptr<FlannBasedMatcher>& matcher,
     const vector<Mat>& allSrcDescriptors,
     const Mat& targetDescriptors,
-    vector<DMatch>& allMatches,
-    vector<DMatch>& allGoodMatches,
-    double& matchedPercentage)
+    StreamingMatchFilter& filter,
+    double& matchedPercentage,
+    const bool verbose = true)
 {
-    // Add the descriptors of the source images as the train descriptors.
-    matcher->add(allSrcDescriptors);
+    // The target descriptors are matched in chunks of rows, so only the matches of one chunk are held at a time.
+    const int queryChunkRows = 1024;
+
+    // Add the descriptors of the source images as the train descriptors, unless the matcher has been loaded
+    // from the reference set cache with the descriptors and the trained index.
+    if (matcher->getTrainDescriptors().empty())
+    {
+        matcher->add(allSrcDescriptors);
+    }
 
     // Train the matcher. Note that this train step may not be necessary, since at the beginning of
     // each match() function it will train the matcher if the train step is not done.
@@ -198,70 +369,366 @@ int FindBestMatchedImageFast(
     // Match the descriptor vectors between the target image and all source images.
     // There are two match methods: one for object recognition and the other for tracking.
     // Here we are using the one for object recognition.
-    matcher->match(targetDescriptors, allMatches);
+    vector<DMatch> chunkMatches;
+    for (int rowStart = 0; rowStart < targetDescriptors.rows; rowStart += queryChunkRows)
+    {
+        int rowEnd = min(rowStart + queryChunkRows, targetDescriptors.rows);
+        matcher->match(targetDescriptors.rowRange(rowStart, rowEnd), chunkMatches);
+
+        for (auto& match: chunkMatches)
+        {
+            match.queryIdx += rowStart;
+            filter.Consume(match);
+        }
+    }
 
     auto tMatchEnd = Clock::now();
 
-    printf("======================================================================\n");
-    printf("The time for matching the descriptors of %lu images: %ld milliseconds\n",
-            allSrcDescriptors.size(), chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tMatchStart).count());
+    if (verbose)
+    {
+        printf("======================================================================\n");
+        printf("The time for matching the descriptors of %lu images: %ld milliseconds\n",
+                allSrcDescriptors.size(), chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tMatchStart).count());
+    }
+
+    return ReportBestMatchedImage(srcFiles, filter, targetDescriptors.rows, matchedPercentage, verbose);
+}
 
-    // Traverse all the matches and obtain the min and max distances.
-    double minDist = DBL_MAX;
-    double maxDist = 0;
-    for (auto& match: allMatches)
+/*
+ * @class PerImageMatchBody
+ * @brief Match the target descriptors with the descriptors of a range of source images, where each source image
+ * has its own FLANN index as in the slow mode, and feed the matches of each source image to the filter of the stripe
+ * as soon as it is matched.
+ */
+class PerImageMatchBody : public ParallelLoopBody
+{
+private:
+    const Ptr<FlannBasedMatcher>& m_matcher;
+    const vector<Mat>& m_allSrcDescriptors;
+    const Mat& m_targetDescriptors;
+
+    // One filter per stripe, indexed by the start of the range of the stripe. The ranges of the stripes are disjoint,
+    // so each filter is only fed by one stripe and no lock is needed.
+    vector<StreamingMatchFilter>& m_stripeFilters;
+
+public:
+    PerImageMatchBody(
+        const Ptr<FlannBasedMatcher>& matcher,
+        const vector<Mat>& allSrcDescriptors,
+        const Mat& targetDescriptors,
+        vector<StreamingMatchFilter>& stripeFilters) :
+        m_matcher(matcher),
+        m_allSrcDescriptors(allSrcDescriptors),
+        m_targetDescriptors(targetDescriptors),
+        m_stripeFilters(stripeFilters)
     {
-        double dist = match.distance;
+    }
 
-        if (dist < minDist)
-        {
-            minDist = dist;
-        }
+    virtual void operator()(const Range& range) const
+    {
+        // Each stripe uses its own copy of the matcher (with the same index and search parameters), so the threads
+        // don't share any state of the matcher.
+        Ptr<DescriptorMatcher> stripeMatcher = m_matcher->clone(true);
+        StreamingMatchFilter& stripeFilter = m_stripeFilters[range.start];
 
-        if (dist > maxDist)
+        vector<DMatch> oneMatches;
+        for (int srcIndex = range.start; srcIndex < range.end; srcIndex++)
         {
-            maxDist = dist;
+            stripeMatcher->match(m_targetDescriptors, m_allSrcDescriptors[srcIndex], oneMatches);
+
+            for (auto& match: oneMatches)
+            {
+                match.imgIdx = srcIndex;
+            }
+
+            stripeFilter.Consume(oneMatches);
         }
     }
+};
+
+/*
+ * @function FindBestMatchedImageParallel()
+ */
+int FindBestMatchedImageParallel(
+    const vector<string>& srcFiles,
+    const Ptr<FlannBasedMatcher>& matcher,
+    const vector<Mat>& allSrcDescriptors,
+    const Mat& targetDescriptors,
+    StreamingMatchFilter& filter,
+    double& matchedPercentage,
+    const bool verbose = true)
+{
+    auto tMatchStart = Clock::now();
+
+    // Match the descriptor vectors between the target image and the source images concurrently on the thread pool
+    // of OpenCV, where one stripe per source image keeps the threads busy even if the images differ in size. Each
+    // stripe feeds the matches of the source image it has matched to its own filter, which starts as a copy of the
+    // given filter that hasn't consumed any match yet, and the filters are merged after all the stripes are done.
+    // The statistics are kept per source image, so the result is the same as in the slow mode regardless of how the
+    // source images are split among the stripes.
+    vector<StreamingMatchFilter> stripeFilters(allSrcDescriptors.size(), filter);
+    parallel_for_(
+        Range(0, static_cast<int>(allSrcDescriptors.size())),
+        PerImageMatchBody(matcher, allSrcDescriptors, targetDescriptors, stripeFilters),
+        static_cast<double>(allSrcDescriptors.size()));
+
+    for (auto& stripeFilter: stripeFilters)
+    {
+        filter.Merge(stripeFilter);
+    }
+
+    auto tMatchEnd = Clock::now();
+
+    if (verbose)
+    {
+        printf("======================================================================\n");
+        printf("The time for matching the descriptors of %lu images with %d threads: %ld milliseconds\n",
+                allSrcDescriptors.size(), getNumThreads(),
+                chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tMatchStart).count());
+    }
+
+    return ReportBestMatchedImage(srcFiles, filter, targetDescriptors.rows, matchedPercentage, verbose);
+}
+
+/*
+ * @function BenchmarkFindBestMatchedImage()
+ * @brief Run the slow, fast and parallel modes on the same descriptors and print their running times, so the
+ * mode can be picked per workload. Return the index of the best matched source image of the parallel mode.
+ */
+int BenchmarkFindBestMatchedImage(
+    const vector<string>& srcFiles,
+    const Ptr<FlannBasedMatcher>& matcher,
+    const vector<Mat>& allSrcDescriptors,
+    const Mat& targetDescriptors,
+    StreamingMatchFilter& filter,
+    double& matchedPercentage)
+{
+    const int benchRepeats = 3;
+    const char* modes[] = { "slow", "fast", "parallel" };
+
+    int bestMatchImageIndex = -1;
 
     printf("======================================================================\n");
-    printf("Min Dist: %f \n", minDist);
-    printf("Max Dist: %f \n", maxDist);
+    printf("Benchmarking the match modes with %lu source images, %d target descriptors and %d threads (%d runs each):\n",
+            allSrcDescriptors.size(), targetDescriptors.rows, getNumThreads(), benchRepeats);
+    printf("\t%-10s %12s %12s %12s %12s\n", "mode", "min (ms)", "mean (ms)", "best image", "matched %");
 
-    // Find only "good" matches, i.e., whose distance is less than 5*minDist, or a small preset
-    // threshold (e.g., 0.02) in case that minDist is very small.
-    vector<int> matchCnts(allSrcDescriptors.size());
-    vector<int> goodMatchCnts(allSrcDescriptors.size());
-    for (auto& match: allMatches)
+    for (int modeIndex = 0; modeIndex < 3; modeIndex++)
     {
-        if (match.distance <= max(5*minDist, presetMaxGoodDist))
+        double minMs = DBL_MAX;
+        double sumMs = 0.0;
+        int modeBestMatchImageIndex = -1;
+        double modeMatchedPercentage = 0.0;
+
+        for (int repeat = 0; repeat < benchRepeats; repeat++)
         {
-            allGoodMatches.push_back(match);
-            goodMatchCnts[match.imgIdx]++;
+            // The fast mode adds the descriptors to the matcher, so each run starts from a fresh copy of the matcher.
+            // Likewise each run starts from a copy of the given filter, which hasn't consumed any match yet.
+            Ptr<FlannBasedMatcher> runMatcher = matcher->clone(true).dynamicCast<FlannBasedMatcher>();
+            StreamingMatchFilter runFilter(filter);
+
+            auto tRunStart = Clock::now();
+            if (modeIndex == 0)
+            {
+                modeBestMatchImageIndex = FindBestMatchedImageSlow(srcFiles, runMatcher, allSrcDescriptors, targetDescriptors,
+                        runFilter, modeMatchedPercentage, false);
+            }
+            else if (modeIndex == 1)
+            {
+                modeBestMatchImageIndex = FindBestMatchedImageFast(srcFiles, runMatcher, allSrcDescriptors, targetDescriptors,
+                        runFilter, modeMatchedPercentage, false);
+            }
+            else
+            {
+                modeBestMatchImageIndex = FindBestMatchedImageParallel(srcFiles, runMatcher, allSrcDescriptors, targetDescriptors,
+                        runFilter, modeMatchedPercentage, false);
+            }
+            auto tRunEnd = Clock::now();
+
+            double runMs = chrono::duration<double, milli>(tRunEnd - tRunStart).count();
+            minMs = min(minMs, runMs);
+            sumMs += runMs;
+
+            if (modeIndex == 2 && repeat == benchRepeats - 1)
+            {
+                filter = runFilter;
+                matchedPercentage = modeMatchedPercentage;
+                bestMatchImageIndex = modeBestMatchImageIndex;
+            }
         }
 
-        matchCnts[match.imgIdx]++;
+        printf("\t%-10s %12.1f %12.1f %12d %12.3f\n",
+                modes[modeIndex], minMs, sumMs / benchRepeats, modeBestMatchImageIndex, modeMatchedPercentage);
     }
 
-    // Find the best matched source image (i.e., with the most "good matches").
-    auto bestMatchImageIt = max_element(goodMatchCnts.begin(), goodMatchCnts.end());
-    int bestMatchImageIndex = distance(goodMatchCnts.begin(), bestMatchImageIt);
+    return bestMatchImageIndex;
+}
 
-    matchedPercentage = 100.0 * (*bestMatchImageIt) / targetDescriptors.rows;
+/*
+ * @struct TargetResult
+ * @brief The result of matching one target image in the batch mode.
+ */
+struct TargetResult
+{
+    bool isLoaded;
+    int descriptorCnt;
+    int bestMatchImageIndex;
+    int goodMatchCnt;
+    double matchedPercentage;
+    double detectMs;
+    double matchMs;
+
+    TargetResult() :
+        isLoaded(false),
+        descriptorCnt(0),
+        bestMatchImageIndex(-1),
+        goodMatchCnt(0),
+        matchedPercentage(0.0),
+        detectMs(0.0),
+        matchMs(0.0)
+    {
+    }
+};
 
-    printf("======================================================================\n");
-    printf("The index of the best matched source image is %d with the matched percentage %f%%\n",
-            bestMatchImageIndex, matchedPercentage);
+/*
+ * @class BatchTargetMatchBody
+ * @brief Detect and match a range of target images with the trained matcher of the source images.
+ */
+class BatchTargetMatchBody : public ParallelLoopBody
+{
+private:
+    const string& m_detectorMethod;
+    const int m_keypointBudget;
+    const vector<string>& m_srcFiles;
+    const Ptr<FlannBasedMatcher>& m_matcher;
+    const vector<Mat>& m_allSrcDescriptors;
+    const vector<string>& m_targetFiles;
+
+    // Each target image is processed by exactly one stripe, so no lock is needed when the stripes write their results.
+    vector<TargetResult>& m_results;
+
+public:
+    BatchTargetMatchBody(
+        const string& detectorMethod,
+        const int keypointBudget,
+        const vector<string>& srcFiles,
+        const Ptr<FlannBasedMatcher>& matcher,
+        const vector<Mat>& allSrcDescriptors,
+        const vector<string>& targetFiles,
+        vector<TargetResult>& results) :
+        m_detectorMethod(detectorMethod),
+        m_keypointBudget(keypointBudget),
+        m_srcFiles(srcFiles),
+        m_matcher(matcher),
+        m_allSrcDescriptors(allSrcDescriptors),
+        m_targetFiles(targetFiles),
+        m_results(results)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        // Each stripe has its own detector, while the matcher is shared since it has been trained and searching
+        // the trained FLANN index doesn't modify it.
+        Ptr<Feature2D> stripeDetector = CreateDetector(m_detectorMethod);
+
+        for (int targetIndex = range.start; targetIndex < range.end; targetIndex++)
+        {
+            TargetResult& result = m_results[targetIndex];
+
+            auto tDetectStart = Clock::now();
+            Mat targetImage = imread(m_targetFiles[targetIndex]);
+            if (targetImage.empty())
+            {
+                continue;
+            }
+
+            vector<KeyPoint> targetKeypoints;
+            Mat targetDescriptors;
+            stripeDetector->detectAndCompute(targetImage, noArray(), targetKeypoints, targetDescriptors);
+            RetainBestKeypointsInGrid(targetKeypoints, targetDescriptors, targetImage.size(), m_keypointBudget);
+            auto tDetectEnd = Clock::now();
+
+            result.isLoaded = true;
+            result.descriptorCnt = targetDescriptors.rows;
+            result.detectMs = chrono::duration<double, milli>(tDetectEnd - tDetectStart).count();
+            if (targetDescriptors.empty())
+            {
+                continue;
+            }
+
+            // The good matches are only counted, so the filter doesn't keep any of them.
+            StreamingMatchFilter filter(static_cast<int>(m_srcFiles.size()), 0, GetMaxDescriptorDist(targetDescriptors),
+                    distHistBins, minDistFactor, presetMaxGoodDist);
+            result.bestMatchImageIndex = FindBestMatchedImageFast(
+                    m_srcFiles,
+                    m_matcher,
+                    m_allSrcDescriptors,
+                    targetDescriptors,
+                    filter,
+                    result.matchedPercentage,
+                    false);
+            auto tMatchEnd = Clock::now();
+
+            result.matchMs = chrono::duration<double, milli>(tMatchEnd - tDetectEnd).count();
+            result.goodMatchCnt = (result.bestMatchImageIndex >= 0) ? filter.GetGoodMatchCnts()[result.bestMatchImageIndex] : 0;
+        }
+    }
+};
+
+/*
+ * @function MatchTargetsInBatch()
+ * @brief Match the target images concurrently with the matcher trained once with the source images, and print
+ * a table of the per-target results.
+ */
+void MatchTargetsInBatch(
+    const string& detectorMethod,
+    const int keypointBudget,
+    const vector<string>& srcFiles,
+    const Ptr<FlannBasedMatcher>& matcher,
+    const vector<Mat>& allSrcDescriptors,
+    const vector<string>& targetFiles)
+{
+    // Train the matcher before the stripes share it, unless it has been loaded from the reference set cache.
+    if (matcher->getTrainDescriptors().empty())
+    {
+        matcher->add(allSrcDescriptors);
+    }
+
+    auto tTrainStart = Clock::now();
+    matcher->train();
+    auto tTrainEnd = Clock::now();
+
+    vector<TargetResult> results(targetFiles.size());
+    parallel_for_(
+        Range(0, static_cast<int>(targetFiles.size())),
+        BatchTargetMatchBody(detectorMethod, keypointBudget, srcFiles, matcher, allSrcDescriptors, targetFiles, results),
+        static_cast<double>(targetFiles.size()));
+    auto tBatchEnd = Clock::now();
 
     printf("======================================================================\n");
-    printf("The counts of matches and good matches for each source image: \n");
-    for (size_t srcImgIndex = 0; srcImgIndex < allSrcDescriptors.size(); srcImgIndex++)
+    printf("%-40s %-30s %8s %8s %10s %10s %10s\n",
+            "target", "best matched source", "desc#", "good#", "matched %", "det (ms)", "match (ms)");
+    for (size_t targetIndex = 0; targetIndex < targetFiles.size(); targetIndex++)
     {
-        printf("\tsrc image %s: match# = %d, good match# = %d\n",
-                srcFiles[srcImgIndex].c_str(), matchCnts[srcImgIndex], goodMatchCnts[srcImgIndex]);
+        const TargetResult& result = results[targetIndex];
+        if (!result.isLoaded)
+        {
+            printf("%-40s (not an image)\n", targetFiles[targetIndex].c_str());
+            continue;
+        }
+
+        string bestMatchSrcFile = (result.bestMatchImageIndex >= 0) ? srcFiles[result.bestMatchImageIndex] : string("-");
+        printf("%-40s %-30s %8d %8d %10.3f %10.1f %10.1f\n",
+                targetFiles[targetIndex].c_str(), bestMatchSrcFile.c_str(), result.descriptorCnt,
+                result.goodMatchCnt, result.matchedPercentage, result.detectMs, result.matchMs);
     }
 
-    return bestMatchImageIndex;
+    double batchMs = chrono::duration<double, milli>(tBatchEnd - tTrainEnd).count();
+    printf("======================================================================\n");
+    printf("Trained the matcher in %.1f ms and matched %lu targets in %.1f ms with %d threads (%.1f targets per second)\n",
+            chrono::duration<double, milli>(tTrainEnd - tTrainStart).count(), targetFiles.size(), batchMs,
+            getNumThreads(), (batchMs > 0) ? 1000.0 * targetFiles.size() / batchMs : 0.0);
 }
 
 /*
@@ -270,7 +737,7 @@ int FindBestMatchedImageFast(
  */
 int main(int argc, char** argv)
 {
-    if(argc != 5)
+    if(argc < 5 || argc > 7)
     {
         Readme();
         return -1;
@@ -288,14 +755,15 @@ int main(int argc, char** argv)
         return error;
     }
 
-    vector<Mat> srcImages;
-    for (auto& srcFile: srcFiles)
+    vector<string> targetFiles;
+    bool isBatch = false;
+
+    error = GetTargetFiles(argv[4], targetFiles, isBatch);
+    if (error != 0)
     {
-        srcImages.push_back(imread(srcFile));
+        return error;
     }
 
-    Mat targetImage = imread(argv[4]);
-
     auto tStart = Clock::now();
 
     // 1. Detect the keypoints using either the SURF detector or the ORB detector, and
@@ -305,18 +773,15 @@ int main(int argc, char** argv)
     // Convert detectorMethod into a lower-case string.
     transform(detectorMethod.begin(), detectorMethod.end(), detectorMethod.begin(), ::tolower);
 
-    Ptr<Feature2D> detector;
-    Ptr<FlannBasedMatcher> matcher;
+    Ptr<Feature2D> detector = CreateDetector(detectorMethod);
+    Ptr<CachedFlannBasedMatcher> matcher;
     if (detectorMethod == "surf")
     {
-        const int minHessian = 400;
-        detector = SURF::create(minHessian);
-        matcher = makePtr<FlannBasedMatcher>();
+        matcher = makePtr<CachedFlannBasedMatcher>();
     }
     else if (detectorMethod == "orb")
     {
-        detector = ORB::create();
-        matcher = makePtr<FlannBasedMatcher>(makePtr<flann::LshIndexParams>(6, 12, 1), makePtr<flann::SearchParams>(50));
+        matcher = makePtr<CachedFlannBasedMatcher>(makePtr<flann::LshIndexParams>(6, 12, 1), makePtr<flann::SearchParams>(50));
     }
     else
     {
@@ -329,17 +794,78 @@ int main(int argc, char** argv)
     vector<KeyPoint> oneSrcKeypoints;
     Mat oneSrcDescriptors;
 
-    for (auto& srcImage: srcImages)
+    // If a reference set cache is given and still valid, the keypoints and the descriptors of the source images
+    // as well as the trained FLANN index are loaded from the cache, so the source images are neither loaded nor
+    // detected and the matcher is not trained again.
+    vector<Mat> srcImages;
+    bool isCacheHit = false;
+    // "-" stands for no cache, so that a keypoint budget can be given without a cache.
+    string cacheFile = (argc >= 6 && string(argv[5]) != "-") ? string(argv[5]) : string();
+
+    // Keep at most keypointBudget keypoints of each image to bound the matching cost. 0 (the default) keeps all.
+    int keypointBudget = (argc == 7) ? max(atoi(argv[6]), 0) : 0;
+    ReferenceSetCache cache(cacheFile);
+    if (!cacheFile.empty())
+    {
+        isCacheHit = cache.Load(detectorMethod, keypointBudget, srcFiles, allSrcKeypoints, allSrcDescriptors, matcher);
+    }
+
+    if (!isCacheHit)
+    {
+        for (auto& srcFile: srcFiles)
+        {
+            srcImages.push_back(imread(srcFile));
+        }
+
+        for (auto& srcImage: srcImages)
+        {
+            detector->detectAndCompute(srcImage, noArray(), oneSrcKeypoints, oneSrcDescriptors);
+            RetainBestKeypointsInGrid(oneSrcKeypoints, oneSrcDescriptors, srcImage.size(), keypointBudget);
+            allSrcKeypoints.push_back(oneSrcKeypoints);
+            allSrcDescriptors.push_back(oneSrcDescriptors.clone());
+        }
+
+        if (!cacheFile.empty())
+        {
+            // Train the matcher once here so that its index can be saved into the cache.
+            matcher->add(allSrcDescriptors);
+            matcher->train();
+            if (cache.Save(detectorMethod, keypointBudget, srcFiles, allSrcKeypoints, allSrcDescriptors, matcher) == 0)
+            {
+                printf("Saved the reference set cache %s.\n", cacheFile.c_str());
+            }
+        }
+    }
+    else
+    {
+        printf("Loaded the keypoints, the descriptors and the FLANN index of %lu source images from the reference set cache %s.\n",
+                srcFiles.size(), cacheFile.c_str());
+    }
+
+    string matchOption(argv[2]);
+    // Convert matchOption into a lower-case string.
+    transform(matchOption.begin(), matchOption.end(), matchOption.begin(), ::tolower);
+
+    if (isBatch)
     {
-        detector->detectAndCompute(srcImage, noArray(), oneSrcKeypoints, oneSrcDescriptors);
-        allSrcKeypoints.push_back(oneSrcKeypoints);
-        allSrcDescriptors.push_back(oneSrcDescriptors);
+        // Build the index of the source images once and match all the target images with it. Only the merged
+        // index of the fast mode is built once, so the batch mode always matches in the fast mode.
+        if (matchOption != "fast")
+        {
+            printf("The batch mode matches the targets in the fast mode instead of the %s mode.\n", matchOption.c_str());
+        }
+
+        MatchTargetsInBatch(detectorMethod, keypointBudget, srcFiles, matcher, allSrcDescriptors, targetFiles);
+        return 0;
     }
 
+    Mat targetImage = imread(targetFiles[0]);
+
     vector<KeyPoint> targetKeypoints;
     Mat targetDescriptors;
 
     detector->detectAndCompute(targetImage, noArray(), targetKeypoints, targetDescriptors);
+    RetainBestKeypointsInGrid(targetKeypoints, targetDescriptors, targetImage.size(), keypointBudget);
 
     auto tDetectAndComputeEnd = Clock::now();
 
@@ -347,15 +873,12 @@ int main(int argc, char** argv)
     printf("The time for the %s keypoint detection and the descriptor computation of %lu images: %ld milliseconds\n",
             detectorMethod.c_str(), srcImages.size() + 1, chrono::duration_cast<chrono::milliseconds>(tDetectAndComputeEnd - tStart).count());
 
-    vector<DMatch> allMatches;
-    vector<DMatch> allGoodMatches;
+    // Only the top good matches of the best matched source image are kept for drawing.
+    StreamingMatchFilter filter(static_cast<int>(srcFiles.size()), maxDrawnGoodMatches, GetMaxDescriptorDist(targetDescriptors),
+            distHistBins, minDistFactor, presetMaxGoodDist);
     int matchedImgIndex = -1;
     double matchedPercentage = 0.0;
 
-    string matchOption(argv[2]);
-    // Convert matchOption into a lower-case string.
-    transform(matchOption.begin(), matchOption.end(), matchOption.begin(), ::tolower);
-
     if (matchOption == "slow")
     {
         matchedImgIndex = FindBestMatchedImageSlow(
@@ -363,8 +886,7 @@ int main(int argc, char** argv)
                 matcher,
                 allSrcDescriptors,
                 targetDescriptors,
-                allMatches,
-                allGoodMatches,
+                filter,
                 matchedPercentage);
     }
     else if (matchOption == "fast")
@@ -374,13 +896,32 @@ int main(int argc, char** argv)
                 matcher,
                 allSrcDescriptors,
                 targetDescriptors,
-                allMatches,
-                allGoodMatches,
+                filter,
+                matchedPercentage);
+    }
+    else if (matchOption == "parallel")
+    {
+        matchedImgIndex = FindBestMatchedImageParallel(
+                srcFiles,
+                matcher,
+                allSrcDescriptors,
+                targetDescriptors,
+                filter,
+                matchedPercentage);
+    }
+    else if (matchOption == "bench")
+    {
+        matchedImgIndex = BenchmarkFindBestMatchedImage(
+                srcFiles,
+                matcher,
+                allSrcDescriptors,
+                targetDescriptors,
+                filter,
                 matchedPercentage);
     }
     else
     {
-        printf("Error: unsupported match option %s. should be either \"slow\" or \"fast\".", matchOption.c_str());
+        printf("Error: unsupported match option %s. should be \"slow\", \"fast\", \"parallel\" or \"bench\".", matchOption.c_str());
         return -1;
     }
 
@@ -389,17 +930,14 @@ int main(int argc, char** argv)
     printf("The time for the FLANN matching: %ld milliseconds\n",
             chrono::duration_cast<chrono::milliseconds>(tMatchEnd - tDetectAndComputeEnd).count());
 
-    vector<DMatch> goodMatches;  // "Good" matches between the target image and the best matched image.
-    for (auto& goodMatch: allGoodMatches)
-    {
-        if (goodMatch.imgIdx == matchedImgIndex)
-        {
-            goodMatches.push_back(goodMatch);
-        }
-    }
-    // Draw only "good" matches.
+    // The top "good" matches between the target image and the best matched image.
+    const vector<DMatch>& goodMatches = filter.GetTopGoodMatches();
+
+    // Draw only "good" matches. The source images are not loaded if the reference set cache is used, so only
+    // the best matched one is loaded here.
+    Mat matchedSrcImage = srcImages.empty() ? imread(srcFiles[matchedImgIndex]) : srcImages[matchedImgIndex];
     Mat imgMatches;
-    drawMatches(targetImage, targetKeypoints, srcImages[matchedImgIndex], allSrcKeypoints[matchedImgIndex],
+    drawMatches(targetImage, targetKeypoints, matchedSrcImage, allSrcKeypoints[matchedImgIndex],
             goodMatches, imgMatches, Scalar::all(-1), Scalar::all(-1),
             vector<char>(), DrawMatchesFlags::NOT_DRAW_SINGLE_POINTS);
 
@@ -414,6 +952,8 @@ int main(int argc, char** argv)
 
     // Display detected matches in the console.
     printf("======================================================================\n");
+    printf("The top %lu of %d good matches with the best matched source image:\n",
+            goodMatches.size(), filter.GetGoodMatchCnts()[matchedImgIndex]);
     for (int goodMatchIndex = 0; goodMatchIndex < static_cast<int>(goodMatches.size()); goodMatchIndex++)
     {
         printf("Good Match [%d]: target keypoint: %d <--> source %d keypoint: %d with distance = %f\n",
@@ -0,0 +1,305 @@
+/*
+ * StreamingMatchFilter.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cfloat>
+#include <algorithm>
+
+#include "StreamingMatchFilter.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Order the matches by the distance, and by the query index in case of a tie, so the top-K are deterministic.
+bool IsCloser(const DMatch& a, const DMatch& b)
+{
+    return (a.distance < b.distance) || (a.distance == b.distance && a.queryIdx < b.queryIdx);
+}
+
+}
+
+StreamingMatchFilter::ImageStats::ImageStats() :
+    cntMatches(0),
+    sumDist(0),
+    minDist(DBL_MAX)
+{
+}
+
+StreamingMatchFilter::StreamingMatchFilter(
+    const int cntImages,
+    const int topK,
+    const double histMax,
+    const int histBins,
+    const double minDistFactor,
+    const double presetMaxGoodDist) :
+    m_cntImages(cntImages),
+    m_topK(topK),
+    m_minDistFactor(minDistFactor),
+    m_presetMaxGoodDist(presetMaxGoodDist),
+    m_cntMatches(0),
+    m_minDist(DBL_MAX),
+    m_maxDist(0),
+    m_histMax(histMax > 0 ? histMax : 1.0),
+    m_hist(max(histBins, 1)),
+    m_cntCandidates(0),
+    m_cntCandidatesAfterPrune(0),
+    m_peakCntCandidates(0),
+    m_isFinished(false),
+    m_sumDist(0),
+    m_bestImgIdx(-1)
+{
+}
+
+double StreamingMatchFilter::GetThreshold() const
+{
+    return max(m_minDistFactor*m_minDist, m_presetMaxGoodDist);
+}
+
+void StreamingMatchFilter::PushTopMatch(ImageStats& imageStats, const DMatch& match) const
+{
+    vector<DMatch>& topMatches = imageStats.topMatches;
+    if (m_topK < 0 || static_cast<int>(topMatches.size()) < m_topK)
+    {
+        topMatches.push_back(match);
+        push_heap(topMatches.begin(), topMatches.end(), IsCloser);
+    }
+    else if (IsCloser(match, topMatches.front()))
+    {
+        pop_heap(topMatches.begin(), topMatches.end(), IsCloser);
+        topMatches.back() = match;
+        push_heap(topMatches.begin(), topMatches.end(), IsCloser);
+    }
+}
+
+void StreamingMatchFilter::PruneCandidates()
+{
+    double threshold = GetThreshold();
+
+    m_cntCandidates = 0;
+    for (auto& imageStatsPair: m_allImageStats)
+    {
+        ImageStats& imageStats = imageStatsPair.second;
+
+        imageStats.candidateDists.erase(
+            remove_if(imageStats.candidateDists.begin(), imageStats.candidateDists.end(),
+                [threshold](const float dist) { return dist > threshold; }),
+            imageStats.candidateDists.end());
+
+        imageStats.topMatches.erase(
+            remove_if(imageStats.topMatches.begin(), imageStats.topMatches.end(),
+                [threshold](const DMatch& match) { return match.distance > threshold; }),
+            imageStats.topMatches.end());
+        make_heap(imageStats.topMatches.begin(), imageStats.topMatches.end(), IsCloser);
+
+        m_cntCandidates += imageStats.candidateDists.size();
+    }
+
+    m_cntCandidatesAfterPrune = m_cntCandidates;
+}
+
+void StreamingMatchFilter::Consume(const DMatch& match)
+{
+    double dist = match.distance;
+
+    m_cntMatches++;
+    m_minDist = min(m_minDist, dist);
+    m_maxDist = max(m_maxDist, dist);
+
+    int bin = static_cast<int>(dist / m_histMax * m_hist.size());
+    m_hist[min(max(bin, 0), static_cast<int>(m_hist.size()) - 1)]++;
+
+    ImageStats& imageStats = m_allImageStats[match.imgIdx];
+    imageStats.cntMatches++;
+    imageStats.sumDist += dist;
+    imageStats.minDist = min(imageStats.minDist, dist);
+
+    if (dist <= GetThreshold())
+    {
+        imageStats.candidateDists.push_back(match.distance);
+        if (m_topK != 0)
+        {
+            PushTopMatch(imageStats, match);
+        }
+
+        m_cntCandidates++;
+        m_peakCntCandidates = max(m_peakCntCandidates, m_cntCandidates);
+
+        // The threshold may have dropped since the last pruning, so drop the candidates above it.
+        if (m_cntCandidates >= 2*m_cntCandidatesAfterPrune + 64)
+        {
+            PruneCandidates();
+        }
+    }
+}
+
+void StreamingMatchFilter::Consume(const vector<DMatch>& matches)
+{
+    for (auto& match: matches)
+    {
+        Consume(match);
+    }
+}
+
+void StreamingMatchFilter::Merge(const StreamingMatchFilter& other)
+{
+    CV_Assert(!m_isFinished && !other.m_isFinished && m_hist.size() == other.m_hist.size());
+
+    // Skip the pruning for an empty filter, e.g., of a stripe which hasn't run.
+    if (other.m_cntMatches == 0)
+    {
+        return;
+    }
+
+    m_cntMatches += other.m_cntMatches;
+    m_minDist = min(m_minDist, other.m_minDist);
+    m_maxDist = max(m_maxDist, other.m_maxDist);
+    for (size_t bin = 0; bin < m_hist.size(); bin++)
+    {
+        m_hist[bin] += other.m_hist[bin];
+    }
+
+    for (auto& otherImageStatsPair: other.m_allImageStats)
+    {
+        const ImageStats& otherImageStats = otherImageStatsPair.second;
+        ImageStats& imageStats = m_allImageStats[otherImageStatsPair.first];
+
+        imageStats.cntMatches += otherImageStats.cntMatches;
+        imageStats.sumDist += otherImageStats.sumDist;
+        imageStats.minDist = min(imageStats.minDist, otherImageStats.minDist);
+        imageStats.candidateDists.insert(imageStats.candidateDists.end(),
+            otherImageStats.candidateDists.begin(), otherImageStats.candidateDists.end());
+        for (auto& match: otherImageStats.topMatches)
+        {
+            PushTopMatch(imageStats, match);
+        }
+    }
+
+    m_peakCntCandidates += other.m_peakCntCandidates;
+
+    // The merged minDist may lower the threshold below the candidates of either filter.
+    PruneCandidates();
+}
+
+void StreamingMatchFilter::Finish()
+{
+    if (m_isFinished)
+    {
+        return;
+    }
+
+    PruneCandidates();
+
+    // All the remaining candidates are good. The sums are added up in the order of the source images, so the mean
+    // doesn't depend on the order in which the matches were consumed or merged.
+    m_matchCnts.assign(m_cntImages, 0);
+    m_goodMatchCnts.assign(m_cntImages, 0);
+    m_sumDist = 0;
+    for (auto& imageStatsPair: m_allImageStats)
+    {
+        const ImageStats& imageStats = imageStatsPair.second;
+        m_matchCnts[imageStatsPair.first] = imageStats.cntMatches;
+        m_goodMatchCnts[imageStatsPair.first] = static_cast<int>(imageStats.candidateDists.size());
+        m_sumDist += imageStats.sumDist;
+    }
+
+    // Find the best matched source image (i.e., with the most "good matches"), the first one in case of a tie.
+    if (!m_goodMatchCnts.empty())
+    {
+        m_bestImgIdx = distance(m_goodMatchCnts.begin(), max_element(m_goodMatchCnts.begin(), m_goodMatchCnts.end()));
+    }
+
+    // The heap of the best matched source image holds its top-K good matches, and none for topK = 0.
+    auto bestImageStatsIt = m_allImageStats.find(m_bestImgIdx);
+    if (bestImageStatsIt != m_allImageStats.end())
+    {
+        m_topGoodMatches.swap(bestImageStatsIt->second.topMatches);
+        sort_heap(m_topGoodMatches.begin(), m_topGoodMatches.end(), IsCloser);
+    }
+
+    // Release the per-image buffers, so only the top-K good matches are retained.
+    map<int, ImageStats>().swap(m_allImageStats);
+    m_cntCandidates = 0;
+    m_isFinished = true;
+}
+
+size_t StreamingMatchFilter::GetMatchCnt() const
+{
+    return m_cntMatches;
+}
+
+double StreamingMatchFilter::GetMinDist() const
+{
+    return m_minDist;
+}
+
+double StreamingMatchFilter::GetMaxDist() const
+{
+    return m_maxDist;
+}
+
+double StreamingMatchFilter::GetDistQuantile(const double q) const
+{
+    if (m_cntMatches == 0)
+    {
+        return 0.0;
+    }
+
+    // Interpolate linearly within the bin where the cumulative count reaches the rank, and clamp the estimate
+    // into the exact range of the distances.
+    double rank = min(max(q, 0.0), 1.0) * m_cntMatches;
+    double binWidth = m_histMax / m_hist.size();
+    double cumCnt = 0;
+    for (size_t bin = 0; bin < m_hist.size(); bin++)
+    {
+        if (m_hist[bin] > 0 && cumCnt + m_hist[bin] >= rank)
+        {
+            double quantile = (bin + (rank - cumCnt) / m_hist[bin]) * binWidth;
+            return min(max(quantile, m_minDist), m_maxDist);
+        }
+
+        cumCnt += m_hist[bin];
+    }
+
+    return m_maxDist;
+}
+
+double StreamingMatchFilter::GetGoodDistThreshold() const
+{
+    return GetThreshold();
+}
+
+double StreamingMatchFilter::GetMeanDist() const
+{
+    return (m_cntMatches > 0) ? m_sumDist / m_cntMatches : 0.0;
+}
+
+const vector<int>& StreamingMatchFilter::GetMatchCnts() const
+{
+    return m_matchCnts;
+}
+
+const vector<int>& StreamingMatchFilter::GetGoodMatchCnts() const
+{
+    return m_goodMatchCnts;
+}
+
+int StreamingMatchFilter::GetBestImgIdx() const
+{
+    return m_bestImgIdx;
+}
+
+const vector<DMatch>& StreamingMatchFilter::GetTopGoodMatches() const
+{
+    return m_topGoodMatches;
+}
+
+size_t StreamingMatchFilter::GetPeakCandidateCnt() const
+{
+    return m_peakCntCandidates;
+}
@@ -12,6 +12,7 @@
 #include <errno.h>
 
 #include <cstdio>
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -24,6 +25,12 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "BatchHistComparator.h"
+#include "HistDatabase.h"
+#include "HsvHistogram.h"
+#include "QuantizedHists.h"
+#include "ReducedImageDecoder.h"
+
 using namespace std;
 using namespace cv;
 namespace po = boost::program_options;
@@ -231,6 +238,35 @@ int GetDirFiles(const string& dir, vector<string>& files)
     return 0;
 }
 
+// Compute the L1-normalized histogram of the given HSV channels of a BGR-colored image decoded by the decoder. Return
+// false if the image can't be loaded.
+bool CalcNormalizedHsvHist(
+    const string& imgFile,
+    const ReducedImageDecoder& decoder,
+    const vector<int>& hsvChannels,
+    const vector<int>& histSize,
+    const vector<float>& ranges,
+    Mat& hist)
+{
+    Mat srcImg = decoder.Read(imgFile);
+    if (srcImg.empty())
+    {
+        return false;
+    }
+
+    // The HSV image isn't materialized.
+    CalcHsvHist(srcImg, hsvChannels, histSize, ranges, hist);
+    normalize(hist, hist, 1, 0, NORM_L1);
+
+    return true;
+}
+
+// View a histogram of any dimensions as a 1 x N row, which is the layout of the histogram database.
+Mat FlattenHist(const Mat& hist)
+{
+    return Mat(1, static_cast<int>(hist.total()), hist.type(), const_cast<uchar*>(hist.ptr()));
+}
+
 int main(int argc, char** argv)
 {
     po::options_description opt("Options");
@@ -240,7 +276,15 @@ int main(int argc, char** argv)
         ("directory,d", po::value<string>()->required(), "The directory of source images for the histogram comparison")
         ("help,h", "Display the help information")
         ("comparison-method,m", po::value<string>(), "The comparison method (correl | chisqr | chisqr_alt | intersect | bhattacharyya | hellinger | kl_div | all). If not specified, default correl.")
-        ("hsv-channels,c", po::value<string>(), "The HSV channels used for generating the histogram (h | s | v). If not specified, default hs.");
+        ("hsv-channels,c", po::value<string>(), "The HSV channels used for generating the histogram (h | s | v). If not specified, default hs.")
+        ("hist-db,b", po::value<string>(), "The histogram database file, where the histograms of the source images are saved and reused in the next run.")
+        ("knn,k", po::value<int>()->default_value(0), "Search the k source images nearest to each baseline image in the Bhattacharyya distance with a FLANN index, instead of comparing all of them.")
+        ("checks", po::value<int>()->default_value(32), "The number of leaves of the FLANN KD-trees to visit in the k-NN search. A larger value is more accurate but slower.")
+        ("quantize,q", po::value<string>(), "Compare the histograms in a compact quantized form (u8 | u16 | sparse), and report the accuracy against the float histograms.")
+        ("threads,j", po::value<int>(), "The number of the threads decoding the source images and computing their histograms in parallel. If not specified, default all the cores.")
+        ("decode-scale", po::value<int>()->default_value(1), "Decode the images at 1/2, 1/4 or 1/8 of the resolution (1 | 2 | 4 | 8) for the histograms, which uses the DCT scaling of the JPEG decoder.")
+        ("target-pixels", po::value<int>(), "Decode the images at the lowest resolution with at least this number of pixels by the DCT scaling or the box downsampling, instead of a fixed decode scale.")
+        ("measure-decode-error", "Measure the errors of the histograms of the reduced resolution against the full resolution, and the decoding times.");
 
     po::positional_options_description posOpt;
     posOpt.add("image1", 1);
@@ -321,21 +365,69 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    Mat srcImg1 = imread(img1, IMREAD_COLOR);
-    if (srcImg1.empty())
+    string histDbFile;
+    if (vm.count("hist-db") > 0)
+    {
+        histDbFile = vm["hist-db"].as<string>();
+    }
+
+    int knn = vm["knn"].as<int>();
+    int checks = vm["checks"].as<int>();
+    if ((knn > 0) && (histComparisonMethods[0] != CV_COMP_BHATTACHARYYA))
+    {
+        printf("[ERROR]: The k-NN search only supports the comparison method bhattacharyya (or hellinger).\n\n");
+        return -1;
+    }
+
+    int quantFormat = -1;
+    if (vm.count("quantize") > 0)
+    {
+        string strQuantFormat = vm["quantize"].as<string>();
+        if (!QuantizedHists::Str2Format(strQuantFormat, quantFormat))
+        {
+            cerr << "[ERROR]: Unsupported or invalid quantization format " << strQuantFormat << "." << endl << endl;
+            return -1;
+        }
+        else if (knn > 0)
+        {
+            cerr << "[ERROR]: The quantized histograms don't support the k-NN search." << endl << endl;
+            return -1;
+        }
+    }
+
+    if (vm.count("threads") > 0)
+    {
+        setNumThreads(max(vm["threads"].as<int>(), 1));
+    }
+
+    int decodeScale = vm["decode-scale"].as<int>();
+    int targetPixels = (vm.count("target-pixels") > 0) ? vm["target-pixels"].as<int>() : 0;
+    if (!ReducedImageDecoder::IsValidScale(decodeScale) || (targetPixels < 0))
+    {
+        printf("[ERROR]: The decode scale should be 1, 2, 4 or 8, and the target pixels should be positive.\n\n");
+        return -1;
+    }
+
+    ReducedImageDecoder decoder(decodeScale, targetPixels);
+    if (!decoder.IsFullResolution())
+    {
+        printf("[INFO]: The images are decoded at %s.\n", decoder.ToStr().c_str());
+    }
+
+    // Compute and the normalize the histograms of image 1 and 2, respectively.
+    Mat hist1;
+    if (!CalcNormalizedHsvHist(img1, decoder, hsvChannels, histSize, ranges, hist1))
     {
         printf("[ERROR]: Cannot load image %s.\n\n", img1.c_str());
         return -1;
     }
-    //Mat croppedImg1 = srcImg1(Range(srcImg1.rows/4, srcImg1.rows), Range(0, srcImg1.cols));
 
-    Mat srcImg2 = imread(img2, IMREAD_COLOR);
-    if (srcImg2.empty())
+    Mat hist2;
+    if (!CalcNormalizedHsvHist(img2, decoder, hsvChannels, histSize, ranges, hist2))
     {
         printf("[ERROR]: Cannot load image %s.\n\n", img2.c_str());
         return -1;
     }
-    //Mat croppedImg2 = srcImg2(Range(srcImg2.rows/4, srcImg2.rows), Range(0, srcImg2.cols));
 
     // Get all the image file names in the source directory.
     vector<string> srcFiles;
@@ -345,76 +437,166 @@ int main(int argc, char** argv)
         return error;
     }
 
-    vector<Mat> srcImgs;
-    for (const auto& srcFile: srcFiles)
+    // Load the histograms of the source images from the database, and only compute those of the new or modified
+    // images. The channels are identified by "hsv"[channel], so the same channels in any order share the database,
+    // followed by the decode mode, so the histograms of different resolutions aren't mixed up.
+    string hsvChannelsKey;
+    for (auto hsvChannel: hsvChannels)
     {
-        Mat srcImg = imread(srcFile);
-        //Mat croppedSrcImg = srcImg(Range(srcImg.rows/4, srcImg.rows), Range(0, srcImg.cols));
-        srcImgs.push_back(srcImg);
-        //srcImgs.push_back(croppedSrcImg);
+        hsvChannelsKey.push_back("hsv"[hsvChannel]);
     }
 
-    // Convert image 1, 2, and all the images in the source directory into HSV.
-    Mat hsvImg1;
-    Mat hsvImg2;
-    cvtColor(srcImg1, hsvImg1, COLOR_BGR2HSV);
-    cvtColor(srcImg2, hsvImg2, COLOR_BGR2HSV);
-    //cvtColor(croppedImg1, hsvImg1, COLOR_BGR2HSV);
-    //cvtColor(croppedImg2, hsvImg2, COLOR_BGR2HSV);
+    hsvChannelsKey += decoder.GetKey();
 
-    vector<Mat> hsvSrcImgs;
-    for (const auto& srcImg: srcImgs)
+    auto calcHistFunc = [&decoder, &hsvChannels, &histSize, &ranges](const string& srcFile, Mat& hist)
+        {
+            return CalcNormalizedHsvHist(srcFile, decoder, hsvChannels, histSize, ranges, hist);
+        };
+
+    HistDatabase histDb(histDbFile);
+    int64 updateStartTick = getTickCount();
+    int cntComputed = histDb.Update(srcFiles, hsvChannelsKey, static_cast<int>(hist1.total()), calcHistFunc);
+    if (cntComputed < 0)
     {
-        Mat tmpHsvImg;
-        cvtColor(srcImg, tmpHsvImg, COLOR_BGR2HSV);
-        hsvSrcImgs.push_back(tmpHsvImg);
+        return -1;
     }
 
-    // Compute and the normalize the histograms of image 1 and 2, respectively.
-    Mat hist1;
-    calcHist(vector<Mat>{hsvImg1}, hsvChannels, noArray(), hist1, histSize, ranges);
-    normalize(hist1, hist1, 1, 0, NORM_L1);
+    printf("[INFO]: %d histograms of the source images are computed and %d are loaded from the histogram database in %.3f s with %d threads.\n",
+        cntComputed, histDb.GetCnt() - cntComputed, (getTickCount() - updateStartTick)/getTickFrequency(), getNumThreads());
 
-    Mat hist2;
-    calcHist(vector<Mat>{hsvImg2}, hsvChannels, noArray(), hist2, histSize, ranges);
-    normalize(hist2, hist2, 1, 0, NORM_L1);
-
-    vector<Mat> hists;
-    for (const auto& hsvSrcImg: hsvSrcImgs)
+    if (vm.count("measure-decode-error") > 0)
     {
-        Mat hist;
-        calcHist(vector<Mat>{hsvSrcImg}, hsvChannels, noArray(), hist, histSize, ranges);
-        normalize(hist, hist, 1, 0, NORM_L1);
+        vector<string> measuredFiles = { img1, img2 };
+        for (int histIdx = 0; histIdx < histDb.GetCnt(); ++histIdx)
+        {
+            if (histDb.IsValid(histIdx))
+            {
+                measuredFiles.push_back(histDb.GetFile(histIdx));
+            }
+        }
 
-        hists.push_back(hist);
+        decoder.ReportError(measuredFiles, [&hsvChannels, &histSize, &ranges](const Mat& img, vector<Mat>& hists)
+            {
+                hists.resize(1);
+                CalcHsvHist(img, hsvChannels, histSize, ranges, hists[0]);
+                normalize(hists[0], hists[0], 1, 0, NORM_L1);
+            });
     }
 
+    Mat flatHist1 = FlattenHist(hist1);
+    Mat flatHist2 = FlattenHist(hist2);
+
     // Compare the normalized histograms.
     printf("[INFO]: The result for a perfect match of the method %s is %f.\n",
         HistComparisonMethod2Str(histComparisonMethods[0]).c_str(),
         histCompPerfectMatchVals[0]);
 
-    for (size_t histIndex = 0; histIndex < hists.size(); ++histIndex)
+    if (knn > 0)
     {
+        // The k-NN search only visits a part of the source images, so it is sub-linear in their number.
+        const vector<pair<string, Mat> > baselines = { make_pair(img1, flatHist1), make_pair(img2, flatHist2) };
+        for (auto& baseline: baselines)
+        {
+            vector<int> histIdxs;
+            vector<double> dists;
+            histDb.KnnSearchBhattacharyya(baseline.second, knn, checks, histIdxs, dists);
+
+            printf("[INFO]: The %lu source images nearest to %s:\n", histIdxs.size(), baseline.first.c_str());
+            for (size_t neighborIdx = 0; neighborIdx < histIdxs.size(); ++neighborIdx)
+            {
+                printf("[INFO]:   %lu. %s = %f\n", neighborIdx + 1, histDb.GetFile(histIdxs[neighborIdx]).c_str(), dists[neighborIdx]);
+            }
+            printf("\n");
+        }
+
+        return histDb.Save();
+    }
+
+    // Compare image 1 and 2 with all the source images in a batch. Row 0 and 1 of the results are those of image 1
+    // and 2, respectively.
+    Mat queryHists = BatchHistComparator::StackHists(vector<Mat>{hist1, hist2});
+    BatchHistComparator histComparator(histDb.GetHists());
+    Mat compareResults;
+    int64 startTick = getTickCount();
+    histComparator.Compare(queryHists, histComparisonMethods[0], compareResults);
+    double floatCompareMs = (getTickCount() - startTick)*1000.0/getTickFrequency();
+
+    if (quantFormat >= 0)
+    {
+        // Compare in the quantized form instead, and measure how far the results are from those of the float
+        // histograms over the valid source images.
+        QuantizedHists quantHists(histDb.GetHists(), quantFormat);
+        QuantizedHists quantQueryHists(queryHists, quantFormat);
+
+        Mat quantCompareResults;
+        startTick = getTickCount();
+        quantHists.Compare(quantQueryHists, histComparisonMethods[0], quantCompareResults);
+        double quantCompareMs = (getTickCount() - startTick)*1000.0/getTickFrequency();
+
+        Mat dequantizedHists;
+        quantHists.Dequantize(dequantizedHists);
+
+        double maxResultErr = 0;
+        double sumResultErr = 0;
+        double maxBinErr = 0;
+        int cntValid = 0;
+        for (int histIdx = 0; histIdx < histDb.GetCnt(); ++histIdx)
+        {
+            if (!histDb.IsValid(histIdx))
+            {
+                continue;
+            }
+
+            for (int queryIdx = 0; queryIdx < compareResults.rows; ++queryIdx)
+            {
+                double resultErr = fabs(quantCompareResults.at<double>(queryIdx, histIdx)
+                    - compareResults.at<double>(queryIdx, histIdx));
+                maxResultErr = max(maxResultErr, resultErr);
+                sumResultErr += resultErr;
+            }
+
+            maxBinErr = max(maxBinErr, norm(dequantizedHists.row(histIdx), histDb.GetHists().row(histIdx), NORM_INF));
+            ++cntValid;
+        }
+
+        printf("[INFO]: The %s quantized histograms take %.1f bytes each on average, and the float ones take %lu bytes.\n",
+            QuantizedHists::Format2Str(quantFormat).c_str(), quantHists.GetBytesPerHist(), histDb.GetHists().cols*sizeof(float));
+        printf("[INFO]: The comparison takes %.3f ms in the quantized form and %.3f ms in float.\n",
+            quantCompareMs, floatCompareMs);
+        printf("[INFO]: Against the float histograms, the max bin error = %g, and the max and the mean errors of the comparison results = %g and %g.\n\n",
+            maxBinErr, maxResultErr, (cntValid > 0) ? sumResultErr/(cntValid*compareResults.rows) : 0.0);
+
+        compareResults = quantCompareResults;
+    }
+
+    for (int histIndex = 0; histIndex < histDb.GetCnt(); ++histIndex)
+    {
+        const string& srcFile = histDb.GetFile(histIndex);
+        if (!histDb.IsValid(histIndex))
+        {
+            printf("[ERROR]: Cannot load image %s.\n\n", srcFile.c_str());
+            continue;
+        }
+
         // Compare the source image with image 1.
-        double compareResult1 = compareHist(hist1, hists[histIndex], histComparisonMethods[0]);
+        double compareResult1 = compareResults.at<double>(0, histIndex);
 
         printf("[INFO]: The comparison result of source image %s with %s (image 1) = %f.\n",
-            srcFiles[histIndex].c_str(), img1.c_str(), compareResult1);
+            srcFile.c_str(), img1.c_str(), compareResult1);
 
         // Compare the source image with image 2.
-        double compareResult2 = compareHist(hist2, hists[histIndex], histComparisonMethods[0]);
+        double compareResult2 = compareResults.at<double>(1, histIndex);
 
         printf("[INFO]: The comparison result of source image %s with %s (image 2) = %f.\n",
-            srcFiles[histIndex].c_str(), img2.c_str(), compareResult2);
+            srcFile.c_str(), img2.c_str(), compareResult2);
 
         double maxCompareResult = max(compareResult1, compareResult2);
         double minCompareResult = min(compareResult1, compareResult2);
         double compareResultRatio = (1 - maxCompareResult )/(1 - minCompareResult);
 
         printf("[INFO]: The ratio of the distances of comparison results of source image %s to a perfect match = %f.\n\n",
-            srcFiles[histIndex].c_str(), compareResultRatio);
+            srcFile.c_str(), compareResultRatio);
     }
 
-    return 0;
+    return histDb.Save();
 }
@@ -0,0 +1,367 @@
+/*
+ * HistDatabase.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <algorithm>
+#include <atomic>
+
+#include "HistDatabase.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Wrap a lambda as the body of parallel_for_().
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+}
+
+HistDatabase::HistDatabase(const string& dbFile) :
+    m_dbFile(dbFile),
+    m_indexFile(dbFile.empty() ? string() : dbFile + "_flannindex"),
+    m_isIndexReady(false),
+    m_isIndexLoadable(false),
+    m_isDirty(false),
+    m_isIndexDirty(false)
+{
+}
+
+bool HistDatabase::GetFileStamp(const string& file, double& size, double& mtimeSec, int& mtimeNsec)
+{
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0)
+    {
+        printf("[ERROR]: stat(%s) for %s.\n\n", strerror(errno), file.c_str());
+        return false;
+    }
+
+    // FileStorage has no 64-bit integers, but a double holds the sizes and the seconds exactly.
+    size = static_cast<double>(info.st_size);
+    mtimeSec = static_cast<double>(info.st_mtim.tv_sec);
+    mtimeNsec = static_cast<int>(info.st_mtim.tv_nsec);
+
+    return true;
+}
+
+void HistDatabase::BuildSqrtHists()
+{
+    m_histSums.clear();
+    m_validHistIdxs.clear();
+
+    for (int histIdx = 0; histIdx < m_hists.rows; ++histIdx)
+    {
+        m_histSums.push_back(sum(m_hists.row(histIdx))[0]);
+        if (m_isValid[histIdx] != 0)
+        {
+            m_validHistIdxs.push_back(histIdx);
+        }
+    }
+
+    m_sqrtValidHists.create(static_cast<int>(m_validHistIdxs.size()), m_hists.cols, CV_32F);
+    for (size_t validIdx = 0; validIdx < m_validHistIdxs.size(); ++validIdx)
+    {
+        Mat sqrtHist = m_sqrtValidHists.row(static_cast<int>(validIdx));
+        cv::sqrt(m_hists.row(m_validHistIdxs[validIdx]), sqrtHist);
+    }
+
+    m_isIndexReady = false;
+}
+
+void HistDatabase::PrepareIndex()
+{
+    if (m_isIndexReady || m_validHistIdxs.empty())
+    {
+        return;
+    }
+
+    // The saved index is only valid for the same rows of the square-rooted histograms. A truncated or corrupt index
+    // file makes the load throw, in which case the index is rebuilt and saved again.
+    if (m_isIndexLoadable)
+    {
+        bool isLoaded = false;
+        try
+        {
+            isLoaded = m_index.load(m_sqrtValidHists, m_indexFile);
+        }
+        catch (const cv::Exception& e)
+        {
+            printf("[ERROR]: Cannot load the FLANN index %s, so it is rebuilt: %s\n\n", m_indexFile.c_str(), e.what());
+        }
+        catch (const std::exception& e)
+        {
+            // FLANN itself throws cvflann::FLANNException for some of the corrupt index files.
+            printf("[ERROR]: Cannot load the FLANN index %s, so it is rebuilt: %s\n\n", m_indexFile.c_str(), e.what());
+        }
+
+        if (isLoaded)
+        {
+            m_isIndexReady = true;
+            return;
+        }
+    }
+
+    m_index.build(m_sqrtValidHists, flann::KDTreeIndexParams(4));
+    m_isIndexReady = true;
+    m_isIndexDirty = true;
+}
+
+int HistDatabase::Update(
+    const vector<string>& files,
+    const string& hsvChannels,
+    const int cntBins,
+    const function<bool(const string&, Mat&)>& calcHistFunc)
+{
+    string cachedHsvChannels;
+    vector<string> cachedFiles;
+    vector<double> cachedSizes;
+    vector<double> cachedMtimeSecs;
+    vector<int> cachedMtimeNsecs;
+    vector<int> cachedIsValid;
+    Mat cachedHists;
+
+    if (!m_dbFile.empty())
+    {
+        FileStorage fs(m_dbFile, FileStorage::READ);
+        if (fs.isOpened())
+        {
+            fs["hsvChannels"] >> cachedHsvChannels;
+            fs["files"] >> cachedFiles;
+            fs["fileSizes"] >> cachedSizes;
+            fs["fileMtimeSecs"] >> cachedMtimeSecs;
+            fs["fileMtimeNsecs"] >> cachedMtimeNsecs;
+            fs["isValid"] >> cachedIsValid;
+            fs["hists"] >> cachedHists;
+        }
+        else
+        {
+            printf("[INFO]: The histogram database %s doesn't exist and is built.\n", m_dbFile.c_str());
+        }
+    }
+
+    // The cached histograms are usable only if they have been computed in the same way.
+    map<string, int> cachedHistIdxs;
+    if ((cachedHsvChannels == hsvChannels) && (cachedHists.cols == cntBins) && (cachedHists.type() == CV_32F)
+        && (cachedHists.rows == static_cast<int>(cachedFiles.size())) && (cachedSizes.size() == cachedFiles.size())
+        && (cachedMtimeSecs.size() == cachedFiles.size()) && (cachedMtimeNsecs.size() == cachedFiles.size())
+        && (cachedIsValid.size() == cachedFiles.size()))
+    {
+        for (size_t cachedIdx = 0; cachedIdx < cachedFiles.size(); ++cachedIdx)
+        {
+            cachedHistIdxs[cachedFiles[cachedIdx]] = static_cast<int>(cachedIdx);
+        }
+    }
+    else if (!cachedFiles.empty())
+    {
+        printf("[INFO]: The histogram database %s was built with the HSV channels %s, so it is rebuilt.\n",
+            m_dbFile.c_str(), cachedHsvChannels.c_str());
+    }
+
+    m_hsvChannels = hsvChannels;
+    m_files = files;
+    m_fileSizes.assign(files.size(), 0);
+    m_fileMtimeSecs.assign(files.size(), 0);
+    m_fileMtimeNsecs.assign(files.size(), 0);
+    m_isValid.assign(files.size(), 0);
+    m_hists = Mat::zeros(static_cast<int>(files.size()), cntBins, CV_32F);
+
+    // Each file is stamped, looked up in the cache and, only if needed, decoded and histogrammed by one worker, which
+    // keeps nothing but the histogram in its own row. So the files are processed in parallel and the memory is
+    // O(histograms) plus one decoded image per worker. Every file is a stripe of its own, since the decoding time
+    // varies a lot from file to file.
+    atomic<int> cntComputed(0);
+    atomic<bool> isHistMismatched(false);
+    const int cntFiles = static_cast<int>(files.size());
+    parallel_for_(Range(0, cntFiles), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            for (int histIdx = range.start; histIdx < range.end; ++histIdx)
+            {
+                if (!GetFileStamp(files[histIdx], m_fileSizes[histIdx], m_fileMtimeSecs[histIdx], m_fileMtimeNsecs[histIdx]))
+                {
+                    continue;
+                }
+
+                auto cachedIt = cachedHistIdxs.find(files[histIdx]);
+                if ((cachedIt != cachedHistIdxs.end())
+                    && (cachedSizes[cachedIt->second] == m_fileSizes[histIdx])
+                    && (cachedMtimeSecs[cachedIt->second] == m_fileMtimeSecs[histIdx])
+                    && (cachedMtimeNsecs[cachedIt->second] == m_fileMtimeNsecs[histIdx]))
+                {
+                    cachedHists.row(cachedIt->second).copyTo(m_hists.row(histIdx));
+                    m_isValid[histIdx] = cachedIsValid[cachedIt->second];
+                    continue;
+                }
+
+                Mat hist;
+                if (calcHistFunc(files[histIdx], hist))
+                {
+                    if ((hist.total() != static_cast<size_t>(cntBins)) || (hist.type() != CV_32F) || !hist.isContinuous())
+                    {
+                        printf("[ERROR]: The histogram of %s doesn't have %d CV_32F bins.\n\n", files[histIdx].c_str(), cntBins);
+                        isHistMismatched = true;
+                        continue;
+                    }
+
+                    Mat(1, cntBins, CV_32F, hist.ptr<float>()).copyTo(m_hists.row(histIdx));
+                    m_isValid[histIdx] = 1;
+                }
+
+                ++cntComputed;
+            }
+        }), cntFiles);
+
+    if (isHistMismatched)
+    {
+        return -1;
+    }
+
+    BuildSqrtHists();
+
+    m_isDirty = (cntComputed > 0) || (cachedFiles != files);
+    m_isIndexLoadable = !m_dbFile.empty() && !m_isDirty;
+    m_isIndexDirty = false;
+
+    return cntComputed;
+}
+
+int HistDatabase::Save()
+{
+    if (m_dbFile.empty())
+    {
+        return 0;
+    }
+
+    if (m_isDirty)
+    {
+        FileStorage fs(m_dbFile, FileStorage::WRITE);
+        if (!fs.isOpened())
+        {
+            printf("[ERROR]: Cannot open the histogram database %s for writing.\n\n", m_dbFile.c_str());
+            return -1;
+        }
+
+        fs << "hsvChannels" << m_hsvChannels;
+        fs << "files" << m_files;
+        fs << "fileSizes" << m_fileSizes;
+        fs << "fileMtimeSecs" << m_fileMtimeSecs;
+        fs << "fileMtimeNsecs" << m_fileMtimeNsecs;
+        fs << "isValid" << m_isValid;
+        fs << "hists" << m_hists;
+
+        // An index saved for the previous histograms must not be loaded for the new ones.
+        if (!m_isIndexDirty)
+        {
+            remove(m_indexFile.c_str());
+        }
+
+        m_isDirty = false;
+    }
+
+    // Note that flann::Index::save() writes the index data in a raw format, so it is saved in a separate file.
+    if (m_isIndexDirty)
+    {
+        m_index.save(m_indexFile);
+        m_isIndexDirty = false;
+    }
+
+    return 0;
+}
+
+int HistDatabase::GetCnt() const
+{
+    return static_cast<int>(m_files.size());
+}
+
+const string& HistDatabase::GetFile(const int histIdx) const
+{
+    return m_files[histIdx];
+}
+
+bool HistDatabase::IsValid(const int histIdx) const
+{
+    return m_isValid[histIdx] != 0;
+}
+
+const Mat& HistDatabase::GetHists() const
+{
+    return m_hists;
+}
+
+void HistDatabase::KnnSearchBhattacharyya(
+    const Mat& queryHist,
+    const int k,
+    const int checks,
+    vector<int>& histIdxs,
+    vector<double>& dists)
+{
+    histIdxs.clear();
+    dists.clear();
+
+    int cntNeighbors = min(k, static_cast<int>(m_validHistIdxs.size()));
+    if (cntNeighbors <= 0)
+    {
+        return;
+    }
+
+    PrepareIndex();
+
+    Mat sqrtQueryHist;
+    cv::sqrt(queryHist, sqrtQueryHist);
+    double querySum = sum(queryHist)[0];
+
+    Mat validIdxs;
+    Mat l2Dists;
+    m_index.knnSearch(sqrtQueryHist, validIdxs, l2Dists, cntNeighbors, flann::SearchParams(checks));
+
+    // The L2 distances are only for ranking, so the exact Bhattacharyya distances of the neighbours are computed.
+    vector<pair<double, int> > neighbors;
+    for (int neighborIdx = 0; neighborIdx < cntNeighbors; ++neighborIdx)
+    {
+        int validIdx = validIdxs.at<int>(neighborIdx);
+        if ((validIdx < 0) || (validIdx >= static_cast<int>(m_validHistIdxs.size())))
+        {
+            continue;
+        }
+
+        int histIdx = m_validHistIdxs[validIdx];
+        double dot = m_sqrtValidHists.row(validIdx).dot(sqrtQueryHist);
+        double sumProduct = m_histSums[histIdx] * querySum;
+        double scale = (fabs(sumProduct) > FLT_EPSILON) ? 1.0/std::sqrt(sumProduct) : 1.0;
+        neighbors.push_back(make_pair(std::sqrt(max(1.0 - dot*scale, 0.0)), histIdx));
+    }
+
+    sort(neighbors.begin(), neighbors.end());
+    for (auto& neighbor: neighbors)
+    {
+        dists.push_back(neighbor.first);
+        histIdxs.push_back(neighbor.second);
+    }
+}
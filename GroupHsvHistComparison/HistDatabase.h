@@ -0,0 +1,103 @@
+/*
+ * HistDatabase.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef HISTDATABASE_H_
+#define HISTDATABASE_H_
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <opencv2/core.hpp>
+#include <opencv2/flann.hpp>
+
+// A persistent database of the L1-normalized histograms of the images in a directory.
+//
+// The histograms are flattened into the rows of a contiguous CV_32F matrix and saved in a yml file together with
+// the size and the modification time of each image, so only the histograms of the new or modified images are
+// computed again in the next run.
+//
+// The Bhattacharyya (Hellinger) distance of two L1-normalized histograms p and q is sqrt(1 - sum(sqrt(p.*q))), i.e.,
+// it only depends on the dot product of the square-rooted histograms. Since ||sqrt(p) - sqrt(q)||^2 =
+// 2 - 2*sum(sqrt(p.*q)), the nearest neighbours in the Bhattacharyya distance are the
+// nearest neighbours in the L2 distance of the square-rooted histograms, which are searched in a FLANN KD-tree.
+// The FLANN index is saved in a raw file next to the yml file (with the suffix "_flannindex").
+class HistDatabase
+{
+private:
+    std::string m_dbFile;
+    std::string m_indexFile;
+
+    std::string m_hsvChannels;
+    std::vector<std::string> m_files;
+    std::vector<double> m_fileSizes;
+    std::vector<double> m_fileMtimeSecs;
+    std::vector<int> m_fileMtimeNsecs;
+
+    // 1 if the file is an image, whose histogram is in the corresponding row of m_hists, or 0 otherwise.
+    std::vector<int> m_isValid;
+
+    // One flattened histogram per row, and the sum of each row for the exact normalization of compareHist().
+    cv::Mat m_hists;
+    std::vector<double> m_histSums;
+
+    // The square-rooted histograms of the valid images, which are the features of the FLANN index.
+    cv::Mat m_sqrtValidHists;
+    std::vector<int> m_validHistIdxs;
+    cv::flann::Index m_index;
+    bool m_isIndexReady;
+
+    // The saved index can be loaded only if no histogram has changed since it was saved.
+    bool m_isIndexLoadable;
+
+    // Whether the histograms or the index need to be saved.
+    bool m_isDirty;
+    bool m_isIndexDirty;
+
+    static bool GetFileStamp(const std::string& file, double& size, double& mtimeSec, int& mtimeNsec);
+
+    void BuildSqrtHists();
+
+    // Load or build the FLANN index on the first k-NN search.
+    void PrepareIndex();
+
+public:
+    // An empty dbFile keeps the database in the memory only.
+    HistDatabase(const std::string& dbFile);
+
+    // Load the database and update it with the given files, where calcHistFunc computes the flattened L1-normalized
+    // histogram of a file and returns false if the file isn't an image. The cached histograms are reused only if the
+    // database was built with the same HSV channels and the file has the same size and modification time. The files
+    // are processed in parallel, so calcHistFunc must be thread-safe.
+    // Return the number of the histograms computed in this run, or -1 on error.
+    int Update(
+        const std::vector<std::string>& files,
+        const std::string& hsvChannels,
+        const int cntBins,
+        const std::function<bool(const std::string&, cv::Mat&)>& calcHistFunc);
+
+    // Save the histograms as well as the FLANN index. Return 0 on success or -1 on error.
+    int Save();
+
+    int GetCnt() const;
+    const std::string& GetFile(const int histIdx) const;
+    bool IsValid(const int histIdx) const;
+
+    // The flattened histograms as the rows of a cnt x cntBins matrix, where the rows of the invalid files are 0.
+    const cv::Mat& GetHists() const;
+
+    // Search the approximate k nearest histograms in the Bhattacharyya distance with the FLANN index, where checks
+    // is the number of the leaves to visit. The results are sorted by the distance.
+    void KnnSearchBhattacharyya(
+        const cv::Mat& queryHist,
+        const int k,
+        const int checks,
+        std::vector<int>& histIdxs,
+        std::vector<double>& dists);
+};
+
+#endif /* HISTDATABASE_H_ */
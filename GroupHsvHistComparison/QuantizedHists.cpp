@@ -0,0 +1,489 @@
+/*
+ * QuantizedHists.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <climits>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "QuantizedHists.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Wrap a lambda as the body of parallel_for_().
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+// The shift beyond which the coarser histogram of an intersection exceeds any bin of the finer one, i.e., 2^16 is
+// larger than any 15-bit value, and which still keeps the shifted 15-bit values within a 32-bit integer.
+const int maxIntersectShift = 16;
+
+// Accumulate the term of one bin of two dequantized histograms p and q in the same way as compareHist(). Correlation
+// and Bhattacharyya accumulate p*q and sqrt(p*q), respectively, which are combined with the per-histogram terms later.
+inline void AccumulateBin(const double p, const double q, const int method, double& result)
+{
+    switch (method)
+    {
+    case CV_COMP_CORREL:
+        result += p*q;
+        break;
+
+    case CV_COMP_CHISQR:
+    case CV_COMP_CHISQR_ALT:
+    {
+        double a = p - q;
+        double b = (method == CV_COMP_CHISQR) ? p : p + q;
+        if (fabs(b) > DBL_EPSILON)
+        {
+            result += a*a/b;
+        }
+        break;
+    }
+
+    case CV_COMP_INTERSECT:
+        result += min(p, q);
+        break;
+
+    case CV_COMP_BHATTACHARYYA:
+        result += std::sqrt(p*q);
+        break;
+
+    default:
+        if (fabs(p) > DBL_EPSILON)
+        {
+            result += p*log(p/((fabs(q) <= DBL_EPSILON) ? 1e-10 : q));
+        }
+        break;
+    }
+}
+
+#if CV_SIMD128
+inline v_int16x8 LoadAsInt16(const uchar* ptr)
+{
+    return v_reinterpret_as_s16(v_load_expand(ptr));
+}
+
+inline v_int16x8 LoadAsInt16(const ushort* ptr)
+{
+    return v_reinterpret_as_s16(v_load(ptr));
+}
+#endif
+
+// Compare two dense quantized histograms, whose bins are hist1[bin]*2^-exp1 and hist2[bin]*2^-exp2, and return the
+// raw result as AccumulateBin(). 8 bins are processed per step, and the float lanes are accumulated for 64 steps at
+// most before being added up in double.
+template <typename T>
+double CompareDensePair(const T* hist1, const int exp1, const T* hist2, const int exp2, const int cntBins, const int method)
+{
+    const double scale1 = ldexp(1.0, -exp1);
+    const double scale2 = ldexp(1.0, -exp2);
+    double result = 0;
+    int bin = 0;
+
+#if CV_SIMD128
+    const int cntStepsPerFlush = 64;
+
+    if (method == CV_COMP_INTERSECT)
+    {
+        // min(P*2^-e1, Q*2^-e2) = min(P, Q*2^(e1 - e2))*2^-e1 for e1 >= e2, which is exact in the integers.
+        const T* fineHist = (exp1 >= exp2) ? hist1 : hist2;
+        const T* coarseHist = (exp1 >= exp2) ? hist2 : hist1;
+        const int shift = min(abs(exp1 - exp2), maxIntersectShift);
+        int64 intResult = 0;
+
+        while (bin <= cntBins - 8)
+        {
+            v_int32x4 acc = v_setzero_s32();
+            for (int step = 0; (step < cntStepsPerFlush) && (bin <= cntBins - 8); ++step, bin += 8)
+            {
+                v_int32x4 p0, p1, q0, q1;
+                v_expand(LoadAsInt16(fineHist + bin), p0, p1);
+                v_expand(LoadAsInt16(coarseHist + bin), q0, q1);
+                acc += v_min(p0, q0 << shift) + v_min(p1, q1 << shift);
+            }
+
+            intResult += v_reduce_sum(acc);
+        }
+
+        result = ldexp(static_cast<double>(intResult), -max(exp1, exp2));
+    }
+    else if (method != CV_COMP_KL_DIV)
+    {
+        const v_float32x4 zero = v_setzero_f32();
+        const v_float32x4 s1 = v_setall_f32(static_cast<float>(scale1));
+        const v_float32x4 s2 = v_setall_f32(static_cast<float>(scale2));
+        const v_float32x4 eps = v_setall_f32(static_cast<float>(DBL_EPSILON));
+
+        while (bin <= cntBins - 8)
+        {
+            v_float32x4 acc = v_setzero_f32();
+            for (int step = 0; (step < cntStepsPerFlush) && (bin <= cntBins - 8); ++step, bin += 8)
+            {
+                v_int16x8 p = LoadAsInt16(hist1 + bin);
+                v_int16x8 q = LoadAsInt16(hist2 + bin);
+
+                if (method == CV_COMP_CORREL)
+                {
+                    // The sum of two products of 15-bit values still fits in 32 bits.
+                    acc += v_cvt_f32(v_dotprod(p, q));
+                }
+                else if (method == CV_COMP_BHATTACHARYYA)
+                {
+                    v_int32x4 pq0, pq1;
+                    v_mul_expand(p, q, pq0, pq1);
+                    acc += v_sqrt(v_cvt_f32(pq0)) + v_sqrt(v_cvt_f32(pq1));
+                }
+                else
+                {
+                    v_int32x4 p0, p1, q0, q1;
+                    v_expand(p, p0, p1);
+                    v_expand(q, q0, q1);
+
+                    v_float32x4 pf[2] = { v_cvt_f32(p0)*s1, v_cvt_f32(p1)*s1 };
+                    v_float32x4 qf[2] = { v_cvt_f32(q0)*s2, v_cvt_f32(q1)*s2 };
+                    for (int half = 0; half < 2; ++half)
+                    {
+                        v_float32x4 a = pf[half] - qf[half];
+                        v_float32x4 b = (method == CV_COMP_CHISQR) ? pf[half] : pf[half] + qf[half];
+
+                        // The bins where the denominator is 0 are skipped.
+                        acc += v_select(v_abs(b) > eps, (a*a)/b, zero);
+                    }
+                }
+            }
+
+            result += v_reduce_sum(acc);
+        }
+
+        // The integer products are in the units of 2^-(e1 + e2).
+        if (method == CV_COMP_CORREL)
+        {
+            result *= scale1*scale2;
+        }
+        else if (method == CV_COMP_BHATTACHARYYA)
+        {
+            result *= std::sqrt(scale1*scale2);
+        }
+    }
+#endif
+
+    for (; bin < cntBins; ++bin)
+    {
+        AccumulateBin(hist1[bin]*scale1, hist2[bin]*scale2, method, result);
+    }
+
+    return result;
+}
+
+// Compare two sparse quantized histograms by merging their nonzero bins, which are sorted by the bin index. The bins
+// which are 0 in both add nothing to the raw result of any method.
+double CompareSparsePair(
+    const ushort* idxs1,
+    const ushort* vals1,
+    const int cnt1,
+    const int exp1,
+    const ushort* idxs2,
+    const ushort* vals2,
+    const int cnt2,
+    const int exp2,
+    const int method)
+{
+    const double scale1 = ldexp(1.0, -exp1);
+    const double scale2 = ldexp(1.0, -exp2);
+    double result = 0;
+
+    int pos1 = 0;
+    int pos2 = 0;
+    while ((pos1 < cnt1) || (pos2 < cnt2))
+    {
+        int bin1 = (pos1 < cnt1) ? idxs1[pos1] : INT_MAX;
+        int bin2 = (pos2 < cnt2) ? idxs2[pos2] : INT_MAX;
+
+        double p = (bin1 <= bin2) ? vals1[pos1]*scale1 : 0;
+        double q = (bin2 <= bin1) ? vals2[pos2]*scale2 : 0;
+        AccumulateBin(p, q, method, result);
+
+        pos1 += (bin1 <= bin2) ? 1 : 0;
+        pos2 += (bin2 <= bin1) ? 1 : 0;
+    }
+
+    return result;
+}
+
+}
+
+QuantizedHists::QuantizedHists(const Mat& hists, const int format) :
+    m_format(format),
+    m_cntBins(hists.cols),
+    m_maxVal((format == FORMAT_U8) ? UCHAR_MAX : SHRT_MAX)
+{
+    CV_Assert((hists.type() == CV_32F) && hists.isContinuous());
+    CV_Assert((format == FORMAT_U8) || (format == FORMAT_U16) || (format == FORMAT_SPARSE));
+    CV_Assert(m_cntBins <= USHRT_MAX + 1);
+
+    if (m_format != FORMAT_SPARSE)
+    {
+        m_denseHists.create(hists.rows, m_cntBins, (m_format == FORMAT_U8) ? CV_8U : CV_16U);
+    }
+    else
+    {
+        m_rowStarts.push_back(0);
+    }
+
+    m_exps.resize(hists.rows);
+    m_sums.resize(hists.rows);
+    m_sqSums.resize(hists.rows);
+
+    for (int histIdx = 0; histIdx < hists.rows; ++histIdx)
+    {
+        const float* hist = hists.ptr<float>(histIdx);
+
+        // The largest exponent for which the largest bin still fits in m_maxVal. The loops only fix the rounding of
+        // log2().
+        double maxBin = 0;
+        for (int bin = 0; bin < m_cntBins; ++bin)
+        {
+            maxBin = max(maxBin, static_cast<double>(hist[bin]));
+        }
+
+        int exp = 0;
+        if (maxBin > 0)
+        {
+            exp = cvFloor(log2(m_maxVal/maxBin));
+            while (ldexp(maxBin, exp) > m_maxVal)
+            {
+                --exp;
+            }
+
+            while (ldexp(maxBin, exp + 1) <= m_maxVal)
+            {
+                ++exp;
+            }
+        }
+
+        m_exps[histIdx] = exp;
+
+        const double scale = ldexp(1.0, -exp);
+        m_sums[histIdx] = 0;
+        m_sqSums[histIdx] = 0;
+        for (int bin = 0; bin < m_cntBins; ++bin)
+        {
+            int val = min(cvRound(ldexp(max(static_cast<double>(hist[bin]), 0.0), exp)), m_maxVal);
+            if (m_format == FORMAT_U8)
+            {
+                m_denseHists.at<uchar>(histIdx, bin) = static_cast<uchar>(val);
+            }
+            else if (m_format == FORMAT_U16)
+            {
+                m_denseHists.at<ushort>(histIdx, bin) = static_cast<ushort>(val);
+            }
+            else if (val > 0)
+            {
+                m_binIdxs.push_back(static_cast<ushort>(bin));
+                m_binVals.push_back(static_cast<ushort>(val));
+            }
+
+            m_sums[histIdx] += val*scale;
+            m_sqSums[histIdx] += val*scale*val*scale;
+        }
+
+        if (m_format == FORMAT_SPARSE)
+        {
+            m_rowStarts.push_back(static_cast<int>(m_binIdxs.size()));
+        }
+    }
+}
+
+bool QuantizedHists::Str2Format(string& strFormat, int& format)
+{
+    transform(strFormat.begin(), strFormat.end(), strFormat.begin(), ::tolower);
+
+    if (strFormat == "u8")
+    {
+        format = FORMAT_U8;
+    }
+    else if (strFormat == "u16")
+    {
+        format = FORMAT_U16;
+    }
+    else if (strFormat == "sparse")
+    {
+        format = FORMAT_SPARSE;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+string QuantizedHists::Format2Str(const int format)
+{
+    switch (format)
+    {
+    case FORMAT_U8:
+        return "8-bit";
+
+    case FORMAT_U16:
+        return "15-bit";
+
+    case FORMAT_SPARSE:
+        return "sparse 15-bit";
+
+    default:
+        return "invalid";
+    }
+}
+
+int QuantizedHists::GetCnt() const
+{
+    return static_cast<int>(m_exps.size());
+}
+
+double QuantizedHists::GetBytesPerHist() const
+{
+    if (m_exps.empty())
+    {
+        return 0;
+    }
+
+    double bytes = static_cast<double>(m_exps.size()*sizeof(int));
+    if (m_format == FORMAT_SPARSE)
+    {
+        bytes += static_cast<double>(m_binIdxs.size()*sizeof(ushort) + m_binVals.size()*sizeof(ushort)
+            + m_rowStarts.size()*sizeof(int));
+    }
+    else
+    {
+        bytes += static_cast<double>(m_denseHists.total()*m_denseHists.elemSize());
+    }
+
+    return bytes/m_exps.size();
+}
+
+void QuantizedHists::Dequantize(Mat& hists) const
+{
+    hists = Mat::zeros(GetCnt(), m_cntBins, CV_32F);
+    for (int histIdx = 0; histIdx < GetCnt(); ++histIdx)
+    {
+        const double scale = ldexp(1.0, -m_exps[histIdx]);
+        float* hist = hists.ptr<float>(histIdx);
+
+        if (m_format == FORMAT_SPARSE)
+        {
+            for (int pos = m_rowStarts[histIdx]; pos < m_rowStarts[histIdx + 1]; ++pos)
+            {
+                hist[m_binIdxs[pos]] = static_cast<float>(m_binVals[pos]*scale);
+            }
+        }
+        else
+        {
+            Mat dequantizedHist = hists.row(histIdx);
+            m_denseHists.row(histIdx).convertTo(dequantizedHist, CV_32F, scale);
+        }
+    }
+}
+
+double QuantizedHists::ComparePair(
+    const QuantizedHists& queryHists,
+    const int queryIdx,
+    const int histIdx,
+    const int method) const
+{
+    const int queryExp = queryHists.m_exps[queryIdx];
+    const int histExp = m_exps[histIdx];
+
+    if (m_format == FORMAT_U8)
+    {
+        return CompareDensePair(queryHists.m_denseHists.ptr<uchar>(queryIdx), queryExp,
+            m_denseHists.ptr<uchar>(histIdx), histExp, m_cntBins, method);
+    }
+
+    if (m_format == FORMAT_U16)
+    {
+        return CompareDensePair(queryHists.m_denseHists.ptr<ushort>(queryIdx), queryExp,
+            m_denseHists.ptr<ushort>(histIdx), histExp, m_cntBins, method);
+    }
+
+    const int queryStart = queryHists.m_rowStarts[queryIdx];
+    const int histStart = m_rowStarts[histIdx];
+    return CompareSparsePair(
+        queryHists.m_binIdxs.data() + queryStart,
+        queryHists.m_binVals.data() + queryStart,
+        queryHists.m_rowStarts[queryIdx + 1] - queryStart,
+        queryExp,
+        m_binIdxs.data() + histStart,
+        m_binVals.data() + histStart,
+        m_rowStarts[histIdx + 1] - histStart,
+        histExp,
+        method);
+}
+
+void QuantizedHists::Compare(const QuantizedHists& queryHists, const int method, Mat& dists) const
+{
+    CV_Assert((queryHists.m_format == m_format) && (queryHists.m_cntBins == m_cntBins));
+    CV_Assert((method == CV_COMP_CORREL) || (method == CV_COMP_CHISQR) || (method == CV_COMP_CHISQR_ALT)
+        || (method == CV_COMP_INTERSECT) || (method == CV_COMP_BHATTACHARYYA) || (method == CV_COMP_KL_DIV));
+
+    dists.create(queryHists.GetCnt(), GetCnt(), CV_64F);
+
+    const int cntHists = GetCnt();
+    parallel_for_(Range(0, queryHists.GetCnt()*cntHists), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            for (int pairIdx = range.start; pairIdx < range.end; ++pairIdx)
+            {
+                int queryIdx = pairIdx/cntHists;
+                int histIdx = pairIdx%cntHists;
+                double result = ComparePair(queryHists, queryIdx, histIdx, method);
+                double& dist = dists.at<double>(queryIdx, histIdx);
+
+                // Combine the raw result with the per-histogram terms in the same way as compareHist().
+                if (method == CV_COMP_CORREL)
+                {
+                    double querySum = queryHists.m_sums[queryIdx];
+                    double scale = 1.0/m_cntBins;
+                    double num = result - querySum*m_sums[histIdx]*scale;
+                    double denom2 = (queryHists.m_sqSums[queryIdx] - querySum*querySum*scale)
+                        *(m_sqSums[histIdx] - m_sums[histIdx]*m_sums[histIdx]*scale);
+                    dist = (fabs(denom2) > DBL_EPSILON) ? num/std::sqrt(denom2) : 1.0;
+                }
+                else if (method == CV_COMP_BHATTACHARYYA)
+                {
+                    double sumProduct = queryHists.m_sums[queryIdx]*m_sums[histIdx];
+                    double scale = (fabs(sumProduct) > FLT_EPSILON) ? 1.0/std::sqrt(sumProduct) : 1.0;
+                    dist = std::sqrt(max(1.0 - result*scale, 0.0));
+                }
+                else
+                {
+                    dist = (method == CV_COMP_CHISQR_ALT) ? 2*result : result;
+                }
+            }
+        }));
+}
@@ -0,0 +1,85 @@
+/*
+ * QuantizedHists.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef QUANTIZEDHISTS_H_
+#define QUANTIZEDHISTS_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// A compact form of a set of histograms, which are compared directly in the quantized form by the methods of
+// compareHist().
+//
+// Each bin is quantized into an integer q of 8 bits (u8) or 15 bits (u16), where the value of the bin is q*2^-e and
+// the exponent e is the largest one for which the largest bin of the histogram still fits, i.e., one exponent per
+// histogram as the block floating point. The 15 bits of u16 keep the product of two bins within a 32-bit integer,
+// so that the 16-bit multiply-add of the SIMD intrinsics can be used. The sparse form keeps the 15-bit values of the
+// nonzero bins only together with their bin indices, which is smaller for the mostly-zero histograms, e.g., H-S
+// histograms of the images with a few dominant colors.
+//
+// The dense histograms are compared with the 128-bit integer SIMD intrinsics of OpenCV: intersection is exact in
+// the integers by shifting the coarser histogram to the exponent of the finer one, correlation and Bhattacharyya
+// use the 16-bit integer products, and chi-square converts the integers to float. The sparse histograms are compared
+// by merging the nonzero bins, and Kullback-Leibler divergence is computed bin by bin in either form.
+class QuantizedHists
+{
+public:
+    enum Format
+    {
+        FORMAT_U8 = 0,
+        FORMAT_U16,
+        FORMAT_SPARSE
+    };
+
+private:
+    int m_format;
+    int m_cntBins;
+    int m_maxVal;
+
+    // N x B CV_8U or CV_16U for the dense forms.
+    cv::Mat m_denseHists;
+
+    // The nonzero bins of histogram i are [m_rowStarts[i], m_rowStarts[i + 1]) of the bin indices and values for the
+    // sparse form.
+    std::vector<int> m_rowStarts;
+    std::vector<ushort> m_binIdxs;
+    std::vector<ushort> m_binVals;
+
+    std::vector<int> m_exps;
+
+    // The sum and the sum of the squares of each dequantized histogram.
+    std::vector<double> m_sums;
+    std::vector<double> m_sqSums;
+
+    // The raw result of one pair before the per-histogram terms are applied.
+    double ComparePair(const QuantizedHists& queryHists, const int queryIdx, const int histIdx, const int method) const;
+
+public:
+    // hists is an N x B CV_32F matrix of one non-negative histogram per row, e.g., from BatchHistComparator::StackHists().
+    QuantizedHists(const cv::Mat& hists, const int format);
+
+    // Return false if the format name (u8 | u16 | sparse) is invalid.
+    static bool Str2Format(std::string& strFormat, int& format);
+    static std::string Format2Str(const int format);
+
+    int GetCnt() const;
+
+    // The bytes of the storage per histogram on average, including the exponent and, for the sparse form, the bin
+    // indices and the row start.
+    double GetBytesPerHist() const;
+
+    // The dequantized histograms as an N x B CV_32F matrix, e.g., to measure the quantization error.
+    void Dequantize(cv::Mat& hists) const;
+
+    // Compare each histogram of queryHists, which must be of the same format and the same number of bins, with each
+    // histogram, and return the M x N CV_64F matrix of the results as BatchHistComparator::Compare().
+    void Compare(const QuantizedHists& queryHists, const int method, cv::Mat& dists) const;
+};
+
+#endif /* QUANTIZEDHISTS_H_ */
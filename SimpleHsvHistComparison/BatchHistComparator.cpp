@@ -0,0 +1,311 @@
+/*
+ * BatchHistComparator.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "BatchHistComparator.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Wrap a lambda as the body of parallel_for_().
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+// Compare two histograms of cntBins bins by chi-square (the first histogram as the denominator), alternative
+// chi-square (the sum of the two as the denominator) or intersection, the same as compareHist() except for the
+// rounding. The 4 lanes are accumulated in float for 64 steps at most, and then added up in double.
+double ComparePair(const float* hist1, const float* hist2, const int cntBins, const int method)
+{
+    double result = 0;
+    int bin = 0;
+
+#if CV_SIMD128
+    const int cntStepsPerFlush = 64;
+    const v_float32x4 zero = v_setzero_f32();
+    const v_float32x4 eps = v_setall_f32(static_cast<float>(DBL_EPSILON));
+
+    while (bin <= cntBins - 4)
+    {
+        v_float32x4 acc = v_setzero_f32();
+        for (int step = 0; (step < cntStepsPerFlush) && (bin <= cntBins - 4); ++step, bin += 4)
+        {
+            v_float32x4 p = v_load(hist1 + bin);
+            v_float32x4 q = v_load(hist2 + bin);
+
+            if (method == CV_COMP_INTERSECT)
+            {
+                acc += v_min(p, q);
+            }
+            else
+            {
+                v_float32x4 a = p - q;
+                v_float32x4 b = (method == CV_COMP_CHISQR) ? p : p + q;
+
+                // The bins where the denominator is 0 are skipped.
+                acc += v_select(v_abs(b) > eps, (a*a)/b, zero);
+            }
+        }
+
+        result += v_reduce_sum(acc);
+    }
+#endif
+
+    for (; bin < cntBins; ++bin)
+    {
+        double p = hist1[bin];
+        double q = hist2[bin];
+
+        if (method == CV_COMP_INTERSECT)
+        {
+            result += min(p, q);
+        }
+        else
+        {
+            double a = p - q;
+            double b = (method == CV_COMP_CHISQR) ? p : p + q;
+            if (fabs(b) > DBL_EPSILON)
+            {
+                result += a*a/b;
+            }
+        }
+    }
+
+    return (method == CV_COMP_CHISQR_ALT) ? 2*result : result;
+}
+
+}
+
+BatchHistComparator::BatchHistComparator(const Mat& hists) :
+    m_hists(hists)
+{
+    CV_Assert((m_hists.type() == CV_32F) && m_hists.isContinuous());
+}
+
+Mat BatchHistComparator::StackHists(const vector<Mat>& hists)
+{
+    if (hists.empty())
+    {
+        return Mat();
+    }
+
+    const int cntBins = static_cast<int>(hists[0].total());
+    Mat stackedHists(static_cast<int>(hists.size()), cntBins, CV_32F);
+    for (size_t histIdx = 0; histIdx < hists.size(); ++histIdx)
+    {
+        CV_Assert((static_cast<int>(hists[histIdx].total()) == cntBins) && hists[histIdx].isContinuous());
+
+        Mat flatHist(1, cntBins, hists[histIdx].type(), const_cast<uchar*>(hists[histIdx].ptr()));
+        Mat stackedHist = stackedHists.row(static_cast<int>(histIdx));
+        flatHist.convertTo(stackedHist, CV_32F);
+    }
+
+    return stackedHists;
+}
+
+int BatchHistComparator::GetCnt() const
+{
+    return m_hists.rows;
+}
+
+void BatchHistComparator::CompareByDotProducts(const Mat& queryHists, const int method, Mat& dists)
+{
+    // Prepare the per-histogram terms.
+    if (m_hists64.empty())
+    {
+        m_hists.convertTo(m_hists64, CV_64F);
+
+        m_sums.resize(m_hists.rows);
+        m_sqSums.resize(m_hists.rows);
+        for (int histIdx = 0; histIdx < m_hists.rows; ++histIdx)
+        {
+            m_sums[histIdx] = sum(m_hists64.row(histIdx))[0];
+            m_sqSums[histIdx] = m_hists64.row(histIdx).dot(m_hists64.row(histIdx));
+        }
+    }
+
+    Mat queryHists64;
+    queryHists.convertTo(queryHists64, CV_64F);
+
+    // The per-query terms and the matrices of the dot products.
+    const int cntBins = m_hists.cols;
+    vector<double> querySums(queryHists.rows);
+    vector<double> querySqSums(queryHists.rows);
+    Mat products;
+
+    if (method == CV_COMP_CORREL)
+    {
+        for (int queryIdx = 0; queryIdx < queryHists.rows; ++queryIdx)
+        {
+            querySums[queryIdx] = sum(queryHists64.row(queryIdx))[0];
+            querySqSums[queryIdx] = queryHists64.row(queryIdx).dot(queryHists64.row(queryIdx));
+        }
+
+        gemm(queryHists64, m_hists64, 1, noArray(), 0, products, GEMM_2_T);
+    }
+    else if (method == CV_COMP_BHATTACHARYYA)
+    {
+        if (m_sqrtHists64.empty())
+        {
+            cv::sqrt(m_hists64, m_sqrtHists64);
+        }
+
+        for (int queryIdx = 0; queryIdx < queryHists.rows; ++queryIdx)
+        {
+            querySums[queryIdx] = sum(queryHists64.row(queryIdx))[0];
+        }
+
+        Mat sqrtQueryHists64;
+        cv::sqrt(queryHists64, sqrtQueryHists64);
+        gemm(sqrtQueryHists64, m_sqrtHists64, 1, noArray(), 0, products, GEMM_2_T);
+    }
+    else
+    {
+        // KL divergence = sum(p*log(p/q)) = sum(p*log(p)) - sum(p*log(q)) over the bins where p isn't 0, and
+        // compareHist() replaces q by 1e-10 where q is 0.
+        if (m_logHists64.empty())
+        {
+            m_logHists64.create(m_hists64.size(), CV_64F);
+            for (int histIdx = 0; histIdx < m_hists64.rows; ++histIdx)
+            {
+                const double* hist = m_hists64.ptr<double>(histIdx);
+                double* logHist = m_logHists64.ptr<double>(histIdx);
+                for (int bin = 0; bin < cntBins; ++bin)
+                {
+                    logHist[bin] = log((fabs(hist[bin]) <= DBL_EPSILON) ? 1e-10 : hist[bin]);
+                }
+            }
+        }
+
+        Mat maskedQueryHists64 = queryHists64.clone();
+        for (int queryIdx = 0; queryIdx < queryHists.rows; ++queryIdx)
+        {
+            double* queryHist = maskedQueryHists64.ptr<double>(queryIdx);
+            double entropyTerm = 0;
+            for (int bin = 0; bin < cntBins; ++bin)
+            {
+                if (fabs(queryHist[bin]) <= DBL_EPSILON)
+                {
+                    queryHist[bin] = 0;
+                }
+                else
+                {
+                    entropyTerm += queryHist[bin]*log(queryHist[bin]);
+                }
+            }
+
+            querySums[queryIdx] = entropyTerm;
+        }
+
+        gemm(maskedQueryHists64, m_logHists64, 1, noArray(), 0, products, GEMM_2_T);
+    }
+
+    // Combine the per-histogram terms with the dot products in the same way as compareHist().
+    dists.create(queryHists.rows, m_hists.rows, CV_64F);
+    const int cntHists = m_hists.rows;
+    parallel_for_(Range(0, queryHists.rows*cntHists), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            for (int pairIdx = range.start; pairIdx < range.end; ++pairIdx)
+            {
+                int queryIdx = pairIdx/cntHists;
+                int histIdx = pairIdx%cntHists;
+                double product = products.at<double>(queryIdx, histIdx);
+                double& dist = dists.at<double>(queryIdx, histIdx);
+
+                if (method == CV_COMP_CORREL)
+                {
+                    double scale = 1.0/cntBins;
+                    double num = product - querySums[queryIdx]*m_sums[histIdx]*scale;
+                    double denom2 = (querySqSums[queryIdx] - querySums[queryIdx]*querySums[queryIdx]*scale)
+                        *(m_sqSums[histIdx] - m_sums[histIdx]*m_sums[histIdx]*scale);
+                    dist = (fabs(denom2) > DBL_EPSILON) ? num/std::sqrt(denom2) : 1.0;
+                }
+                else if (method == CV_COMP_BHATTACHARYYA)
+                {
+                    double sumProduct = querySums[queryIdx]*m_sums[histIdx];
+                    double scale = (fabs(sumProduct) > FLT_EPSILON) ? 1.0/std::sqrt(sumProduct) : 1.0;
+                    dist = std::sqrt(max(1.0 - product*scale, 0.0));
+                }
+                else
+                {
+                    dist = querySums[queryIdx] - product;
+                }
+            }
+        }));
+}
+
+void BatchHistComparator::CompareByPairs(const Mat& queryHists, const int method, Mat& dists) const
+{
+    dists.create(queryHists.rows, m_hists.rows, CV_64F);
+
+    const int cntHists = m_hists.rows;
+    parallel_for_(Range(0, queryHists.rows*cntHists), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            for (int pairIdx = range.start; pairIdx < range.end; ++pairIdx)
+            {
+                int queryIdx = pairIdx/cntHists;
+                int histIdx = pairIdx%cntHists;
+                dists.at<double>(queryIdx, histIdx) = ComparePair(
+                    queryHists.ptr<float>(queryIdx), m_hists.ptr<float>(histIdx), m_hists.cols, method);
+            }
+        }));
+}
+
+void BatchHistComparator::Compare(const Mat& queryHists, const int method, Mat& dists)
+{
+    CV_Assert(queryHists.cols == m_hists.cols);
+
+    Mat queryHists32;
+    queryHists.convertTo(queryHists32, CV_32F);
+
+    if (queryHists32.empty() || m_hists.empty())
+    {
+        dists = Mat::zeros(queryHists32.rows, m_hists.rows, CV_64F);
+        return;
+    }
+
+    switch (method)
+    {
+    case CV_COMP_CORREL:
+    case CV_COMP_BHATTACHARYYA:
+    case CV_COMP_KL_DIV:
+        CompareByDotProducts(queryHists32, method, dists);
+        break;
+
+    case CV_COMP_CHISQR:
+    case CV_COMP_CHISQR_ALT:
+    case CV_COMP_INTERSECT:
+        CompareByPairs(queryHists32, method, dists);
+        break;
+
+    default:
+        CV_Error(Error::StsBadArg, "Unknown histogram comparison method");
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * BatchHistComparator.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef BATCHHISTCOMPARATOR_H_
+#define BATCHHISTCOMPARATOR_H_
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Compare a batch of query histograms with a set of histograms by the methods of compareHist(), where the query is
+// always the first histogram of compareHist(). The histograms are flattened into the rows of a contiguous CV_32F
+// matrix, and the result of comparing query i with histogram j is element (i, j) of a CV_64F distance matrix.
+//
+// Correlation, Bhattacharyya and Kullback-Leibler divergence are separable into the per-histogram terms and a dot
+// product, so all their dot products are computed by a single matrix product in double precision. Chi-square,
+// alternative chi-square and intersection are computed pair by pair with the 128-bit SIMD intrinsics of OpenCV.
+// Both are multi-threaded across the query-histogram pairs.
+class BatchHistComparator
+{
+private:
+    // N x B, one flattened histogram per row.
+    cv::Mat m_hists;
+
+    // The per-histogram terms, computed on the first use of the method that needs them.
+    cv::Mat m_hists64;
+    cv::Mat m_sqrtHists64;
+    cv::Mat m_logHists64;
+    std::vector<double> m_sums;
+    std::vector<double> m_sqSums;
+
+    void CompareByDotProducts(const cv::Mat& queryHists, const int method, cv::Mat& dists);
+    void CompareByPairs(const cv::Mat& queryHists, const int method, cv::Mat& dists) const;
+
+public:
+    // hists is an N x B CV_32F matrix of one histogram per row, e.g., from StackHists().
+    explicit BatchHistComparator(const cv::Mat& hists);
+
+    // Flatten each histogram, which may have any number of dimensions, into a row of an N x B CV_32F matrix.
+    static cv::Mat StackHists(const std::vector<cv::Mat>& hists);
+
+    int GetCnt() const;
+
+    // Compare each row of queryHists (M x B) with each histogram, and return the M x N matrix of the results.
+    // method is one of CV_COMP_CORREL, CV_COMP_CHISQR, CV_COMP_CHISQR_ALT, CV_COMP_INTERSECT,
+    // CV_COMP_BHATTACHARYYA and CV_COMP_KL_DIV.
+    void Compare(const cv::Mat& queryHists, const int method, cv::Mat& dists);
+};
+
+#endif /* BATCHHISTCOMPARATOR_H_ */
@@ -0,0 +1,261 @@
+/*
+ * ReducedImageDecoder.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <mutex>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "ReducedImageDecoder.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Wrap a lambda as the body of parallel_for_().
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+int DecodeScale2ImreadFlag(const int decodeScale)
+{
+    switch (decodeScale)
+    {
+    case 2:
+        return IMREAD_REDUCED_COLOR_2;
+
+    case 4:
+        return IMREAD_REDUCED_COLOR_4;
+
+    case 8:
+        return IMREAD_REDUCED_COLOR_8;
+
+    default:
+        return IMREAD_COLOR;
+    }
+}
+
+}
+
+ReducedImageDecoder::ReducedImageDecoder(const int decodeScale, const int targetPixels) :
+    m_decodeScale(IsValidScale(decodeScale) ? decodeScale : 1),
+    m_targetPixels(max(targetPixels, 0))
+{
+}
+
+bool ReducedImageDecoder::IsValidScale(const int decodeScale)
+{
+    return (decodeScale == 1) || (decodeScale == 2) || (decodeScale == 4) || (decodeScale == 8);
+}
+
+bool ReducedImageDecoder::IsFullResolution() const
+{
+    return (m_targetPixels == 0) && (m_decodeScale == 1);
+}
+
+string ReducedImageDecoder::GetKey() const
+{
+    if (m_targetPixels > 0)
+    {
+        return "@t" + to_string(m_targetPixels);
+    }
+
+    return (m_decodeScale > 1) ? "@" + to_string(m_decodeScale) : string();
+}
+
+string ReducedImageDecoder::ToStr() const
+{
+    if (m_targetPixels > 0)
+    {
+        return "the target of " + to_string(m_targetPixels) + " pixels";
+    }
+
+    return (m_decodeScale > 1) ? "1/" + to_string(m_decodeScale) + " of the resolution" : string("the full resolution");
+}
+
+bool ReducedImageDecoder::ReadJpegSize(const string& file, Size& size)
+{
+    ifstream ifs(file, ios::binary);
+    if (!ifs.is_open() || (ifs.get() != 0xFF) || (ifs.get() != 0xD8))
+    {
+        return false;
+    }
+
+    // Walk through the segments up to the first start of frame.
+    while (ifs)
+    {
+        int marker = ifs.get();
+        if (marker != 0xFF)
+        {
+            return false;
+        }
+
+        // Skip the fill bytes.
+        while (marker == 0xFF)
+        {
+            marker = ifs.get();
+        }
+
+        // The standalone markers have no length.
+        if ((marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD8)))
+        {
+            continue;
+        }
+
+        if ((marker == 0xD9) || (marker == 0xDA) || (marker == EOF))
+        {
+            return false;
+        }
+
+        int length = (ifs.get() << 8);
+        length |= ifs.get();
+        if (!ifs || (length < 2))
+        {
+            return false;
+        }
+
+        // SOF0 to SOF15 except DHT (C4), JPG (C8) and DAC (CC): the precision, the height and the width.
+        if ((marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC))
+        {
+            uchar sof[5];
+            if (!ifs.read(reinterpret_cast<char*>(sof), sizeof(sof)))
+            {
+                return false;
+            }
+
+            size = Size((sof[3] << 8) | sof[4], (sof[1] << 8) | sof[2]);
+            return (size.width > 0) && (size.height > 0);
+        }
+
+        ifs.seekg(length - 2, ios::cur);
+    }
+
+    return false;
+}
+
+Mat ReducedImageDecoder::Read(const string& file) const
+{
+    if (m_targetPixels == 0)
+    {
+        return imread(file, DecodeScale2ImreadFlag(m_decodeScale));
+    }
+
+    // The largest decoder scale whose image still has the target pixels, if the size is known before decoding.
+    int decodeScale = 1;
+    Size size;
+    if (ReadJpegSize(file, size))
+    {
+        const double cntPixels = static_cast<double>(size.width)*size.height;
+        while ((decodeScale < 8) && (cntPixels/(4.0*decodeScale*decodeScale) >= m_targetPixels))
+        {
+            decodeScale *= 2;
+        }
+    }
+
+    Mat img = imread(file, DecodeScale2ImreadFlag(decodeScale));
+    if (img.empty())
+    {
+        return img;
+    }
+
+    // Box-downsample by an integer factor, which averages each factor x factor block, if the image is still too large.
+    int factor = cvFloor(std::sqrt(static_cast<double>(img.total())/m_targetPixels));
+    if (factor >= 2)
+    {
+        Mat reducedImg;
+        resize(img, reducedImg, Size(img.cols/factor, img.rows/factor), 0, 0, INTER_AREA);
+        return reducedImg;
+    }
+
+    return img;
+}
+
+void ReducedImageDecoder::ReportError(
+    const vector<string>& files,
+    const function<void(const Mat&, vector<Mat>&)>& calcHistsFunc) const
+{
+    mutex statsMutex;
+    int cntImages = 0;
+    double maxHistErr = 0;
+    double sumHistErr = 0;
+    double sumFullMs = 0;
+    double sumReducedMs = 0;
+    double sumFullPixels = 0;
+    double sumReducedPixels = 0;
+
+    const int cntFiles = static_cast<int>(files.size());
+    parallel_for_(Range(0, cntFiles), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            for (int fileIdx = range.start; fileIdx < range.end; ++fileIdx)
+            {
+                int64 startTick = getTickCount();
+                Mat fullImg = imread(files[fileIdx], IMREAD_COLOR);
+                double fullMs = (getTickCount() - startTick)*1000.0/getTickFrequency();
+
+                startTick = getTickCount();
+                Mat reducedImg = Read(files[fileIdx]);
+                double reducedMs = (getTickCount() - startTick)*1000.0/getTickFrequency();
+
+                if (fullImg.empty() || reducedImg.empty())
+                {
+                    continue;
+                }
+
+                vector<Mat> fullHists;
+                vector<Mat> reducedHists;
+                calcHistsFunc(fullImg, fullHists);
+                calcHistsFunc(reducedImg, reducedHists);
+                CV_Assert(fullHists.size() == reducedHists.size());
+
+                double histErr = 0;
+                for (size_t histIdx = 0; histIdx < fullHists.size(); ++histIdx)
+                {
+                    histErr = max(histErr, norm(fullHists[histIdx], reducedHists[histIdx], NORM_L1));
+                }
+
+                lock_guard<mutex> lock(statsMutex);
+                ++cntImages;
+                maxHistErr = max(maxHistErr, histErr);
+                sumHistErr += histErr;
+                sumFullMs += fullMs;
+                sumReducedMs += reducedMs;
+                sumFullPixels += static_cast<double>(fullImg.total());
+                sumReducedPixels += static_cast<double>(reducedImg.total());
+            }
+        }), cntFiles);
+
+    if (cntImages == 0)
+    {
+        printf("[INFO]: No image is decoded to measure the error of %s.\n", ToStr().c_str());
+        return;
+    }
+
+    printf("[INFO]: Decoding %d images at %s: %.0f pixels and %.3f ms per image on average, against %.0f pixels and %.3f ms at the full resolution.\n",
+        cntImages, ToStr().c_str(), sumReducedPixels/cntImages, sumReducedMs/cntImages,
+        sumFullPixels/cntImages, sumFullMs/cntImages);
+    printf("[INFO]: The L1 distance between the histograms of the reduced and the full resolutions: max = %f, mean = %f.\n",
+        maxHistErr, sumHistErr/cntImages);
+}
@@ -19,6 +19,10 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "BatchHistComparator.h"
+#include "HsvHistogram.h"
+#include "ReducedImageDecoder.h"
+
 using namespace std;
 using namespace cv;
 namespace po = boost::program_options;
@@ -226,7 +230,10 @@ int main(int argc, char** argv)
         ("image2", po::value<string>()->required(), "The second image") // This is also a positional option.
         ("help,h", "Display the help information")
         ("comparison-method,m", po::value<string>(), "The comparison method (correl | chisqr | chisqr_alt | intersect | bhattacharyya | hellinger | kl_div | all). If not specified, default correl.")
-        ("hsv-channels,c", po::value<string>(), "The HSV channels used for generating the histogram (h | s | v). If not specified, default hs.");
+        ("hsv-channels,c", po::value<string>(), "The HSV channels used for generating the histogram (h | s | v). If not specified, default hs.")
+        ("decode-scale", po::value<int>()->default_value(1), "Decode the images at 1/2, 1/4 or 1/8 of the resolution (1 | 2 | 4 | 8) for the histograms, which uses the DCT scaling of the JPEG decoder.")
+        ("target-pixels", po::value<int>(), "Decode the images at the lowest resolution with at least this number of pixels by the DCT scaling or the box downsampling, instead of a fixed decode scale.")
+        ("measure-decode-error", "Measure the errors of the histograms of the reduced resolution against the full resolution, and the decoding times.");
 
     po::positional_options_description posOpt;
     posOpt.add("image1", 1);
@@ -300,20 +307,44 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    Mat srcImg1 = imread(img1, IMREAD_COLOR);
+    int decodeScale = vm["decode-scale"].as<int>();
+    int targetPixels = (vm.count("target-pixels") > 0) ? vm["target-pixels"].as<int>() : 0;
+    if (!ReducedImageDecoder::IsValidScale(decodeScale) || (targetPixels < 0))
+    {
+        cerr << "[ERROR]: The decode scale should be 1, 2, 4 or 8, and the target pixels should be positive." << endl << endl;
+        return -1;
+    }
+
+    ReducedImageDecoder decoder(decodeScale, targetPixels);
+    if (!decoder.IsFullResolution())
+    {
+        cout << "[INFO]: The images are decoded at " << decoder.ToStr() << "." << endl;
+    }
+
+    Mat srcImg1 = decoder.Read(img1);
     if (srcImg1.empty())
     {
         cerr << "[ERROR]: Cannot load " << img1 << "." << endl << endl;
         return -1;
     }
 
-    Mat srcImg2 = imread(img2, IMREAD_COLOR);
+    Mat srcImg2 = decoder.Read(img2);
     if (srcImg2.empty())
     {
         cerr << "[ERROR]: Cannot load " << img2 << "." << endl << endl;
         return -1;
     }
 
+    if (vm.count("measure-decode-error") > 0)
+    {
+        decoder.ReportError(vector<string>{img1, img2}, [&hsvChannels, &histSize, &ranges](const Mat& img, vector<Mat>& hists)
+            {
+                hists.resize(1);
+                CalcHsvHist(img, hsvChannels, histSize, ranges, hists[0]);
+                normalize(hists[0], hists[0], 1, 0, NORM_L1);
+            });
+    }
+
     // Display the original image 1 and 2 in one window side by side.
     if (srcImg1.rows == srcImg2.rows)
     {
@@ -325,17 +356,12 @@ int main(int argc, char** argv)
         imshow("The original image 1 and 2", srcImgs);
     }
     
-    // Convert image 1 and 2 into HSV.
-    Mat hsvImg1;
-    Mat hsvImg2;
-    cvtColor(srcImg1, hsvImg1, COLOR_BGR2HSV);
-    cvtColor(srcImg2, hsvImg2, COLOR_BGR2HSV);
-
-    // Compute the histograms of image 1 and 2, respectively.
+    // Compute the histograms of the HSV channels of image 1 and 2, respectively, without converting the images
+    // into HSV first.
     Mat hist1;
     Mat hist2;
-    calcHist(vector<Mat>{hsvImg1}, hsvChannels, noArray(), hist1, histSize, ranges);
-    calcHist(vector<Mat>{hsvImg2}, hsvChannels, noArray(), hist2, histSize, ranges);
+    CalcHsvHist(srcImg1, hsvChannels, histSize, ranges, hist1);
+    CalcHsvHist(srcImg2, hsvChannels, histSize, ranges, hist2);
 
     // Normalize the histograms.
     normalize(hist1, hist1, 1, 0, NORM_L1);
@@ -362,9 +388,13 @@ int main(int argc, char** argv)
     }
 
     // Compare the two normalized histograms.
+    BatchHistComparator histComparator(BatchHistComparator::StackHists(vector<Mat>{hist2}));
+    Mat queryHists = BatchHistComparator::StackHists(vector<Mat>{hist1});
     for (size_t compMethodIndex = 0; compMethodIndex < histComparisonMethods.size(); ++compMethodIndex)
     {
-        double compareResult = compareHist(hist1, hist2, histComparisonMethods[compMethodIndex]);
+        Mat compareResults;
+        histComparator.Compare(queryHists, histComparisonMethods[compMethodIndex], compareResults);
+        double compareResult = compareResults.at<double>(0, 0);
         cout << "[INFO]: The comparison result of the two histograms = " << compareResult << " with the method "
             << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << endl;
         cout << "[INFO]: The result for a perfect match of the method " << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex])
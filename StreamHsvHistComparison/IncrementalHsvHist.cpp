@@ -0,0 +1,234 @@
+/*
+ * IncrementalHsvHist.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <climits>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+#include <opencv2/imgproc.hpp>
+
+#include "IncrementalHsvHist.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Wrap a lambda as the body of parallel_for_().
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+// A bin offset no valid offset can reach even if the offsets of all the three channels are added up.
+const int outOfRange = INT_MIN/4;
+
+}
+
+IncrementalHsvHist::IncrementalHsvHist(
+    const vector<int>& hsvChannels,
+    const vector<int>& histSize,
+    const vector<float>& ranges,
+    const int tileSize,
+    const double changeThreshold) :
+    m_cntBins(1),
+    m_tileSize(max(tileSize, 1)),
+    m_changeThreshold(changeThreshold),
+    m_binTabs(3*256, 0)
+{
+    const int dims = static_cast<int>(hsvChannels.size());
+    CV_Assert((dims > 0) && (dims <= 3) && (static_cast<int>(histSize.size()) == dims)
+        && (static_cast<int>(ranges.size()) == 2*dims));
+
+    // Build the lookup tables in the same way as calcHist() does for the uniform ranges. The table of a channel not
+    // in the histogram is all 0.
+    for (int dim = dims - 1; dim >= 0; --dim)
+    {
+        CV_Assert((hsvChannels[dim] >= 0) && (hsvChannels[dim] <= 2)
+            && (count(hsvChannels.begin(), hsvChannels.end(), hsvChannels[dim]) == 1));
+
+        double t = histSize[dim]/(static_cast<double>(ranges[2*dim + 1]) - ranges[2*dim]);
+        double a = -t*ranges[2*dim];
+        int* tab = &m_binTabs[256*hsvChannels[dim]];
+        for (int value = 0; value < 256; ++value)
+        {
+            int bin = cvFloor(value*t + a);
+            tab[value] = (static_cast<unsigned>(bin) < static_cast<unsigned>(histSize[dim])) ? bin*m_cntBins : outOfRange;
+        }
+
+        m_cntBins *= histSize[dim];
+    }
+
+    m_binCnts.assign(m_cntBins, 0);
+}
+
+int IncrementalHsvHist::Update(const Mat& srcFrame, int& cntTiles)
+{
+    CV_Assert(srcFrame.depth() == CV_8U);
+
+    // Some capture backends and image sequences deliver gray or BGRA frames, which are converted into BGR first.
+    Mat frame;
+    switch (srcFrame.channels())
+    {
+    case 1:
+        cvtColor(srcFrame, frame, COLOR_GRAY2BGR);
+        break;
+
+    case 4:
+        cvtColor(srcFrame, frame, COLOR_BGRA2BGR);
+        break;
+
+    default:
+        CV_Assert(srcFrame.channels() == 3);
+        frame = srcFrame;
+        break;
+    }
+
+    // Start over if the frame size changes.
+    const bool isReset = (frame.size() != m_binnedFrame.size());
+    if (isReset)
+    {
+        m_binnedFrame.create(frame.size(), CV_8UC3);
+        m_binIdxs.create(frame.size(), CV_32S);
+        m_binIdxs.setTo(Scalar::all(-1));
+        fill(m_binCnts.begin(), m_binCnts.end(), 0);
+    }
+
+    const int cntTileRows = (frame.rows + m_tileSize - 1)/m_tileSize;
+    const int cntTileCols = (frame.cols + m_tileSize - 1)/m_tileSize;
+    cntTiles = cntTileRows*cntTileCols;
+
+    // Each stripe of the tile rows accumulates the changes of the bin counts by itself, and adds them up at last.
+    int cntRebinnedTiles = 0;
+    mutex binCntsMutex;
+    parallel_for_(Range(0, cntTileRows), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            const int* hTab = &m_binTabs[0];
+            const int* sTab = hTab + 256;
+            const int* vTab = sTab + 256;
+
+            vector<int> binCntDeltas(m_cntBins, 0);
+            int cntStripeRebinnedTiles = 0;
+            Mat hsvTile;
+
+            for (int tileRow = range.start; tileRow < range.end; ++tileRow)
+            {
+                for (int tileCol = 0; tileCol < cntTileCols; ++tileCol)
+                {
+                    Rect tile = Rect(tileCol*m_tileSize, tileRow*m_tileSize, m_tileSize, m_tileSize)
+                        & Rect(0, 0, frame.cols, frame.rows);
+                    if (!isReset && (norm(frame(tile), m_binnedFrame(tile), NORM_INF) <= m_changeThreshold))
+                    {
+                        continue;
+                    }
+
+                    cvtColor(frame(tile), hsvTile, COLOR_BGR2HSV);
+                    for (int row = 0; row < tile.height; ++row)
+                    {
+                        const uchar* hsv = hsvTile.ptr<uchar>(row);
+                        int* binIdxs = m_binIdxs.ptr<int>(tile.y + row) + tile.x;
+                        for (int col = 0; col < tile.width; ++col, hsv += 3)
+                        {
+                            int offset = hTab[hsv[0]] + sTab[hsv[1]] + vTab[hsv[2]];
+                            int binIdx = (offset >= 0) ? offset : -1;
+                            if (binIdx != binIdxs[col])
+                            {
+                                if (binIdxs[col] >= 0)
+                                {
+                                    binCntDeltas[binIdxs[col]]--;
+                                }
+
+                                if (binIdx >= 0)
+                                {
+                                    binCntDeltas[binIdx]++;
+                                }
+
+                                binIdxs[col] = binIdx;
+                            }
+                        }
+                    }
+
+                    frame(tile).copyTo(m_binnedFrame(tile));
+                    ++cntStripeRebinnedTiles;
+                }
+            }
+
+            if (cntStripeRebinnedTiles > 0)
+            {
+                lock_guard<mutex> lock(binCntsMutex);
+                for (int bin = 0; bin < m_cntBins; ++bin)
+                {
+                    m_binCnts[bin] += binCntDeltas[bin];
+                }
+
+                cntRebinnedTiles += cntStripeRebinnedTiles;
+            }
+        }));
+
+    return cntRebinnedTiles;
+}
+
+void IncrementalHsvHist::GetNormalizedHist(Mat& hist) const
+{
+    Mat(1, m_cntBins, CV_32S, const_cast<int*>(&m_binCnts[0])).convertTo(hist, CV_32F);
+    normalize(hist, hist, 1, 0, NORM_L1);
+}
+
+RunningHistAggregates::RunningHistAggregates(const double emaAlpha, const int windowLen) :
+    m_emaAlpha(emaAlpha),
+    m_windowLen(max(windowLen, 1))
+{
+}
+
+void RunningHistAggregates::Add(const Mat& hist)
+{
+    Mat hist64;
+    hist.convertTo(hist64, CV_64F);
+
+    if (m_ema.empty())
+    {
+        m_ema = hist64.clone();
+        m_windowSum = Mat::zeros(hist64.size(), CV_64F);
+    }
+    else
+    {
+        addWeighted(m_ema, 1 - m_emaAlpha, hist64, m_emaAlpha, 0, m_ema);
+    }
+
+    // Keep the sum of the histograms in the window, so the mean costs O(B) whatever the window length.
+    m_windowSum += hist64;
+    m_window.push_back(hist64);
+    if (static_cast<int>(m_window.size()) > m_windowLen)
+    {
+        m_windowSum -= m_window.front();
+        m_window.pop_front();
+    }
+}
+
+void RunningHistAggregates::GetEma(Mat& ema) const
+{
+    m_ema.convertTo(ema, CV_32F);
+}
+
+void RunningHistAggregates::GetWindowMean(Mat& windowMean) const
+{
+    m_windowSum.convertTo(windowMean, CV_32F, 1.0/max(static_cast<int>(m_window.size()), 1));
+}
@@ -0,0 +1,80 @@
+/*
+ * IncrementalHsvHist.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef INCREMENTALHSVHIST_H_
+#define INCREMENTALHSVHIST_H_
+
+#include <vector>
+#include <deque>
+
+#include <opencv2/core.hpp>
+
+// Keep the histogram of the given HSV channels of the latest frame of a video stream up to date.
+//
+// The frames are divided into square tiles. A tile is rebinned only if any of its pixels differs from the content
+// last binned for it by more than the change threshold, and then only the pixels whose bins have changed move their
+// counts from the old bins to the new ones. The bin index of each pixel is kept, so a frame costs one comparison
+// with the previous content plus the HSV conversion and the binning of the changed tiles. With the threshold 0, the
+// histogram is exactly the one of calcHist() on every frame. With a positive threshold, the content of a tile is
+// never more than the threshold away from the content binned for it, so the error doesn't accumulate over frames.
+class IncrementalHsvHist
+{
+private:
+    int m_cntBins;
+    int m_tileSize;
+    double m_changeThreshold;
+
+    // The lookup tables from the 8-bit H, S and V values to the flattened bin offsets, 256 entries per channel.
+    std::vector<int> m_binTabs;
+
+    // The content last binned for each tile, the bin index of each of its pixels, or -1 if the pixel is out of the
+    // ranges, and the pixel count of each bin.
+    cv::Mat m_binnedFrame;
+    cv::Mat m_binIdxs;
+    std::vector<int> m_binCnts;
+
+public:
+    IncrementalHsvHist(
+        const std::vector<int>& hsvChannels,
+        const std::vector<int>& histSize,
+        const std::vector<float>& ranges,
+        const int tileSize = 32,
+        const double changeThreshold = 0);
+
+    // Update the histogram by a CV_8U BGR frame, where a gray or a BGRA frame is converted into BGR first, and return
+    // the number of the rebinned tiles. All the tiles are rebinned for the first frame and whenever the frame size
+    // changes.
+    int Update(const cv::Mat& srcFrame, int& cntTiles);
+
+    // The histogram of the latest frame normalized to the sum of 1, as a 1 x B CV_32F row.
+    void GetNormalizedHist(cv::Mat& hist) const;
+};
+
+// The exponential-decay and the sliding-window aggregates of a stream of normalized 1 x B histograms.
+class RunningHistAggregates
+{
+private:
+    double m_emaAlpha;
+    int m_windowLen;
+
+    cv::Mat m_ema;
+    std::deque<cv::Mat> m_window;
+    cv::Mat m_windowSum;
+
+public:
+    // emaAlpha is the weight of the latest histogram in the exponential moving average, and windowLen is the number
+    // of the latest histograms averaged by the sliding window.
+    RunningHistAggregates(const double emaAlpha, const int windowLen);
+
+    void Add(const cv::Mat& hist);
+
+    // Both are 1 x B CV_32F rows.
+    void GetEma(cv::Mat& ema) const;
+    void GetWindowMean(cv::Mat& windowMean) const;
+};
+
+#endif /* INCREMENTALHSVHIST_H_ */
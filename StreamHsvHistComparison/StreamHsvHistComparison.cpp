@@ -0,0 +1,375 @@
+/*
+ * StreamHsvHistComparison.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include <boost/program_options.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "BatchHistComparator.h"
+#include "HsvHistogram.h"
+#include "IncrementalHsvHist.h"
+
+using namespace std;
+using namespace cv;
+namespace po = boost::program_options;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+void Str2HistComparisonMethod(
+    string& strCompMethod,
+    vector<int>& compMethods,
+    vector<float>& perfectMatchVal)
+{
+    transform(strCompMethod.begin(), strCompMethod.end(), strCompMethod.begin(), ::tolower);
+
+    compMethods.clear();
+
+    if ((strCompMethod == "correl") || (strCompMethod == "all"))
+    {
+        compMethods.push_back(CV_COMP_CORREL);
+        perfectMatchVal.push_back(1.0);
+    }
+
+    if ((strCompMethod == "chisqr") || (strCompMethod == "all"))
+    {
+        compMethods.push_back(CV_COMP_CHISQR);
+        perfectMatchVal.push_back(0.0);
+    }
+
+    if ((strCompMethod == "chisqr_alt") || (strCompMethod == "all"))
+    {
+        compMethods.push_back(CV_COMP_CHISQR_ALT);
+        perfectMatchVal.push_back(0.0);
+    }
+
+    if ((strCompMethod == "intersect") || (strCompMethod == "all"))
+    {
+        compMethods.push_back(CV_COMP_INTERSECT);
+        perfectMatchVal.push_back(1.0);
+    }
+
+    if ((strCompMethod == "bhattacharyya") || (strCompMethod == "hellinger") || (strCompMethod == "all"))
+    {
+        // CV_COMP_HELLINGER is the same as CV_COMP_BHATTACHARYYA
+        compMethods.push_back(CV_COMP_BHATTACHARYYA);
+        perfectMatchVal.push_back(0.0);
+    }
+
+    if ((strCompMethod == "kl_div") || (strCompMethod == "all"))
+    {
+        compMethods.push_back(CV_COMP_KL_DIV);
+        perfectMatchVal.push_back(0.0);
+    }
+
+    return;
+}
+
+string HistComparisonMethod2Str(const int histComparisonMethod)
+{
+    switch (histComparisonMethod)
+    {
+    case CV_COMP_CORREL:
+        return "correl";
+
+    case CV_COMP_CHISQR:
+        return "chisqr";
+
+    case CV_COMP_CHISQR_ALT:
+        return "chisqr_alt";
+
+    case CV_COMP_INTERSECT:
+        return "intersect";
+
+    case CV_COMP_BHATTACHARYYA:
+        return "bhattacharyya";
+
+    case CV_COMP_KL_DIV:
+        return "kl_dlv";
+
+    default:
+        return "invalid";
+    }
+}
+
+void Str2HsvChannels(
+    string& strHsvChannels,
+    vector<int>& hsvChannels,
+    vector<int>& histSize,
+    vector<float>& ranges)
+{
+    transform(strHsvChannels.begin(), strHsvChannels.end(), strHsvChannels.begin(), ::tolower);
+
+    hsvChannels.clear();
+    histSize.clear();
+    ranges.clear();
+
+    if (strHsvChannels.find('h') != string::npos)
+    {
+        hsvChannels.push_back(0);   // Channel 0 is hue.
+        histSize.push_back(30);
+        ranges.push_back(0);        // Hue range is [0, 179].
+        ranges.push_back(180);      // Note that the range is left inclusive and right exclusive.
+    }
+
+    if (strHsvChannels.find('s') != string::npos)
+    {
+        hsvChannels.push_back(1);   // Channel 1 is saturation.
+        histSize.push_back(32);
+        ranges.push_back(0);        // Saturation range is [0, 255].
+        ranges.push_back(256);      // Note that the range is left inclusive and right exclusive.
+    }
+
+    if (strHsvChannels.find('v') != string::npos)
+    {
+        hsvChannels.push_back(2);   // Channel 2 is value.
+        histSize.push_back(32);
+        ranges.push_back(0);        // Value range is [0, 255].
+        ranges.push_back(256);      // Note that the range is left inclusive and right exclusive.
+    }
+}
+
+int main(int argc, char** argv)
+{
+    po::options_description opt("Options");
+    opt.add_options()
+        ("video", po::value<string>()->required(), "The video file, stream URL or camera index")    // This is a positional option.
+        ("reference", po::value<string>()->required(), "The reference image")                     // This is also a positional option.
+        ("help,h", "Display the help information")
+        ("comparison-method,m", po::value<string>(), "The comparison method (correl | chisqr | chisqr_alt | intersect | bhattacharyya | hellinger | kl_div | all). If not specified, default correl.")
+        ("hsv-channels,c", po::value<string>(), "The HSV channels used for generating the histogram (h | s | v). If not specified, default hs.")
+        ("tile-size,t", po::value<int>(), "The size of the square tiles whose changes are detected. If not specified, default 32.")
+        ("change-threshold", po::value<double>(), "A tile is rebinned only if any of its values changes by more than this threshold. If not specified, default 0, i.e., exact.")
+        ("ema-alpha", po::value<double>(), "The weight of the latest frame in the exponential moving average of the histograms. If not specified, default 0.1.")
+        ("window", po::value<int>(), "The number of the latest frames averaged by the sliding window. If not specified, default 30.")
+        ("max-frames", po::value<int>(), "Stop after this many frames. If not specified, the whole stream is processed.")
+        ("display", "Display the frames, and stop at any key.");
+
+    po::positional_options_description posOpt;
+    posOpt.add("video", 1);
+    posOpt.add("reference", 1);
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::command_line_parser(argc, argv).options(opt).positional(posOpt).run(), vm);
+
+        if (vm.count("help") > 0)
+        {
+            cout << "Usage: ./StreamHsvHistComparison video reference -m [comparison-method] -c [HSV-channels] -t [tile-size]" << endl << endl;
+            cout << opt << endl;
+            return 0;
+        }
+
+        po::notify(vm);
+    }
+    catch (po::error& e)
+    {
+        cerr << "[ERROR]: " << e.what() << endl << endl;
+        cout << opt << endl;
+        return -1;
+    }
+
+    string video;
+    string reference;
+    string strCompMethod;
+    string strHsvChannels;
+
+    video = vm["video"].as<string>();
+    reference = vm["reference"].as<string>();
+
+    if (vm.count("comparison-method") > 0)
+    {
+        strCompMethod = vm["comparison-method"].as<string>();
+    }
+    else
+    {
+        strCompMethod = "correl";
+        cout << "[INFO]: No distance method is specified and use the default distance method Correlation." << endl;
+    }
+
+    vector<int> histComparisonMethods;
+    vector<float> histCompPerfectMatchVals;
+    Str2HistComparisonMethod(strCompMethod, histComparisonMethods, histCompPerfectMatchVals);
+    if (histComparisonMethods.empty())
+    {
+        cerr << "[ERROR]: Invalid histogram comparison method " << strCompMethod << "." << endl << endl;
+        return -1;
+    }
+
+    if (vm.count("hsv-channels") > 0)
+    {
+        strHsvChannels = vm["hsv-channels"].as<string>();
+    }
+    else
+    {
+        strHsvChannels = "hs";
+        cout << "[INFO]: no hsv channel is specified and use the default channels 0 and 1 (i.e., h and s)." << endl;
+    }
+
+    vector<int> hsvChannels;
+    vector<int> histSize;
+    vector<float> ranges;
+    Str2HsvChannels(strHsvChannels, hsvChannels, histSize, ranges);
+    if (hsvChannels.empty())
+    {
+        cerr << "[ERROR]: Invalid HSV channels " << strHsvChannels  << ", should contain h or s or v." << endl << endl;
+        return -1;
+    }
+
+    int tileSize = (vm.count("tile-size") > 0) ? vm["tile-size"].as<int>() : 32;
+    double changeThreshold = (vm.count("change-threshold") > 0) ? vm["change-threshold"].as<double>() : 0;
+    double emaAlpha = (vm.count("ema-alpha") > 0) ? vm["ema-alpha"].as<double>() : 0.1;
+    int windowLen = (vm.count("window") > 0) ? vm["window"].as<int>() : 30;
+    int maxFrames = (vm.count("max-frames") > 0) ? vm["max-frames"].as<int>() : 0;
+    bool isDisplayed = (vm.count("display") > 0);
+
+    if ((tileSize <= 0) || (changeThreshold < 0) || (emaAlpha <= 0) || (emaAlpha > 1) || (windowLen <= 0))
+    {
+        cerr << "[ERROR]: The tile size and the window should be positive, the change threshold should not be negative, "
+            << "and the EMA alpha should be in (0, 1]." << endl << endl;
+        return -1;
+    }
+
+    // The reference histogram is the only histogram of the comparator, and each frame queries it with the histograms
+    // of the frame, the exponential moving average and the sliding window.
+    Mat refImg = imread(reference, IMREAD_COLOR);
+    if (refImg.empty())
+    {
+        cerr << "[ERROR]: Cannot load " << reference << "." << endl << endl;
+        return -1;
+    }
+
+    Mat refHist;
+    CalcHsvHist(refImg, hsvChannels, histSize, ranges, refHist);
+    normalize(refHist, refHist, 1, 0, NORM_L1);
+    BatchHistComparator histComparator(BatchHistComparator::StackHists(vector<Mat>{refHist}));
+
+    // A video argument of digits only is a camera index.
+    VideoCapture cap;
+    if (!video.empty() && all_of(video.begin(), video.end(), ::isdigit))
+    {
+        cap.open(stoi(video));
+    }
+    else
+    {
+        cap.open(video);
+    }
+
+    if (!cap.isOpened())
+    {
+        cerr << "[ERROR]: Cannot open the video " << video << "." << endl << endl;
+        return -1;
+    }
+
+    IncrementalHsvHist incrementalHist(hsvChannels, histSize, ranges, tileSize, changeThreshold);
+    RunningHistAggregates histAggregates(emaAlpha, windowLen);
+
+    const string frameWindow("The video stream");
+    if (isDisplayed)
+    {
+        namedWindow(frameWindow, WINDOW_AUTOSIZE);
+    }
+
+    Mat frame;
+    int cntFrames = 0;
+    int64 totalUpdateUs = 0;
+    int64 totalCompareUs = 0;
+    double totalRebinnedRatio = 0;
+    while ((maxFrames <= 0) || (cntFrames < maxFrames))
+    {
+        cap >> frame;
+        if (frame.empty())
+        {
+            break;
+        }
+
+        // Update the histogram of the frame and the aggregates.
+        auto tStart = Clock::now();
+
+        int cntTiles = 0;
+        int cntRebinnedTiles = incrementalHist.Update(frame, cntTiles);
+
+        Mat frameHist;
+        Mat emaHist;
+        Mat windowHist;
+        incrementalHist.GetNormalizedHist(frameHist);
+        histAggregates.Add(frameHist);
+        histAggregates.GetEma(emaHist);
+        histAggregates.GetWindowMean(windowHist);
+
+        auto tUpdated = Clock::now();
+
+        // Compare the three histograms with the reference histogram by each method.
+        Mat queryHists;
+        vconcat(vector<Mat>{frameHist, emaHist, windowHist}, queryHists);
+
+        vector<Mat> compareResults(histComparisonMethods.size());
+        for (size_t compMethodIndex = 0; compMethodIndex < histComparisonMethods.size(); ++compMethodIndex)
+        {
+            histComparator.Compare(queryHists, histComparisonMethods[compMethodIndex], compareResults[compMethodIndex]);
+        }
+
+        auto tEnd = Clock::now();
+
+        int64 updateUs = chrono::duration_cast<chrono::microseconds>(tUpdated - tStart).count();
+        int64 compareUs = chrono::duration_cast<chrono::microseconds>(tEnd - tUpdated).count();
+        totalUpdateUs += updateUs;
+        totalCompareUs += compareUs;
+        totalRebinnedRatio += static_cast<double>(cntRebinnedTiles)/cntTiles;
+
+        cout << "[INFO]: Frame " << cntFrames << ": " << cntRebinnedTiles << "/" << cntTiles << " tiles rebinned, latency "
+            << updateUs + compareUs << " microseconds (update " << updateUs << ", compare " << compareUs << ")." << endl;
+        for (size_t compMethodIndex = 0; compMethodIndex < histComparisonMethods.size(); ++compMethodIndex)
+        {
+            cout << "[INFO]:     " << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex])
+                << ": frame = " << compareResults[compMethodIndex].at<double>(0, 0)
+                << ", ema = " << compareResults[compMethodIndex].at<double>(1, 0)
+                << ", window = " << compareResults[compMethodIndex].at<double>(2, 0) << endl;
+        }
+
+        ++cntFrames;
+
+        if (isDisplayed)
+        {
+            imshow(frameWindow, frame);
+            if (waitKey(1) >= 0)
+            {
+                break;
+            }
+        }
+    }
+
+    if (cntFrames > 0)
+    {
+        cout << "[INFO]: " << cntFrames << " frames, on average " << totalRebinnedRatio*100/cntFrames
+            << "% of the tiles rebinned, update " << totalUpdateUs/cntFrames << " microseconds and compare "
+            << totalCompareUs/cntFrames << " microseconds per frame." << endl;
+    }
+    else
+    {
+        cerr << "[ERROR]: No frame is read from " << video << "." << endl << endl;
+        return -1;
+    }
+
+    if (isDisplayed)
+    {
+        destroyWindow(frameWindow);
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * HistSimilarityMap.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <opencv2/imgproc.hpp>
+
+#include "HistSimilarityMap.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// Wrap a lambda as the body of parallel_for_().
+class ParallelLoopBodyWrapper : public ParallelLoopBody
+{
+private:
+    function<void(const Range&)> m_body;
+
+public:
+    ParallelLoopBodyWrapper(const function<void(const Range&)>& body) :
+        m_body(body)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        m_body(range);
+    }
+};
+
+}
+
+HistSimilarityMap::HistSimilarityMap(const Mat& img, const vector<int>& histSize, const vector<float>& ranges)
+{
+    const int dims = static_cast<int>(histSize.size());
+    CV_Assert((img.depth() == CV_8U) && (img.channels() == dims) && (static_cast<int>(ranges.size()) == 2*dims));
+
+    // Build the lookup tables from the 8-bit values to the flattened bin offsets in the same way as calcHist() does
+    // for the uniform ranges.
+    vector<vector<int> > binTabs(dims, vector<int>(256));
+    m_cntBins = 1;
+    for (int dim = dims - 1; dim >= 0; --dim)
+    {
+        double t = histSize[dim]/(static_cast<double>(ranges[2*dim + 1]) - ranges[2*dim]);
+        double a = -t*ranges[2*dim];
+        for (int value = 0; value < 256; ++value)
+        {
+            int bin = cvFloor(value*t + a);
+            binTabs[dim][value] = (static_cast<unsigned>(bin) < static_cast<unsigned>(histSize[dim])) ? bin*m_cntBins : -1;
+        }
+
+        m_cntBins *= histSize[dim];
+    }
+
+    m_binIdxsT.create(img.cols, img.rows, CV_32S);
+    for (int row = 0; row < img.rows; ++row)
+    {
+        const uchar* src = img.ptr<uchar>(row);
+        for (int col = 0; col < img.cols; ++col, src += dims)
+        {
+            int binIdx = 0;
+            for (int dim = 0; (dim < dims) && (binIdx >= 0); ++dim)
+            {
+                int offset = binTabs[dim][src[dim]];
+                binIdx = (offset >= 0) ? binIdx + offset : -1;
+            }
+
+            m_binIdxsT.at<int>(col, row) = binIdx;
+        }
+    }
+}
+
+void HistSimilarityMap::Compute(
+    const Mat& templHist,
+    const Size& windowSize,
+    const int method,
+    Mat& similarityMap) const
+{
+    const int imgRows = m_binIdxsT.cols;
+    const int imgCols = m_binIdxsT.rows;
+    const int windowWidth = windowSize.width;
+    const int windowHeight = windowSize.height;
+
+    CV_Assert((static_cast<int>(templHist.total()) == m_cntBins) && templHist.isContinuous());
+    CV_Assert((windowWidth > 0) && (windowHeight > 0) && (windowWidth <= imgCols) && (windowHeight <= imgRows));
+    CV_Assert((method == CV_COMP_INTERSECT) || (method == CV_COMP_BHATTACHARYYA));
+
+    // The terms of the template bins, and the square roots of all the possible counts of a window bin.
+    const int cntPixels = windowWidth*windowHeight;
+    const double invCntPixels = 1.0/cntPixels;
+    Mat templHist64;
+    Mat(1, m_cntBins, templHist.type(), const_cast<uchar*>(templHist.ptr())).convertTo(templHist64, CV_64F);
+
+    vector<double> templTerms(m_cntBins);
+    vector<double> sqrtCnts;
+    for (int bin = 0; bin < m_cntBins; ++bin)
+    {
+        double templVal = templHist64.at<double>(bin);
+        templTerms[bin] = (method == CV_COMP_INTERSECT) ? templVal : std::sqrt(max(templVal, 0.0)*invCntPixels);
+    }
+
+    if (method == CV_COMP_BHATTACHARYYA)
+    {
+        sqrtCnts.resize(cntPixels + 1);
+        for (int cnt = 0; cnt <= cntPixels; ++cnt)
+        {
+            sqrtCnts[cnt] = std::sqrt(static_cast<double>(cnt));
+        }
+    }
+
+    similarityMap.create(imgRows - windowHeight + 1, imgCols - windowWidth + 1, CV_32F);
+    parallel_for_(Range(0, similarityMap.rows), ParallelLoopBodyWrapper([&](const Range& range)
+        {
+            vector<int> windowHist(m_cntBins);
+            double similarity = 0;
+
+            // The change of the similarity when the count of a bin goes up from cnt to cnt + 1.
+            auto gain = [&](const int bin, const int cnt)
+            {
+                if (method == CV_COMP_INTERSECT)
+                {
+                    return min((cnt + 1)*invCntPixels, templTerms[bin]) - min(cnt*invCntPixels, templTerms[bin]);
+                }
+
+                return templTerms[bin]*(sqrtCnts[cnt + 1] - sqrtCnts[cnt]);
+            };
+
+            auto addPixel = [&](const int bin)
+            {
+                if (bin >= 0)
+                {
+                    similarity += gain(bin, windowHist[bin]);
+                    ++windowHist[bin];
+                }
+            };
+
+            auto removePixel = [&](const int bin)
+            {
+                if (bin >= 0)
+                {
+                    --windowHist[bin];
+                    similarity -= gain(bin, windowHist[bin]);
+                }
+            };
+
+            for (int mapRow = range.start; mapRow < range.end; ++mapRow)
+            {
+                // Every row starts from scratch, so the rounding errors don't accumulate along the columns.
+                fill(windowHist.begin(), windowHist.end(), 0);
+                similarity = 0;
+
+                for (int col = 0; col < windowWidth; ++col)
+                {
+                    const int* binIdxs = m_binIdxsT.ptr<int>(col) + mapRow;
+                    for (int row = 0; row < windowHeight; ++row)
+                    {
+                        addPixel(binIdxs[row]);
+                    }
+                }
+
+                float* similarities = similarityMap.ptr<float>(mapRow);
+                similarities[0] = static_cast<float>(similarity);
+
+                for (int mapCol = 1; mapCol < similarityMap.cols; ++mapCol)
+                {
+                    const int* leavingBinIdxs = m_binIdxsT.ptr<int>(mapCol - 1) + mapRow;
+                    const int* enteringBinIdxs = m_binIdxsT.ptr<int>(mapCol + windowWidth - 1) + mapRow;
+                    for (int row = 0; row < windowHeight; ++row)
+                    {
+                        removePixel(leavingBinIdxs[row]);
+                        addPixel(enteringBinIdxs[row]);
+                    }
+
+                    similarities[mapCol] = static_cast<float>(similarity);
+                }
+            }
+        }));
+}
+
+void HistSimilarityMap::FindTopCandidates(
+    const Mat& similarityMap,
+    const int k,
+    const Size& suppressSize,
+    vector<Point>& locs,
+    vector<float>& scores)
+{
+    locs.clear();
+    scores.clear();
+
+    Mat remainingMap = similarityMap.clone();
+    const Rect mapRect(0, 0, remainingMap.cols, remainingMap.rows);
+    for (int candidateIdx = 0; candidateIdx < k; ++candidateIdx)
+    {
+        double maxVal = 0;
+        Point maxLoc;
+        minMaxLoc(remainingMap, nullptr, &maxVal, nullptr, &maxLoc);
+        if (maxVal <= -FLT_MAX)
+        {
+            break;
+        }
+
+        locs.push_back(maxLoc);
+        scores.push_back(static_cast<float>(maxVal));
+
+        // Suppress the locations whose windows mostly overlap the window of this candidate.
+        Rect suppressRect(maxLoc.x - suppressSize.width/2, maxLoc.y - suppressSize.height/2,
+            suppressSize.width + 1, suppressSize.height + 1);
+        remainingMap(suppressRect & mapRect).setTo(Scalar::all(-FLT_MAX));
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * HistSimilarityMap.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef HISTSIMILARITYMAP_H_
+#define HISTSIMILARITYMAP_H_
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Score the histogram of every window of an image against a template histogram in one pass, i.e., a dense
+// histogram-similarity map as the one of matchTemplate(), and find the top candidate locations on the map.
+//
+// Each pixel is binned once by the same uniform lookup as calcHist(). The window histogram then slides along each row
+// by removing the pixels of the column leaving the window and adding the ones of the column entering it, and the
+// similarity is updated by the change of the bins touched only, so each window costs O(window height) whatever the
+// number of bins. The rows of the map are independent and scored in parallel.
+class HistSimilarityMap
+{
+private:
+    // The flattened bin index of each pixel, or -1 if it is out of the ranges, transposed so that the pixels of an
+    // image column are contiguous.
+    cv::Mat m_binIdxsT;
+    int m_cntBins;
+
+public:
+    // img is an 8-bit image whose channels are the dimensions of the histograms of histSize and ranges.
+    HistSimilarityMap(const cv::Mat& img, const std::vector<int>& histSize, const std::vector<float>& ranges);
+
+    // Compute the (rows - h + 1) x (cols - w + 1) CV_32F map of the similarity between the histogram of each window of
+    // windowSize (w x h) and templHist, where both are normalized to the sum of 1. method is CV_COMP_INTERSECT for the
+    // intersection or CV_COMP_BHATTACHARYYA for the Bhattacharyya coefficient, i.e., 1 - d*d for the Bhattacharyya
+    // distance d, so a larger value is always more similar. The pixels out of the ranges never match.
+    void Compute(const cv::Mat& templHist, const cv::Size& windowSize, const int method, cv::Mat& similarityMap) const;
+
+    // Find at most k local maxima of the map in the descending order, where a location within half of suppressSize
+    // of a better one is suppressed.
+    static void FindTopCandidates(
+        const cv::Mat& similarityMap,
+        const int k,
+        const cv::Size& suppressSize,
+        std::vector<cv::Point>& locs,
+        std::vector<float>& scores);
+};
+
+#endif /* HISTSIMILARITYMAP_H_ */
@@ -0,0 +1,192 @@
+/*
+ * HsvHistogram.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#include <climits>
+#include <algorithm>
+
+#include <opencv2/imgproc.hpp>
+
+#include "HsvHistogram.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+
+// The same fixed-point shift and division tables as the 8-bit BGR2HSV conversion of cvtColor().
+const int hsvShift = 12;
+
+struct HsvDivTables
+{
+    int sdiv[256];
+    int hdiv180[256];
+
+    HsvDivTables()
+    {
+        sdiv[0] = 0;
+        hdiv180[0] = 0;
+        for (int i = 1; i < 256; ++i)
+        {
+            sdiv[i] = saturate_cast<int>((255 << hsvShift)/(1.*i));
+            hdiv180[i] = saturate_cast<int>((180 << hsvShift)/(6.*i));
+        }
+    }
+};
+
+const HsvDivTables& GetHsvDivTables()
+{
+    static const HsvDivTables tables;
+    return tables;
+}
+
+// A bin offset no valid offset can reach even if the offsets of all the three channels are added up.
+const int outOfRange = INT_MIN/4;
+
+// Bin the pixel rows [range.start, range.end) of a stripe into its own integer histogram, whose flattened index is
+// the sum of the lookup tables of the H, S and V values. The table of a channel not in the histogram is all 0.
+class HsvHistStripeBody : public ParallelLoopBody
+{
+private:
+    const Mat& m_bgrImg;
+    const vector<int>& m_binTabs;
+    const int m_cntStripes;
+    vector<vector<int> >& m_stripeHists;
+
+public:
+    HsvHistStripeBody(
+        const Mat& bgrImg,
+        const vector<int>& binTabs,
+        const int cntStripes,
+        vector<vector<int> >& stripeHists) :
+        m_bgrImg(bgrImg),
+        m_binTabs(binTabs),
+        m_cntStripes(cntStripes),
+        m_stripeHists(stripeHists)
+    {
+    }
+
+    virtual void operator()(const Range& range) const
+    {
+        const HsvDivTables& divTables = GetHsvDivTables();
+        const int* hTab = &m_binTabs[0];
+        const int* sTab = hTab + 256;
+        const int* vTab = sTab + 256;
+
+        for (int stripe = range.start; stripe < range.end; ++stripe)
+        {
+            int* stripeHist = &m_stripeHists[stripe][0];
+            int rowStart = static_cast<int>(static_cast<int64>(m_bgrImg.rows) * stripe / m_cntStripes);
+            int rowEnd = static_cast<int>(static_cast<int64>(m_bgrImg.rows) * (stripe + 1) / m_cntStripes);
+
+            for (int row = rowStart; row < rowEnd; ++row)
+            {
+                const uchar* src = m_bgrImg.ptr<uchar>(row);
+                for (int col = 0; col < m_bgrImg.cols; ++col, src += 3)
+                {
+                    int b = src[0];
+                    int g = src[1];
+                    int r = src[2];
+
+                    int v = max(max(b, g), r);
+                    int vmin = min(min(b, g), r);
+                    int diff = v - vmin;
+                    int vr = (v == r) ? -1 : 0;
+                    int vg = (v == g) ? -1 : 0;
+
+                    int s = (diff * divTables.sdiv[v] + (1 << (hsvShift - 1))) >> hsvShift;
+                    int h = (vr & (g - b)) + (~vr & ((vg & (b - r + 2*diff)) + ((~vg) & (r - g + 4*diff))));
+                    h = (h * divTables.hdiv180[diff] + (1 << (hsvShift - 1))) >> hsvShift;
+                    h += (h < 0) ? 180 : 0;
+
+                    int offset = hTab[saturate_cast<uchar>(h)] + sTab[s] + vTab[v];
+                    if (offset >= 0)
+                    {
+                        stripeHist[offset]++;
+                    }
+                }
+            }
+        }
+    }
+};
+
+}
+
+void CalcHsvHist(
+    const Mat& bgrImg,
+    const vector<int>& hsvChannels,
+    const vector<int>& histSize,
+    const vector<float>& ranges,
+    Mat& hist)
+{
+    const int dims = static_cast<int>(hsvChannels.size());
+
+    // The fused path supports each of the H, S and V channels at most once.
+    bool isFusible = (bgrImg.type() == CV_8UC3) && (dims > 0) && (dims <= 3)
+        && (static_cast<int>(histSize.size()) == dims) && (static_cast<int>(ranges.size()) == 2*dims);
+    for (int dim = 0; isFusible && (dim < dims); ++dim)
+    {
+        isFusible = (hsvChannels[dim] >= 0) && (hsvChannels[dim] <= 2)
+            && (count(hsvChannels.begin(), hsvChannels.end(), hsvChannels[dim]) == 1);
+    }
+
+    if (!isFusible)
+    {
+        Mat hsvImg;
+        cvtColor(bgrImg, hsvImg, COLOR_BGR2HSV);
+        calcHist(vector<Mat>{hsvImg}, hsvChannels, noArray(), hist, histSize, ranges);
+        return;
+    }
+
+    // Build the lookup tables from the 8-bit values to the flattened bin offsets in the same way as calcHist() does
+    // for the uniform ranges, i.e., bin = floor(value*t - low*t) where t = histSize/(high - low).
+    vector<int> binTabs(3*256, 0);
+    int cntBins = 1;
+    for (int dim = dims - 1; dim >= 0; --dim)
+    {
+        double t = histSize[dim]/(static_cast<double>(ranges[2*dim + 1]) - ranges[2*dim]);
+        double a = -t*ranges[2*dim];
+        int* tab = &binTabs[256*hsvChannels[dim]];
+        for (int value = 0; value < 256; ++value)
+        {
+            int bin = cvFloor(value*t + a);
+            tab[value] = (static_cast<unsigned>(bin) < static_cast<unsigned>(histSize[dim])) ? bin*cntBins : outOfRange;
+        }
+
+        cntBins *= histSize[dim];
+    }
+
+    // Small images, e.g., the patches, aren't worth splitting.
+    const int minPixelsPerStripe = 1 << 16;
+    int cntStripes = static_cast<int>(min(static_cast<int64>(max(getNumThreads(), 1)),
+        max(static_cast<int64>(bgrImg.total())/minPixelsPerStripe, static_cast<int64>(1))));
+    cntStripes = max(min(cntStripes, bgrImg.rows), 1);
+
+    vector<vector<int> > stripeHists(cntStripes, vector<int>(cntBins, 0));
+    HsvHistStripeBody body(bgrImg, binTabs, cntStripes, stripeHists);
+    if (cntStripes > 1)
+    {
+        parallel_for_(Range(0, cntStripes), body, cntStripes);
+    }
+    else
+    {
+        body(Range(0, 1));
+    }
+
+    // Sum up the integer histograms of the stripes, and convert the sum into CV_32F as calcHist() does.
+    Mat ihist(dims, &histSize[0], CV_32S, Scalar(0));
+    int* ihistData = ihist.ptr<int>();
+    for (auto& stripeHist: stripeHists)
+    {
+        for (int bin = 0; bin < cntBins; ++bin)
+        {
+            ihistData[bin] += stripeHist[bin];
+        }
+    }
+
+    ihist.convertTo(hist, CV_32F);
+}
@@ -0,0 +1,30 @@
+/*
+ * HsvHistogram.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: renwei
+ */
+
+#ifndef HSVHISTOGRAM_H_
+#define HSVHISTOGRAM_H_
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Compute the histogram of the given HSV channels of a BGR-colored image, which is bit-identical to
+// cvtColor(COLOR_BGR2HSV) followed by calcHist() with the uniform ranges.
+//
+// For a CV_8UC3 image, each pixel is converted into H/S/V by the same fixed-point arithmetic as cvtColor() and binned
+// by the same lookup tables as calcHist() right away, so no HSV image is written and read back. The rows are split
+// into stripes which are binned into their own integer histograms in parallel, and the integer histograms are summed
+// up and converted into CV_32F at last, exactly as calcHist() does. Any other image is converted by cvtColor() and
+// binned by calcHist().
+void CalcHsvHist(
+    const cv::Mat& bgrImg,
+    const std::vector<int>& hsvChannels,
+    const std::vector<int>& histSize,
+    const std::vector<float>& ranges,
+    cv::Mat& hist);
+
+#endif /* HSVHISTOGRAM_H_ */
@@ -5,6 +5,7 @@
  *      Author: renwei
  */
 
+#include <cfloat>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -17,6 +18,12 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "BatchHistComparator.h"
+#include "HsvHistogram.h"
+#include "FastEmd.h"
+#include "HistSimilarityMap.h"
+#include "ReducedImageDecoder.h"
+
 using namespace std;
 using namespace cv;
 namespace po = boost::program_options;
@@ -243,6 +250,68 @@ Point GetTemplateMatchingPoint(
     return maxLoc;
 }
 
+// Locate the template by the dense map of the similarity between the H-S histograms of the source windows and the
+// template histogram. If isPrefilter, matchTemplate() only runs around the top candidates of the map and the best of
+// them is the match, and otherwise the best candidate of the map is. result is the map normalized into [0, 1].
+Point GetHistSearchPoint(
+    const Mat& srcImg,
+    const Mat& templImg,
+    const Mat& templHist,
+    const vector<int>& histSize,
+    const vector<float>& ranges,
+    const int method,
+    const int topK,
+    const bool isPrefilter,
+    Mat& result)
+{
+    HistSimilarityMap similarityMap(srcImg, histSize, ranges);
+    similarityMap.Compute(templHist, templImg.size(), method, result);
+
+    vector<Point> candidateLocs;
+    vector<float> candidateScores;
+    HistSimilarityMap::FindTopCandidates(result, topK, templImg.size(), candidateLocs, candidateScores);
+    normalize(result, result, 0, 1, NORM_MINMAX);
+
+    Point matchPoint = candidateLocs[0];
+    double bestCcoeff = -DBL_MAX;
+    for (size_t candidateIdx = 0; candidateIdx < candidateLocs.size(); ++candidateIdx)
+    {
+        const Point& loc = candidateLocs[candidateIdx];
+        cout << "[INFO]: Candidate " << candidateIdx << " at (" << loc.x << ", " << loc.y << ") with the histogram "
+            << ((method == CV_COMP_INTERSECT) ? "intersection " : "Bhattacharyya coefficient ")
+            << candidateScores[candidateIdx] << "." << endl;
+
+        if (!isPrefilter)
+        {
+            continue;
+        }
+
+        // Search the locations within half of the template size around the candidate.
+        Rect roi(loc.x - templImg.cols/2, loc.y - templImg.rows/2, templImg.cols*2, templImg.rows*2);
+        roi &= Rect(0, 0, srcImg.cols, srcImg.rows);
+
+        Mat roiResult;
+        double maxVal;
+        Point maxLoc;
+        matchTemplate(srcImg(roi), templImg, roiResult, TM_CCOEFF_NORMED);
+        minMaxLoc(roiResult, nullptr, &maxVal, nullptr, &maxLoc);
+
+        if (maxVal > bestCcoeff)
+        {
+            bestCcoeff = maxVal;
+            matchPoint = roi.tl() + maxLoc;
+        }
+    }
+
+    if (isPrefilter)
+    {
+        cout << "[INFO]: The best match around the candidates is at (" << matchPoint.x << ", " << matchPoint.y
+            << ") with the normalized correlation coefficient " << bestCcoeff << "." << endl;
+    }
+
+    return matchPoint;
+}
+
 void CreateSignatureFromHistogram(
     const Mat& hist,
     Mat& sig)
@@ -292,7 +361,15 @@ int main(int argc, char** argv)
         ("templImg", po::value<string>()->required(), "The template image") // This is also a positional option.
         ("help,h", "Display the help information")
         ("comparison-method,m", po::value<string>(), "The comparison method (correl | chisqr | chisqr_alt | intersect | bhattacharyya | hellinger | kl_div | emd | all). If not specified, default correl.")
-        ("distance,d", po::value<string>(), "The distance used by the EMD comparison (l1 | l2 | c | all). If not specified, default l1.");
+        ("distance,d", po::value<string>(), "The distance used by the EMD comparison (l1 | l2 | c | all). If not specified, default l1.")
+        ("emd-solver,s", po::value<string>(), "The EMD solver of the two-dimensional H-S histograms (exact | sinkhorn | auto). If not specified, default exact.")
+        ("sinkhorn-reg", po::value<double>(), "The regularization of the Sinkhorn solver relative to the largest ground distance. If not specified, default 0.01.")
+        ("emd-prune", po::value<float>(), "Skip solving EMD if the centroid lower bound is above this threshold, and report the bound instead.")
+        ("circular-hue", "Measure the ground distance along the hue bins around the hue circle, so that the first and the last bins are adjacent.")
+        ("search", po::value<string>(), "How to locate the template (match | hist | prefilter): by matchTemplate(), by the best window of the H-S histogram-similarity map, or by matchTemplate() around the top candidates of the map only. If not specified, default match.")
+        ("search-method", po::value<string>(), "The histogram similarity of the map (intersect | bhattacharyya). If not specified, default intersect.")
+        ("top-k", po::value<int>(), "The number of the candidates taken from the map with the non-maximum suppression. If not specified, default 5.")
+        ("decode-scale", po::value<int>()->default_value(1), "Decode both images at 1/2, 1/4 or 1/8 of the resolution (1 | 2 | 4 | 8) for the searches hist and prefilter, which uses the DCT scaling of the JPEG decoder.");
 
     po::positional_options_description posOpt;
     posOpt.add("srcImg", 1);
@@ -305,7 +382,7 @@ int main(int argc, char** argv)
 
         if (vm.count("help") > 0)
         {
-            cout << "Usage: ./TemplateHsHistComparison srcImg templImg -m [comparison-method] -d [distance]" << endl << endl;
+            cout << "Usage: ./TemplateHsHistComparison srcImg templImg -m [comparison-method] -d [distance] -s [EMD-solver] --search [search]" << endl << endl;
             cout << opt << endl;
             return 0;
         }
@@ -348,6 +425,10 @@ int main(int argc, char** argv)
     }
 
     vector<int> distances;
+    int emdSolver = FastEmd::SOLVER_EXACT;
+    double sinkhornReg = 0.01;
+    bool isPruned = false;
+    float pruneThreshold = 0;
     if ((strCompMethod == "emd") || (strCompMethod == "all"))
     {
         if (vm.count("distance") > 0)
@@ -366,18 +447,113 @@ int main(int argc, char** argv)
             cerr << "[ERROR]: Unsupported or invalid EMD distance method " << strDistance << "." << endl << endl;
             return -1;
         }
+
+        string strEmdSolver = "exact";
+        if (vm.count("emd-solver") > 0)
+        {
+            strEmdSolver = vm["emd-solver"].as<string>();
+        }
+
+        if (!FastEmd::Str2Solver(strEmdSolver, emdSolver))
+        {
+            cerr << "[ERROR]: Unsupported or invalid EMD solver " << strEmdSolver << "." << endl << endl;
+            return -1;
+        }
+        else if (emdSolver == FastEmd::SOLVER_CDF)
+        {
+            cerr << "[ERROR]: The CDF solver only supports one-dimensional histograms, not the H-S histograms." << endl << endl;
+            return -1;
+        }
+
+        if (vm.count("sinkhorn-reg") > 0)
+        {
+            sinkhornReg = vm["sinkhorn-reg"].as<double>();
+            if (sinkhornReg <= 0)
+            {
+                cerr << "[ERROR]: The Sinkhorn regularization should be positive." << endl << endl;
+                return -1;
+            }
+        }
+
+        isPruned = (vm.count("emd-prune") > 0);
+        pruneThreshold = isPruned ? vm["emd-prune"].as<float>() : 0;
+    }
+
+    FastEmd fastEmd(emdSolver, sinkhornReg);
+
+    string strSearch = "match";
+    if (vm.count("search") > 0)
+    {
+        strSearch = vm["search"].as<string>();
+        transform(strSearch.begin(), strSearch.end(), strSearch.begin(), ::tolower);
+    }
+
+    if ((strSearch != "match") && (strSearch != "hist") && (strSearch != "prefilter"))
+    {
+        cerr << "[ERROR]: Unsupported or invalid search " << strSearch << "." << endl << endl;
+        return -1;
+    }
+
+    string strSearchMethod = "intersect";
+    if (vm.count("search-method") > 0)
+    {
+        strSearchMethod = vm["search-method"].as<string>();
+        transform(strSearchMethod.begin(), strSearchMethod.end(), strSearchMethod.begin(), ::tolower);
+    }
+
+    int searchMethod = CV_COMP_INTERSECT;
+    if (strSearchMethod == "bhattacharyya")
+    {
+        searchMethod = CV_COMP_BHATTACHARYYA;
+    }
+    else if (strSearchMethod != "intersect")
+    {
+        cerr << "[ERROR]: Unsupported or invalid histogram similarity " << strSearchMethod << " of the search." << endl << endl;
+        return -1;
+    }
+
+    int topK = 5;
+    if (vm.count("top-k") > 0)
+    {
+        topK = vm["top-k"].as<int>();
+        if (topK <= 0)
+        {
+            cerr << "[ERROR]: The number of the candidates should be positive." << endl << endl;
+            return -1;
+        }
+    }
+
+    // Both images are decoded at the same scale, so that the template keeps its size relative to the source image.
+    // The search match locates the template by the pixels rather than the histograms, so it keeps the full resolution.
+    int decodeScale = vm["decode-scale"].as<int>();
+    if (!ReducedImageDecoder::IsValidScale(decodeScale))
+    {
+        cerr << "[ERROR]: The decode scale should be 1, 2, 4 or 8." << endl << endl;
+        return -1;
+    }
+
+    if ((decodeScale > 1) && (strSearch == "match"))
+    {
+        cerr << "[ERROR]: The decode scale only applies to the searches hist and prefilter." << endl << endl;
+        return -1;
+    }
+
+    ReducedImageDecoder decoder(decodeScale);
+    if (!decoder.IsFullResolution())
+    {
+        cout << "[INFO]: The images are decoded at " << decoder.ToStr() << ", so the template is located in the reduced coordinates." << endl;
     }
 
     // Load the source image and the template image.
 
-    Mat originalSrcImg = imread(srcImgFile, IMREAD_COLOR);
+    Mat originalSrcImg = decoder.Read(srcImgFile);
     if (originalSrcImg.empty())
     {
         cerr << "[ERROR]: Cannot load the source image " << srcImgFile << "." << endl << endl;
         return -1;
     }
 
-    Mat originalTemplImg = imread(templImgFile, IMREAD_COLOR);
+    Mat originalTemplImg = decoder.Read(templImgFile);
     if (originalTemplImg.empty())
     {
         cerr << "[ERROR]: Cannot load the template image " << templImgFile << "." << endl << endl;
@@ -400,9 +576,43 @@ int main(int argc, char** argv)
     namedWindow(templImgWindow, WINDOW_AUTOSIZE);
     imshow(templImgWindow, originalTemplImg);
 
-    // Do the template matching and find the best match point.
+    Mat bestMatchedPatchHist;
+    Mat templHist;
+
+    vector<int> hsChannels{0, 1};   // Channel hue and saturation
+    vector<int> histSize{30, 32};   // 30 bins for hue and 32 bins for saturation
+    vector<float> ranges{0, 180, 0, 256};   // The range of hue is [0, 180) and the range of saturation is [0, 256).
+
+    // Compute the normalized histogram of the template image, which the histogram search needs as well.
+    CalcHsvHist(originalTemplImg, hsChannels, histSize, ranges, templHist);
+    normalize(templHist, templHist, 1, 0, NORM_L1);
+
+    // Do the template matching or the histogram search and find the best match point.
     Mat result;
-    Point matchPoint = GetTemplateMatchingPoint(srcImgHs, templImgHs, result);
+    Point matchPoint;
+    if (strSearch == "match")
+    {
+        matchPoint = GetTemplateMatchingPoint(srcImgHs, templImgHs, result);
+    }
+    else
+    {
+        matchPoint = GetHistSearchPoint(srcImgHs, templImgHs, templHist, histSize, ranges, searchMethod, topK,
+            strSearch == "prefilter", result);
+    }
+
+    // Crop the patch of the original source image which best matches the template image. Its H-S histogram is
+    // computed from the BGR pixels directly, before the patch is marked on the source image.
+    Mat bestMatchedPatch = originalSrcImg(Rect(matchPoint.x, matchPoint.y, templImg.cols, templImg.rows));
+
+    // Compute and normalize the histogram of the best-matched patch.
+    CalcHsvHist(bestMatchedPatch, hsChannels, histSize, ranges, bestMatchedPatchHist);
+    normalize(bestMatchedPatchHist, bestMatchedPatchHist, 1, 0, NORM_L1);
+
+    // The ground distances of the H-S bins are computed once for each EMD distance.
+    if (vm.count("circular-hue") > 0)
+    {
+        fastEmd.SetCircularDim(histSize, 0);
+    }
 
     //Mat bestMatchedPatchRgb = originalSrcImg(Rect(matchPoint.x, matchPoint.y, templImg.cols, templImg.rows));
     //namedWindow("The best matched patch", WINDOW_AUTOSIZE);
@@ -435,32 +645,18 @@ int main(int argc, char** argv)
     namedWindow(resWindow, WINDOW_AUTOSIZE);
     imshow(resWindow, result);
 
-    // Crop the patch of the source image which best matches the template image.
-    Mat bestMatchedPatch = srcImg(Rect(matchPoint.x, matchPoint.y, templImg.cols, templImg.rows));
-
-    Mat bestMatchedPatchHist;
-    Mat templHist;
-
-    vector<int> hsChannels{0, 1};   // Channel hue and saturation
-    vector<int> histSize{30, 32};   // 30 bins for hue and 32 bins for saturation
-    vector<float> ranges{0, 180, 0, 256};   // The range of hue is [0, 180) and the range of saturation is [0, 256).
-
-    // Compute the histograms of the best-matched patch and the template image, respectively.
-    calcHist(vector<Mat>{bestMatchedPatch}, hsChannels, noArray(), bestMatchedPatchHist, histSize, ranges);
-    calcHist(vector<Mat>{templImg}, hsChannels, noArray(), templHist, histSize, ranges);
-
-    // Normalize the histograms.
-    normalize(bestMatchedPatchHist, bestMatchedPatchHist, 1, 0, NORM_L1);
-    normalize(templHist, templHist, 1, 0, NORM_L1);
-
     // Compare the two normalized histograms.
+    BatchHistComparator histComparator(BatchHistComparator::StackHists(vector<Mat>{templHist}));
+    Mat queryHists = BatchHistComparator::StackHists(vector<Mat>{bestMatchedPatchHist});
     for (size_t compMethodIndex = 0; compMethodIndex < histComparisonMethods.size(); ++compMethodIndex)
     {
         double compareResult = 0;
 
         if (histComparisonMethods[compMethodIndex] != CV_COMP_EMD)
         {
-            compareResult = compareHist(bestMatchedPatchHist, templHist, histComparisonMethods[compMethodIndex]);
+            Mat compareResults;
+            histComparator.Compare(queryHists, histComparisonMethods[compMethodIndex], compareResults);
+            compareResult = compareResults.at<double>(0, 0);
 
             cout << "[INFO]: The comparison result of the two histograms = " << compareResult << " with the method "
                 << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << endl;
@@ -477,10 +673,26 @@ int main(int argc, char** argv)
 
             for (const int& distMethod : distances)
             {
-                compareResult = EMD(bestMatchedPatchSig, templSig, distMethod);
+                // The centroid lower bound costs O(n), so a pair already known to be farther than the threshold isn't
+                // solved.
+                if (isPruned)
+                {
+                    float lowerBound = fastEmd.ComputeCentroidLowerBound(bestMatchedPatchSig, templSig, distMethod);
+                    if (lowerBound > pruneThreshold)
+                    {
+                        cout << "[INFO]: The comparison of the two histograms with the method "
+                            << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << " and the "
+                            << DistMethod2Str(distMethod) << " is pruned with the lower bound " << lowerBound
+                            << " > " << pruneThreshold << "." << endl;
+                        continue;
+                    }
+                }
+
+                compareResult = fastEmd.Compute(bestMatchedPatchSig, templSig, distMethod);
                 cout << "[INFO]: The comparison result of the two histograms = " << compareResult << " with the method "
                     << HistComparisonMethod2Str(histComparisonMethods[compMethodIndex]) << " and the "
-                    << DistMethod2Str(distMethod) << "." << endl;
+                    << DistMethod2Str(distMethod) << " by the "
+                    << FastEmd::Solver2Str(fastEmd.SelectSolver(bestMatchedPatchSig, templSig)) << "." << endl;
             }
         }
 